@@ -0,0 +1,461 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#include "addr.h"
+#include "http.h"
+
+/**
+ * HTTP_ADDR_HOPS_MAX is the most forwarding hops looked at, counting back
+ * from the nearest one.
+ */
+#define HTTP_ADDR_HOPS_MAX 32
+
+/**
+ * http_proxy_range is a trusted proxy range, the addresses sharing the first
+ * prefix bits with addr.
+ */
+struct http_proxy_range {
+    struct http_addr addr;
+    unsigned int prefix;
+};
+
+static struct http_proxy_range trusted_proxies[HTTP_TRUSTED_PROXIES_MAX];
+static size_t trusted_proxies_count;
+
+static const unsigned char http_addr_v4_mapped[12] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+};
+
+static const char http_addr_hex[] = "0123456789abcdef";
+
+int
+http_addr_from_sockaddr(const struct sockaddr *sa, struct http_addr *addr)
+{
+    addr->family = AF_UNSPEC;
+    if (sa == NULL) {
+        return -1;
+    }
+
+    if (sa->sa_family == AF_INET) {
+        addr->family = AF_INET;
+        memcpy(addr->bytes, &((const struct sockaddr_in*)sa)->sin_addr, 4);
+        return 0;
+    }
+    if (sa->sa_family == AF_INET6) {
+        const unsigned char *b = (const unsigned char*)&((const struct sockaddr_in6*)sa)->sin6_addr;
+
+        // dual stack sockets report IPv4 peers as mapped addresses
+        if (memcmp(b, http_addr_v4_mapped, sizeof(http_addr_v4_mapped)) == 0) {
+            addr->family = AF_INET;
+            memcpy(addr->bytes, b + 12, 4);
+        } else {
+            addr->family = AF_INET6;
+            memcpy(addr->bytes, b, 16);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+int
+http_addr_parse(const char *str, const size_t len, struct http_addr *addr)
+{
+    char buf[HTTP_ADDR_STRLEN];
+
+    addr->family = AF_UNSPEC;
+    if (len == 0 || len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    if (memchr(buf, ':', len) == NULL) {
+        if (inet_pton(AF_INET, buf, addr->bytes) != 1) {
+            return -1;
+        }
+        addr->family = AF_INET;
+    } else {
+        if (inet_pton(AF_INET6, buf, addr->bytes) != 1) {
+            return -1;
+        }
+        addr->family = AF_INET6;
+    }
+
+    return 0;
+}
+
+/**
+ * http_addr_put_u8 writes the given byte in decimal.
+ */
+static inline char*
+http_addr_put_u8(char *p, const unsigned int v)
+{
+    if (v >= 100) {
+        *p++ = (char)('0' + v / 100);
+        *p++ = (char)('0' + (v / 10) % 10);
+    } else if (v >= 10) {
+        *p++ = (char)('0' + v / 10);
+    }
+    *p++ = (char)('0' + v % 10);
+
+    return p;
+}
+
+/**
+ * http_addr_put_v4 writes the 4 bytes as a dotted quad.
+ */
+static char*
+http_addr_put_v4(char *p, const unsigned char *b)
+{
+    p = http_addr_put_u8(p, b[0]);
+    *p++ = '.';
+    p = http_addr_put_u8(p, b[1]);
+    *p++ = '.';
+    p = http_addr_put_u8(p, b[2]);
+    *p++ = '.';
+    p = http_addr_put_u8(p, b[3]);
+
+    return p;
+}
+
+/**
+ * http_addr_put_u16 writes the given group in lowercase hex without leading
+ * zeros, RFC 5952 4.1 and 4.3.
+ */
+static inline char*
+http_addr_put_u16(char *p, const unsigned int v)
+{
+    if (v >= 0x1000) {
+        *p++ = http_addr_hex[v >> 12];
+    }
+    if (v >= 0x100) {
+        *p++ = http_addr_hex[(v >> 8) & 0xf];
+    }
+    if (v >= 0x10) {
+        *p++ = http_addr_hex[(v >> 4) & 0xf];
+    }
+    *p++ = http_addr_hex[v & 0xf];
+
+    return p;
+}
+
+size_t
+http_addr_format(const struct http_addr *addr, char *buf)
+{
+    char *p = buf;
+
+    if (addr->family == AF_INET) {
+        p = http_addr_put_v4(p, addr->bytes);
+        *p = '\0';
+        return (size_t)(p - buf);
+    }
+    if (addr->family != AF_INET6) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    const unsigned char *b = addr->bytes;
+
+    // IPv4 mapped addresses keep the dotted quad, RFC 5952 5
+    if (memcmp(b, http_addr_v4_mapped, sizeof(http_addr_v4_mapped)) == 0) {
+        memcpy(p, "::ffff:", 7);
+        p = http_addr_put_v4(p + 7, b + 12);
+        *p = '\0';
+        return (size_t)(p - buf);
+    }
+
+    unsigned int groups[8];
+    for (int i = 0; i < 8; i++) {
+        groups[i] = (unsigned int)b[i * 2] << 8 | b[i * 2 + 1];
+    }
+
+    // the longest run of 2 or more zero groups is shortened to "::", the
+    // first one if there's a tie, RFC 5952 4.2
+    int best = -1;
+    int best_len = 1;
+    for (int i = 0; i < 8;) {
+        if (groups[i] != 0) {
+            i++;
+            continue;
+        }
+        int j = i;
+        while (j < 8 && groups[j] == 0) {
+            j++;
+        }
+        if (j - i > best_len) {
+            best = i;
+            best_len = j - i;
+        }
+        i = j;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        if (i == best) {
+            *p++ = ':';
+            *p++ = ':';
+            i += best_len - 1;
+            continue;
+        }
+        if (i > 0 && i != best + best_len) {
+            *p++ = ':';
+        }
+        p = http_addr_put_u16(p, groups[i]);
+    }
+    *p = '\0';
+
+    return (size_t)(p - buf);
+}
+
+/**
+ * http_addr_match checks whether the first prefix bits of the addresses are
+ * the same.
+ */
+static int
+http_addr_match(const struct http_addr *a, const struct http_addr *b,
+                const unsigned int prefix)
+{
+    if (a->family != b->family) {
+        return 0;
+    }
+
+    unsigned int bytes = prefix / 8;
+    unsigned int bits = prefix % 8;
+
+    if (memcmp(a->bytes, b->bytes, bytes) != 0) {
+        return 0;
+    }
+    if (bits == 0) {
+        return 1;
+    }
+
+    unsigned char mask = (unsigned char)(0xff << (8 - bits));
+
+    return (a->bytes[bytes] & mask) == (b->bytes[bytes] & mask);
+}
+
+int
+http_trusted_proxy_add(const char *cidr)
+{
+    if (cidr == NULL || trusted_proxies_count >= HTTP_TRUSTED_PROXIES_MAX) {
+        return -1;
+    }
+
+    struct http_proxy_range range;
+    const char *slash = strchr(cidr, '/');
+    size_t len = slash != NULL ? (size_t)(slash - cidr) : strlen(cidr);
+
+    if (http_addr_parse(cidr, len, &range.addr) != 0) {
+        return -1;
+    }
+
+    unsigned int max = (unsigned int)http_addr_len(&range.addr) * 8;
+    range.prefix = max;
+
+    if (slash != NULL) {
+        char *end;
+        unsigned long prefix = strtoul(slash + 1, &end, 10);
+        if (slash[1] == '\0' || *end != '\0' || prefix > max) {
+            return -1;
+        }
+        range.prefix = (unsigned int)prefix;
+    }
+
+    trusted_proxies[trusted_proxies_count] = range;
+    __atomic_store_n(&trusted_proxies_count, trusted_proxies_count + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int
+http_trusted_proxy(const struct http_addr *addr)
+{
+    size_t count = __atomic_load_n(&trusted_proxies_count, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i < count; i++) {
+        if (http_addr_match(addr, &trusted_proxies[i].addr, trusted_proxies[i].prefix)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * http_addr_parse_node parses a forwarding hop, which may be quoted and may
+ * carry a port, as in "[2001:db8::1]:8080" or 192.0.2.1:8080. Hops that are
+ * obfuscated or "unknown", RFC 7239 6, aren't addresses and fail.
+ */
+static int
+http_addr_parse_node(struct http_slice node, struct http_addr *addr)
+{
+    const char *p = node.ptr;
+    size_t len = node.len;
+
+    if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+        p++;
+        len -= 2;
+    }
+
+    if (len > 0 && p[0] == '[') {
+        const char *end = memchr(p, ']', len);
+        if (end == NULL) {
+            return -1;
+        }
+        return http_addr_parse(p + 1, (size_t)(end - p - 1), addr);
+    }
+
+    // a single colon is an IPv4 address with a port
+    const char *colon = memchr(p, ':', len);
+    if (colon != NULL && memchr(colon + 1, ':', len - (size_t)(colon - p) - 1) == NULL) {
+        len = (size_t)(colon - p);
+    }
+
+    return http_addr_parse(p, len, addr);
+}
+
+/**
+ * http_forwarded_for finds the for parameter of a Forwarded element,
+ * RFC 7239 4. Returns 1 if it's found and 0 if not.
+ */
+static int
+http_forwarded_for(const struct http_slice *elem, struct http_slice *node)
+{
+    const char *p = elem->ptr;
+    const char *end = elem->ptr + elem->len;
+
+    while (p < end) {
+        const char *start = p;
+        int quoted = 0;
+
+        for (; p < end; p++) {
+            if (quoted) {
+                if (*p == '\\' && p + 1 < end) {
+                    p++;
+                } else if (*p == '"') {
+                    quoted = 0;
+                }
+            } else if (*p == '"') {
+                quoted = 1;
+            } else if (*p == ';') {
+                break;
+            }
+        }
+
+        const char *pair_end = p;
+        if (p < end) {
+            p++;
+        }
+
+        while (start < pair_end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        if (pair_end - start > 4 && strncasecmp(start, "for=", 4) == 0) {
+            node->ptr = start + 4;
+            node->len = (size_t)(pair_end - start - 4);
+            while (node->len > 0 &&
+                   (node->ptr[node->len - 1] == ' ' || node->ptr[node->len - 1] == '\t')) {
+                node->len--;
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+http_client_addr(const struct _u_request *request, struct http_addr *addr)
+{
+    if (http_addr_from_sockaddr(request->client_address, addr) != 0) {
+        return -1;
+    }
+    if (!http_trusted_proxy(addr)) {
+        return 0;
+    }
+
+    int forwarded = 1;
+    const char *value = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_FORWARDED);
+    if (value == NULL) {
+        forwarded = 0;
+        value = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_X_FORWARDED_FOR);
+    }
+    if (value == NULL) {
+        return 0;
+    }
+
+    // keep the nearest hops, the last ones in the list
+    struct http_slice hops[HTTP_ADDR_HOPS_MAX];
+    size_t count = 0;
+
+    struct http_list_iter it;
+    struct http_slice elem;
+
+    http_list_init(&it, value, strlen(value));
+    while (http_list_next(&it, &elem)) {
+        if (forwarded && !http_forwarded_for(&elem, &elem)) {
+            continue;
+        }
+        hops[count % HTTP_ADDR_HOPS_MAX] = elem;
+        count++;
+    }
+
+    size_t n = count < HTTP_ADDR_HOPS_MAX ? count : HTTP_ADDR_HOPS_MAX;
+    for (size_t i = 0; i < n; i++) {
+        struct http_addr hop;
+        if (http_addr_parse_node(hops[(count - 1 - i) % HTTP_ADDR_HOPS_MAX], &hop) != 0) {
+            break;
+        }
+        *addr = hop;
+        if (!http_trusted_proxy(addr)) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+size_t
+http_client_addr_format(const struct _u_request *request, char *buf)
+{
+    struct http_addr addr;
+
+    if (http_client_addr(request, &addr) != 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    return http_addr_format(&addr, buf);
+}
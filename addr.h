@@ -0,0 +1,136 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_ADDR_H
+#define _HTTP_ADDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <ulfius.h>
+
+/**
+ * HTTP_ADDR_STRLEN is the longest formatted address, including the
+ * terminating NUL. It's the same as INET6_ADDRSTRLEN.
+ */
+#define HTTP_ADDR_STRLEN 46
+
+/**
+ * HTTP_TRUSTED_PROXIES_MAX is the most trusted proxy ranges that can be
+ * configured.
+ */
+#ifndef HTTP_TRUSTED_PROXIES_MAX
+#define HTTP_TRUSTED_PROXIES_MAX 32
+#endif
+
+/**
+ * http_addr is an IPv4 or IPv6 address in network byte order. IPv4
+ * addresses use the first 4 bytes. A family of AF_UNSPEC means no address.
+ */
+struct http_addr {
+    sa_family_t family;
+    unsigned char bytes[16];
+};
+
+/**
+ * http_addr_len returns the number of bytes used by the address.
+ */
+static inline size_t
+http_addr_len(const struct http_addr *addr)
+{
+    return addr->family == AF_INET ? 4 : addr->family == AF_INET6 ? 16 : 0;
+}
+
+/**
+ * http_addr_from_sockaddr sets addr to the address of the given socket
+ * address. Returns 0 on success and -1 if it isn't IPv4 or IPv6.
+ */
+int
+http_addr_from_sockaddr(const struct sockaddr *sa, struct http_addr *addr);
+
+/**
+ * http_addr_parse parses a textual IPv4 or IPv6 address of len bytes, which
+ * doesn't need to be NUL terminated. Returns 0 on success and -1 if it isn't
+ * a valid address.
+ */
+int
+http_addr_parse(const char *str, const size_t len, struct http_addr *addr);
+
+/**
+ * http_addr_format writes the address into buf, which needs room for
+ * HTTP_ADDR_STRLEN bytes. IPv6 addresses are written in the RFC 5952
+ * canonical form. It doesn't allocate or touch any shared state, so it's
+ * safe to call from any thread. Returns the length written, not counting
+ * the NUL, which is 0 for an unknown family.
+ */
+size_t
+http_addr_format(const struct http_addr *addr, char *buf);
+
+/**
+ * http_trusted_proxy_add adds a range of proxies, in CIDR notation like
+ * "10.0.0.0/8" or "fd00::/8", or a single address, whose Forwarded and
+ * X-Forwarded-For headers are believed. Meant to be called at startup,
+ * before any requests are handled. Returns 0 on success and -1 if the range
+ * is invalid or there's no room for it.
+ */
+int
+http_trusted_proxy_add(const char *cidr);
+
+/**
+ * http_trusted_proxy checks whether the address is in a trusted proxy range.
+ */
+int
+http_trusted_proxy(const struct http_addr *addr);
+
+/**
+ * http_client_addr sets addr to the address of the client that made the
+ * request. That's the peer address unless the peer is a trusted proxy, in
+ * which case the Forwarded header, or X-Forwarded-For without one, is
+ * walked from the nearest hop back and the first address that isn't a
+ * trusted proxy is used. Returns 0 on success and -1 if there's no usable
+ * address.
+ */
+int
+http_client_addr(const struct _u_request *request, struct http_addr *addr);
+
+/**
+ * http_client_addr_format writes the request's client address, as found by
+ * http_client_addr, into buf, which needs room for HTTP_ADDR_STRLEN bytes.
+ * Returns the length written, which is 0 if there's no usable address.
+ */
+size_t
+http_client_addr_format(const struct _u_request *request, char *buf);
+
+#endif /* _HTTP_ADDR_H */
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,388 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define HTTP_ARENA_ALIGN alignof(max_align_t)
+
+/**
+ * http_arena_chunk_t is a block allocations are bumped out of.
+ */
+struct http_arena_chunk_t {
+    struct http_arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+/**
+ * http_arena is an arena. It lives at the start of its first chunk, so
+ * creating one takes no allocation of its own. chunks holds the chunks in
+ * use, current one first, and large the dedicated blocks of large
+ * allocations.
+ */
+struct http_arena {
+    struct http_arena_chunk_t *chunks;
+    struct http_arena_chunk_t *large;
+    unsigned int chunk_count;
+    size_t bytes;
+};
+
+#define HTTP_ARENA_HEADER \
+    ((sizeof(struct http_arena) + HTTP_ARENA_ALIGN - 1) & ~(HTTP_ARENA_ALIGN - 1))
+
+/**
+ * http_arena_cache_t is a thread's cache of freed chunks, along with the
+ * stats of the arenas it freed. The counters are only written by the owning
+ * thread; readers aggregate them with relaxed loads.
+ */
+struct http_arena_cache_t {
+    struct http_arena_chunk_t *free;
+    unsigned int free_count;
+
+    uint64_t requests;
+    uint64_t total_bytes;
+    uint64_t peak_bytes;
+    uint64_t chunk_allocs;
+    uint64_t overflows;
+    uint64_t large_allocs;
+
+    struct http_arena_cache_t *prev;
+    struct http_arena_cache_t *next;
+};
+
+/**
+ * http_arenas_t tracks every thread's cache so stats can be aggregated.
+ * Counts of exited threads are folded into retired.
+ */
+struct http_arenas_t {
+    pthread_once_t once;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    struct http_arena_cache_t *head;
+    struct http_arena_stats retired;
+    size_t chunk_size;
+};
+
+static struct http_arenas_t arenas = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .chunk_size = HTTP_ARENA_CHUNK_SIZE,
+};
+
+static __thread struct http_arena_cache_t *arena_cache;
+
+static void
+http_arena_chunks_free(struct http_arena_chunk_t *c)
+{
+    while (c != NULL) {
+        struct http_arena_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+/**
+ * http_arena_cache_free folds an exiting thread's counts into the retired
+ * stats and frees its cache along with the chunks it holds.
+ */
+static void
+http_arena_cache_free(void *arg)
+{
+    struct http_arena_cache_t *c = (struct http_arena_cache_t*)arg;
+
+    pthread_mutex_lock(&arenas.lock);
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        arenas.head = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+
+    arenas.retired.requests += c->requests;
+    arenas.retired.bytes += c->total_bytes;
+    if (c->peak_bytes > arenas.retired.peak_bytes) {
+        arenas.retired.peak_bytes = c->peak_bytes;
+    }
+    arenas.retired.chunk_allocs += c->chunk_allocs;
+    arenas.retired.overflows += c->overflows;
+    arenas.retired.large_allocs += c->large_allocs;
+    pthread_mutex_unlock(&arenas.lock);
+
+    http_arena_chunks_free(c->free);
+    free(c);
+    arena_cache = NULL;
+}
+
+static void
+http_arena_key_create(void)
+{
+    pthread_key_create(&arenas.key, http_arena_cache_free);
+}
+
+/**
+ * http_arena_cache_get returns the calling thread's cache, creating and
+ * registering it on first use.
+ */
+static struct http_arena_cache_t*
+http_arena_cache_get(void)
+{
+    if (arena_cache != NULL) {
+        return arena_cache;
+    }
+
+    pthread_once(&arenas.once, http_arena_key_create);
+
+    struct http_arena_cache_t *c =
+        (struct http_arena_cache_t*)calloc(1, sizeof(struct http_arena_cache_t));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&arenas.lock);
+    c->next = arenas.head;
+    if (arenas.head != NULL) {
+        arenas.head->prev = c;
+    }
+    arenas.head = c;
+    pthread_mutex_unlock(&arenas.lock);
+
+    pthread_setspecific(arenas.key, c);
+    arena_cache = c;
+
+    return c;
+}
+
+void
+http_arena_set_chunk_size(const size_t size)
+{
+    size_t s = size < 256 ? 256 : size;
+    __atomic_store_n(&arenas.chunk_size, s, __ATOMIC_RELAXED);
+}
+
+/**
+ * http_arena_chunk_new returns a chunk of at least size bytes, reusing one
+ * of the thread's free chunks if it's big enough.
+ */
+static struct http_arena_chunk_t*
+http_arena_chunk_new(const size_t size)
+{
+    struct http_arena_cache_t *cache = http_arena_cache_get();
+    struct http_arena_chunk_t *c = cache != NULL ? cache->free : NULL;
+
+    if (c != NULL && c->size >= size) {
+        cache->free = c->next;
+        cache->free_count--;
+    } else {
+        c = (struct http_arena_chunk_t*)malloc(sizeof(struct http_arena_chunk_t) + size);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->size = size;
+        if (cache != NULL) {
+            __atomic_store_n(&cache->chunk_allocs, cache->chunk_allocs + 1,
+                __ATOMIC_RELAXED);
+        }
+    }
+    c->used = 0;
+    c->next = NULL;
+
+    return c;
+}
+
+struct http_arena*
+http_arena_new(void)
+{
+    size_t chunk_size = __atomic_load_n(&arenas.chunk_size, __ATOMIC_RELAXED);
+
+    struct http_arena_chunk_t *c = http_arena_chunk_new(chunk_size);
+    if (c == NULL) {
+        return NULL;
+    }
+    c->used = HTTP_ARENA_HEADER;
+
+    struct http_arena *a = (struct http_arena*)c->data;
+    a->chunks = c;
+    a->large = NULL;
+    a->chunk_count = 1;
+    a->bytes = 0;
+
+    return a;
+}
+
+void*
+http_arena_alloc(struct http_arena *a, const size_t n)
+{
+    if (a == NULL) {
+        return NULL;
+    }
+
+    size_t size = (n + HTTP_ARENA_ALIGN - 1) & ~(HTTP_ARENA_ALIGN - 1);
+    if (size < n) {
+        return NULL;
+    }
+
+    struct http_arena_chunk_t *c = a->chunks;
+    if (c->size - c->used >= size) {
+        void *p = c->data + c->used;
+        c->used += size;
+        a->bytes += size;
+        return p;
+    }
+
+    size_t chunk_size = __atomic_load_n(&arenas.chunk_size, __ATOMIC_RELAXED);
+
+    // big allocations get a block of their own so they don't waste the
+    // rest of a chunk
+    if (size > chunk_size / 4) {
+        if (size > SIZE_MAX - sizeof(struct http_arena_chunk_t)) {
+            return NULL;
+        }
+        c = (struct http_arena_chunk_t*)malloc(sizeof(struct http_arena_chunk_t) + size);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->size = size;
+        c->used = size;
+        c->next = a->large;
+        a->large = c;
+        a->bytes += size;
+        struct http_arena_cache_t *cache = http_arena_cache_get();
+        if (cache != NULL) {
+            __atomic_store_n(&cache->large_allocs, cache->large_allocs + 1,
+                __ATOMIC_RELAXED);
+        }
+        return c->data;
+    }
+
+    c = http_arena_chunk_new(chunk_size);
+    if (c == NULL) {
+        return NULL;
+    }
+
+    // the arena lives in its first chunk, which stays at the end of the list
+    c->next = a->chunks;
+    a->chunks = c;
+    a->chunk_count++;
+
+    c->used = size;
+    a->bytes += size;
+
+    return c->data;
+}
+
+char*
+http_arena_strndup(struct http_arena *a, const char *str, const size_t n)
+{
+    size_t len = strnlen(str, n);
+
+    char *s = (char*)http_arena_alloc(a, len + 1);
+    if (s == NULL) {
+        return NULL;
+    }
+    memcpy(s, str, len);
+    s[len] = '\0';
+
+    return s;
+}
+
+void
+http_arena_free(struct http_arena *a)
+{
+    if (a == NULL) {
+        return;
+    }
+
+    // a goes away with its chunk, so take what's needed first
+    struct http_arena_chunk_t *c = a->chunks;
+    struct http_arena_chunk_t *large = a->large;
+    unsigned int chunk_count = a->chunk_count;
+    size_t bytes = a->bytes;
+
+    struct http_arena_cache_t *cache = http_arena_cache_get();
+    size_t chunk_size = __atomic_load_n(&arenas.chunk_size, __ATOMIC_RELAXED);
+
+    while (c != NULL) {
+        struct http_arena_chunk_t *next = c->next;
+        if (cache != NULL && cache->free_count < HTTP_ARENA_CACHED_CHUNKS &&
+            c->size >= chunk_size) {
+            c->next = cache->free;
+            cache->free = c;
+            cache->free_count++;
+        } else {
+            free(c);
+        }
+        c = next;
+    }
+    http_arena_chunks_free(large);
+
+    if (cache == NULL) {
+        return;
+    }
+    __atomic_store_n(&cache->requests, cache->requests + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->total_bytes, cache->total_bytes + bytes,
+        __ATOMIC_RELAXED);
+    if (bytes > cache->peak_bytes) {
+        __atomic_store_n(&cache->peak_bytes, bytes, __ATOMIC_RELAXED);
+    }
+    if (chunk_count > 1) {
+        __atomic_store_n(&cache->overflows, cache->overflows + 1,
+            __ATOMIC_RELAXED);
+    }
+}
+
+void
+http_arena_get_stats(struct http_arena_stats *stats)
+{
+    pthread_mutex_lock(&arenas.lock);
+    *stats = arenas.retired;
+
+    for (struct http_arena_cache_t *a = arenas.head; a != NULL; a = a->next) {
+        uint64_t peak = __atomic_load_n(&a->peak_bytes, __ATOMIC_RELAXED);
+
+        stats->requests += __atomic_load_n(&a->requests, __ATOMIC_RELAXED);
+        stats->bytes += __atomic_load_n(&a->total_bytes, __ATOMIC_RELAXED);
+        if (peak > stats->peak_bytes) {
+            stats->peak_bytes = peak;
+        }
+        stats->chunk_allocs += __atomic_load_n(&a->chunk_allocs, __ATOMIC_RELAXED);
+        stats->overflows += __atomic_load_n(&a->overflows, __ATOMIC_RELAXED);
+        stats->large_allocs += __atomic_load_n(&a->large_allocs, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&arenas.lock);
+
+    stats->chunk_size = __atomic_load_n(&arenas.chunk_size, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,123 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_ARENA_H
+#define _HTTP_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * HTTP_ARENA_CHUNK_SIZE is the default size of an arena chunk.
+ */
+#ifndef HTTP_ARENA_CHUNK_SIZE
+#define HTTP_ARENA_CHUNK_SIZE 4096
+#endif
+
+/**
+ * HTTP_ARENA_CACHED_CHUNKS is the most freed chunks a thread keeps for
+ * reuse by the arenas it creates. Chunks past that are freed.
+ */
+#ifndef HTTP_ARENA_CACHED_CHUNKS
+#define HTTP_ARENA_CACHED_CHUNKS 4
+#endif
+
+/**
+ * http_arena_stats holds totals across all threads. requests is the number
+ * of arenas freed, bytes the bytes allocated from them and peak_bytes the
+ * most a single arena allocated. chunk_allocs counts chunks taken from
+ * malloc rather than reused, overflows arenas that needed more than one
+ * chunk and large_allocs allocations too big to share a chunk.
+ */
+struct http_arena_stats {
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+    uint64_t chunk_allocs;
+    uint64_t overflows;
+    uint64_t large_allocs;
+    size_t chunk_size;
+};
+
+/**
+ * http_arena is a bump allocator everything allocated from is freed
+ * together, such as the allocations made while handling a request.
+ */
+struct http_arena;
+
+/**
+ * http_arena_set_chunk_size sets the size of new chunks. Meant to be called
+ * once at startup, sized from http_arena_get_stats.
+ */
+void
+http_arena_set_chunk_size(const size_t size);
+
+/**
+ * http_arena_new creates an arena. Its first chunk, which also holds the
+ * arena itself, comes from the calling thread's cache of freed chunks when
+ * there is one. Returns NULL on allocation failure.
+ */
+struct http_arena*
+http_arena_new(void);
+
+/**
+ * http_arena_alloc allocates n bytes, aligned for any type, from the given
+ * arena. The memory lives until http_arena_free and must not be freed on
+ * its own. Returns NULL on allocation failure.
+ */
+void*
+http_arena_alloc(struct http_arena *arena, const size_t n);
+
+/**
+ * http_arena_strndup copies up to n bytes of the given string into the
+ * arena and NUL terminates it. Returns NULL on allocation failure.
+ */
+char*
+http_arena_strndup(struct http_arena *arena, const char *str, const size_t n);
+
+/**
+ * http_arena_free frees the arena and everything allocated from it. Its
+ * chunks go to the calling thread's cache, which needn't be the thread that
+ * created it.
+ */
+void
+http_arena_free(struct http_arena *arena);
+
+/**
+ * http_arena_get_stats fills in stats with the totals so far.
+ */
+void
+http_arena_get_stats(struct http_arena_stats *stats);
+
+#endif /* _HTTP_ARENA_H */
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,436 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "auth.h"
+#include "logger.h"
+
+/**
+ * http_auth_entry_t is a cached verification result. Entries are chained in
+ * their hash bucket and linked into their shard's LRU list, most recently
+ * used first. The key is the full Authorization header.
+ */
+struct http_auth_entry_t {
+    uint64_t hash;
+    uint64_t expires;
+    int result;
+    struct http_auth_entry_t *chain;
+    struct http_auth_entry_t *prev;
+    struct http_auth_entry_t *next;
+    size_t key_len;
+    unsigned char key[];
+};
+
+/**
+ * http_auth_shard_t is a bounded LRU map under its own lock.
+ */
+struct http_auth_shard_t {
+    pthread_mutex_t lock;
+    struct http_auth_entry_t **buckets;
+    size_t mask;
+    size_t count;
+    size_t capacity;
+    struct http_auth_entry_t *head;
+    struct http_auth_entry_t *tail;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct http_auth_cache {
+    struct http_auth_shard_t shards[HTTP_AUTH_CACHE_SHARDS];
+    uint64_t seed[2];
+    unsigned int ttl;
+    unsigned int negative_ttl;
+    unsigned int log_every;
+    uint64_t lookups;
+};
+
+/**
+ * http_auth_now returns the monotonic clock in seconds. The coarse clock is
+ * plenty for TTLs and avoids a full clock read on every lookup.
+ */
+static uint64_t
+http_auth_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec;
+}
+
+#define HTTP_AUTH_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define HTTP_AUTH_SIPROUND           \
+    do {                             \
+        v0 += v1;                    \
+        v1 = HTTP_AUTH_ROTL(v1, 13); \
+        v1 ^= v0;                    \
+        v0 = HTTP_AUTH_ROTL(v0, 32); \
+        v2 += v3;                    \
+        v3 = HTTP_AUTH_ROTL(v3, 16); \
+        v3 ^= v2;                    \
+        v0 += v3;                    \
+        v3 = HTTP_AUTH_ROTL(v3, 21); \
+        v3 ^= v0;                    \
+        v2 += v1;                    \
+        v1 = HTTP_AUTH_ROTL(v1, 17); \
+        v1 ^= v2;                    \
+        v2 = HTTP_AUTH_ROTL(v2, 32); \
+    } while (0)
+
+/**
+ * http_auth_hash is SipHash-2-4 keyed with the cache's random seed, so
+ * clients can't pick headers that pile into one bucket.
+ */
+static uint64_t
+http_auth_hash(const uint64_t seed[2], const unsigned char *in, const size_t len)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ seed[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ seed[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ seed[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ seed[1];
+    const unsigned char *end = in + (len & ~(size_t)7);
+    uint64_t b = (uint64_t)len << 56;
+
+    for (; in != end; in += 8) {
+        uint64_t m;
+        memcpy(&m, in, 8);
+        v3 ^= m;
+        HTTP_AUTH_SIPROUND;
+        HTTP_AUTH_SIPROUND;
+        v0 ^= m;
+    }
+
+    for (size_t i = 0; i < (len & 7); i++) {
+        b |= (uint64_t)in[i] << (8 * i);
+    }
+
+    v3 ^= b;
+    HTTP_AUTH_SIPROUND;
+    HTTP_AUTH_SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    HTTP_AUTH_SIPROUND;
+    HTTP_AUTH_SIPROUND;
+    HTTP_AUTH_SIPROUND;
+    HTTP_AUTH_SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+int
+http_auth_equal(const void *a, const size_t a_len, const void *b, const size_t b_len)
+{
+    const unsigned char *x = a;
+    const unsigned char *y = b;
+    unsigned char diff = a_len != b_len;
+
+    // always walk all of a so the time doesn't depend on where they differ
+    for (size_t i = 0; i < a_len; i++) {
+        diff |= x[i] ^ (b_len > 0 ? y[i % b_len] : 0);
+    }
+
+    return diff == 0;
+}
+
+/**
+ * http_auth_destroy_entry frees the given entry. The key is a credential so
+ * it's wiped rather than left lying around in the heap.
+ */
+static void
+http_auth_destroy_entry(struct http_auth_entry_t *entry)
+{
+    explicit_bzero(entry->key, entry->key_len);
+    free(entry);
+}
+
+struct http_auth_cache*
+http_auth_cache_new(const size_t capacity, const unsigned int ttl,
+                    const unsigned int negative_ttl, const unsigned int log_every)
+{
+    if (capacity == 0) {
+        return NULL;
+    }
+
+    struct http_auth_cache *cache = calloc(1, sizeof(struct http_auth_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    if (getrandom(cache->seed, sizeof(cache->seed), 0) != sizeof(cache->seed)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        cache->seed[0] = (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 32);
+        cache->seed[1] = (uint64_t)ts.tv_sec ^ (uint64_t)(uintptr_t)cache;
+    }
+
+    cache->ttl = ttl;
+    cache->negative_ttl = negative_ttl;
+    cache->log_every = log_every;
+
+    size_t per_shard = (capacity + HTTP_AUTH_CACHE_SHARDS - 1) / HTTP_AUTH_CACHE_SHARDS;
+    size_t buckets = 1;
+    while (buckets < per_shard) {
+        buckets <<= 1;
+    }
+
+    for (int i = 0; i < HTTP_AUTH_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+    }
+
+    for (int i = 0; i < HTTP_AUTH_CACHE_SHARDS; i++) {
+        struct http_auth_shard_t *shard = &cache->shards[i];
+
+        shard->capacity = per_shard;
+        shard->mask = buckets - 1;
+        shard->buckets = calloc(buckets, sizeof(struct http_auth_entry_t *));
+        if (shard->buckets == NULL) {
+            http_auth_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+void
+http_auth_cache_free(struct http_auth_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < HTTP_AUTH_CACHE_SHARDS; i++) {
+        struct http_auth_shard_t *shard = &cache->shards[i];
+
+        for (struct http_auth_entry_t *e = shard->head, *next; e != NULL; e = next) {
+            next = e->next;
+            http_auth_destroy_entry(e);
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    free(cache);
+}
+
+/**
+ * http_auth_shard_unlink removes the given entry from its bucket chain and
+ * the LRU list. The shard lock must be held.
+ */
+static void
+http_auth_shard_unlink(struct http_auth_shard_t *shard, struct http_auth_entry_t *entry)
+{
+    struct http_auth_entry_t **p = &shard->buckets[entry->hash & shard->mask];
+    while (*p != entry) {
+        p = &(*p)->chain;
+    }
+    *p = entry->chain;
+
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        shard->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        shard->tail = entry->prev;
+    }
+
+    shard->count--;
+}
+
+/**
+ * http_auth_shard_push links the given entry in at the front of the LRU
+ * list. The shard lock must be held.
+ */
+static void
+http_auth_shard_push(struct http_auth_shard_t *shard, struct http_auth_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = shard->head;
+    if (shard->head != NULL) {
+        shard->head->prev = entry;
+    } else {
+        shard->tail = entry;
+    }
+    shard->head = entry;
+}
+
+/**
+ * http_auth_shard_find returns the entry for the given key, or NULL. The
+ * shard lock must be held.
+ */
+static struct http_auth_entry_t*
+http_auth_shard_find(struct http_auth_shard_t *shard, const uint64_t hash,
+                     const char *key, const size_t len)
+{
+    for (struct http_auth_entry_t *e = shard->buckets[hash & shard->mask]; e != NULL; e = e->chain) {
+        if (e->hash == hash && http_auth_equal(key, len, e->key, e->key_len)) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * http_auth_cache_report logs the hit ratio across every shard.
+ */
+static void
+http_auth_cache_report(struct http_auth_cache *cache)
+{
+    uint64_t hits, misses;
+    http_auth_cache_stats(cache, &hits, &misses);
+
+    s_log(S_LOG_INFO,
+        s_log_string("msg", "auth cache"),
+        s_log_uint64("hits", hits),
+        s_log_uint64("misses", misses),
+        s_log_double("hit_ratio", hits + misses > 0 ? (double)hits / (double)(hits + misses) : 0.0));
+}
+
+int
+http_auth_cache_get(struct http_auth_cache *cache, const char *key, const size_t len)
+{
+    if (cache == NULL || key == NULL || len > HTTP_AUTH_CACHE_MAX_KEY) {
+        return HTTP_AUTH_CACHE_MISS;
+    }
+
+    uint64_t hash = http_auth_hash(cache->seed, (const unsigned char *)key, len);
+    struct http_auth_shard_t *shard = &cache->shards[(hash >> 56) % HTTP_AUTH_CACHE_SHARDS];
+    struct http_auth_entry_t *expired = NULL;
+    int result = HTTP_AUTH_CACHE_MISS;
+
+    pthread_mutex_lock(&shard->lock);
+    struct http_auth_entry_t *e = http_auth_shard_find(shard, hash, key, len);
+    if (e != NULL && e->expires <= http_auth_now()) {
+        http_auth_shard_unlink(shard, e);
+        expired = e;
+    } else if (e != NULL) {
+        result = e->result;
+        if (shard->head != e) {
+            http_auth_shard_unlink(shard, e);
+            e->chain = shard->buckets[hash & shard->mask];
+            shard->buckets[hash & shard->mask] = e;
+            http_auth_shard_push(shard, e);
+            shard->count++;
+        }
+    }
+    if (result == HTTP_AUTH_CACHE_MISS) {
+        shard->misses++;
+    } else {
+        shard->hits++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (expired != NULL) {
+        http_auth_destroy_entry(expired);
+    }
+
+    if (cache->log_every > 0 &&
+        __atomic_add_fetch(&cache->lookups, 1, __ATOMIC_RELAXED) % cache->log_every == 0) {
+        http_auth_cache_report(cache);
+    }
+
+    return result;
+}
+
+void
+http_auth_cache_put(struct http_auth_cache *cache, const char *key, const size_t len,
+                    const int result)
+{
+    if (cache == NULL || key == NULL || len > HTTP_AUTH_CACHE_MAX_KEY) {
+        return;
+    }
+    unsigned int ttl = result == HTTP_AUTH_CACHE_ALLOW ? cache->ttl : cache->negative_ttl;
+    if (ttl == 0) {
+        return;
+    }
+
+    struct http_auth_entry_t *entry = malloc(sizeof(struct http_auth_entry_t) + len);
+    if (entry == NULL) {
+        return;
+    }
+    uint64_t hash = http_auth_hash(cache->seed, (const unsigned char *)key, len);
+    entry->hash = hash;
+    entry->expires = http_auth_now() + ttl;
+    entry->result = result;
+    entry->key_len = len;
+    memcpy(entry->key, key, len);
+
+    struct http_auth_shard_t *shard = &cache->shards[(hash >> 56) % HTTP_AUTH_CACHE_SHARDS];
+    struct http_auth_entry_t *old = NULL;
+    struct http_auth_entry_t *evicted = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+    old = http_auth_shard_find(shard, hash, key, len);
+    if (old != NULL) {
+        http_auth_shard_unlink(shard, old);
+    } else if (shard->count >= shard->capacity) {
+        evicted = shard->tail;
+        http_auth_shard_unlink(shard, evicted);
+    }
+    entry->chain = shard->buckets[hash & shard->mask];
+    shard->buckets[hash & shard->mask] = entry;
+    http_auth_shard_push(shard, entry);
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (old != NULL) {
+        http_auth_destroy_entry(old);
+    }
+    if (evicted != NULL) {
+        http_auth_destroy_entry(evicted);
+    }
+}
+
+void
+http_auth_cache_stats(struct http_auth_cache *cache, uint64_t *hits, uint64_t *misses)
+{
+    *hits = 0;
+    *misses = 0;
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < HTTP_AUTH_CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        *hits += cache->shards[i].hits;
+        *misses += cache->shards[i].misses;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+}
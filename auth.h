@@ -0,0 +1,115 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_AUTH_H
+#define _HTTP_AUTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * HTTP_AUTH_CACHE_SHARDS is the number of independently locked shards the
+ * auth cache is split into.
+ */
+#ifndef HTTP_AUTH_CACHE_SHARDS
+#define HTTP_AUTH_CACHE_SHARDS 16
+#endif
+
+/**
+ * HTTP_AUTH_CACHE_MAX_KEY is the longest Authorization header that's cached.
+ * Longer ones are verified every time.
+ */
+#define HTTP_AUTH_CACHE_MAX_KEY 4096
+
+/**
+ * Results of a cache lookup. HTTP_AUTH_CACHE_MISS means the credentials have
+ * to be verified and the result stored with http_auth_cache_put.
+ */
+enum {
+    HTTP_AUTH_CACHE_MISS = -1,
+    HTTP_AUTH_CACHE_DENY = 0,
+    HTTP_AUTH_CACHE_ALLOW = 1,
+};
+
+struct http_auth_cache;
+
+/**
+ * http_auth_cache_new creates a cache of verification results keyed by the
+ * full Authorization header. It holds at most capacity entries, evicting the
+ * least recently used, and results expire after ttl seconds, or negative_ttl
+ * seconds for failed verifications. A negative_ttl of 0 doesn't cache
+ * failures. The hit ratio is logged every log_every lookups unless that's 0.
+ * Returns NULL on failure.
+ */
+struct http_auth_cache*
+http_auth_cache_new(const size_t capacity, const unsigned int ttl,
+                    const unsigned int negative_ttl, const unsigned int log_every);
+
+/**
+ * http_auth_cache_free frees the given cache and every entry in it.
+ */
+void
+http_auth_cache_free(struct http_auth_cache *cache);
+
+/**
+ * http_auth_cache_get looks up the result for the given credentials. Entries
+ * are found by a seeded hash and then compared in full in constant time, so a
+ * hash collision can't authenticate anyone.
+ */
+int
+http_auth_cache_get(struct http_auth_cache *cache, const char *key, const size_t len);
+
+/**
+ * http_auth_cache_put stores the result of verifying the given credentials,
+ * HTTP_AUTH_CACHE_ALLOW or HTTP_AUTH_CACHE_DENY.
+ */
+void
+http_auth_cache_put(struct http_auth_cache *cache, const char *key, const size_t len,
+                    const int result);
+
+/**
+ * http_auth_cache_stats sets hits and misses to the number of lookups that
+ * found and didn't find a live entry.
+ */
+void
+http_auth_cache_stats(struct http_auth_cache *cache, uint64_t *hits, uint64_t *misses);
+
+/**
+ * http_auth_equal compares a and b in time that depends only on their
+ * lengths. Returns 1 if they're equal and 0 if not.
+ */
+int
+http_auth_equal(const void *a, const size_t a_len, const void *b, const size_t b_len);
+
+#endif /* _HTTP_AUTH_H */
+#ifdef __cplusplus
+}
+#endif
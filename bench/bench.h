@@ -0,0 +1,393 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTP_BENCH_H
+#define _HTTP_BENCH_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * A small benchmark harness shared by the programs in this directory. Each
+ * measurement runs the function under test in batches, doubling the batch
+ * until one takes at least BENCH_MIN_MS (100ms by default), then repeats
+ * that batch BENCH_REPEATS times (5 by default) and reports the median time
+ * per operation. Results are written as a JSON document to stdout, or to the
+ * file given with -o:
+ *
+ *   {"suite":"logger","results":[
+ *     {"name":"s_log_int","ns_per_op":1.02,"ops_per_sec":980392156.9},
+ *     ...
+ *   ]}
+ *
+ * Results with a byte count also get bytes_per_op and mb_per_sec.
+ */
+struct bench {
+    FILE *out;
+    const char *filter;
+    uint64_t min_ns;
+    int repeats;
+    int results;
+};
+
+/**
+ * bench_fn runs the operation under test n times.
+ */
+typedef void (*bench_fn)(void *arg, uint64_t n);
+
+/**
+ * bench_keep stops the compiler from optimizing away a value the benchmark
+ * doesn't otherwise use.
+ */
+#define bench_keep(v) __asm__ volatile("" : : "g"(v) : "memory")
+
+static inline uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t
+bench_env(const char *name, const uint64_t def)
+{
+    const char *v = getenv(name);
+
+    return v != NULL && *v != '\0' ? strtoull(v, NULL, 10) : def;
+}
+
+/**
+ * bench_init parses the common options, -o for the output file and -f to
+ * only run benchmarks whose name contains the given string, and starts the
+ * JSON document for the suite. Returns 0 on success and -1 on bad options.
+ */
+static inline int
+bench_init(struct bench *b, const char *suite, int argc, char **argv)
+{
+    int opt;
+
+    memset(b, 0, sizeof(*b));
+    b->out = stdout;
+    b->min_ns = bench_env("BENCH_MIN_MS", 100) * 1000000ULL;
+    b->repeats = (int)bench_env("BENCH_REPEATS", 5);
+    if (b->repeats < 1) {
+        b->repeats = 1;
+    }
+
+    while ((opt = getopt(argc, argv, "o:f:")) != -1) {
+        switch (opt) {
+            case 'o':
+                b->out = fopen(optarg, "w");
+                if (b->out == NULL) {
+                    perror(optarg);
+                    return -1;
+                }
+                break;
+            case 'f':
+                b->filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-o file] [-f filter]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    fprintf(b->out, "{\"suite\":\"%s\",\"results\":[", suite);
+
+    return 0;
+}
+
+/**
+ * bench_enabled checks whether the named benchmark passes the -f filter.
+ */
+static inline int
+bench_enabled(const struct bench *b, const char *name)
+{
+    return b->filter == NULL || strstr(name, b->filter) != NULL;
+}
+
+static int
+bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * bench_measure returns the median nanoseconds per call of fn.
+ */
+static inline double
+bench_measure(const struct bench *b, bench_fn fn, void *arg)
+{
+    uint64_t n = 1;
+    uint64_t elapsed;
+
+    // warm up and size the batch
+    for (;;) {
+        uint64_t start = bench_now_ns();
+        fn(arg, n);
+        elapsed = bench_now_ns() - start;
+        if (elapsed >= b->min_ns || n >= (1ULL << 40)) {
+            break;
+        }
+        // aim a little past the minimum so the next batch is usually the
+        // last one
+        uint64_t scale = elapsed > 0 ? b->min_ns / elapsed + 1 : 16;
+        n *= scale < 2 ? 2 : scale;
+    }
+
+    double samples[64];
+    int repeats = b->repeats < 64 ? b->repeats : 64;
+    for (int i = 0; i < repeats; i++) {
+        uint64_t start = bench_now_ns();
+        fn(arg, n);
+        samples[i] = (double)(bench_now_ns() - start) / (double)n;
+    }
+    qsort(samples, (size_t)repeats, sizeof(double), bench_cmp_double);
+
+    return samples[repeats / 2];
+}
+
+/**
+ * bench_report writes a result. bytes_per_op is the number of bytes each
+ * operation produces or consumes, or 0 if that doesn't apply.
+ */
+static inline void
+bench_report(struct bench *b, const char *name, const double ns_per_op,
+             const double bytes_per_op)
+{
+    fprintf(b->out, "%s\n  {\"name\":\"%s\",\"ns_per_op\":%.2f,\"ops_per_sec\":%.1f",
+        b->results++ > 0 ? "," : "", name, ns_per_op,
+        ns_per_op > 0 ? 1e9 / ns_per_op : 0.0);
+    if (bytes_per_op > 0) {
+        fprintf(b->out, ",\"bytes_per_op\":%.1f,\"mb_per_sec\":%.1f",
+            bytes_per_op, ns_per_op > 0 ? bytes_per_op * 1e3 / ns_per_op : 0.0);
+    }
+    fputc('}', b->out);
+    fflush(b->out);
+}
+
+/**
+ * bench_run measures fn and reports it under the given name, if it passes
+ * the filter.
+ */
+static inline void
+bench_run(struct bench *b, const char *name, bench_fn fn, void *arg,
+          const double bytes_per_op)
+{
+    if (!bench_enabled(b, name)) {
+        return;
+    }
+    bench_report(b, name, bench_measure(b, fn, arg), bytes_per_op);
+}
+
+/**
+ * bench_finish ends the JSON document.
+ */
+static inline int
+bench_finish(struct bench *b)
+{
+    fputs("\n]}\n", b->out);
+    if (b->out != stdout) {
+        fclose(b->out);
+    }
+
+    return 0;
+}
+
+/**
+ * BENCH_HIST_SUB_BITS sets the precision of bench_hist: each power of 2 is
+ * split into 2^BENCH_HIST_SUB_BITS linear buckets, so values are recorded
+ * within 1%. BENCH_HIST_MAG is the number of powers of 2 covered past the
+ * linear range, up to about half an hour in nanoseconds.
+ */
+#define BENCH_HIST_SUB_BITS 7
+#define BENCH_HIST_SUB      (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_MAG      34
+#define BENCH_HIST_BUCKETS  ((BENCH_HIST_MAG + 1) * BENCH_HIST_SUB)
+
+/**
+ * bench_hist is a log-linear latency histogram in the style of HdrHistogram.
+ */
+struct bench_hist {
+    uint64_t counts[BENCH_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    uint64_t min;
+    double sum;
+};
+
+static inline void
+bench_hist_init(struct bench_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline size_t
+bench_hist_index(const uint64_t v)
+{
+    if (v < BENCH_HIST_SUB) {
+        return (size_t)v;
+    }
+
+    unsigned int mag = 63 - (unsigned int)__builtin_clzll(v);
+    unsigned int shift = mag - BENCH_HIST_SUB_BITS;
+    size_t i = ((size_t)(shift + 1) << BENCH_HIST_SUB_BITS) +
+        (size_t)((v >> shift) & (BENCH_HIST_SUB - 1));
+
+    return i < BENCH_HIST_BUCKETS ? i : BENCH_HIST_BUCKETS - 1;
+}
+
+/**
+ * bench_hist_value returns the highest value recorded in the given bucket.
+ */
+static inline uint64_t
+bench_hist_value(const size_t i)
+{
+    if (i < BENCH_HIST_SUB) {
+        return i;
+    }
+
+    unsigned int shift = (unsigned int)(i >> BENCH_HIST_SUB_BITS) - 1;
+    uint64_t sub = (i & (BENCH_HIST_SUB - 1)) | BENCH_HIST_SUB;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline void
+bench_hist_record(struct bench_hist *h, const uint64_t v)
+{
+    h->counts[bench_hist_index(v)]++;
+    h->total++;
+    h->sum += (double)v;
+    if (v > h->max) {
+        h->max = v;
+    }
+    if (v < h->min) {
+        h->min = v;
+    }
+}
+
+/**
+ * bench_hist_record_corrected records v and, if it's longer than the
+ * expected interval between requests, the requests a closed loop client
+ * would have sent in the meantime had it not been waiting, as HdrHistogram
+ * does to correct for coordinated omission.
+ */
+static inline void
+bench_hist_record_corrected(struct bench_hist *h, const uint64_t v,
+                            const uint64_t interval)
+{
+    bench_hist_record(h, v);
+    if (interval == 0) {
+        return;
+    }
+    for (uint64_t missed = v > interval ? v - interval : 0; missed >= interval;
+         missed -= interval) {
+        bench_hist_record(h, missed);
+    }
+}
+
+static inline void
+bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src)
+{
+    for (size_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+}
+
+/**
+ * bench_hist_percentile returns the value at the given percentile, 0-100.
+ */
+static inline uint64_t
+bench_hist_percentile(const struct bench_hist *h, const double p)
+{
+    if (h->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * (double)h->total);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = bench_hist_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/**
+ * bench_hist_json writes the histogram's percentiles, in microseconds, as a
+ * JSON object.
+ */
+static inline void
+bench_hist_json(FILE *out, const struct bench_hist *h)
+{
+    static const struct {
+        const char *name;
+        double p;
+    } points[] = {
+        { "p50", 50 }, { "p90", 90 }, { "p99", 99 }, { "p99_9", 99.9 },
+        { "p99_99", 99.99 },
+    };
+
+    fprintf(out, "{\"count\":%llu,\"mean\":%.1f,\"min\":%.1f",
+        (unsigned long long)h->total,
+        h->total > 0 ? h->sum / (double)h->total / 1e3 : 0.0,
+        h->total > 0 ? (double)h->min / 1e3 : 0.0);
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        fprintf(out, ",\"%s\":%.1f", points[i].name,
+            (double)bench_hist_percentile(h, points[i].p) / 1e3);
+    }
+    fprintf(out, ",\"max\":%.1f}", (double)h->max / 1e3);
+}
+
+#endif /* _HTTP_BENCH_H */
@@ -0,0 +1,500 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * bench_http measures header parsing and the ulfius callbacks in this
+ * library. Callbacks are run on synthetic requests with the headers a
+ * browser sends, and each operation includes setting up and cleaning the
+ * response, which "response/init_clean" measures on its own. Access log
+ * entries go to /dev/null.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "http.h"
+
+static const char header_block[] =
+    "Host: api.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/dashboard\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=5f2b1c9a8e7d6c5b4a39281706f5e4d3; theme=dark\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "X-Request-ID: 8c0f5f0e-2f55-4c1e-9d2b-4f0c3e7a1b2d\r\n"
+    "X-Forwarded-For: 203.0.113.42, 10.0.0.3\r\n"
+    "If-None-Match: \"33a64df551425fcc55e4d42a148795d9f25f89d4\"\r\n"
+    "\r\n";
+
+/**
+ * request_new builds a GET request for path carrying the headers in
+ * header_block, from a peer in 10.0.0.0/8.
+ */
+static struct _u_request*
+request_new(const char *path)
+{
+    struct _u_request *request =
+        (struct _u_request*)o_malloc(sizeof(struct _u_request));
+    ulfius_init_request(request);
+
+    o_free(request->http_verb);
+    request->http_verb = o_strdup("GET");
+    o_free(request->url_path);
+    request->url_path = o_strdup(path);
+    o_free(request->http_protocol);
+    request->http_protocol = o_strdup("HTTP/1.1");
+
+    struct sockaddr_in *sin =
+        (struct sockaddr_in*)o_malloc(sizeof(struct sockaddr_in));
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    inet_pton(AF_INET, "10.0.0.3", &sin->sin_addr);
+    o_free(request->client_address);
+    request->client_address = (struct sockaddr*)sin;
+
+    struct http_header_iter it;
+    struct http_slice name, value;
+    http_header_iter_init(&it, header_block, sizeof(header_block) - 1);
+    while (http_header_iter_next(&it, &name, &value, NULL) == 1) {
+        char k[64], v[256];
+        snprintf(k, sizeof(k), "%.*s", (int)name.len, name.ptr);
+        snprintf(v, sizeof(v), "%.*s", (int)value.len, value.ptr);
+        u_map_put(request->map_header, k, v);
+    }
+
+    return request;
+}
+
+static void
+request_free(struct _u_request *request)
+{
+    ulfius_clean_request(request);
+    o_free(request);
+}
+
+static void
+bench_header_value(void *arg, uint64_t n)
+{
+    static const char line[] = "Accept-Encoding: gzip, deflate, br\r\n";
+    struct http_slice value;
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        int found = http_header_value(line, sizeof(line) - 1, "accept-encoding", &value);
+        bench_keep(found);
+        bench_keep(value.len);
+    }
+}
+
+/**
+ * bench_get_header_value is the legacy copying lookup http_header_value
+ * replaces, including the free its callers have to do.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+static void
+bench_get_header_value(void *arg, uint64_t n)
+{
+    static const char line[] = "Accept-Encoding: gzip, deflate, br";
+    static char key[] = "Accept-Encoding";
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        char *value = get_header_value(line, key);
+        bench_keep(value);
+        free(value);
+    }
+}
+#pragma GCC diagnostic pop
+
+/**
+ * bench_header_value_arena copies the value into an arena, which is set up
+ * and freed each time as it would be for a request.
+ */
+static void
+bench_header_value_arena(void *arg, uint64_t n)
+{
+    static const char line[] = "Accept-Encoding: gzip, deflate, br";
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        struct http_arena *arena = http_arena_new();
+        char *value = http_header_value_arena(arena, line, "accept-encoding");
+        bench_keep(value);
+        http_arena_free(arena);
+    }
+}
+
+static void
+bench_list(void *arg, uint64_t n)
+{
+    static const char accept[] =
+        "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,*/*;q=0.8";
+    struct http_list_iter it;
+    struct http_slice elem;
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        size_t total = 0;
+        http_list_init(&it, accept, sizeof(accept) - 1);
+        while (http_list_next(&it, &elem)) {
+            total += elem.len;
+        }
+        bench_keep(total);
+    }
+}
+
+static void
+bench_header_iter(void *arg, uint64_t n)
+{
+    struct http_header_iter it;
+    struct http_slice name, value;
+    int id;
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        int known = 0;
+        http_header_iter_init(&it, header_block, sizeof(header_block) - 1);
+        while (http_header_iter_next(&it, &name, &value, &id) == 1) {
+            known += id != HTTP_REQUEST_HEADER_ID_UNKNOWN;
+        }
+        bench_keep(known);
+    }
+}
+
+static void
+bench_header_id(void *arg, uint64_t n)
+{
+    static const struct {
+        const char *name;
+        size_t len;
+    } names[] = {
+        { "Host", 4 }, { "user-agent", 10 }, { "Accept-Encoding", 15 },
+        { "X-Custom-Header", 15 },
+    };
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        int id = http_header_id(names[i & 3].name, names[i & 3].len);
+        bench_keep(id);
+    }
+}
+
+static void
+bench_headers_index(void *arg, uint64_t n)
+{
+    const struct _u_request *request = (const struct _u_request*)arg;
+    struct http_headers headers;
+
+    for (uint64_t i = 0; i < n; i++) {
+        http_headers_index(&headers, request->map_header);
+        bench_keep(&headers);
+    }
+}
+
+static void
+bench_addr_format(void *arg, uint64_t n)
+{
+    const struct http_addr *addr = (const struct http_addr*)arg;
+    char buf[HTTP_ADDR_STRLEN];
+
+    for (uint64_t i = 0; i < n; i++) {
+        size_t len = http_addr_format(addr, buf);
+        bench_keep(len);
+        bench_keep(buf);
+    }
+}
+
+static void
+bench_inet_ntop(void *arg, uint64_t n)
+{
+    const struct http_addr *addr = (const struct http_addr*)arg;
+    char buf[INET6_ADDRSTRLEN];
+
+    for (uint64_t i = 0; i < n; i++) {
+        const char *str = inet_ntop(addr->family, addr->bytes, buf, sizeof(buf));
+        bench_keep(str);
+        bench_keep(buf);
+    }
+}
+
+/**
+ * run_addr compares http_addr_format with inet_ntop on the given address.
+ */
+static void
+run_addr(struct bench *b, const char *family, const char *str)
+{
+    struct http_addr addr;
+    char name[64];
+
+    if (http_addr_parse(str, strlen(str), &addr) != 0) {
+        return;
+    }
+    snprintf(name, sizeof(name), "addr/http_addr_format_%s", family);
+    bench_run(b, name, bench_addr_format, &addr, 0);
+    snprintf(name, sizeof(name), "addr/inet_ntop_%s", family);
+    bench_run(b, name, bench_inet_ntop, &addr, 0);
+}
+
+/**
+ * callback_bench runs a callback against a request with a fresh response
+ * each time.
+ */
+struct callback_bench {
+    int (*callback)(const struct _u_request *, struct _u_response *, void *);
+    void *user_data;
+    struct _u_request *request;
+};
+
+static int
+callback_none(const struct _u_request *request, struct _u_response *response,
+              void *user_data)
+{
+    (void)request;
+    (void)response;
+    (void)user_data;
+
+    return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * callback_log_request logs the request as a route's last callback would,
+ * after callback_route has named it.
+ */
+static int
+callback_log_request(const struct _u_request *request,
+                     struct _u_response *response, void *user_data)
+{
+    (void)user_data;
+
+    callback_route(request, response, "/api/v1/users/:id");
+    response->status = 200;
+    log_request(request, response, http_timer_start());
+
+    return U_CALLBACK_CONTINUE;
+}
+
+static int
+callback_rate_limited(const struct _u_request *request,
+                      struct _u_response *response, void *user_data)
+{
+    callback_route(request, response, "/api/v1/users/:id");
+    int ret = callback_rate_limit(request, response, user_data);
+    http_limiter_release(100000);
+
+    return ret;
+}
+
+/**
+ * static_headers are the constant headers the header set benchmarks add to
+ * every response.
+ */
+static const char *const static_headers[][2] = {
+    { "Content-Type", "application/json" },
+    { "Cache-Control", "no-store" },
+    { "X-Content-Type-Options", "nosniff" },
+    { "X-Frame-Options", "DENY" },
+    { "Strict-Transport-Security", "max-age=63072000; includeSubDomains" },
+    { "Referrer-Policy", "no-referrer" },
+};
+
+/**
+ * callback_headers_put adds static_headers one u_map_put at a time and
+ * renders its own Date header, as handlers did before header sets, for
+ * comparison with callback_header_set.
+ */
+static int
+callback_headers_put(const struct _u_request *request,
+                     struct _u_response *response, void *user_data)
+{
+    char date[64];
+    struct tm tm;
+    time_t now = time(NULL);
+
+    (void)request;
+    (void)user_data;
+
+    for (size_t i = 0; i < sizeof(static_headers) / sizeof(static_headers[0]); i++) {
+        u_map_put(response->map_header, static_headers[i][0], static_headers[i][1]);
+    }
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&now, &tm));
+    u_map_put(response->map_header, "Date", date);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+static void
+bench_date_strftime(void *arg, uint64_t n)
+{
+    char date[64];
+    struct tm tm;
+
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        time_t now = time(NULL);
+        size_t len = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
+            gmtime_r(&now, &tm));
+        bench_keep(len);
+    }
+}
+
+static void
+bench_date_now(void *arg, uint64_t n)
+{
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        const char *date = http_date_now();
+        bench_keep(date);
+    }
+}
+
+static void
+bench_callback(void *arg, uint64_t n)
+{
+    struct callback_bench *cb = (struct callback_bench*)arg;
+    struct _u_response response;
+
+    for (uint64_t i = 0; i < n; i++) {
+        ulfius_init_response(&response);
+        int ret = cb->callback(cb->request, &response, cb->user_data);
+        bench_keep(ret);
+        ulfius_clean_response(&response);
+    }
+}
+
+static void
+run_callback(struct bench *b, const char *name, struct _u_request *request,
+             int (*callback)(const struct _u_request *, struct _u_response *, void *),
+             void *user_data)
+{
+    struct callback_bench cb = {
+        .callback = callback,
+        .user_data = user_data,
+        .request = request,
+    };
+
+    bench_run(b, name, bench_callback, &cb, 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench b;
+
+    if (bench_init(&b, "http", argc, argv) != 0) {
+        return 1;
+    }
+
+    FILE *null_out = fopen("/dev/null", "w");
+    if (null_out == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+    s_log_init(null_out);
+    http_metrics_init();
+    http_trusted_proxy_add("10.0.0.0/8");
+
+    struct _u_request *request = request_new("/api/v1/users/12345");
+
+    bench_run(&b, "headers/http_header_value", bench_header_value, NULL, 0);
+    bench_run(&b, "headers/get_header_value", bench_get_header_value, NULL, 0);
+    bench_run(&b, "headers/http_header_value_arena", bench_header_value_arena, NULL, 0);
+    bench_run(&b, "headers/http_list_next", bench_list, NULL, 0);
+    bench_run(&b, "headers/http_header_iter", bench_header_iter, NULL,
+        sizeof(header_block) - 1);
+    bench_run(&b, "headers/http_header_id", bench_header_id, NULL, 0);
+    bench_run(&b, "headers/http_headers_index", bench_headers_index, request, 0);
+
+    run_addr(&b, "ipv4", "203.0.113.42");
+    run_addr(&b, "ipv6", "2001:db8:85a3::8a2e:370:7334");
+
+    run_callback(&b, "response/init_clean", request, callback_none, NULL);
+    run_callback(&b, "callback/request_id", request, callback_request_id, NULL);
+    run_callback(&b, "callback/route", request, callback_route,
+        "/api/v1/users/:id");
+    run_callback(&b, "callback/default", request, callback_default, NULL);
+    run_callback(&b, "callback/health_check", request, callback_health_check,
+        "0123456789abcdef");
+
+    struct http_health_check *hc =
+        http_health_check_new("0123456789abcdef", HTTP_HEALTH_CHECK_LIVENESS, 0);
+    if (hc != NULL) {
+        run_callback(&b, "callback/health_check_cached", request,
+            callback_health_check_cached, hc);
+        http_health_check_free(hc);
+    }
+
+    run_callback(&b, "callback/log_request", request, callback_log_request, NULL);
+    log_request_set_sample_rate(100);
+    run_callback(&b, "callback/log_request_sampled", request,
+        callback_log_request, NULL);
+    log_request_set_sample_rate(1);
+
+    struct http_limit_config config = {
+        .client_rate = 1e9,
+        .client_burst = 1000000,
+        .route_rate = 1e9,
+        .route_burst = 1000000,
+        .max_in_flight = 1024,
+        .idle_secs = 60,
+        .max_buckets = 4096,
+    };
+    struct http_limiter *limiter = http_limiter_new(&config);
+    if (limiter != NULL) {
+        run_callback(&b, "callback/rate_limit", request, callback_rate_limited,
+            limiter);
+        http_limiter_free(limiter);
+    }
+
+    run_callback(&b, "callback/metrics", request, callback_metrics, NULL);
+
+    bench_run(&b, "date/strftime", bench_date_strftime, NULL, 0);
+    bench_run(&b, "date/http_date_now", bench_date_now, NULL, 0);
+    run_callback(&b, "headers/u_map_put", request, callback_headers_put, NULL);
+    struct http_header_set *set = http_header_set_new(1);
+    if (set != NULL) {
+        for (size_t i = 0; i < sizeof(static_headers) / sizeof(static_headers[0]); i++) {
+            http_header_set_add(set, static_headers[i][0], static_headers[i][1]);
+        }
+        run_callback(&b, "headers/header_set", request, callback_header_set, set);
+        http_header_set_free(set);
+    }
+
+    request_free(request);
+    fclose(null_out);
+
+    return bench_finish(&b);
+}
@@ -0,0 +1,225 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * bench_json compares the streaming JSON writer with building a jansson tree
+ * and dumping it, the way handlers did before, on list responses of about
+ * 1 KB, 100 KB and 10 MB. Each operation produces the whole body from
+ * scratch, including allocating and freeing its buffer, as a handler would
+ * for each request. The jansson runs are only built when jansson is found.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef BENCH_HAVE_JANSSON
+#include <jansson.h>
+#endif
+
+#include "bench.h"
+#include "json_writer.h"
+
+static const char *const names[] = {
+    "Ada Lovelace", "Grace Hopper", "Alan Turing", "Edsger Dijkstra",
+    "Barbara Liskov", "Donald Knuth", "Frances Allen", "Ken Thompson",
+};
+
+static const char *const emails[] = {
+    "ada@example.com", "grace@example.com", "alan@example.com",
+    "edsger@example.com", "barbara@example.com", "donald@example.com",
+    "frances@example.com", "ken@example.com",
+};
+
+/**
+ * payload is a list response of count users.
+ */
+struct payload {
+    size_t count;
+    size_t bytes;
+};
+
+static const struct http_json_key key_users = HTTP_JSON_KEY("users");
+static const struct http_json_key key_count = HTTP_JSON_KEY("count");
+static const struct http_json_key key_id = HTTP_JSON_KEY("id");
+static const struct http_json_key key_name = HTTP_JSON_KEY("name");
+static const struct http_json_key key_email = HTTP_JSON_KEY("email");
+static const struct http_json_key key_active = HTTP_JSON_KEY("active");
+static const struct http_json_key key_score = HTTP_JSON_KEY("score");
+static const struct http_json_key key_tags = HTTP_JSON_KEY("tags");
+
+static void
+write_user(struct http_json *w, const size_t i)
+{
+    http_json_object_begin(w);
+    http_json_key_pre(w, &key_id);
+    http_json_uint(w, 100000 + i);
+    http_json_key_pre(w, &key_name);
+    http_json_string(w, names[i & 7]);
+    http_json_key_pre(w, &key_email);
+    http_json_string(w, emails[i & 7]);
+    http_json_key_pre(w, &key_active);
+    http_json_bool(w, i & 1);
+    http_json_key_pre(w, &key_score);
+    http_json_double(w, (double)i * 0.25);
+    http_json_key_pre(w, &key_tags);
+    http_json_array_begin(w);
+    http_json_string(w, "admin");
+    http_json_string(w, "beta");
+    http_json_array_end(w);
+    http_json_object_end(w);
+}
+
+static void
+write_payload(struct http_json *w, const size_t count)
+{
+    http_json_object_begin(w);
+    http_json_key_pre(w, &key_users);
+    http_json_array_begin(w);
+    for (size_t i = 0; i < count; i++) {
+        write_user(w, i);
+    }
+    http_json_array_end(w);
+    http_json_key_pre(w, &key_count);
+    http_json_uint(w, count);
+    http_json_object_end(w);
+}
+
+/**
+ * payload_init sizes the payload to about target bytes.
+ */
+static void
+payload_init(struct payload *p, const size_t target)
+{
+    struct http_json w;
+
+    http_json_init(&w, 0);
+    write_payload(&w, 1);
+    size_t one = w.len;
+    http_json_reset(&w);
+    write_payload(&w, 2);
+    size_t item = w.len - one;
+
+    p->count = target > one ? (target - one) / item + 1 : 1;
+    http_json_reset(&w);
+    write_payload(&w, p->count);
+    p->bytes = w.len;
+    http_json_free(&w);
+}
+
+static void
+bench_writer(void *arg, uint64_t n)
+{
+    const struct payload *p = (const struct payload*)arg;
+    struct http_json w;
+
+    for (uint64_t i = 0; i < n; i++) {
+        http_json_init(&w, 0);
+        write_payload(&w, p->count);
+        bench_keep(w.buf);
+        http_json_free(&w);
+    }
+}
+
+#ifdef BENCH_HAVE_JANSSON
+static json_t*
+jansson_payload(const size_t count)
+{
+    json_t *users = json_array();
+    for (size_t i = 0; i < count; i++) {
+        json_t *user = json_object();
+        json_object_set_new(user, "id", json_integer((json_int_t)(100000 + i)));
+        json_object_set_new(user, "name", json_string(names[i & 7]));
+        json_object_set_new(user, "email", json_string(emails[i & 7]));
+        json_object_set_new(user, "active", json_boolean(i & 1));
+        json_object_set_new(user, "score", json_real((double)i * 0.25));
+        json_t *tags = json_array();
+        json_array_append_new(tags, json_string("admin"));
+        json_array_append_new(tags, json_string("beta"));
+        json_object_set_new(user, "tags", tags);
+        json_array_append_new(users, user);
+    }
+
+    json_t *root = json_object();
+    json_object_set_new(root, "users", users);
+    json_object_set_new(root, "count", json_integer((json_int_t)count));
+
+    return root;
+}
+
+/**
+ * bench_jansson builds the tree and serializes it compactly, as
+ * ulfius_set_json_body_response does, then frees both.
+ */
+static void
+bench_jansson(void *arg, uint64_t n)
+{
+    const struct payload *p = (const struct payload*)arg;
+
+    for (uint64_t i = 0; i < n; i++) {
+        json_t *root = jansson_payload(p->count);
+        char *body = json_dumps(root, JSON_COMPACT);
+        bench_keep(body);
+        free(body);
+        json_decref(root);
+    }
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        size_t bytes;
+    } sizes[] = {
+        { "1KB", 1024 },
+        { "100KB", 100 * 1024 },
+        { "10MB", 10 * 1024 * 1024 },
+    };
+    struct bench b;
+
+    if (bench_init(&b, "json", argc, argv) != 0) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct payload p;
+        char name[64];
+
+        payload_init(&p, sizes[i].bytes);
+        snprintf(name, sizeof(name), "writer/%s", sizes[i].name);
+        bench_run(&b, name, bench_writer, &p, (double)p.bytes);
+#ifdef BENCH_HAVE_JANSSON
+        snprintf(name, sizeof(name), "jansson/%s", sizes[i].name);
+        bench_run(&b, name, bench_jansson, &p, (double)p.bytes);
+#endif
+    }
+
+    return bench_finish(&b);
+}
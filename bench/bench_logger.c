@@ -0,0 +1,341 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * bench_logger measures building log fields and writing entries through
+ * each of the logger's output modes. Entries are the fields log_request
+ * writes for a typical request, written to /dev/null, or to segment files
+ * in $TMPDIR for the file sink, so the numbers are the logger's own cost
+ * rather than the disk's. When jansson is available, "reallog/jansson"
+ * writes the same entry the way reallog did before it had its own writer,
+ * building a json_t object and dumping it, as a baseline for "reallog/json".
+ * "reallog/json" and "reallog/binary" also report the size of the entry in
+ * each format as bytes_per_op.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BENCH_HAVE_JANSSON
+#include <jansson.h>
+#endif
+
+#include "bench.h"
+#include "logger.h"
+
+static struct s_log_field_t sink[4];
+
+#define BENCH_FIELD(fn, value)                                      \
+    static void                                                     \
+    bench_##fn(void *arg, uint64_t n)                               \
+    {                                                               \
+        (void)arg;                                                  \
+        for (uint64_t i = 0; i < n; i++) {                          \
+            sink[i & 3] = fn("key", value);                         \
+            bench_keep(&sink[i & 3]);                               \
+        }                                                           \
+    }
+
+BENCH_FIELD(s_log_int, (int)i)
+BENCH_FIELD(s_log_int8, (int8_t)i)
+BENCH_FIELD(s_log_int16, (int16_t)i)
+BENCH_FIELD(s_log_int32, (int32_t)i)
+BENCH_FIELD(s_log_int64, (int64_t)i)
+BENCH_FIELD(s_log_uint, (unsigned int)i)
+BENCH_FIELD(s_log_uint8, (uint8_t)i)
+BENCH_FIELD(s_log_uint16, (uint16_t)i)
+BENCH_FIELD(s_log_uint32, (uint32_t)i)
+BENCH_FIELD(s_log_uint64, (uint64_t)i)
+BENCH_FIELD(s_log_float, (float)i)
+BENCH_FIELD(s_log_double, (double)i)
+BENCH_FIELD(s_log_string, "value")
+
+/**
+ * log_request_line writes the entry log_request does for a typical request.
+ */
+static void
+log_request_line(const uint64_t i)
+{
+    s_log(S_LOG_INFO,
+        s_log_string("method", "GET"),
+        s_log_string("path", "/api/v1/users/12345/orders"),
+        s_log_uint32("status", 200),
+        s_log_string("proto", "HTTP/1.1"),
+        s_log_double("duration", 0.25 + (double)(i & 7) * 0.125),
+        s_log_string("client_addr", "203.0.113.42"),
+        s_log_string("user-agent",
+            "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0"));
+}
+
+static void
+bench_reallog(void *arg, uint64_t n)
+{
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        log_request_line(i);
+    }
+}
+
+#ifdef BENCH_HAVE_JANSSON
+/**
+ * jansson_value makes the json_t node for a field's value.
+ */
+static json_t*
+jansson_value(const struct s_log_field_t *f)
+{
+    switch (f->type) {
+        case S_LOG_INT:    return json_integer(f->int_value);
+        case S_LOG_INT8:   return json_integer(f->int8_value);
+        case S_LOG_INT16:  return json_integer(f->int16_value);
+        case S_LOG_INT32:  return json_integer(f->int32_value);
+        case S_LOG_INT64:  return json_integer(f->int64_value);
+        case S_LOG_UINT:   return json_integer(f->uint_value);
+        case S_LOG_UINT8:  return json_integer(f->uint8_value);
+        case S_LOG_UINT16: return json_integer(f->uint16_value);
+        case S_LOG_UINT32: return json_integer(f->uint32_value);
+        case S_LOG_UINT64: return json_integer((json_int_t)f->uint64_value);
+        case S_LOG_FLOAT:  return json_real(f->float_value);
+        case S_LOG_DOUBLE: return json_real(f->double_value);
+        case S_LOG_STRING: return f->string_value ? json_string(f->string_value) : json_null();
+    }
+
+    return json_null();
+}
+
+/**
+ * jansson_log writes an entry the way reallog did with jansson: one object
+ * per entry with a node for each field, dumped to out and freed.
+ */
+static void
+jansson_log(FILE *out, const char *level, const struct s_log_field_t *fields,
+            const size_t count)
+{
+    json_t *root = json_object();
+    json_object_set_new(root, "level", json_string(level));
+    json_object_set_new(root, "timestamp", json_integer((json_int_t)time(NULL)));
+    for (size_t i = 0; i < count; i++) {
+        json_object_set_new(root, fields[i].key, jansson_value(&fields[i]));
+    }
+
+    json_dumpf(root, out, JSON_INDENT(0));
+    fputc('\n', out);
+    json_decref(root);
+}
+
+static void
+bench_reallog_jansson(void *arg, uint64_t n)
+{
+    FILE *out = (FILE*)arg;
+
+    for (uint64_t i = 0; i < n; i++) {
+        struct s_log_field_t fields[] = {
+            s_log_string("method", "GET"),
+            s_log_string("path", "/api/v1/users/12345/orders"),
+            s_log_uint32("status", 200),
+            s_log_string("proto", "HTTP/1.1"),
+            s_log_double("duration", 0.25 + (double)(i & 7) * 0.125),
+            s_log_string("client_addr", "203.0.113.42"),
+            s_log_string("user-agent",
+                "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0"),
+        };
+        jansson_log(out, "info", fields, sizeof(fields) / sizeof(fields[0]));
+    }
+}
+#endif
+
+static void
+bench_reallog_escaped(void *arg, uint64_t n)
+{
+    (void)arg;
+    for (uint64_t i = 0; i < n; i++) {
+        s_log(S_LOG_INFO,
+            s_log_string("msg", "a \"quoted\" message\twith\nescapes"),
+            s_log_string("path", "C:\\Windows\\System32"),
+            s_log_uint64("n", i));
+    }
+}
+
+/**
+ * remove_segments unlinks every file in the file sink's directory. Open
+ * segments stay usable until they're closed, and unlinking them as the
+ * benchmark goes keeps it from filling the disk.
+ */
+static void
+remove_segments(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') {
+            continue;
+        }
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+static void
+bench_reallog_file(void *arg, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        log_request_line(i);
+        if ((i & 0xffff) == 0xffff) {
+            remove_segments((const char*)arg);
+        }
+    }
+}
+
+/**
+ * record_bytes returns the average size of a log_request entry in the
+ * current format, written to a temporary file after one entry that pays
+ * for any key records, so they're left out of the average.
+ */
+static double
+record_bytes(void)
+{
+    FILE *tmp = tmpfile();
+    if (tmp == NULL) {
+        return 0;
+    }
+
+    s_log_init(tmp);
+    log_request_line(0);
+    fflush(tmp);
+    long start = ftell(tmp);
+    for (uint64_t i = 0; i < 1000; i++) {
+        log_request_line(i);
+    }
+    fflush(tmp);
+    long end = ftell(tmp);
+    fclose(tmp);
+
+    return start >= 0 && end > start ? (double)(end - start) / 1000.0 : 0;
+}
+
+static int
+open_null(FILE **out)
+{
+    *out = fopen("/dev/null", "w");
+    if (*out == NULL) {
+        perror("/dev/null");
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench b;
+    FILE *null_out;
+
+    if (bench_init(&b, "logger", argc, argv) != 0 || open_null(&null_out) != 0) {
+        return 1;
+    }
+
+    bench_run(&b, "field/s_log_int", bench_s_log_int, NULL, 0);
+    bench_run(&b, "field/s_log_int8", bench_s_log_int8, NULL, 0);
+    bench_run(&b, "field/s_log_int16", bench_s_log_int16, NULL, 0);
+    bench_run(&b, "field/s_log_int32", bench_s_log_int32, NULL, 0);
+    bench_run(&b, "field/s_log_int64", bench_s_log_int64, NULL, 0);
+    bench_run(&b, "field/s_log_uint", bench_s_log_uint, NULL, 0);
+    bench_run(&b, "field/s_log_uint8", bench_s_log_uint8, NULL, 0);
+    bench_run(&b, "field/s_log_uint16", bench_s_log_uint16, NULL, 0);
+    bench_run(&b, "field/s_log_uint32", bench_s_log_uint32, NULL, 0);
+    bench_run(&b, "field/s_log_uint64", bench_s_log_uint64, NULL, 0);
+    bench_run(&b, "field/s_log_float", bench_s_log_float, NULL, 0);
+    bench_run(&b, "field/s_log_double", bench_s_log_double, NULL, 0);
+    bench_run(&b, "field/s_log_string", bench_s_log_string, NULL, 0);
+
+    double json_bytes = record_bytes();
+    s_log_set_format(S_LOG_FORMAT_BINARY);
+    double binary_bytes = record_bytes();
+    s_log_set_format(S_LOG_FORMAT_JSON);
+
+    s_log_init(null_out);
+
+    s_log_set_level(S_LOG_WARN);
+    bench_run(&b, "reallog/disabled", bench_reallog, NULL, 0);
+    s_log_set_level(S_LOG_TRACE);
+
+    bench_run(&b, "reallog/json", bench_reallog, NULL, json_bytes);
+#ifdef BENCH_HAVE_JANSSON
+    bench_run(&b, "reallog/jansson", bench_reallog_jansson, null_out, 0);
+#endif
+    bench_run(&b, "reallog/json_escaped", bench_reallog_escaped, NULL, 0);
+
+    if (bench_enabled(&b, "reallog/json_buffered")) {
+        if (s_log_init_buffered(null_out, 64 * 1024, 100) == 0) {
+            bench_run(&b, "reallog/json_buffered", bench_reallog, NULL, 0);
+            s_log_shutdown();
+        }
+    }
+
+    if (bench_enabled(&b, "reallog/json_async")) {
+        if (s_log_init_async(null_out, 4096, S_LOG_OVERFLOW_BLOCK) == 0) {
+            bench_run(&b, "reallog/json_async", bench_reallog, NULL, 0);
+            s_log_shutdown();
+        }
+    }
+
+    if (bench_enabled(&b, "reallog/json_file")) {
+        const char *tmp = getenv("TMPDIR");
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s/s_log_bench_XXXXXX", tmp ? tmp : "/tmp");
+        if (mkdtemp(dir) != NULL) {
+            char path[300];
+            snprintf(path, sizeof(path), "%s/bench.log", dir);
+            if (s_log_init_file(path, 16 << 20, 0, 0) == 0) {
+                bench_run(&b, "reallog/json_file", bench_reallog_file, dir, 0);
+                s_log_shutdown();
+            }
+            remove_segments(dir);
+            rmdir(dir);
+        }
+    }
+
+    s_log_init(null_out);
+    s_log_set_format(S_LOG_FORMAT_BINARY);
+    bench_run(&b, "reallog/binary", bench_reallog, NULL, binary_bytes);
+    s_log_set_format(S_LOG_FORMAT_JSON);
+
+    fclose(null_out);
+
+    return bench_finish(&b);
+}
@@ -0,0 +1,559 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * loadgen drives an HTTP server over loopback with keep-alive connections,
+ * one thread each, and reports throughput and latency percentiles as JSON.
+ * By default it starts an in-process ulfius server with this library's
+ * callbacks; -u points it at a server that's already running instead.
+ *
+ * In closed loop mode (the default) every connection sends its next request
+ * as soon as the last response arrives. That measures peak throughput but
+ * hides stalls, since a client stuck waiting doesn't send the requests it
+ * would have; -i gives the expected interval between requests so latencies
+ * are corrected for that the way HdrHistogram does. In open loop mode, -R,
+ * requests are sent on a fixed schedule at the given total rate and latency
+ * is measured from when each request was due, so time spent queued behind a
+ * slow response counts. service_time_us is always measured from when the
+ * request was actually sent.
+ *
+ *   loadgen -c 16 -d 10                 closed loop against /health
+ *   loadgen -c 16 -d 10 -R 20000        open loop at 20k requests/s
+ *   loadgen -u 127.0.0.1:8080 -p /api   an external server
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "http.h"
+
+#define LOADGEN_BUF 65536
+
+struct loadgen_config {
+    const char *host;
+    unsigned int port;
+    const char *path;
+    unsigned int connections;
+    double duration;
+    double warmup;
+    double rate;
+    uint64_t expected_interval_ns;
+};
+
+/**
+ * loadgen_conn is the state of a single connection and its thread.
+ */
+struct loadgen_conn {
+    const struct loadgen_config *config;
+    unsigned int index;
+    uint64_t start_ns;
+    uint64_t record_ns;
+    uint64_t end_ns;
+    int fd;
+    char request[512];
+    size_t request_len;
+    char buf[LOADGEN_BUF];
+    size_t len;
+    size_t pos;
+    uint64_t requests;
+    uint64_t errors;
+    struct bench_hist latency;
+    struct bench_hist service;
+    pthread_t thread;
+};
+
+static int
+loadgen_connect(const struct loadgen_config *config)
+{
+    struct sockaddr_in sin = { .sin_family = AF_INET };
+    sin.sin_port = htons((uint16_t)config->port);
+    if (inet_pton(AF_INET, config->host, &sin.sin_addr) != 1) {
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int
+loadgen_send(const int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/**
+ * loadgen_fill reads more of the response into the connection's buffer,
+ * first moving what's left to the front. Returns -1 if the connection
+ * failed or the buffer is full.
+ */
+static int
+loadgen_fill(struct loadgen_conn *c)
+{
+    if (c->pos > 0) {
+        memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+        c->len -= c->pos;
+        c->pos = 0;
+    }
+    if (c->len == sizeof(c->buf) - 1) {
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+        if (n > 0) {
+            c->len += (size_t)n;
+            c->buf[c->len] = '\0';
+            return 0;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+/**
+ * loadgen_line returns the next CRLF terminated line, NUL terminated in
+ * place, reading more as needed. Returns NULL on failure.
+ */
+static char*
+loadgen_line(struct loadgen_conn *c)
+{
+    char *eol;
+
+    while ((eol = memmem(c->buf + c->pos, c->len - c->pos, "\r\n", 2)) == NULL) {
+        if (loadgen_fill(c) != 0) {
+            return NULL;
+        }
+    }
+
+    char *line = c->buf + c->pos;
+    *eol = '\0';
+    c->pos = (size_t)(eol - c->buf) + 2;
+
+    return line;
+}
+
+/**
+ * loadgen_skip discards the next n bytes of the response.
+ */
+static int
+loadgen_skip(struct loadgen_conn *c, size_t n)
+{
+    for (;;) {
+        size_t have = c->len - c->pos;
+        if (have >= n) {
+            c->pos += n;
+            return 0;
+        }
+        n -= have;
+        c->pos = c->len = 0;
+        if (loadgen_fill(c) != 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * loadgen_read reads a complete response, with either a Content-Length or a
+ * chunked body, discarding the body. Returns the status code, or -1 if the
+ * connection failed or the response couldn't be parsed.
+ */
+static int
+loadgen_read(struct loadgen_conn *c)
+{
+    char *line = loadgen_line(c);
+    int status = 0;
+
+    if (line == NULL || sscanf(line, "HTTP/%*d.%*d %d", &status) != 1) {
+        return -1;
+    }
+
+    size_t length = 0;
+    int chunked = 0;
+    while ((line = loadgen_line(c)) != NULL && *line != '\0') {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = strtoul(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            chunked = strstr(line + 18, "chunked") != NULL;
+        }
+    }
+    if (line == NULL) {
+        return -1;
+    }
+
+    if (!chunked) {
+        return loadgen_skip(c, length) == 0 ? status : -1;
+    }
+
+    for (;;) {
+        if ((line = loadgen_line(c)) == NULL) {
+            return -1;
+        }
+        size_t size = strtoul(line, NULL, 16);
+        if (size == 0) {
+            // trailers, if any, up to the empty line
+            while ((line = loadgen_line(c)) != NULL && *line != '\0') {
+            }
+            return line != NULL ? status : -1;
+        }
+        if (loadgen_skip(c, size + 2) != 0) {
+            return -1;
+        }
+    }
+}
+
+static void
+loadgen_sleep_until(const uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)(ns / 1000000000ULL),
+        .tv_nsec = (long)(ns % 1000000000ULL),
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void*
+loadgen_worker(void *arg)
+{
+    struct loadgen_conn *c = (struct loadgen_conn*)arg;
+    const struct loadgen_config *config = c->config;
+
+    // in open loop mode each connection sends rate / connections requests a
+    // second, staggered so they don't all go out at once
+    uint64_t interval = config->rate > 0 ?
+        (uint64_t)(1e9 * config->connections / config->rate) : 0;
+    uint64_t due = c->start_ns + (interval * c->index) / config->connections;
+
+    c->fd = -1;
+    for (;;) {
+        if (interval > 0) {
+            loadgen_sleep_until(due);
+        } else {
+            due = bench_now_ns();
+        }
+        if (due >= c->end_ns) {
+            break;
+        }
+
+        if (c->fd < 0 && (c->fd = loadgen_connect(config)) < 0) {
+            c->errors++;
+            due += interval;
+            continue;
+        }
+
+        uint64_t sent = bench_now_ns();
+        int status = -1;
+        if (loadgen_send(c->fd, c->request, c->request_len) == 0) {
+            status = loadgen_read(c);
+        }
+        uint64_t done = bench_now_ns();
+
+        if (status < 0) {
+            close(c->fd);
+            c->fd = -1;
+            c->len = c->pos = 0;
+        }
+        if (due >= c->record_ns) {
+            if (status < 0 || status >= 500) {
+                c->errors++;
+            } else {
+                c->requests++;
+                bench_hist_record(&c->service, done - sent);
+                if (interval > 0) {
+                    bench_hist_record(&c->latency, done - due);
+                } else {
+                    bench_hist_record_corrected(&c->latency, done - sent,
+                        config->expected_interval_ns);
+                }
+            }
+        }
+
+        due += interval;
+    }
+
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+
+    return NULL;
+}
+
+static int
+callback_hello(const struct _u_request *request, struct _u_response *response,
+               void *user_data)
+{
+    (void)user_data;
+    uint64_t start = http_timer_start();
+
+    ulfius_set_string_body_response(response, 200, "hello");
+    log_request(request, response, start);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * loadgen_server starts the in-process server on the configured port.
+ */
+static int
+loadgen_server(struct _u_instance *instance, const struct loadgen_config *config)
+{
+    struct sockaddr_in bind_addr = { .sin_family = AF_INET };
+    bind_addr.sin_port = htons((uint16_t)config->port);
+    inet_pton(AF_INET, config->host, &bind_addr.sin_addr);
+
+    if (ulfius_init_instance(instance, config->port, &bind_addr, NULL) != U_OK) {
+        return -1;
+    }
+
+    ulfius_add_endpoint_by_val(instance, "GET", "/health", NULL, 0,
+        callback_health_check, "0123456789abcdef");
+    ulfius_add_endpoint_by_val(instance, "GET", "/hello", NULL, 0,
+        callback_route, "/hello");
+    ulfius_add_endpoint_by_val(instance, "GET", "/hello", NULL, 1,
+        callback_hello, NULL);
+    ulfius_add_endpoint_by_val(instance, "GET", "/metrics", NULL, 0,
+        callback_metrics, NULL);
+    ulfius_set_default_endpoint(instance, callback_default, NULL);
+
+    if (ulfius_start_framework(instance) != U_OK) {
+        ulfius_clean_instance(instance);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [-c connections] [-d seconds] [-w warmup seconds]\n"
+        "          [-R total rate] [-i expected interval us] [-p path]\n"
+        "          [-u host:port] [-P port] [-o file]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct loadgen_config config = {
+        .host = "127.0.0.1",
+        .port = 18080,
+        .path = "/health",
+        .connections = 16,
+        .duration = 10,
+        .warmup = 1,
+    };
+    int external = 0;
+    FILE *out = stdout;
+    char host[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:w:R:i:p:u:P:o:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config.connections = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                config.duration = strtod(optarg, NULL);
+                break;
+            case 'w':
+                config.warmup = strtod(optarg, NULL);
+                break;
+            case 'R':
+                config.rate = strtod(optarg, NULL);
+                break;
+            case 'i':
+                config.expected_interval_ns = strtoull(optarg, NULL, 10) * 1000;
+                break;
+            case 'p':
+                config.path = optarg;
+                break;
+            case 'u': {
+                const char *colon = strrchr(optarg, ':');
+                if (colon == NULL || (size_t)(colon - optarg) >= sizeof(host)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                memcpy(host, optarg, (size_t)(colon - optarg));
+                host[colon - optarg] = '\0';
+                config.host = host;
+                config.port = (unsigned int)strtoul(colon + 1, NULL, 10);
+                external = 1;
+                break;
+            }
+            case 'P':
+                config.port = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (out == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (config.connections == 0 || config.duration <= 0 || config.warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct _u_instance instance;
+    FILE *null_out = NULL;
+    if (!external) {
+        null_out = fopen("/dev/null", "w");
+        s_log_init(null_out != NULL ? null_out : stderr);
+        http_metrics_init();
+        if (loadgen_server(&instance, &config) != 0) {
+            fprintf(stderr, "couldn't start the server on port %u\n", config.port);
+            return 1;
+        }
+    }
+
+    struct loadgen_conn *conns = (struct loadgen_conn*)calloc(config.connections,
+        sizeof(struct loadgen_conn));
+    if (conns == NULL) {
+        return 1;
+    }
+
+    uint64_t start = bench_now_ns() + 10000000ULL;
+    uint64_t record = start + (uint64_t)(config.warmup * 1e9);
+    uint64_t end = record + (uint64_t)(config.duration * 1e9);
+
+    for (unsigned int i = 0; i < config.connections; i++) {
+        struct loadgen_conn *c = &conns[i];
+        c->config = &config;
+        c->index = i;
+        c->start_ns = start;
+        c->record_ns = record;
+        c->end_ns = end;
+        c->request_len = (size_t)snprintf(c->request, sizeof(c->request),
+            "GET %s HTTP/1.1\r\nHost: %s:%u\r\n"
+            "User-Agent: loadgen\r\nAccept: */*\r\n\r\n",
+            config.path, config.host, config.port);
+        bench_hist_init(&c->latency);
+        bench_hist_init(&c->service);
+        if (pthread_create(&c->thread, NULL, loadgen_worker, c) != 0) {
+            fprintf(stderr, "couldn't start connection %u\n", i);
+            return 1;
+        }
+    }
+
+    struct bench_hist *latency = (struct bench_hist*)malloc(sizeof(struct bench_hist));
+    struct bench_hist *service = (struct bench_hist*)malloc(sizeof(struct bench_hist));
+    if (latency == NULL || service == NULL) {
+        return 1;
+    }
+    bench_hist_init(latency);
+    bench_hist_init(service);
+
+    uint64_t requests = 0, errors = 0;
+    for (unsigned int i = 0; i < config.connections; i++) {
+        pthread_join(conns[i].thread, NULL);
+        bench_hist_merge(latency, &conns[i].latency);
+        bench_hist_merge(service, &conns[i].service);
+        requests += conns[i].requests;
+        errors += conns[i].errors;
+    }
+    // an open loop run that fell behind keeps going until it has sent every
+    // request that was due, so throughput is over the time actually taken
+    double elapsed = (double)(bench_now_ns() - record) / 1e9;
+
+    fprintf(out, "{\"suite\":\"loadgen\",\"target\":\"%s:%u\",\"path\":\"%s\","
+        "\"mode\":\"%s\",\"connections\":%u,\"duration_s\":%.2f,"
+        "\"target_rate\":%.1f,\"expected_interval_us\":%.1f,"
+        "\"requests\":%llu,\"errors\":%llu,\"throughput_rps\":%.1f,"
+        "\"latency_us\":",
+        config.host, config.port, config.path,
+        config.rate > 0 ? "open" : "closed", config.connections, elapsed,
+        config.rate, (double)config.expected_interval_ns / 1e3,
+        (unsigned long long)requests, (unsigned long long)errors,
+        elapsed > 0 ? (double)requests / elapsed : 0.0);
+    bench_hist_json(out, latency);
+    fputs(",\"service_time_us\":", out);
+    bench_hist_json(out, service);
+    fputs("}\n", out);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (!external) {
+        ulfius_stop_framework(&instance);
+        ulfius_clean_instance(&instance);
+        if (null_out != NULL) {
+            fclose(null_out);
+        }
+    }
+
+    free(latency);
+    free(service);
+    free(conns);
+
+    return 0;
+}
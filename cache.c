@@ -0,0 +1,759 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "cache.h"
+#include "compress.h"
+#include "http.h"
+
+/**
+ * http_cache_entry_t is a cached response. Entries are chained in their hash
+ * bucket and linked into their shard's CLOCK ring. They're reference counted
+ * so a hit can copy the response out without holding the shard lock, and the
+ * key and body live in the same allocation as the entry.
+ */
+struct http_cache_entry_t {
+    uint64_t hash;
+    uint64_t expires;
+    time_t stored;
+    time_t last_modified;
+    long status;
+    int refs;
+    uint8_t referenced;
+    size_t size;
+    const char *etag;
+    struct _u_map headers;
+    char *key;
+    size_t key_len;
+    char *body;
+    size_t body_len;
+    struct http_cache_entry_t *chain;
+    struct http_cache_entry_t *prev;
+    struct http_cache_entry_t *next;
+};
+
+/**
+ * http_cache_shard_t is a hash table of entries under its own lock. Lookups
+ * only take the read lock, marking the entry referenced, and the CLOCK hand
+ * skips referenced entries once, clearing the mark, when it needs room.
+ */
+struct http_cache_shard_t {
+    pthread_rwlock_t lock;
+    struct http_cache_entry_t **buckets;
+    size_t mask;
+    struct http_cache_entry_t *hand;
+    size_t bytes;
+    size_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct http_cache {
+    struct http_cache_shard_t shards[HTTP_CACHE_SHARDS];
+    unsigned int default_ttl;
+    size_t vary_count;
+    char *vary[HTTP_CACHE_MAX_VARY];
+    char *vary_header;
+    struct http_compress *compress;
+};
+
+/**
+ * HTTP_CACHE_ABSENT marks a vary header the request didn't have, so it keys
+ * differently from one that's present but empty.
+ */
+#define HTTP_CACHE_ABSENT '\1'
+
+static uint64_t
+http_cache_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec;
+}
+
+/**
+ * http_cache_hash is 64 bit FNV-1a.
+ */
+static uint64_t
+http_cache_hash(const char *data, const size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+struct http_cache*
+http_cache_new(const size_t max_bytes, const unsigned int default_ttl,
+               const char *const *vary, const size_t vary_count)
+{
+    if (max_bytes == 0 || vary_count > HTTP_CACHE_MAX_VARY) {
+        return NULL;
+    }
+
+    struct http_cache *cache = calloc(1, sizeof(struct http_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->default_ttl = default_ttl;
+
+    size_t header_len = 0;
+    for (size_t i = 0; i < vary_count; i++) {
+        cache->vary[i] = strdup(vary[i]);
+        if (cache->vary[i] == NULL) {
+            http_cache_free(cache);
+            return NULL;
+        }
+        cache->vary_count++;
+        header_len += strlen(vary[i]) + 2;
+    }
+    if (vary_count > 0) {
+        cache->vary_header = calloc(1, header_len + 1);
+        if (cache->vary_header == NULL) {
+            http_cache_free(cache);
+            return NULL;
+        }
+        for (size_t i = 0; i < vary_count; i++) {
+            if (i > 0) {
+                strcat(cache->vary_header, ", ");
+            }
+            strcat(cache->vary_header, vary[i]);
+        }
+    }
+
+    // assume entries of a few KB when sizing the tables
+    size_t per_shard = max_bytes / HTTP_CACHE_SHARDS;
+    size_t buckets = 64;
+    while (buckets < per_shard / 2048) {
+        buckets <<= 1;
+    }
+
+    for (int i = 0; i < HTTP_CACHE_SHARDS; i++) {
+        pthread_rwlock_init(&cache->shards[i].lock, NULL);
+    }
+    for (int i = 0; i < HTTP_CACHE_SHARDS; i++) {
+        struct http_cache_shard_t *shard = &cache->shards[i];
+
+        shard->capacity = per_shard;
+        shard->mask = buckets - 1;
+        shard->buckets = calloc(buckets, sizeof(struct http_cache_entry_t *));
+        if (shard->buckets == NULL) {
+            http_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+static void
+http_cache_entry_release(struct http_cache_entry_t *entry)
+{
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        u_map_clean(&entry->headers);
+        free(entry);
+    }
+}
+
+void
+http_cache_free(struct http_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < HTTP_CACHE_SHARDS; i++) {
+        struct http_cache_shard_t *shard = &cache->shards[i];
+
+        while (shard->hand != NULL) {
+            struct http_cache_entry_t *e = shard->hand;
+            shard->hand = e->next != e ? e->next : NULL;
+            e->prev->next = e->next;
+            e->next->prev = e->prev;
+            http_cache_entry_release(e);
+        }
+        free(shard->buckets);
+        pthread_rwlock_destroy(&shard->lock);
+    }
+    for (size_t i = 0; i < cache->vary_count; i++) {
+        free(cache->vary[i]);
+    }
+    free(cache->vary_header);
+
+    free(cache);
+}
+
+void
+http_cache_set_compress(struct http_cache *cache, struct http_compress *compress)
+{
+    cache->compress = compress;
+}
+
+void
+http_cache_stats(struct http_cache *cache, uint64_t *hits, uint64_t *misses, size_t *bytes)
+{
+    *hits = 0;
+    *misses = 0;
+    *bytes = 0;
+
+    for (int i = 0; cache != NULL && i < HTTP_CACHE_SHARDS; i++) {
+        struct http_cache_shard_t *shard = &cache->shards[i];
+
+        *hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        *misses += __atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+        pthread_rwlock_rdlock(&shard->lock);
+        *bytes += shard->bytes;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+/**
+ * http_cache_key builds the key for the given request into buf, which holds
+ * len bytes: the method, with HEAD served from GET, the URL and the values
+ * of the vary headers, NUL separated. Returns the key length, which may be
+ * more than len, in which case nothing useful was written.
+ */
+static size_t
+http_cache_key(const struct http_cache *cache, const struct _u_request *request,
+               char *buf, const size_t len)
+{
+    const char *parts[HTTP_CACHE_MAX_VARY + 1];
+    size_t total = 4;
+
+    parts[0] = request->http_url != NULL ? request->http_url : "";
+    total += strlen(parts[0]) + 1;
+    for (size_t i = 0; i < cache->vary_count; i++) {
+        parts[i + 1] = u_map_get_case(request->map_header, cache->vary[i]);
+        total += (parts[i + 1] != NULL ? strlen(parts[i + 1]) : 1) + 1;
+    }
+    if (total > len) {
+        return total;
+    }
+
+    char *p = buf;
+    memcpy(p, "GET", 4);
+    p += 4;
+    for (size_t i = 0; i <= cache->vary_count; i++) {
+        if (parts[i] == NULL) {
+            *p++ = HTTP_CACHE_ABSENT;
+        } else {
+            size_t n = strlen(parts[i]);
+            memcpy(p, parts[i], n);
+            p += n;
+        }
+        *p++ = '\0';
+    }
+
+    return total;
+}
+
+/**
+ * http_cache_find returns the entry for the given key, or NULL. The shard
+ * lock must be held.
+ */
+static struct http_cache_entry_t*
+http_cache_find(struct http_cache_shard_t *shard, const uint64_t hash,
+                const char *key, const size_t key_len)
+{
+    for (struct http_cache_entry_t *e = shard->buckets[hash & shard->mask]; e != NULL; e = e->chain) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * http_cache_unlink removes the given entry from its bucket and the CLOCK
+ * ring. The shard write lock must be held. The cache's reference is left for
+ * the caller to release.
+ */
+static void
+http_cache_unlink(struct http_cache_shard_t *shard, struct http_cache_entry_t *entry)
+{
+    struct http_cache_entry_t **p = &shard->buckets[entry->hash & shard->mask];
+    while (*p != entry) {
+        p = &(*p)->chain;
+    }
+    *p = entry->chain;
+
+    if (entry->next == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+        if (shard->hand == entry) {
+            shard->hand = entry->next;
+        }
+    }
+
+    shard->bytes -= entry->size;
+}
+
+/**
+ * http_cache_evict advances the CLOCK hand to the first entry that's expired
+ * or hasn't been used since the hand last passed it, and unlinks it. The
+ * shard write lock must be held.
+ */
+static struct http_cache_entry_t*
+http_cache_evict(struct http_cache_shard_t *shard, const uint64_t now)
+{
+    struct http_cache_entry_t *e = shard->hand;
+
+    while (__atomic_load_n(&e->referenced, __ATOMIC_RELAXED) && e->expires > now) {
+        __atomic_store_n(&e->referenced, 0, __ATOMIC_RELAXED);
+        e = e->next;
+    }
+    http_cache_unlink(shard, e);
+
+    return e;
+}
+
+/**
+ * http_cache_request_no_cache checks whether the request asks for a fresh
+ * response with Cache-Control no-cache or max-age=0, or Pragma: no-cache.
+ */
+static int
+http_cache_request_no_cache(const struct _u_request *request, int *no_store)
+{
+    const char *cc = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_CACHE_CONTROL);
+    struct http_list_iter it;
+    struct http_slice elem;
+    int no_cache = 0;
+
+    *no_store = 0;
+    if (cc == NULL) {
+        const char *pragma = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_PRAGMA);
+        return pragma != NULL && strcasecmp(pragma, "no-cache") == 0;
+    }
+
+    http_list_init(&it, cc, strlen(cc));
+    while (http_list_next(&it, &elem)) {
+        if (http_slice_equal(&elem, "no-cache") || http_slice_equal(&elem, "max-age=0")) {
+            no_cache = 1;
+        } else if (http_slice_equal(&elem, "no-store")) {
+            no_cache = 1;
+            *no_store = 1;
+        }
+    }
+
+    return no_cache;
+}
+
+/**
+ * http_cache_etag_equal compares 2 entity tags with the weak comparison
+ * If-None-Match uses, RFC 7232 2.3.2.
+ */
+static int
+http_cache_etag_equal(struct http_slice a, const char *b)
+{
+    size_t b_len = strlen(b);
+
+    if (a.len >= 2 && a.ptr[0] == 'W' && a.ptr[1] == '/') {
+        a.ptr += 2;
+        a.len -= 2;
+    }
+    if (b_len >= 2 && b[0] == 'W' && b[1] == '/') {
+        b += 2;
+        b_len -= 2;
+    }
+
+    return a.len == b_len && memcmp(a.ptr, b, b_len) == 0;
+}
+
+/**
+ * http_cache_not_modified checks the request's preconditions against the
+ * given entry, RFC 7232 6. If-Modified-Since is ignored when If-None-Match
+ * is present.
+ */
+static int
+http_cache_not_modified(const struct _u_request *request, const struct http_cache_entry_t *entry)
+{
+    const char *inm = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_NONE_MATCH);
+    if (inm != NULL) {
+        struct http_list_iter it;
+        struct http_slice elem;
+
+        http_list_init(&it, inm, strlen(inm));
+        while (http_list_next(&it, &elem)) {
+            if ((elem.len == 1 && elem.ptr[0] == '*') ||
+                (entry->etag != NULL && http_cache_etag_equal(elem, entry->etag))) {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    const char *ims = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_MODIFIED_SINCE);
+    time_t since;
+    if (ims != NULL && entry->last_modified != (time_t)-1 &&
+        http_date_parse(ims, &since) == 0 && entry->last_modified <= since) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * http_cache_validators are the headers sent with a 304, RFC 7232 4.1.
+ */
+static const char *http_cache_validators[] = {
+    HTTP_RESPONSE_HEADER_CACHE_CONTROL,
+    HTTP_RESPONSE_HEADER_ETAG,
+    HTTP_RESPONSE_HEADER_EXPIRES,
+    HTTP_RESPONSE_HEADER_LAST_MODIFIED,
+    HTTP_RESPONSE_HEADER_VARY,
+};
+
+/**
+ * http_cache_respond fills in the response from the given entry, as a 304
+ * if not_modified is set.
+ */
+static void
+http_cache_respond(struct _u_response *response, const struct http_cache_entry_t *entry,
+                   const int not_modified)
+{
+    if (not_modified) {
+        for (size_t i = 0; i < sizeof(http_cache_validators) / sizeof(http_cache_validators[0]); i++) {
+            const char *value = u_map_get_case(&entry->headers, http_cache_validators[i]);
+            if (value != NULL) {
+                u_map_put(response->map_header, http_cache_validators[i], value);
+            }
+        }
+        ulfius_set_empty_body_response(response, HTTP_STATUS_CODE_NOT_MODIFIED);
+        return;
+    }
+
+    for (int i = 0; i < entry->headers.nb_values; i++) {
+        u_map_put(response->map_header, entry->headers.keys[i], entry->headers.values[i]);
+    }
+    ulfius_set_binary_body_response(response, (unsigned int)entry->status,
+        entry->body, entry->body_len);
+
+    char age[24];
+    time_t now = time(NULL);
+    snprintf(age, sizeof(age), "%lld",
+        (long long)(now > entry->stored ? now - entry->stored : 0));
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_AGE, age);
+}
+
+int
+callback_cache_lookup(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    struct http_cache *cache = (struct http_cache*)user_data;
+    uint64_t start = http_timer_start();
+
+    if (cache == NULL || request->http_verb == NULL ||
+        (strcmp(request->http_verb, HTTP_METHOD_GET) != 0 &&
+         strcmp(request->http_verb, HTTP_METHOD_HEAD) != 0)) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    int no_store;
+    if (http_cache_request_no_cache(request, &no_store)) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    char stack[512];
+    char *key = stack;
+    size_t key_len = http_cache_key(cache, request, stack, sizeof(stack));
+    if (key_len > sizeof(stack)) {
+        key = malloc(key_len);
+        if (key == NULL) {
+            return U_CALLBACK_CONTINUE;
+        }
+        http_cache_key(cache, request, key, key_len);
+    }
+
+    uint64_t hash = http_cache_hash(key, key_len);
+    struct http_cache_shard_t *shard = &cache->shards[(hash >> 56) % HTTP_CACHE_SHARDS];
+
+    pthread_rwlock_rdlock(&shard->lock);
+    struct http_cache_entry_t *entry = http_cache_find(shard, hash, key, key_len);
+    if (entry != NULL && entry->expires > http_cache_now()) {
+        __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        entry = NULL;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (key != stack) {
+        free(key);
+    }
+
+    if (entry == NULL) {
+        __atomic_add_fetch(&shard->misses, 1, __ATOMIC_RELAXED);
+        return U_CALLBACK_CONTINUE;
+    }
+    __atomic_add_fetch(&shard->hits, 1, __ATOMIC_RELAXED);
+
+    int not_modified = http_cache_not_modified(request, entry);
+    http_cache_respond(response, entry, not_modified);
+    http_cache_entry_release(entry);
+
+    // the handler chain stops here so callback_compress won't run
+    if (!not_modified && cache->compress != NULL) {
+        http_compress_response(cache->compress, request, response);
+    }
+
+    log_request(request, response, start);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+/**
+ * http_cache_ttl works out how long the response can be cached for from its
+ * Cache-Control header. Returns -1 if it can't be cached.
+ */
+static long
+http_cache_ttl(const struct http_cache *cache, const struct _u_request *request,
+               const struct _u_response *response)
+{
+    const char *cc = u_map_get_case(response->map_header, HTTP_RESPONSE_HEADER_CACHE_CONTROL);
+    long max_age = -1;
+    long s_maxage = -1;
+    int public = 0;
+
+    if (cc != NULL) {
+        struct http_list_iter it;
+        struct http_slice elem;
+
+        http_list_init(&it, cc, strlen(cc));
+        while (http_list_next(&it, &elem)) {
+            if (http_slice_equal(&elem, "no-store") || http_slice_equal(&elem, "no-cache") ||
+                http_slice_equal(&elem, "private")) {
+                return -1;
+            } else if (http_slice_equal(&elem, "public")) {
+                public = 1;
+            } else if (elem.len > 8 && strncasecmp(elem.ptr, "max-age=", 8) == 0) {
+                max_age = strtol(elem.ptr + 8, NULL, 10);
+            } else if (elem.len > 9 && strncasecmp(elem.ptr, "s-maxage=", 9) == 0) {
+                s_maxage = strtol(elem.ptr + 9, NULL, 10);
+            }
+        }
+    }
+
+    // shared caches can only keep authenticated responses they're told to,
+    // RFC 7234 3.2
+    if (u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_AUTHORIZATION) != NULL &&
+        !public && s_maxage < 0) {
+        return -1;
+    }
+
+    long ttl = s_maxage >= 0 ? s_maxage : max_age >= 0 ? max_age : (long)cache->default_ttl;
+
+    return ttl > 0 ? ttl : -1;
+}
+
+/**
+ * http_cache_storable checks the parts of the response besides its
+ * Cache-Control header that decide whether it can be cached.
+ */
+static int
+http_cache_storable(const struct http_cache *cache, const struct _u_response *response)
+{
+    switch (response->status) {
+    case HTTP_STATUS_CODE_OK:
+    case HTTP_STATUS_CODE_NONAUTHORITATIVE_INFO:
+    case HTTP_STATUS_CODE_MULTIPLE_CHOICES:
+    case HTTP_STATUS_CODE_MOVED_PERMANENTLY:
+    case HTTP_STATUS_CODE_NOT_FOUND:
+    case HTTP_STATUS_CODE_GONE:
+        break;
+    default:
+        return 0;
+    }
+
+    if (response->stream_callback != NULL || response->nb_cookies > 0 ||
+        u_map_has_key_case(response->map_header, HTTP_RESPONSE_HEADER_SET_COOKIE)) {
+        return 0;
+    }
+
+    // the response can't vary on anything the key doesn't
+    const char *vary = u_map_get_case(response->map_header, HTTP_RESPONSE_HEADER_VARY);
+    if (vary != NULL) {
+        struct http_list_iter it;
+        struct http_slice elem;
+
+        http_list_init(&it, vary, strlen(vary));
+        while (http_list_next(&it, &elem)) {
+            size_t i = 0;
+            while (i < cache->vary_count && !http_slice_equal(&elem, cache->vary[i])) {
+                i++;
+            }
+            if (i == cache->vary_count) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int
+callback_cache_store(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    struct http_cache *cache = (struct http_cache*)user_data;
+
+    if (cache == NULL || request->http_verb == NULL ||
+        strcmp(request->http_verb, HTTP_METHOD_GET) != 0 ||
+        !http_cache_storable(cache, response)) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    int no_store;
+    http_cache_request_no_cache(request, &no_store);
+    long ttl = http_cache_ttl(cache, request, response);
+    if (no_store || ttl < 0) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    if (cache->vary_header != NULL &&
+        !u_map_has_key_case(response->map_header, HTTP_RESPONSE_HEADER_VARY)) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_VARY, cache->vary_header);
+    }
+    if (!u_map_has_key_case(response->map_header, HTTP_RESPONSE_HEADER_ETAG)) {
+        char etag[24];
+        snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)
+            http_cache_hash(response->binary_body, response->binary_body_length));
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_ETAG, etag);
+    }
+
+    size_t key_len = http_cache_key(cache, request, NULL, 0);
+    size_t body_len = response->binary_body_length;
+    struct http_cache_entry_t *entry = malloc(sizeof(struct http_cache_entry_t) + key_len + body_len);
+    if (entry == NULL) {
+        return U_CALLBACK_CONTINUE;
+    }
+    memset(entry, 0, sizeof(struct http_cache_entry_t));
+    entry->key = (char*)(entry + 1);
+    entry->key_len = http_cache_key(cache, request, entry->key, key_len);
+    entry->body = entry->key + key_len;
+    entry->body_len = body_len;
+    if (body_len > 0) {
+        memcpy(entry->body, response->binary_body, body_len);
+    }
+
+    if (u_map_init(&entry->headers) != U_OK ||
+        u_map_copy_into(&entry->headers, response->map_header) != U_OK) {
+        u_map_clean(&entry->headers);
+        free(entry);
+        return U_CALLBACK_CONTINUE;
+    }
+    // Date and Age are set per response
+    u_map_remove_from_key_case(&entry->headers, HTTP_RESPONSE_HEADER_DATE);
+    u_map_remove_from_key_case(&entry->headers, HTTP_RESPONSE_HEADER_AGE);
+
+    entry->hash = http_cache_hash(entry->key, entry->key_len);
+    entry->status = response->status;
+    entry->stored = time(NULL);
+    entry->expires = http_cache_now() + (uint64_t)ttl;
+    entry->etag = u_map_get_case(&entry->headers, HTTP_RESPONSE_HEADER_ETAG);
+    entry->last_modified = (time_t)-1;
+    const char *lm = u_map_get_case(&entry->headers, HTTP_RESPONSE_HEADER_LAST_MODIFIED);
+    if (lm != NULL && http_date_parse(lm, &entry->last_modified) != 0) {
+        entry->last_modified = (time_t)-1;
+    }
+    entry->size = sizeof(struct http_cache_entry_t) + key_len + body_len;
+    for (int i = 0; i < entry->headers.nb_values; i++) {
+        entry->size += strlen(entry->headers.keys[i]) + entry->headers.lengths[i];
+    }
+    // one reference for the cache and one held until we're done with it here
+    entry->refs = 2;
+
+    struct http_cache_shard_t *shard = &cache->shards[(entry->hash >> 56) % HTTP_CACHE_SHARDS];
+    struct http_cache_entry_t *evicted = NULL;
+    uint64_t now = http_cache_now();
+
+    pthread_rwlock_wrlock(&shard->lock);
+    if (entry->size > shard->capacity) {
+        pthread_rwlock_unlock(&shard->lock);
+        entry->refs = 1;
+        http_cache_entry_release(entry);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    struct http_cache_entry_t *old = http_cache_find(shard, entry->hash, entry->key, entry->key_len);
+    if (old != NULL) {
+        http_cache_unlink(shard, old);
+        old->chain = evicted;
+        evicted = old;
+    }
+    while (shard->bytes + entry->size > shard->capacity) {
+        struct http_cache_entry_t *e = http_cache_evict(shard, now);
+        e->chain = evicted;
+        evicted = e;
+    }
+
+    entry->chain = shard->buckets[entry->hash & shard->mask];
+    shard->buckets[entry->hash & shard->mask] = entry;
+    if (shard->hand == NULL) {
+        entry->next = entry;
+        entry->prev = entry;
+        shard->hand = entry;
+    } else {
+        // just behind the hand so it's the last entry the hand reaches
+        entry->next = shard->hand;
+        entry->prev = shard->hand->prev;
+        shard->hand->prev->next = entry;
+        shard->hand->prev = entry;
+    }
+    shard->bytes += entry->size;
+    pthread_rwlock_unlock(&shard->lock);
+
+    while (evicted != NULL) {
+        struct http_cache_entry_t *next = evicted->chain;
+        http_cache_entry_release(evicted);
+        evicted = next;
+    }
+
+    // the client may have this response already, even on a miss
+    if (http_cache_not_modified(request, entry)) {
+        http_cache_respond(response, entry, 1);
+    }
+    http_cache_entry_release(entry);
+
+    return U_CALLBACK_CONTINUE;
+}
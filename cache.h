@@ -0,0 +1,119 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_CACHE_H
+#define _HTTP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ulfius.h>
+
+/**
+ * HTTP_CACHE_SHARDS is the number of independently locked shards the response
+ * cache is split into.
+ */
+#ifndef HTTP_CACHE_SHARDS
+#define HTTP_CACHE_SHARDS 16
+#endif
+
+/**
+ * HTTP_CACHE_MAX_VARY is the most request headers a cache can vary on.
+ */
+#define HTTP_CACHE_MAX_VARY 8
+
+struct http_cache;
+
+/**
+ * http_cache_new creates a cache of complete responses, status, headers and
+ * body, for GET and HEAD requests, holding at most max_bytes. Responses are
+ * kept for their Cache-Control s-maxage or max-age, or default_ttl seconds
+ * if they have neither, in which case a default_ttl of 0 doesn't cache
+ * them. Responses are keyed on the method, URL and the values of the
+ * vary_count request headers in vary, which are also listed in the Vary
+ * header of cached responses. Returns NULL on failure.
+ */
+struct http_cache*
+http_cache_new(const size_t max_bytes, const unsigned int default_ttl,
+               const char *const *vary, const size_t vary_count);
+
+/**
+ * http_cache_free frees the given cache. No requests may be using it.
+ */
+void
+http_cache_free(struct http_cache *cache);
+
+struct http_compress;
+
+/**
+ * http_cache_set_compress makes the cache compress the responses it answers
+ * with the given configuration, since callback_compress doesn't get to run
+ * on a hit. Compressed bodies are cached by the http_compress, keyed by the
+ * ETag every cached response has, so each is only compressed once.
+ */
+void
+http_cache_set_compress(struct http_cache *cache, struct http_compress *compress);
+
+/**
+ * http_cache_stats sets hits, misses and bytes to the number of requests
+ * answered from the cache, the number that weren't and the memory held.
+ */
+void
+http_cache_stats(struct http_cache *cache, uint64_t *hits, uint64_t *misses, size_t *bytes);
+
+/**
+ * callback_cache_lookup answers requests from the http_cache given as user
+ * data. It has to run before the route's handler, so it's registered with a
+ * lower priority. On a hit it fills in the response, answering a 304 if the
+ * request's If-None-Match or If-Modified-Since shows the client has it
+ * already, logs the request with log_request and returns
+ * U_CALLBACK_COMPLETE so the handler never runs. Requests sent with
+ * Cache-Control: no-cache skip the lookup.
+ */
+int
+callback_cache_lookup(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * callback_cache_store stores the response built by the route's handler in
+ * the http_cache given as user data. It has to run after the handler, so
+ * it's registered with a higher priority. Responses that are marked
+ * no-store, no-cache or private, set cookies, are streamed or aren't a 200,
+ * 203, 300, 301, 404 or 410 aren't stored, nor are responses to requests
+ * with an Authorization header unless they're marked public. Stored
+ * responses without an ETag are given one.
+ */
+int
+callback_cache_store(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+#endif /* _HTTP_CACHE_H */
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,788 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+#ifdef HTTP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HTTP_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "compress.h"
+#include "http.h"
+
+/**
+ * HTTP_COMPRESS_SHARDS is the number of independently locked shards the
+ * compressed body cache is split into.
+ */
+#define HTTP_COMPRESS_SHARDS 8
+
+/**
+ * HTTP_COMPRESS_BUCKETS is the size of each shard's hash table.
+ */
+#define HTTP_COMPRESS_BUCKETS 256
+
+static const char *http_encoding_names[HTTP_ENCODING_COUNT] = {
+    [HTTP_ENCODING_IDENTITY] = "identity",
+    [HTTP_ENCODING_GZIP]     = "gzip",
+    [HTTP_ENCODING_DEFLATE]  = "deflate",
+    [HTTP_ENCODING_ZSTD]     = "zstd",
+    [HTTP_ENCODING_BROTLI]   = "br",
+};
+
+/**
+ * http_encoding_preference lists the encodings we can produce, best first.
+ */
+static const int http_encoding_preference[] = {
+#ifdef HTTP_HAVE_BROTLI
+    HTTP_ENCODING_BROTLI,
+#endif
+#ifdef HTTP_HAVE_ZSTD
+    HTTP_ENCODING_ZSTD,
+#endif
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_DEFLATE,
+};
+
+/**
+ * http_compress_entry_t is a cached compressed body, keyed by the request
+ * path, the response's strong ETag and the encoding.
+ */
+struct http_compress_entry_t {
+    uint64_t hash;
+    size_t original_len;
+    size_t size;
+    struct http_compress_entry_t *chain;
+    struct http_compress_entry_t *prev;
+    struct http_compress_entry_t *next;
+    size_t key_len;
+    size_t len;
+    char *data;
+    char key[];
+};
+
+/**
+ * http_compress_shard_t is a bounded LRU map under its own lock.
+ */
+struct http_compress_shard_t {
+    pthread_mutex_t lock;
+    struct http_compress_entry_t *buckets[HTTP_COMPRESS_BUCKETS];
+    struct http_compress_entry_t *head;
+    struct http_compress_entry_t *tail;
+    size_t bytes;
+    size_t capacity;
+};
+
+struct http_compress {
+    size_t min_size;
+    int level;
+    struct http_compress_shard_t *shards;
+};
+
+/**
+ * http_compress_ctx_t holds a thread's compressor state. The zlib streams
+ * are reset rather than reinitialized between responses, and the output
+ * buffer is reused. It's freed when the thread exits.
+ */
+struct http_compress_ctx_t {
+    z_stream zlib[2];
+    int zlib_level[2];
+#ifdef HTTP_HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+    unsigned char *out;
+    size_t cap;
+};
+
+static __thread struct http_compress_ctx_t *compress_ctx;
+static pthread_key_t compress_key;
+static pthread_once_t compress_once = PTHREAD_ONCE_INIT;
+
+static void
+http_compress_ctx_free(void *arg)
+{
+    struct http_compress_ctx_t *ctx = (struct http_compress_ctx_t*)arg;
+
+    for (int i = 0; i < 2; i++) {
+        if (ctx->zlib_level[i] != 0) {
+            deflateEnd(&ctx->zlib[i]);
+        }
+    }
+#ifdef HTTP_HAVE_ZSTD
+    ZSTD_freeCCtx(ctx->zstd);
+#endif
+    free(ctx->out);
+    free(ctx);
+    compress_ctx = NULL;
+}
+
+static void
+http_compress_key_create(void)
+{
+    pthread_key_create(&compress_key, http_compress_ctx_free);
+}
+
+/**
+ * http_compress_ctx returns the calling thread's compressor state, with an
+ * output buffer of at least n bytes. Returns NULL on allocation failure.
+ */
+static struct http_compress_ctx_t*
+http_compress_ctx(const size_t n)
+{
+    struct http_compress_ctx_t *ctx = compress_ctx;
+
+    if (ctx == NULL) {
+        pthread_once(&compress_once, http_compress_key_create);
+        ctx = calloc(1, sizeof(struct http_compress_ctx_t));
+        if (ctx == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(compress_key, ctx);
+        compress_ctx = ctx;
+    }
+
+    if (ctx->cap < n) {
+        unsigned char *out = realloc(ctx->out, n);
+        if (out == NULL) {
+            return NULL;
+        }
+        ctx->out = out;
+        ctx->cap = n;
+    }
+
+    return ctx;
+}
+
+/**
+ * http_compress_zlib compresses in with the thread's gzip or zlib stream.
+ * Returns the compressed length or 0 on failure.
+ */
+static size_t
+http_compress_zlib(struct http_compress_ctx_t *ctx, const int gzip, const int level,
+                   const unsigned char *in, const size_t len)
+{
+    z_stream *zs = &ctx->zlib[gzip];
+
+    if (ctx->zlib_level[gzip] == 0) {
+        memset(zs, 0, sizeof(z_stream));
+        // 16 added to the window bits asks for a gzip wrapper
+        if (deflateInit2(zs, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            return 0;
+        }
+        ctx->zlib_level[gzip] = level;
+    } else {
+        deflateReset(zs);
+        if (ctx->zlib_level[gzip] != level) {
+            deflateParams(zs, level, Z_DEFAULT_STRATEGY);
+            ctx->zlib_level[gzip] = level;
+        }
+    }
+
+    size_t bound = deflateBound(zs, (uLong)len);
+    if (http_compress_ctx(bound) == NULL) {
+        return 0;
+    }
+
+    zs->next_in = (Bytef*)in;
+    zs->avail_in = (uInt)len;
+    zs->next_out = ctx->out;
+    zs->avail_out = (uInt)bound;
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+
+    return bound - zs->avail_out;
+}
+
+#ifdef HTTP_HAVE_ZSTD
+/**
+ * http_compress_zstd_level maps a zlib level, 1 to 9, linearly onto zstd's
+ * regular levels, 1 to 19, leaving out the ultra levels past them.
+ */
+static inline int
+http_compress_zstd_level(const int level)
+{
+    return 1 + (level - 1) * 18 / 8;
+}
+#endif
+
+#ifdef HTTP_HAVE_BROTLI
+/**
+ * http_compress_brotli_level maps a zlib level, 1 to 9, onto brotli's 0 to
+ * 11 quality, rounding to the nearest so 1 gives 1 and 9 gives 11.
+ */
+static inline int
+http_compress_brotli_level(const int level)
+{
+    return (level * 11 + 4) / 9;
+}
+#endif
+
+/**
+ * http_compress_body compresses in with the given encoding into the
+ * thread's output buffer. Returns the compressed length or 0 on failure.
+ */
+static size_t
+http_compress_body(const int encoding, const int level, const unsigned char *in,
+                   const size_t len, const unsigned char **out)
+{
+    struct http_compress_ctx_t *ctx = http_compress_ctx(0);
+    size_t n = 0;
+
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    switch (encoding) {
+    case HTTP_ENCODING_GZIP:
+    case HTTP_ENCODING_DEFLATE:
+        n = http_compress_zlib(ctx, encoding == HTTP_ENCODING_GZIP, level, in, len);
+        break;
+#ifdef HTTP_HAVE_ZSTD
+    case HTTP_ENCODING_ZSTD: {
+        if (ctx->zstd == NULL && (ctx->zstd = ZSTD_createCCtx()) == NULL) {
+            return 0;
+        }
+        size_t bound = ZSTD_compressBound(len);
+        if (http_compress_ctx(bound) == NULL) {
+            return 0;
+        }
+        n = ZSTD_compressCCtx(ctx->zstd, ctx->out, bound, in, len,
+                http_compress_zstd_level(level));
+        if (ZSTD_isError(n)) {
+            return 0;
+        }
+        break;
+    }
+#endif
+#ifdef HTTP_HAVE_BROTLI
+    case HTTP_ENCODING_BROTLI: {
+        // the one shot encoder has no context to keep, it sets one up per call
+        size_t bound = BrotliEncoderMaxCompressedSize(len);
+        if (bound == 0 || http_compress_ctx(bound) == NULL) {
+            return 0;
+        }
+        n = bound;
+        if (!BrotliEncoderCompress(http_compress_brotli_level(level), BROTLI_DEFAULT_WINDOW,
+                BROTLI_MODE_TEXT, len, in, &n, ctx->out)) {
+            return 0;
+        }
+        break;
+    }
+#endif
+    default:
+        return 0;
+    }
+
+    *out = ctx->out;
+
+    return n;
+}
+
+struct http_compress*
+http_compress_new(const size_t min_size, const int level, const size_t cache_bytes)
+{
+    struct http_compress *compress = calloc(1, sizeof(struct http_compress));
+    if (compress == NULL) {
+        return NULL;
+    }
+    compress->min_size = min_size;
+    compress->level = level < 1 ? 1 : level > 9 ? 9 : level;
+
+    if (cache_bytes > 0) {
+        compress->shards = calloc(HTTP_COMPRESS_SHARDS, sizeof(struct http_compress_shard_t));
+        if (compress->shards == NULL) {
+            free(compress);
+            return NULL;
+        }
+        for (int i = 0; i < HTTP_COMPRESS_SHARDS; i++) {
+            pthread_mutex_init(&compress->shards[i].lock, NULL);
+            compress->shards[i].capacity = cache_bytes / HTTP_COMPRESS_SHARDS;
+        }
+    }
+
+    return compress;
+}
+
+void
+http_compress_free(struct http_compress *compress)
+{
+    if (compress == NULL) {
+        return;
+    }
+
+    for (int i = 0; compress->shards != NULL && i < HTTP_COMPRESS_SHARDS; i++) {
+        struct http_compress_shard_t *shard = &compress->shards[i];
+
+        for (struct http_compress_entry_t *e = shard->head, *next; e != NULL; e = next) {
+            next = e->next;
+            free(e);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(compress->shards);
+
+    free(compress);
+}
+
+const char*
+http_encoding_name(const int encoding)
+{
+    if (encoding < 0 || encoding >= HTTP_ENCODING_COUNT) {
+        return NULL;
+    }
+
+    return http_encoding_names[encoding];
+}
+
+/**
+ * http_encoding_qvalue parses the q parameter of an Accept-Encoding element,
+ * RFC 7231 5.3.1, as thousandths. Elements without one get 1000.
+ */
+static int
+http_encoding_qvalue(const char *p, const char *end)
+{
+    while (p < end) {
+        while (p < end && (*p == ';' || *p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            p += 2;
+            int q = 0;
+            if (p < end && *p == '1') {
+                return 1000;
+            }
+            if (p < end && *p == '0') {
+                p++;
+                if (p < end && *p == '.') {
+                    p++;
+                    for (int scale = 100; scale > 0 && p < end && *p >= '0' && *p <= '9'; scale /= 10) {
+                        q += (*p++ - '0') * scale;
+                    }
+                }
+            }
+            return q;
+        }
+        while (p < end && *p != ';') {
+            p++;
+        }
+    }
+
+    return 1000;
+}
+
+int
+http_encoding_negotiate(const char *accept_encoding)
+{
+    if (accept_encoding == NULL) {
+        return HTTP_ENCODING_IDENTITY;
+    }
+
+    int q[HTTP_ENCODING_COUNT];
+    int star = -1;
+    struct http_list_iter it;
+    struct http_slice elem;
+
+    for (int i = 0; i < HTTP_ENCODING_COUNT; i++) {
+        q[i] = -1;
+    }
+
+    http_list_init(&it, accept_encoding, strlen(accept_encoding));
+    while (http_list_next(&it, &elem)) {
+        const char *end = elem.ptr + elem.len;
+        const char *semi = memchr(elem.ptr, ';', elem.len);
+        struct http_slice coding = {
+            .ptr = elem.ptr,
+            .len = (size_t)((semi != NULL ? semi : end) - elem.ptr)
+        };
+        while (coding.len > 0 && (coding.ptr[coding.len - 1] == ' ' || coding.ptr[coding.len - 1] == '\t')) {
+            coding.len--;
+        }
+        int value = semi != NULL ? http_encoding_qvalue(semi, end) : 1000;
+
+        if (coding.len == 1 && coding.ptr[0] == '*') {
+            star = value;
+        } else if (http_slice_equal(&coding, "x-gzip")) {
+            q[HTTP_ENCODING_GZIP] = value;
+        } else {
+            for (int i = 1; i < HTTP_ENCODING_COUNT; i++) {
+                if (http_slice_equal(&coding, http_encoding_names[i])) {
+                    q[i] = value;
+                    break;
+                }
+            }
+        }
+    }
+
+    int best = HTTP_ENCODING_IDENTITY;
+    int best_q = 0;
+    for (size_t i = 0; i < sizeof(http_encoding_preference) / sizeof(http_encoding_preference[0]); i++) {
+        int e = http_encoding_preference[i];
+        int value = q[e] >= 0 ? q[e] : star >= 0 ? star : 0;
+        if (value > best_q) {
+            best = e;
+            best_q = value;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * http_compress_skip_type checks whether the content type is one that's
+ * already compressed, so compressing it again would only burn CPU.
+ */
+static int
+http_compress_skip_type(const char *type)
+{
+    static const char *types[] = {
+        "image/",
+        "audio/",
+        "video/",
+        "font/woff",
+        "application/zip",
+        "application/gzip",
+        "application/x-gzip",
+        "application/zstd",
+        "application/x-bzip2",
+        "application/x-xz",
+        "application/pdf",
+    };
+
+    if (type == NULL) {
+        return 0;
+    }
+    if (strncasecmp(type, "image/svg+xml", 13) == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strncasecmp(type, types[i], strlen(types[i])) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * http_compress_add_vary adds Accept-Encoding to the response's Vary header.
+ */
+static void
+http_compress_add_vary(struct _u_response *response)
+{
+    const char *vary = u_map_get_case(response->map_header, HTTP_RESPONSE_HEADER_VARY);
+    if (vary == NULL) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_VARY, HTTP_REQUEST_HEADER_ACCEPT_ENCODING);
+        return;
+    }
+
+    struct http_list_iter it;
+    struct http_slice elem;
+    http_list_init(&it, vary, strlen(vary));
+    while (http_list_next(&it, &elem)) {
+        if (http_slice_equal(&elem, HTTP_REQUEST_HEADER_ACCEPT_ENCODING) ||
+            http_slice_equal(&elem, "*")) {
+            return;
+        }
+    }
+
+    size_t len = strlen(vary);
+    char *value = malloc(len + sizeof(", " HTTP_REQUEST_HEADER_ACCEPT_ENCODING));
+    if (value == NULL) {
+        return;
+    }
+    memcpy(value, vary, len);
+    memcpy(value + len, ", " HTTP_REQUEST_HEADER_ACCEPT_ENCODING,
+        sizeof(", " HTTP_REQUEST_HEADER_ACCEPT_ENCODING));
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_VARY, value);
+    free(value);
+}
+
+/**
+ * http_compress_key builds the cache key for a compressed body into buf,
+ * which holds len bytes. Returns the key length, which may be more than len,
+ * in which case nothing was written.
+ */
+static size_t
+http_compress_key(const char *url, const char *etag, const int encoding,
+                  char *buf, const size_t len)
+{
+    size_t url_len = strlen(url);
+    size_t etag_len = strlen(etag);
+    size_t n = url_len + etag_len + 3;
+
+    if (n <= len) {
+        memcpy(buf, url, url_len);
+        buf[url_len] = '\0';
+        memcpy(buf + url_len + 1, etag, etag_len);
+        buf[url_len + 1 + etag_len] = '\0';
+        buf[n - 1] = (char)('0' + encoding);
+    }
+
+    return n;
+}
+
+static uint64_t
+http_compress_hash(const char *data, const size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void
+http_compress_unlink(struct http_compress_shard_t *shard, struct http_compress_entry_t *entry)
+{
+    struct http_compress_entry_t **p = &shard->buckets[entry->hash % HTTP_COMPRESS_BUCKETS];
+    while (*p != entry) {
+        p = &(*p)->chain;
+    }
+    *p = entry->chain;
+
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        shard->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        shard->tail = entry->prev;
+    }
+
+    shard->bytes -= entry->size;
+}
+
+static void
+http_compress_push(struct http_compress_shard_t *shard, struct http_compress_entry_t *entry)
+{
+    entry->chain = shard->buckets[entry->hash % HTTP_COMPRESS_BUCKETS];
+    shard->buckets[entry->hash % HTTP_COMPRESS_BUCKETS] = entry;
+
+    entry->prev = NULL;
+    entry->next = shard->head;
+    if (shard->head != NULL) {
+        shard->head->prev = entry;
+    } else {
+        shard->tail = entry;
+    }
+    shard->head = entry;
+
+    shard->bytes += entry->size;
+}
+
+static struct http_compress_entry_t*
+http_compress_find(struct http_compress_shard_t *shard, const uint64_t hash,
+                   const char *key, const size_t key_len)
+{
+    for (struct http_compress_entry_t *e = shard->buckets[hash % HTTP_COMPRESS_BUCKETS]; e != NULL; e = e->chain) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * http_compress_cached sets the response body to the cached compressed body
+ * for the given key, if there is one. Returns 1 if it was found.
+ */
+static int
+http_compress_cached(struct http_compress *compress, struct _u_response *response,
+                     const char *key, const size_t key_len)
+{
+    uint64_t hash = http_compress_hash(key, key_len);
+    struct http_compress_shard_t *shard = &compress->shards[hash % HTTP_COMPRESS_SHARDS];
+    int found = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    struct http_compress_entry_t *e = http_compress_find(shard, hash, key, key_len);
+    // a strong ETag means the same bytes, the length is only a sanity check
+    if (e != NULL && e->original_len == response->binary_body_length) {
+        http_compress_unlink(shard, e);
+        http_compress_push(shard, e);
+        found = ulfius_set_binary_body_response(response, (unsigned int)response->status,
+            e->data, e->len) == U_OK;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
+}
+
+/**
+ * http_compress_store caches the given compressed body, evicting the least
+ * recently used bodies to make room.
+ */
+static void
+http_compress_store(struct http_compress *compress, const char *key, const size_t key_len,
+                    const size_t original_len, const unsigned char *data, const size_t len)
+{
+    size_t size = sizeof(struct http_compress_entry_t) + key_len + len;
+    uint64_t hash = http_compress_hash(key, key_len);
+    struct http_compress_shard_t *shard = &compress->shards[hash % HTTP_COMPRESS_SHARDS];
+
+    if (size > shard->capacity) {
+        return;
+    }
+
+    struct http_compress_entry_t *entry = malloc(size);
+    if (entry == NULL) {
+        return;
+    }
+    entry->hash = hash;
+    entry->original_len = original_len;
+    entry->size = size;
+    entry->key_len = key_len;
+    memcpy(entry->key, key, key_len);
+    entry->data = entry->key + key_len;
+    entry->len = len;
+    memcpy(entry->data, data, len);
+
+    struct http_compress_entry_t *evicted = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+    struct http_compress_entry_t *old = http_compress_find(shard, hash, key, key_len);
+    if (old != NULL) {
+        http_compress_unlink(shard, old);
+        old->chain = evicted;
+        evicted = old;
+    }
+    while (shard->bytes + size > shard->capacity) {
+        struct http_compress_entry_t *e = shard->tail;
+        http_compress_unlink(shard, e);
+        e->chain = evicted;
+        evicted = e;
+    }
+    http_compress_push(shard, entry);
+    pthread_mutex_unlock(&shard->lock);
+
+    while (evicted != NULL) {
+        struct http_compress_entry_t *next = evicted->chain;
+        free(evicted);
+        evicted = next;
+    }
+}
+
+int
+http_compress_response(struct http_compress *compress, const struct _u_request *request,
+                       struct _u_response *response)
+{
+    if (compress == NULL || response->stream_callback != NULL ||
+        response->binary_body == NULL || response->binary_body_length < compress->min_size ||
+        response->status < 200 || response->status == HTTP_STATUS_CODE_NO_CONTENT ||
+        response->status == HTTP_STATUS_CODE_PARTIAL_CONTENT ||
+        response->status == HTTP_STATUS_CODE_NOT_MODIFIED ||
+        u_map_has_key_case(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_ENCODING) ||
+        http_compress_skip_type(u_map_get_case(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE))) {
+        return HTTP_ENCODING_IDENTITY;
+    }
+
+    // from here on the body depends on Accept-Encoding, whatever's picked
+    http_compress_add_vary(response);
+
+    if (request->http_verb != NULL && strcmp(request->http_verb, HTTP_METHOD_HEAD) == 0) {
+        return HTTP_ENCODING_IDENTITY;
+    }
+
+    int encoding = http_encoding_negotiate(
+        u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_ACCEPT_ENCODING));
+    if (encoding == HTTP_ENCODING_IDENTITY) {
+        return HTTP_ENCODING_IDENTITY;
+    }
+
+    const char *etag = u_map_get_case(response->map_header, HTTP_RESPONSE_HEADER_ETAG);
+    char stack[512];
+    char *key = NULL;
+    size_t key_len = 0;
+    // keyed on the full URL since ETags only have to be unique per
+    // resource, and the query string can pick a different one
+    if (compress->shards != NULL && etag != NULL && etag[0] == '"' && request->http_url != NULL) {
+        key_len = http_compress_key(request->http_url, etag, encoding, stack, sizeof(stack));
+        if (key_len <= sizeof(stack)) {
+            key = stack;
+        }
+    }
+
+    size_t original_len = response->binary_body_length;
+    int done = key != NULL && http_compress_cached(compress, response, key, key_len);
+    if (!done) {
+        const unsigned char *out;
+        size_t n = http_compress_body(encoding, compress->level,
+            response->binary_body, original_len, &out);
+        if (n == 0 || n >= original_len) {
+            return HTTP_ENCODING_IDENTITY;
+        }
+        if (key != NULL) {
+            http_compress_store(compress, key, key_len, original_len, out, n);
+        }
+        if (ulfius_set_binary_body_response(response, (unsigned int)response->status,
+                (const char*)out, n) != U_OK) {
+            return HTTP_ENCODING_IDENTITY;
+        }
+    }
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_ENCODING,
+        http_encoding_names[encoding]);
+
+    // the encoded body isn't byte for byte the same representation, so a
+    // strong ETag becomes weak, which still matches If-None-Match
+    if (etag != NULL && etag[0] == '"') {
+        size_t len = strlen(etag);
+        char *weak = malloc(len + 3);
+        if (weak != NULL) {
+            memcpy(weak, "W/", 2);
+            memcpy(weak + 2, etag, len + 1);
+            u_map_put(response->map_header, HTTP_RESPONSE_HEADER_ETAG, weak);
+            free(weak);
+        }
+    }
+
+    return encoding;
+}
+
+int
+callback_compress(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    http_compress_response((struct http_compress*)user_data, request, response);
+
+    return U_CALLBACK_CONTINUE;
+}
@@ -0,0 +1,120 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_COMPRESS_H
+#define _HTTP_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ulfius.h>
+
+/**
+ * Content codings, RFC 7231 3.1.2.1. zstd and brotli are only available
+ * when built with HTTP_HAVE_ZSTD and HTTP_HAVE_BROTLI.
+ */
+enum http_encoding {
+    HTTP_ENCODING_IDENTITY,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_DEFLATE,
+    HTTP_ENCODING_ZSTD,
+    HTTP_ENCODING_BROTLI,
+    HTTP_ENCODING_COUNT
+};
+
+/**
+ * HTTP_COMPRESS_MIN_SIZE is the default size below which bodies are sent as
+ * they are, since compressing them saves less than it costs.
+ */
+#define HTTP_COMPRESS_MIN_SIZE 1024
+
+struct http_compress;
+
+/**
+ * http_compress_new creates a compression configuration for
+ * callback_compress. Bodies smaller than min_size aren't compressed and
+ * level is the zlib compression level, clamped to 1 to 9, which is mapped
+ * linearly onto zstd's 1 to 19 and brotli's 0 to 11, so 1 is the fastest
+ * and 9 the strongest for every encoding. Compressed bodies of responses
+ * with a strong ETag are kept in a cache of up to cache_bytes, 0 disabling
+ * it, keyed by URL and ETag, so repeated responses are only compressed
+ * once. Returns NULL on failure.
+ */
+struct http_compress*
+http_compress_new(const size_t min_size, const int level, const size_t cache_bytes);
+
+/**
+ * http_compress_free frees the given configuration and its cache.
+ */
+void
+http_compress_free(struct http_compress *compress);
+
+/**
+ * http_encoding_name returns the content coding name for the given encoding.
+ */
+const char*
+http_encoding_name(const int encoding);
+
+/**
+ * http_encoding_negotiate picks the encoding for a response from the given
+ * Accept-Encoding value, RFC 7231 5.3.4, going by q-values and preferring
+ * brotli, zstd, gzip and then deflate when they tie. Only encodings that were
+ * built in are picked. Returns HTTP_ENCODING_IDENTITY if nothing better is
+ * acceptable, including when the header is missing.
+ */
+int
+http_encoding_negotiate(const char *accept_encoding);
+
+/**
+ * http_compress_response compresses the response's body for the request if
+ * the client accepts an encoding we have and the body is worth compressing,
+ * setting Content-Encoding and Vary. Bodies that already have a
+ * Content-Encoding, are streamed, are below the minimum size or have a
+ * content type that's already compressed are left alone. Returns the
+ * encoding used.
+ */
+int
+http_compress_response(struct http_compress *compress, const struct _u_request *request,
+                       struct _u_response *response);
+
+/**
+ * callback_compress compresses the responses of routes it's added to with
+ * the http_compress given as user data. It has to run after the handler, and
+ * after callback_cache_store if the route is cached, so it's registered with
+ * a higher priority.
+ */
+int
+callback_compress(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+#endif /* _HTTP_COMPRESS_H */
+#ifdef __cplusplus
+}
+#endif
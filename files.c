@@ -0,0 +1,1195 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include "files.h"
+#include "http.h"
+
+#define HTTP_FILES_WATCH_EVENTS \
+    (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | \
+     IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+/**
+ * http_file_t is an open file along with what's needed to answer for it.
+ * It's reference counted so responses can keep using it after it's been
+ * dropped from the cache, and the path lives in the same allocation.
+ */
+struct http_file_t {
+    uint64_t hash;
+    int refs;
+    int fd;
+    size_t size;
+    time_t mtime;
+    const char *content_type;
+    char etag[48];
+    char last_modified[HTTP_DATE_LEN + 1];
+    char *path;
+    size_t path_len;
+    struct http_file_t *chain;
+    struct http_file_t *prev;
+    struct http_file_t *next;
+};
+
+/**
+ * http_files_watch_t maps an inotify watch to the directory it's on,
+ * relative to the root.
+ */
+struct http_files_watch_t {
+    int wd;
+    char *dir;
+};
+
+/**
+ * http_files holds the cache, a hash table of files with an LRU list, and
+ * the inotify state. generation is bumped on every change reported so a
+ * file opened while a change to it was being handled isn't cached.
+ */
+struct http_files {
+    int root_fd;
+    int no_openat2;
+    char *root;
+    char *prefix;
+    size_t prefix_len;
+
+    pthread_mutex_t lock;
+    struct http_file_t **buckets;
+    size_t mask;
+    struct http_file_t *head;
+    struct http_file_t *tail;
+    size_t count;
+    size_t max_entries;
+    uint64_t hits;
+    uint64_t misses;
+
+    int inotify_fd;
+    int wake_fd;
+    pthread_t watcher;
+    uint64_t generation;
+    struct http_files_watch_t *watches;
+    size_t watch_count;
+};
+
+/**
+ * http_files_types maps file extensions to content types.
+ */
+static const struct {
+    const char *ext;
+    const char *type;
+} http_files_types[] = {
+    { "css",   "text/css; charset=utf-8" },
+    { "gif",   "image/gif" },
+    { "htm",   "text/html; charset=utf-8" },
+    { "html",  "text/html; charset=utf-8" },
+    { "ico",   "image/x-icon" },
+    { "jpeg",  "image/jpeg" },
+    { "jpg",   "image/jpeg" },
+    { "js",    "text/javascript; charset=utf-8" },
+    { "json",  "application/json" },
+    { "map",   "application/json" },
+    { "mjs",   "text/javascript; charset=utf-8" },
+    { "pdf",   "application/pdf" },
+    { "png",   "image/png" },
+    { "svg",   "image/svg+xml" },
+    { "txt",   "text/plain; charset=utf-8" },
+    { "wasm",  "application/wasm" },
+    { "webp",  "image/webp" },
+    { "woff",  "font/woff" },
+    { "woff2", "font/woff2" },
+    { "xml",   "application/xml" },
+};
+
+static const char*
+http_files_content_type(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+
+    if (dot != NULL && (slash == NULL || dot > slash)) {
+        for (size_t i = 0; i < sizeof(http_files_types) / sizeof(http_files_types[0]); i++) {
+            if (strcasecmp(dot + 1, http_files_types[i].ext) == 0) {
+                return http_files_types[i].type;
+            }
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+/**
+ * http_files_hash is 64 bit FNV-1a.
+ */
+static uint64_t
+http_files_hash(const char *data, const size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void
+http_file_release(struct http_file_t *file)
+{
+    if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    close(file->fd);
+    free(file);
+}
+
+/**
+ * http_files_unlink removes the file from the cache and drops the cache's
+ * reference. Called with the lock held.
+ */
+static void
+http_files_unlink(struct http_files *files, struct http_file_t *file)
+{
+    struct http_file_t **p = &files->buckets[file->hash & files->mask];
+    while (*p != file) {
+        p = &(*p)->chain;
+    }
+    *p = file->chain;
+
+    if (file->prev != NULL) {
+        file->prev->next = file->next;
+    } else {
+        files->head = file->next;
+    }
+    if (file->next != NULL) {
+        file->next->prev = file->prev;
+    } else {
+        files->tail = file->prev;
+    }
+    files->count--;
+
+    http_file_release(file);
+}
+
+/**
+ * http_files_find returns the cached file with the given path, or NULL.
+ * Called with the lock held.
+ */
+static struct http_file_t*
+http_files_find(struct http_files *files, const uint64_t hash, const char *path,
+                const size_t len)
+{
+    for (struct http_file_t *f = files->buckets[hash & files->mask]; f != NULL; f = f->chain) {
+        if (f->hash == hash && f->path_len == len && memcmp(f->path, path, len) == 0) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * http_files_invalidate drops the cached file with the given path, or every
+ * file if path is NULL.
+ */
+static void
+http_files_invalidate(struct http_files *files, const char *path, const size_t len)
+{
+    pthread_mutex_lock(&files->lock);
+    __atomic_add_fetch(&files->generation, 1, __ATOMIC_RELEASE);
+
+    if (path == NULL) {
+        while (files->head != NULL) {
+            http_files_unlink(files, files->head);
+        }
+    } else {
+        struct http_file_t *f = http_files_find(files, http_files_hash(path, len), path, len);
+        if (f != NULL) {
+            http_files_unlink(files, f);
+        }
+    }
+    pthread_mutex_unlock(&files->lock);
+}
+
+/**
+ * http_files_watch_dir returns the directory, relative to the root, of the
+ * given watch. Called with the lock held.
+ */
+static const char*
+http_files_watch_dir(struct http_files *files, const int wd)
+{
+    for (size_t i = 0; i < files->watch_count; i++) {
+        if (files->watches[i].wd == wd) {
+            return files->watches[i].dir;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * http_files_handle applies a single inotify event. Anything that changes a
+ * directory, or an event that can't be tied to a file, drops every file.
+ */
+static void
+http_files_handle(struct http_files *files, const struct inotify_event *ev)
+{
+    char path[PATH_MAX];
+    int n = -1;
+
+    if (ev->mask & IN_IGNORED) {
+        pthread_mutex_lock(&files->lock);
+        for (size_t i = 0; i < files->watch_count; i++) {
+            if (files->watches[i].wd == ev->wd) {
+                free(files->watches[i].dir);
+                files->watches[i] = files->watches[--files->watch_count];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&files->lock);
+    }
+
+    if (ev->len > 0 && !(ev->mask & (IN_ISDIR | IN_Q_OVERFLOW))) {
+        pthread_mutex_lock(&files->lock);
+        const char *dir = http_files_watch_dir(files, ev->wd);
+        if (dir != NULL) {
+            n = dir[0] != '\0' ?
+                snprintf(path, sizeof(path), "%s/%s", dir, ev->name) :
+                snprintf(path, sizeof(path), "%s", ev->name);
+        }
+        pthread_mutex_unlock(&files->lock);
+    }
+
+    if (n > 0 && (size_t)n < sizeof(path)) {
+        http_files_invalidate(files, path, (size_t)n);
+    } else {
+        http_files_invalidate(files, NULL, 0);
+    }
+}
+
+/**
+ * http_files_watcher reads inotify events until it's woken up to exit.
+ */
+static void*
+http_files_watcher(void *arg)
+{
+    struct http_files *files = (struct http_files*)arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = files->inotify_fd, .events = POLLIN },
+        { .fd = files->wake_fd, .events = POLLIN },
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        ssize_t len = read(files->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break;
+        }
+
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event*)p;
+            http_files_handle(files, ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return NULL;
+}
+
+struct http_files*
+http_files_new(const char *root, const char *prefix, const size_t max_entries)
+{
+    if (root == NULL) {
+        return NULL;
+    }
+
+    struct http_files *files = calloc(1, sizeof(struct http_files));
+    if (files == NULL) {
+        return NULL;
+    }
+    files->inotify_fd = -1;
+    files->wake_fd = -1;
+
+    size_t buckets = 16;
+    while (buckets < max_entries * 2) {
+        buckets *= 2;
+    }
+
+    files->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    files->root = strdup(root);
+    files->prefix = strdup(prefix != NULL ? prefix : "");
+    files->buckets = calloc(buckets, sizeof(struct http_file_t*));
+    if (files->root_fd < 0 || files->root == NULL || files->prefix == NULL ||
+        files->buckets == NULL) {
+        if (files->root_fd >= 0) {
+            close(files->root_fd);
+        }
+        free(files->root);
+        free(files->prefix);
+        free(files->buckets);
+        free(files);
+        return NULL;
+    }
+    files->prefix_len = strlen(files->prefix);
+    files->mask = buckets - 1;
+    files->max_entries = max_entries;
+    pthread_mutex_init(&files->lock, NULL);
+
+    if (max_entries > 0) {
+        files->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        files->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (files->inotify_fd < 0 || files->wake_fd < 0 ||
+            pthread_create(&files->watcher, NULL, http_files_watcher, files) != 0) {
+            // serve without caching rather than risk serving stale files
+            if (files->inotify_fd >= 0) {
+                close(files->inotify_fd);
+            }
+            if (files->wake_fd >= 0) {
+                close(files->wake_fd);
+            }
+            files->inotify_fd = -1;
+            files->wake_fd = -1;
+            files->max_entries = 0;
+        }
+    }
+
+    return files;
+}
+
+void
+http_files_free(struct http_files *files)
+{
+    if (files == NULL) {
+        return;
+    }
+
+    if (files->inotify_fd >= 0) {
+        uint64_t one = 1;
+        if (write(files->wake_fd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(files->watcher, NULL);
+        }
+        close(files->inotify_fd);
+        close(files->wake_fd);
+    }
+
+    while (files->head != NULL) {
+        http_files_unlink(files, files->head);
+    }
+    for (size_t i = 0; i < files->watch_count; i++) {
+        free(files->watches[i].dir);
+    }
+    free(files->watches);
+
+    pthread_mutex_destroy(&files->lock);
+    close(files->root_fd);
+    free(files->buckets);
+    free(files->root);
+    free(files->prefix);
+    free(files);
+}
+
+void
+http_files_stats(struct http_files *files, uint64_t *hits, uint64_t *misses, size_t *entries)
+{
+    pthread_mutex_lock(&files->lock);
+    *hits = files->hits;
+    *misses = files->misses;
+    *entries = files->count;
+    pthread_mutex_unlock(&files->lock);
+}
+
+/**
+ * http_files_watch makes sure the directory holding path is watched.
+ * Returns 0 on success and -1 if it couldn't be.
+ */
+static int
+http_files_watch(struct http_files *files, const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = slash != NULL ? (size_t)(slash - path) : 0;
+    char full[PATH_MAX];
+
+    int n = snprintf(full, sizeof(full), "%s/%.*s", files->root, (int)dir_len, path);
+    if (n < 0 || (size_t)n >= sizeof(full)) {
+        return -1;
+    }
+
+    int wd = inotify_add_watch(files->inotify_fd, full, HTTP_FILES_WATCH_EVENTS);
+    if (wd < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&files->lock);
+    if (http_files_watch_dir(files, wd) == NULL) {
+        struct http_files_watch_t *watches = realloc(files->watches,
+            (files->watch_count + 1) * sizeof(struct http_files_watch_t));
+        char *dir = strndup(path, dir_len);
+        if (watches == NULL || dir == NULL) {
+            if (watches != NULL) {
+                files->watches = watches;
+            }
+            free(dir);
+            pthread_mutex_unlock(&files->lock);
+            inotify_rm_watch(files->inotify_fd, wd);
+            return -1;
+        }
+        files->watches = watches;
+        files->watches[files->watch_count].wd = wd;
+        files->watches[files->watch_count].dir = dir;
+        files->watch_count++;
+    }
+    pthread_mutex_unlock(&files->lock);
+
+    return 0;
+}
+
+/**
+ * http_files_walk opens path relative to the root one segment at a time,
+ * with O_NOFOLLOW on each, so a symbolic link anywhere along it fails the
+ * open. Returns the descriptor, or -1 and sets errno on failure.
+ */
+static int
+http_files_walk(const struct http_files *files, const char *path)
+{
+    char seg[NAME_MAX + 1];
+    int dir = files->root_fd;
+
+    for (;;) {
+        const char *slash = strchr(path, '/');
+        int fd;
+        if (slash == NULL) {
+            fd = openat(dir, path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        } else if ((size_t)(slash - path) > NAME_MAX) {
+            fd = -1;
+            errno = ENAMETOOLONG;
+        } else {
+            memcpy(seg, path, (size_t)(slash - path));
+            seg[slash - path] = '\0';
+            // O_PATH only needs search permission, like a plain lookup, and
+            // gives ENOTDIR rather than the link itself for a symlink
+            fd = openat(dir, seg, O_PATH | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+        }
+
+        if (dir != files->root_fd) {
+            int err = errno;
+            close(dir);
+            errno = err;
+        }
+        if (fd < 0 || slash == NULL) {
+            return fd;
+        }
+        dir = fd;
+        path = slash + 1;
+    }
+}
+
+/**
+ * http_files_openat opens path relative to the root without following
+ * symbolic links in any segment, with openat2 where the kernel has it
+ * and by walking the path where it doesn't. Returns the descriptor, or -1
+ * and sets errno on failure.
+ */
+static int
+http_files_openat(struct http_files *files, const char *path)
+{
+#ifdef SYS_openat2
+    if (!__atomic_load_n(&files->no_openat2, __ATOMIC_RELAXED)) {
+        struct open_how how = {
+            .flags = O_RDONLY | O_CLOEXEC,
+            .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+        };
+        int fd = (int)syscall(SYS_openat2, files->root_fd, path, &how, sizeof(how));
+        // seccomp filters that don't know openat2 tend to answer EPERM
+        if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) {
+            return fd;
+        }
+        __atomic_store_n(&files->no_openat2, 1, __ATOMIC_RELAXED);
+    }
+#endif
+
+    return http_files_walk(files, path);
+}
+
+/**
+ * http_files_open opens and describes the file at path, relative to the
+ * root. Returns NULL and sets errno on failure.
+ */
+static struct http_file_t*
+http_files_open(struct http_files *files, const char *path, const size_t len,
+                const uint64_t hash)
+{
+    int fd = http_files_openat(files, path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    struct http_file_t *file = calloc(1, sizeof(struct http_file_t) + len + 1);
+    if (file == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    file->size = (size_t)st.st_size;
+    file->hash = hash;
+    file->refs = 1;
+    file->fd = fd;
+    file->mtime = st.st_mtime;
+    file->path = (char*)(file + 1);
+    file->path_len = len;
+    memcpy(file->path, path, len);
+    file->content_type = http_files_content_type(file->path);
+
+    snprintf(file->etag, sizeof(file->etag), "\"%llx-%llx\"",
+        (unsigned long long)st.st_size,
+        (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL +
+            (unsigned long long)st.st_mtim.tv_nsec);
+    http_date_format(file->mtime, file->last_modified);
+
+    return file;
+}
+
+/**
+ * http_files_get returns a reference to the file at path, from the cache if
+ * it's there, opening and caching it if not. Returns NULL and sets errno on
+ * failure.
+ */
+static struct http_file_t*
+http_files_get(struct http_files *files, const char *path, const size_t len)
+{
+    uint64_t hash = http_files_hash(path, len);
+
+    pthread_mutex_lock(&files->lock);
+    struct http_file_t *file = http_files_find(files, hash, path, len);
+    if (file != NULL) {
+        __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+        if (file != files->head) {
+            file->prev->next = file->next;
+            if (file->next != NULL) {
+                file->next->prev = file->prev;
+            } else {
+                files->tail = file->prev;
+            }
+            file->prev = NULL;
+            file->next = files->head;
+            files->head->prev = file;
+            files->head = file;
+        }
+        files->hits++;
+        pthread_mutex_unlock(&files->lock);
+        return file;
+    }
+    files->misses++;
+    pthread_mutex_unlock(&files->lock);
+
+    if (files->max_entries == 0) {
+        return http_files_open(files, path, len, hash);
+    }
+
+    // the watch has to be in place before the file is opened so no change
+    // after the open goes unnoticed
+    int cacheable = http_files_watch(files, path) == 0;
+    uint64_t generation = __atomic_load_n(&files->generation, __ATOMIC_ACQUIRE);
+
+    file = http_files_open(files, path, len, hash);
+    if (file == NULL || !cacheable) {
+        return file;
+    }
+
+    pthread_mutex_lock(&files->lock);
+    if (__atomic_load_n(&files->generation, __ATOMIC_ACQUIRE) == generation &&
+        http_files_find(files, hash, path, len) == NULL) {
+        if (files->count >= files->max_entries) {
+            http_files_unlink(files, files->tail);
+        }
+
+        file->refs++;
+        file->chain = files->buckets[hash & files->mask];
+        files->buckets[hash & files->mask] = file;
+        file->next = files->head;
+        if (files->head != NULL) {
+            files->head->prev = file;
+        } else {
+            files->tail = file;
+        }
+        files->head = file;
+        files->count++;
+    }
+    pthread_mutex_unlock(&files->lock);
+
+    return file;
+}
+
+/**
+ * http_files_path checks the request path and turns it into a path
+ * relative to the root in buf. Returns the length, or 0 if the path is
+ * outside the prefix or not allowed.
+ */
+static size_t
+http_files_path(const struct http_files *files, const char *url, char *buf,
+                const size_t size)
+{
+    if (url == NULL || strncmp(url, files->prefix, files->prefix_len) != 0) {
+        return 0;
+    }
+    url += files->prefix_len;
+    if (*url != '/') {
+        return 0;
+    }
+    url++;
+
+    size_t len = strlen(url);
+    if (len + sizeof("index.html") > size) {
+        return 0;
+    }
+
+    // every segment has to be a plain name, which rules out ".", "..",
+    // hidden files and empty segments
+    for (const char *seg = url; *seg != '\0';) {
+        const char *end = strchr(seg, '/');
+        if (end == NULL) {
+            end = url + len;
+        }
+        if (end == seg || seg[0] == '.') {
+            return 0;
+        }
+        seg = *end == '/' ? end + 1 : end;
+    }
+
+    memcpy(buf, url, len);
+    if (len == 0 || buf[len - 1] == '/') {
+        memcpy(buf + len, "index.html", sizeof("index.html") - 1);
+        len += sizeof("index.html") - 1;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+/**
+ * http_files_etag_match checks whether the list of entity tags matches the
+ * file's, using the weak comparison if weak is set and the strong one
+ * otherwise, RFC 7232 2.3.2.
+ */
+static int
+http_files_etag_match(const char *list, const struct http_file_t *file, const int weak)
+{
+    struct http_list_iter it;
+    struct http_slice elem;
+    size_t etag_len = strlen(file->etag);
+
+    http_list_init(&it, list, strlen(list));
+    while (http_list_next(&it, &elem)) {
+        if (elem.len == 1 && elem.ptr[0] == '*') {
+            return 1;
+        }
+        if (elem.len >= 2 && elem.ptr[0] == 'W' && elem.ptr[1] == '/') {
+            if (!weak) {
+                continue;
+            }
+            elem.ptr += 2;
+            elem.len -= 2;
+        }
+        if (elem.len == etag_len && memcmp(elem.ptr, file->etag, etag_len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * http_files_precondition evaluates the request's conditional headers in the
+ * order RFC 7232 6 gives. Returns the status to answer with, 412 or 304, or
+ * 0 to carry on.
+ */
+static unsigned int
+http_files_precondition(const struct _u_request *request, const struct http_file_t *file)
+{
+    const char *im = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_MATCH);
+    const char *ius = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_UNMODIFIED_SINCE);
+    time_t t;
+
+    if (im != NULL) {
+        if (!http_files_etag_match(im, file, 0)) {
+            return HTTP_STATUS_CODE_PRECONDITION_FAILED;
+        }
+    } else if (ius != NULL && http_date_parse(ius, &t) == 0 && file->mtime > t) {
+        return HTTP_STATUS_CODE_PRECONDITION_FAILED;
+    }
+
+    const char *inm = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_NONE_MATCH);
+    const char *ims = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_MODIFIED_SINCE);
+
+    if (inm != NULL) {
+        if (http_files_etag_match(inm, file, 1)) {
+            return HTTP_STATUS_CODE_NOT_MODIFIED;
+        }
+    } else if (ims != NULL && http_date_parse(ims, &t) == 0 && file->mtime <= t) {
+        return HTTP_STATUS_CODE_NOT_MODIFIED;
+    }
+
+    return 0;
+}
+
+/**
+ * http_files_range is an inclusive byte range.
+ */
+struct http_files_range {
+    size_t first;
+    size_t last;
+};
+
+/**
+ * http_files_parse_uint parses the decimal digits of the slice. Returns 0 on
+ * success and -1 if it's empty, has anything else or overflows.
+ */
+static int
+http_files_parse_uint(const char *p, const size_t len, size_t *value)
+{
+    size_t v = 0;
+
+    if (len == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9' || v > (SIZE_MAX - 9) / 10) {
+            return -1;
+        }
+        v = v * 10 + (size_t)(p[i] - '0');
+    }
+    *value = v;
+
+    return 0;
+}
+
+/**
+ * http_files_parse_ranges parses a Range header against a file of size
+ * bytes, RFC 7233 2.1, keeping the satisfiable ranges. Returns the number
+ * kept, which is 0 if none can be satisfied, or -1 if the header should be
+ * ignored because it's invalid, asks for too many ranges or asks for more
+ * bytes than the file has.
+ */
+static int
+http_files_parse_ranges(const char *value, const size_t size,
+                        struct http_files_range *ranges)
+{
+    if (strncasecmp(value, "bytes=", 6) != 0 || size == 0) {
+        return -1;
+    }
+
+    struct http_list_iter it;
+    struct http_slice elem;
+    int count = 0;
+    int total = 0;
+    size_t bytes = 0;
+
+    http_list_init(&it, value + 6, strlen(value + 6));
+    while (http_list_next(&it, &elem)) {
+        if (++total > HTTP_FILES_MAX_RANGES) {
+            return -1;
+        }
+
+        const char *dash = memchr(elem.ptr, '-', elem.len);
+        if (dash == NULL) {
+            return -1;
+        }
+        size_t first_len = (size_t)(dash - elem.ptr);
+        size_t last_len = elem.len - first_len - 1;
+        size_t first, last;
+
+        if (first_len == 0) {
+            // a suffix range, the last n bytes
+            size_t n;
+            if (http_files_parse_uint(dash + 1, last_len, &n) != 0) {
+                return -1;
+            }
+            if (n == 0) {
+                continue;
+            }
+            first = n < size ? size - n : 0;
+            last = size - 1;
+        } else {
+            if (http_files_parse_uint(elem.ptr, first_len, &first) != 0) {
+                return -1;
+            }
+            last = size - 1;
+            if (last_len > 0) {
+                if (http_files_parse_uint(dash + 1, last_len, &last) != 0 || last < first) {
+                    return -1;
+                }
+                if (last >= size) {
+                    last = size - 1;
+                }
+            }
+            if (first >= size) {
+                continue;
+            }
+        }
+
+        bytes += last - first + 1;
+        if (bytes > size) {
+            return -1;
+        }
+        ranges[count].first = first;
+        ranges[count].last = last;
+        count++;
+    }
+
+    return total > 0 ? count : -1;
+}
+
+/**
+ * http_files_if_range checks whether an If-Range validator still matches
+ * the file, RFC 7233 3.2. Entity tags need a strong match and dates an
+ * exact one.
+ */
+static int
+http_files_if_range(const char *value, const struct http_file_t *file)
+{
+    if (value[0] == '"' || (value[0] == 'W' && value[1] == '/')) {
+        return strcmp(value, file->etag) == 0;
+    }
+
+    time_t t;
+
+    return http_date_parse(value, &t) == 0 && t == file->mtime;
+}
+
+/**
+ * http_files_body_t is a response body made of segments, ranges of the file
+ * and multipart headers, streamed in order. A segment with a NULL ptr is
+ * the range of the file starting at file_off. It holds a reference to the
+ * file until the response is done. seg and off are where the next read
+ * starts, pos being its offset into the body.
+ */
+struct http_files_body_t {
+    struct http_file_t *file;
+    size_t count;
+    size_t seg;
+    size_t off;
+    uint64_t pos;
+    struct {
+        const char *ptr;
+        size_t file_off;
+        size_t len;
+    } segs[];
+};
+
+/**
+ * http_files_pread reads len bytes of the file at off straight into the
+ * block ulfius hands out, so it's still a single copy. Unlike a mapping, a
+ * file truncated while it's being sent ends the response with an error
+ * rather than a SIGBUS. Returns 0 on success and -1 if the file came up
+ * short.
+ */
+static int
+http_files_pread(const int fd, char *out, size_t len, size_t off)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, out, len, (off_t)off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        out += n;
+        len -= (size_t)n;
+        off += (size_t)n;
+    }
+
+    return 0;
+}
+
+static ssize_t
+http_files_body_read(void *cls, uint64_t pos, char *out, size_t max)
+{
+    struct http_files_body_t *body = (struct http_files_body_t*)cls;
+
+    if (pos != body->pos) {
+        // not where the last read stopped, so find the segment again
+        body->seg = 0;
+        body->off = 0;
+        body->pos = 0;
+        while (body->seg < body->count && body->pos + body->segs[body->seg].len <= pos) {
+            body->pos += body->segs[body->seg].len;
+            body->seg++;
+        }
+        if (body->seg < body->count) {
+            body->off = (size_t)(pos - body->pos);
+        }
+        body->pos = pos;
+    }
+
+    size_t n = 0;
+    while (n < max && body->seg < body->count) {
+        size_t avail = body->segs[body->seg].len - body->off;
+        size_t take = avail < max - n ? avail : max - n;
+
+        if (body->segs[body->seg].ptr != NULL) {
+            memcpy(out + n, body->segs[body->seg].ptr + body->off, take);
+        } else if (http_files_pread(body->file->fd, out + n, take,
+                       body->segs[body->seg].file_off + body->off) != 0) {
+            return U_STREAM_ERROR;
+        }
+        n += take;
+        body->off += take;
+        if (body->off == body->segs[body->seg].len) {
+            body->seg++;
+            body->off = 0;
+        }
+    }
+    body->pos += n;
+
+    return n > 0 ? (ssize_t)n : U_STREAM_END;
+}
+
+static void
+http_files_body_free(void *cls)
+{
+    struct http_files_body_t *body = (struct http_files_body_t*)cls;
+
+    http_file_release(body->file);
+    free(body);
+}
+
+/**
+ * http_files_respond streams the given ranges of the file, the whole file
+ * if count is 0, as a 206 multipart/byteranges body if there's more than 1.
+ * The body holds its own reference to the file. Returns 0 on success and -1
+ * on allocation failure.
+ */
+static int
+http_files_respond(struct _u_response *response, struct http_file_t *file,
+                   const struct http_files_range *ranges, const int count)
+{
+    static __thread uint64_t boundary_seq;
+
+    char boundary[40];
+    size_t nsegs = count > 1 ? (size_t)count * 2 + 1 : 1;
+    size_t headers_len = 0;
+
+    if (count > 1) {
+        snprintf(boundary, sizeof(boundary), "%016llx%016llx",
+            (unsigned long long)file->hash,
+            (unsigned long long)(++boundary_seq ^ (uint64_t)(uintptr_t)&boundary_seq));
+        // "\r\n--" boundary "\r\nContent-Type: " type "\r\nContent-Range:
+        // bytes " first "-" last "/" size "\r\n\r\n" for each part
+        headers_len = (size_t)count * (strlen(boundary) + strlen(file->content_type) + 3 * 20 + 64) +
+            strlen(boundary) + 9;
+    }
+
+    struct http_files_body_t *body = malloc(sizeof(struct http_files_body_t) +
+        nsegs * sizeof(body->segs[0]) + headers_len);
+    if (body == NULL) {
+        return -1;
+    }
+    body->file = file;
+    body->count = nsegs;
+    body->seg = 0;
+    body->off = 0;
+    body->pos = 0;
+
+    char range[80];
+    unsigned int status = HTTP_STATUS_CODE_OK;
+    uint64_t total = 0;
+
+    if (count == 0) {
+        body->segs[0].ptr = NULL;
+        body->segs[0].file_off = 0;
+        body->segs[0].len = file->size;
+    } else if (count == 1) {
+        status = HTTP_STATUS_CODE_PARTIAL_CONTENT;
+        body->segs[0].ptr = NULL;
+        body->segs[0].file_off = ranges[0].first;
+        body->segs[0].len = ranges[0].last - ranges[0].first + 1;
+        snprintf(range, sizeof(range), "bytes %zu-%zu/%zu",
+            ranges[0].first, ranges[0].last, file->size);
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_RANGE, range);
+    } else {
+        status = HTTP_STATUS_CODE_PARTIAL_CONTENT;
+        char *h = (char*)&body->segs[nsegs];
+
+        for (int i = 0; i < count; i++) {
+            int n = sprintf(h, "\r\n--%s\r\n" "Content-Type: %s\r\n"
+                "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                boundary, file->content_type, ranges[i].first, ranges[i].last, file->size);
+            body->segs[i * 2].ptr = h;
+            body->segs[i * 2].len = (size_t)n;
+            h += n;
+            body->segs[i * 2 + 1].ptr = NULL;
+            body->segs[i * 2 + 1].file_off = ranges[i].first;
+            body->segs[i * 2 + 1].len = ranges[i].last - ranges[i].first + 1;
+        }
+        int n = sprintf(h, "\r\n--%s--\r\n", boundary);
+        body->segs[nsegs - 1].ptr = h;
+        body->segs[nsegs - 1].len = (size_t)n;
+
+        char type[80];
+        snprintf(type, sizeof(type), "multipart/byteranges; boundary=%s", boundary);
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE, type);
+    }
+
+    for (size_t i = 0; i < nsegs; i++) {
+        total += body->segs[i].len;
+    }
+
+    if (ulfius_set_stream_response(response, status, http_files_body_read,
+            http_files_body_free, total, HTTP_FILES_BLOCK, body) != U_OK) {
+        free(body);
+        return -1;
+    }
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int
+callback_static_file(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    uint64_t start = http_timer_start();
+    struct http_files *files = (struct http_files*)user_data;
+
+    int head = strcmp(request->http_verb, "HEAD") == 0;
+    if (!head && strcmp(request->http_verb, "GET") != 0) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_ALLOW, "GET, HEAD");
+        ulfius_set_string_body_response(response, HTTP_STATUS_CODE_METHOD_NOT_ALLOWED,
+            HTTP_STATUS_MESSAGE_METHOD_NOT_ALLOWED);
+        log_request(request, response, start);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    char path[PATH_MAX];
+    size_t len = http_files_path(files, request->url_path, path, sizeof(path));
+    struct http_file_t *file = len > 0 ? http_files_get(files, path, len) : NULL;
+
+    if (file == NULL) {
+        unsigned int status = HTTP_STATUS_CODE_NOT_FOUND;
+        if (len > 0 && errno == EACCES) {
+            status = HTTP_STATUS_CODE_FORBIDDEN;
+        } else if (len > 0 && errno != ENOENT && errno != ENOTDIR &&
+                   errno != ELOOP && errno != EXDEV && errno != ENAMETOOLONG) {
+            status = HTTP_STATUS_CODE_INTERNAL_SERVER_ERROR;
+        }
+        ulfius_set_string_body_response(response, status, http_status_reason(status));
+        log_request(request, response, start);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_ETAG, file->etag);
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_LAST_MODIFIED, file->last_modified);
+
+    unsigned int status = http_files_precondition(request, file);
+    if (status != 0) {
+        ulfius_set_empty_body_response(response, status);
+        http_file_release(file);
+        log_request(request, response, start);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_ACCEPT_RANGES, "bytes");
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE, file->content_type);
+
+    struct http_files_range ranges[HTTP_FILES_MAX_RANGES];
+    int count = 0;
+    const char *range = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_RANGE);
+    const char *if_range = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_IF_RANGE);
+
+    if (range != NULL && !head && (if_range == NULL || http_files_if_range(if_range, file))) {
+        count = http_files_parse_ranges(range, file->size, ranges);
+        if (count == 0) {
+            char value[48];
+            snprintf(value, sizeof(value), "bytes */%zu", file->size);
+            u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_RANGE, value);
+            ulfius_set_empty_body_response(response,
+                HTTP_STATUS_CODE_REQUESTED_RANGE_NOT_SATISFIABLE);
+            http_file_release(file);
+            log_request(request, response, start);
+            return U_CALLBACK_CONTINUE;
+        }
+        if (count < 0) {
+            count = 0;
+        }
+    }
+
+    if (file->size == 0) {
+        ulfius_set_empty_body_response(response, HTTP_STATUS_CODE_OK);
+    } else if (http_files_respond(response, file, ranges, count) != 0) {
+        ulfius_set_string_body_response(response, HTTP_STATUS_CODE_INTERNAL_SERVER_ERROR,
+            HTTP_STATUS_MESSAGE_INTERNAL_SERVER_ERROR);
+    }
+    http_file_release(file);
+    log_request(request, response, start);
+
+    return U_CALLBACK_CONTINUE;
+}
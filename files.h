@@ -0,0 +1,107 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_FILES_H
+#define _HTTP_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ulfius.h>
+
+/**
+ * HTTP_FILES_MAX_RANGES is the most ranges a request can ask for. Requests
+ * for more get the whole file.
+ */
+#ifndef HTTP_FILES_MAX_RANGES
+#define HTTP_FILES_MAX_RANGES 16
+#endif
+
+/**
+ * HTTP_FILES_BLOCK is the size of the blocks file bodies are handed to
+ * ulfius in.
+ */
+#ifndef HTTP_FILES_BLOCK
+#define HTTP_FILES_BLOCK 65536
+#endif
+
+struct http_files;
+
+/**
+ * http_files_new serves the files under root for URLs starting with prefix,
+ * so with a prefix of "/static" a request for /static/css/site.css gets
+ * root/css/site.css. Up to max_entries open files, with their metadata, are
+ * cached and dropped as soon as inotify reports a change to them; without
+ * inotify, or with a max_entries of 0, every request opens the file. Files
+ * are read from the open descriptor as they're sent, so they should be
+ * replaced by renaming a new file over them rather than rewritten in place:
+ * a response for a file truncated while it's being sent is cut short.
+ * Returns NULL on failure.
+ */
+struct http_files*
+http_files_new(const char *root, const char *prefix, const size_t max_entries);
+
+/**
+ * http_files_free stops watching for changes and frees the given file
+ * server. Responses still being sent keep their files open until they're
+ * done.
+ */
+void
+http_files_free(struct http_files *files);
+
+/**
+ * http_files_stats sets hits and misses to the number of requests served
+ * from the cache and the number that had to open the file, and entries to
+ * the number of files cached.
+ */
+void
+http_files_stats(struct http_files *files, uint64_t *hits, uint64_t *misses, size_t *entries);
+
+/**
+ * callback_static_file serves GET and HEAD requests from the http_files
+ * given as user data. Responses carry an ETag and Last-Modified made from
+ * the file's size and modification time and the request's conditional
+ * headers are honoured with a 304 or 412. Range requests, RFC 7233, get a
+ * 206 with the single range or a multipart/byteranges body, subject to
+ * If-Range, or a 416 if none of the ranges can be satisfied. Paths with
+ * "." or ".." segments or hidden files are refused and a path ending in
+ * "/" serves its index.html. Symbolic links under the root aren't followed,
+ * neither for the file nor for any directory on the way to it, and are
+ * answered with a 404. The root itself may be or sit below one, as it's
+ * opened once by http_files_new. The request is logged with log_request.
+ */
+int
+callback_static_file(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+#endif /* _HTTP_FILES_H */
+#ifdef __cplusplus
+}
+#endif
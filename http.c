@@ -1,49 +1,513 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/random.h>
+#include <unistd.h>
 
 #include "http.h"
 
 #define UNUSED(x) (void)x
 
-#ifndef HTTP_BASIC_UATH_USER
-#define HTTP_BASIC_UATH_USER "user"
+#if defined(HTTP_BASIC_UATH_USER) && !defined(HTTP_BASIC_AUTH_USER)
+#define HTTP_BASIC_AUTH_USER HTTP_BASIC_UATH_USER
 #endif
+#ifndef HTTP_BASIC_AUTH_USER
+#define HTTP_BASIC_AUTH_USER "user"
+#endif
+// an empty password disables the built in basic auth credentials
+#ifndef HTTP_BASIC_AUTH_PASSWORD
+#define HTTP_BASIC_AUTH_PASSWORD ""
+#endif
+
+/**
+ * is_ows checks whether the given character is optional whitespace as
+ * defined by RFC 7230, a space or a horizontal tab.
+ */
+static inline int
+is_ows(const char c)
+{
+    return c == ' ' || c == '\t';
+}
+
 /**
- * trim_whitespace removes any white space on
- * the given string.
+ * http_slice_trim strips leading and trailing optional whitespace.
  */
-static char*
-trim_whitespace(char *str)
+static struct http_slice
+http_slice_trim(const char *p, const char *end)
+{
+    while (p < end && is_ows(*p)) {
+        p++;
+    }
+    while (end > p && is_ows(end[-1])) {
+        end--;
+    }
+
+    return (struct http_slice){ .ptr = p, .len = (size_t)(end - p) };
+}
+
+int
+http_slice_equal(const struct http_slice *s, const char *str)
+{
+    size_t len = strlen(str);
+
+    return s->len == len && strncasecmp(s->ptr, str, len) == 0;
+}
+
+int
+http_header_value(const char *line, const size_t line_len, const char *key,
+                  struct http_slice *value)
 {
-    while(isspace((unsigned char)*str)) {
-        str++;
+    if (line == NULL || key == NULL || value == NULL) {
+        return 0;
     }
-    if (*str == 0) {
-        return str;
+
+    const char *end = line + line_len;
+    const char *colon = memchr(line, ':', line_len);
+    if (colon == NULL) {
+        return 0;
+    }
+
+    // field names can't have whitespace before the colon, RFC 7230 3.2.4
+    size_t key_len = strlen(key);
+    if ((size_t)(colon - line) != key_len ||
+        strncasecmp(line, key, key_len) != 0) {
+        return 0;
     }
 
-    char *end = str + strlen(str) - 1;
-    while(end > str && isspace((unsigned char)*end)) {
+    // ignore a trailing CRLF if the whole line was passed in
+    if (end > colon + 1 && end[-1] == '\n') {
         end--;
     }
-    end[1] = '\0';
+    if (end > colon + 1 && end[-1] == '\r') {
+        end--;
+    }
+
+    *value = http_slice_trim(colon + 1, end);
 
-    return str;
+    return 1;
 }
 
+void
+http_list_init(struct http_list_iter *it, const char *value, const size_t len)
+{
+    it->p = value;
+    it->end = value + len;
+}
+
+int
+http_list_next(struct http_list_iter *it, struct http_slice *elem)
+{
+    while (it->p < it->end) {
+        const char *start = it->p;
+        const char *p = start;
+        int quoted = 0;
+
+        for (; p < it->end; p++) {
+            if (quoted) {
+                if (*p == '\\' && p + 1 < it->end) {
+                    p++;
+                } else if (*p == '"') {
+                    quoted = 0;
+                }
+            } else if (*p == '"') {
+                quoted = 1;
+            } else if (*p == ',') {
+                break;
+            }
+        }
+
+        it->p = p < it->end ? p + 1 : p;
+
+        // empty elements are allowed and ignored, RFC 7230 7
+        *elem = http_slice_trim(start, p);
+        if (elem->len > 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#define HTTP_STR_(x) #x
+#define HTTP_STR(x) HTTP_STR_(x)
+
 /**
- * slice_str removes a portion of the given string.
+ * HTTP_STATUS_ENTRY expands to the http_status_table entry for the status
+ * named n, pasting the code and message macros into the status line.
  */
-static void
-slice_str(const char *str, char *buffer, size_t start, size_t end)
+#define HTTP_STATUS_ENTRY(n)                                            \
+    [HTTP_STATUS_CODE_##n - HTTP_STATUS_MIN] = {                        \
+        .reason = HTTP_STATUS_MESSAGE_##n,                              \
+        .reason_len = sizeof(HTTP_STATUS_MESSAGE_##n) - 1,              \
+        .line = "HTTP/1.1 " HTTP_STR(HTTP_STATUS_CODE_##n) " "          \
+            HTTP_STATUS_MESSAGE_##n "\r\n",                             \
+        .line_len = sizeof("HTTP/1.1 " HTTP_STR(HTTP_STATUS_CODE_##n) " " \
+            HTTP_STATUS_MESSAGE_##n "\r\n") - 1,                        \
+    }
+
+const struct http_status http_status_table[HTTP_STATUS_MAX - HTTP_STATUS_MIN + 1] = {
+    HTTP_STATUS_ENTRY(CONTINUE),
+    HTTP_STATUS_ENTRY(SWITCHING_PROTOCOLS),
+    HTTP_STATUS_ENTRY(PROCESSING),
+    HTTP_STATUS_ENTRY(EARLY_HINTS),
+    HTTP_STATUS_ENTRY(OK),
+    HTTP_STATUS_ENTRY(CREATED),
+    HTTP_STATUS_ENTRY(ACCEPTED),
+    HTTP_STATUS_ENTRY(NONAUTHORITATIVE_INFO),
+    HTTP_STATUS_ENTRY(NO_CONTENT),
+    HTTP_STATUS_ENTRY(RESET_CONTENT),
+    HTTP_STATUS_ENTRY(PARTIAL_CONTENT),
+    HTTP_STATUS_ENTRY(MULTI_STATUS),
+    HTTP_STATUS_ENTRY(ALREADY_REPORTED),
+    HTTP_STATUS_ENTRY(IM_USED),
+    HTTP_STATUS_ENTRY(MULTIPLE_CHOICES),
+    HTTP_STATUS_ENTRY(MOVED_PERMANENTLY),
+    HTTP_STATUS_ENTRY(FOUND),
+    HTTP_STATUS_ENTRY(SEE_OTHER),
+    HTTP_STATUS_ENTRY(NOT_MODIFIED),
+    HTTP_STATUS_ENTRY(USE_PROXY),
+    HTTP_STATUS_ENTRY(TEMPORARY_REDIRECT),
+    HTTP_STATUS_ENTRY(PERMANENT_REDIRECT),
+    HTTP_STATUS_ENTRY(BAD_REQUEST),
+    HTTP_STATUS_ENTRY(UNAUTHORIZED),
+    HTTP_STATUS_ENTRY(PAYMENT_REQUIRED),
+    HTTP_STATUS_ENTRY(FORBIDDEN),
+    HTTP_STATUS_ENTRY(NOT_FOUND),
+    HTTP_STATUS_ENTRY(METHOD_NOT_ALLOWED),
+    HTTP_STATUS_ENTRY(NOT_ACCEPTABLE),
+    HTTP_STATUS_ENTRY(PROXY_AUTH_REQUIRED),
+    HTTP_STATUS_ENTRY(REQUEST_TIMEOUT),
+    HTTP_STATUS_ENTRY(CONFLICT),
+    HTTP_STATUS_ENTRY(GONE),
+    HTTP_STATUS_ENTRY(LENGTH_REQUIRED),
+    HTTP_STATUS_ENTRY(PRECONDITION_FAILED),
+    HTTP_STATUS_ENTRY(REQUEST_ENTITY_TOO_LARGE),
+    HTTP_STATUS_ENTRY(REQUEST_URI_TOO_LONG),
+    HTTP_STATUS_ENTRY(UNSUPPORTED_MEDIA_TYPE),
+    HTTP_STATUS_ENTRY(REQUESTED_RANGE_NOT_SATISFIABLE),
+    HTTP_STATUS_ENTRY(EXPECTATION_FAILED),
+    HTTP_STATUS_ENTRY(TEAPOT),
+    HTTP_STATUS_ENTRY(MISDIRECTED_REQUEST),
+    HTTP_STATUS_ENTRY(UNPROCESSABLE_ENTITY),
+    HTTP_STATUS_ENTRY(LOCKED),
+    HTTP_STATUS_ENTRY(FAILED_DEPENDENCY),
+    HTTP_STATUS_ENTRY(TOO_EARLY),
+    HTTP_STATUS_ENTRY(UPGRADE_REQUIRED),
+    HTTP_STATUS_ENTRY(PRECONDITION_REQUIRED),
+    HTTP_STATUS_ENTRY(TOO_MANY_REQUESTS),
+    HTTP_STATUS_ENTRY(REQUEST_HEADER_FIELDS_TOO_LARGE),
+    HTTP_STATUS_ENTRY(UNAVAILABLE_FOR_LEGAL_REASONS),
+    HTTP_STATUS_ENTRY(INTERNAL_SERVER_ERROR),
+    HTTP_STATUS_ENTRY(NOT_IMPLEMENTED),
+    HTTP_STATUS_ENTRY(BAD_GATEWAY),
+    HTTP_STATUS_ENTRY(SERVICE_UNAVAILABLE),
+    HTTP_STATUS_ENTRY(GATEWAY_TIMEOUT),
+    HTTP_STATUS_ENTRY(HTTP_VERSION_NOT_SUPPORTED),
+    HTTP_STATUS_ENTRY(VARIANT_ALSO_NEGOTIATES),
+    HTTP_STATUS_ENTRY(INSUFFICIENT_STORAGE),
+    HTTP_STATUS_ENTRY(LOOP_DETECTED),
+    HTTP_STATUS_ENTRY(NOT_EXTENDED),
+    HTTP_STATUS_ENTRY(NETWORK_AUTHENTICATION_REQUIRED),
+};
+
+/**
+ * http_header_name holds a well known header name and its length.
+ */
+struct http_header_name {
+    const char *name;
+    size_t len;
+};
+
+#define HTTP_HEADER_NAME(s) { s, sizeof(s) - 1 }
+
+#define HTTP_HEADER_SLOTS 128
+
+static const struct http_header_name http_header_names[HTTP_REQUEST_HEADER_ID_COUNT] = {
+    [HTTP_REQUEST_HEADER_ID_AIM]                            = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_AIM),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT]                         = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_CHARSET]                 = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_CHARSET),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_DATETIME]                = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_DATETIME),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_ENCODING]                = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_ENCODING),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_LANGUAGE]                = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_LANGUAGE),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_METHOD]  = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_CONTROL_REQUEST_METHOD),
+    [HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_HEADERS] = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_ACCEPT_CONTROL_REQUEST_HEADERS),
+    [HTTP_REQUEST_HEADER_ID_AUTHORIZATION]                  = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_AUTHORIZATION),
+    [HTTP_REQUEST_HEADER_ID_CACHE_CONTROL]                  = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CACHE_CONTROL),
+    [HTTP_REQUEST_HEADER_ID_CONNECTION]                     = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CONNECTION),
+    [HTTP_REQUEST_HEADER_ID_CONTENT_ENCODING]               = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CONTENT_ENCODING),
+    [HTTP_REQUEST_HEADER_ID_CONTENT_LENGTH]                 = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CONTENT_LENGTH),
+    [HTTP_REQUEST_HEADER_ID_CONTENT_MD5]                    = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CONTENT_MD5),
+    [HTTP_REQUEST_HEADER_ID_CONTENT_TYPE]                   = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_CONTENT_TYPE),
+    [HTTP_REQUEST_HEADER_ID_COOKIE]                         = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_COOKIE),
+    [HTTP_REQUEST_HEADER_ID_DATE]                           = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_DATE),
+    [HTTP_REQUEST_HEADER_ID_EXPECT]                         = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_EXPECT),
+    [HTTP_REQUEST_HEADER_ID_FORWARDED]                      = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_FORWARDED),
+    [HTTP_REQUEST_HEADER_ID_FROM]                           = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_FROM),
+    [HTTP_REQUEST_HEADER_ID_HOST]                           = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_HOST),
+    [HTTP_REQUEST_HEADER_ID_HTTP2_SETTINGS]                 = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_HTTP2_SETTINGS),
+    [HTTP_REQUEST_HEADER_ID_IF_MATCH]                       = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_IF_MATCH),
+    [HTTP_REQUEST_HEADER_ID_IF_MODIFIED_SINCE]              = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_IF_MODIFIED_SINCE),
+    [HTTP_REQUEST_HEADER_ID_IF_NONE_MATCH]                  = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_IF_NONE_MATCH),
+    [HTTP_REQUEST_HEADER_ID_IF_RANGE]                       = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_IF_RANGE),
+    [HTTP_REQUEST_HEADER_ID_IF_UNMODIFIED_SINCE]            = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_IF_UNMODIFIED_SINCE),
+    [HTTP_REQUEST_HEADER_ID_MAX_FORWARDS]                   = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_MAX_FORWARDS),
+    [HTTP_REQUEST_HEADER_ID_PRAGMA]                         = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_PRAGMA),
+    [HTTP_REQUEST_HEADER_ID_PROXY_AUTHORIZATION]            = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_PROXY_AUTHORIZATION),
+    [HTTP_REQUEST_HEADER_ID_RANGE]                          = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_RANGE),
+    [HTTP_REQUEST_HEADER_ID_REFERRER]                       = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_REFERRER),
+    [HTTP_REQUEST_HEADER_ID_TE]                             = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_TE),
+    [HTTP_REQUEST_HEADER_ID_TRAILER]                        = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_TRAILER),
+    [HTTP_REQUEST_HEADER_ID_TRANSFER_ENCODING]              = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_TRANSFER_ENCODING),
+    [HTTP_REQUEST_HEADER_ID_USER_AGENT]                     = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_USER_AGENT),
+    [HTTP_REQUEST_HEADER_ID_UPGRADE]                        = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_UPGRADE),
+    [HTTP_REQUEST_HEADER_ID_WARNING]                        = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_WARNING),
+    [HTTP_REQUEST_HEADER_ID_X_FORWARDED_FOR]                = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_X_FORWARDED_FOR),
+    [HTTP_REQUEST_HEADER_ID_X_REAL_IP]                      = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_X_REAL_IP),
+    [HTTP_REQUEST_HEADER_ID_X_REQUEST_ID]                   = HTTP_HEADER_NAME(HTTP_REQUEST_HEADER_X_REQUEST_ID),
+};
+
+static const uint8_t http_header_slots[HTTP_HEADER_SLOTS] = {
+    [  3] = HTTP_REQUEST_HEADER_ID_CONNECTION,
+    [  4] = HTTP_REQUEST_HEADER_ID_MAX_FORWARDS,
+    [  5] = HTTP_REQUEST_HEADER_ID_ACCEPT_DATETIME,
+    [  6] = HTTP_REQUEST_HEADER_ID_HOST,
+    [ 11] = HTTP_REQUEST_HEADER_ID_PRAGMA,
+    [ 17] = HTTP_REQUEST_HEADER_ID_CONTENT_LENGTH,
+    [ 18] = HTTP_REQUEST_HEADER_ID_RANGE,
+    [ 25] = HTTP_REQUEST_HEADER_ID_X_FORWARDED_FOR,
+    [ 27] = HTTP_REQUEST_HEADER_ID_CONTENT_MD5,
+    [ 35] = HTTP_REQUEST_HEADER_ID_DATE,
+    [ 36] = HTTP_REQUEST_HEADER_ID_AIM,
+    [ 37] = HTTP_REQUEST_HEADER_ID_IF_MATCH,
+    [ 40] = HTTP_REQUEST_HEADER_ID_CONTENT_TYPE,
+    [ 43] = HTTP_REQUEST_HEADER_ID_TRAILER,
+    [ 45] = HTTP_REQUEST_HEADER_ID_ACCEPT_ENCODING,
+    [ 52] = HTTP_REQUEST_HEADER_ID_CONTENT_ENCODING,
+    [ 53] = HTTP_REQUEST_HEADER_ID_IF_UNMODIFIED_SINCE,
+    [ 56] = HTTP_REQUEST_HEADER_ID_TRANSFER_ENCODING,
+    [ 59] = HTTP_REQUEST_HEADER_ID_TE,
+    [ 60] = HTTP_REQUEST_HEADER_ID_AUTHORIZATION,
+    [ 65] = HTTP_REQUEST_HEADER_ID_WARNING,
+    [ 66] = HTTP_REQUEST_HEADER_ID_X_REQUEST_ID,
+    [ 69] = HTTP_REQUEST_HEADER_ID_UPGRADE,
+    [ 72] = HTTP_REQUEST_HEADER_ID_COOKIE,
+    [ 75] = HTTP_REQUEST_HEADER_ID_X_REAL_IP,
+    [ 81] = HTTP_REQUEST_HEADER_ID_IF_MODIFIED_SINCE,
+    [ 82] = HTTP_REQUEST_HEADER_ID_IF_NONE_MATCH,
+    [ 85] = HTTP_REQUEST_HEADER_ID_ACCEPT_LANGUAGE,
+    [ 91] = HTTP_REQUEST_HEADER_ID_ACCEPT_CHARSET,
+    [ 94] = HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_METHOD,
+    [ 97] = HTTP_REQUEST_HEADER_ID_FORWARDED,
+    [101] = HTTP_REQUEST_HEADER_ID_PROXY_AUTHORIZATION,
+    [103] = HTTP_REQUEST_HEADER_ID_ACCEPT,
+    [104] = HTTP_REQUEST_HEADER_ID_CACHE_CONTROL,
+    [111] = HTTP_REQUEST_HEADER_ID_FROM,
+    [114] = HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_HEADERS,
+    [115] = HTTP_REQUEST_HEADER_ID_EXPECT,
+    [117] = HTTP_REQUEST_HEADER_ID_HTTP2_SETTINGS,
+    [120] = HTTP_REQUEST_HEADER_ID_IF_RANGE,
+    [125] = HTTP_REQUEST_HEADER_ID_REFERRER,
+    [127] = HTTP_REQUEST_HEADER_ID_USER_AGENT,
+};
+
+/**
+ * http_header_hash maps a header name onto a slot in http_header_slots. The
+ * multipliers were picked so no two well known names share a slot. OR-ing in
+ * 0x20 lower cases every character that can appear in those names.
+ */
+static inline unsigned int
+http_header_hash(const char *name, const size_t len)
 {
-    size_t j = 0;
+    return (unsigned int)(len + (name[0] | 0x20) * 3 +
+        (name[len - 1] | 0x20) * 15 + (name[len / 2] | 0x20) * 10) &
+        (HTTP_HEADER_SLOTS - 1);
+}
 
-    for (size_t i = start; i <= end; ++i) {
-        buffer[j++] = str[i];
+int
+http_header_id(const char *name, const size_t len)
+{
+    if (name == NULL || len == 0) {
+        return HTTP_REQUEST_HEADER_ID_UNKNOWN;
+    }
+
+    int id = http_header_slots[http_header_hash(name, len)];
+    if (id != HTTP_REQUEST_HEADER_ID_UNKNOWN &&
+        (http_header_names[id].len != len ||
+         strncasecmp(http_header_names[id].name, name, len) != 0)) {
+        return HTTP_REQUEST_HEADER_ID_UNKNOWN;
+    }
+
+    return id;
+}
+
+const char*
+http_header_name(const int id)
+{
+    if (id <= HTTP_REQUEST_HEADER_ID_UNKNOWN || id >= HTTP_REQUEST_HEADER_ID_COUNT) {
+        return NULL;
+    }
+
+    return http_header_names[id].name;
+}
+
+/**
+ * http_scan_name_scalar returns the first ':', CR or LF at or after p, or
+ * end if there isn't one.
+ */
+static const char*
+http_scan_name_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (*p == ':' || *p == '\r' || *p == '\n') {
+            break;
+        }
+    }
+
+    return p;
+}
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+
+/**
+ * http_scan_name_sse2 is http_scan_name_scalar 16 bytes at a time.
+ */
+static const char*
+http_scan_name_sse2(const char *p, const char *end)
+{
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+
+    return http_scan_name_scalar(p, end);
+}
+
+/**
+ * http_scan_name_avx2 is http_scan_name_scalar 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static const char*
+http_scan_name_avx2(const char *p, const char *end)
+{
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return http_scan_name_sse2(p, end);
+}
+#endif
+
+typedef const char *(*http_scan_fn)(const char *, const char *);
+
+static const char* http_scan_name_resolve(const char *p, const char *end);
+
+/**
+ * http_scan_name points at the best scanner for the CPU we're running on.
+ * It's picked on first use and every thread would pick the same one, so the
+ * race setting it is harmless.
+ */
+static http_scan_fn http_scan_name = http_scan_name_resolve;
+
+static const char*
+http_scan_name_resolve(const char *p, const char *end)
+{
+    http_scan_fn scan = http_scan_name_scalar;
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    __builtin_cpu_init();
+    scan = __builtin_cpu_supports("avx2") ? http_scan_name_avx2 : http_scan_name_sse2;
+#endif
+    __atomic_store_n(&http_scan_name, scan, __ATOMIC_RELAXED);
+
+    return scan(p, end);
+}
+
+void
+http_header_iter_init(struct http_header_iter *it, const char *block, const size_t len)
+{
+    it->p = block;
+    it->end = block + len;
+}
+
+int
+http_header_iter_next(struct http_header_iter *it, struct http_slice *name,
+                      struct http_slice *value, int *id)
+{
+    const char *p = it->p;
+    const char *end = it->end;
+
+    if (p >= end || *p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n')) {
+        it->p = end;
+        return 0;
+    }
+    if (is_ows(*p)) {
+        return -1;
+    }
+
+    http_scan_fn scan = __atomic_load_n(&http_scan_name, __ATOMIC_RELAXED);
+    const char *colon = scan(p, end);
+    if (colon == end || *colon != ':' || colon == p || is_ows(colon[-1])) {
+        return -1;
+    }
+
+    // glibc's memchr is already vectorized, so it's used for the line end
+    const char *eol = memchr(colon + 1, '\n', (size_t)(end - colon - 1));
+    const char *next = eol != NULL ? eol + 1 : end;
+    if (eol == NULL) {
+        eol = end;
+    }
+    if (eol > colon + 1 && eol[-1] == '\r') {
+        eol--;
+    }
+
+    *name = (struct http_slice){ .ptr = p, .len = (size_t)(colon - p) };
+    *value = http_slice_trim(colon + 1, eol);
+    if (id != NULL) {
+        *id = http_header_id(name->ptr, name->len);
+    }
+    it->p = next;
+
+    return 1;
+}
+
+void
+http_headers_index(struct http_headers *headers, const struct _u_map *map)
+{
+    memset(headers, 0, sizeof(struct http_headers));
+    if (map == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < map->nb_values; i++) {
+        int id = http_header_id(map->keys[i], strlen(map->keys[i]));
+        if (id != HTTP_REQUEST_HEADER_ID_UNKNOWN && headers->values[id] == NULL) {
+            headers->values[id] = map->values[i];
+        }
     }
-    buffer[j] = 0;
 }
 
 char*
@@ -56,20 +520,491 @@ get_header_value(const char *header, char *key)
         return NULL;
     }
 
-    char *tmp = malloc(strlen(header)+2);
-    strcpy(tmp, header);
-    size_t header_len = strlen(header);
-    char *value = malloc(header_len+1);
-    slice_str(header, value, strlen(key)+2, header_len+1);
+    struct http_slice value = { .ptr = "", .len = 0 };
+    http_header_value(header, strlen(header), key, &value);
+
+    char *ret = malloc(value.len + 1);
+    if (ret == NULL) {
+        return NULL;
+    }
+    memcpy(ret, value.ptr, value.len);
+    ret[value.len] = '\0';
+
+    return ret;
+}
+
+char*
+http_header_value_arena(struct http_arena *arena, const char *header, const char *key)
+{
+    if (arena == NULL || !header || !header[0] || !key || !key[0]) {
+        return NULL;
+    }
+
+    struct http_slice value = { .ptr = "", .len = 0 };
+    http_header_value(header, strlen(header), key, &value);
+
+    return http_arena_strndup(arena, value.ptr, value.len);
+}
+
+/**
+ * http_request_ctx_t is the library's per request state. It's allocated
+ * from the request arena and kept in the response's shared_data, so ulfius
+ * frees both when it cleans up the response.
+ */
+struct http_request_ctx_t {
+    struct http_arena *arena;
+    const char *route;
+};
+
+static void
+http_request_ctx_free(void *data)
+{
+    struct http_request_ctx_t *ctx = (struct http_request_ctx_t*)data;
+
+    http_arena_free(ctx->arena);
+}
+
+/**
+ * http_request_ctx returns the response's request state, creating it if
+ * asked to. Returns NULL if the application uses shared_data itself.
+ */
+static struct http_request_ctx_t*
+http_request_ctx(struct _u_response *response, const int create)
+{
+    if (response->shared_data != NULL) {
+        if (response->free_shared_data != http_request_ctx_free) {
+            return NULL;
+        }
+        return (struct http_request_ctx_t*)response->shared_data;
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    struct http_arena *arena = http_arena_new();
+    struct http_request_ctx_t *ctx = (struct http_request_ctx_t*)
+        http_arena_alloc(arena, sizeof(struct http_request_ctx_t));
+    if (ctx == NULL) {
+        http_arena_free(arena);
+        return NULL;
+    }
+    ctx->arena = arena;
+    ctx->route = NULL;
+
+    response->shared_data = ctx;
+    response->free_shared_data = http_request_ctx_free;
+
+    return ctx;
+}
 
-    return value;
+struct http_arena*
+http_request_arena(struct _u_response *response)
+{
+    struct http_request_ctx_t *ctx = http_request_ctx(response, 1);
+
+    return ctx != NULL ? ctx->arena : NULL;
+}
+
+int
+callback_route(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    (void)request;
+
+    struct http_request_ctx_t *ctx = http_request_ctx(response, 1);
+    if (ctx != NULL) {
+        ctx->route = (const char*)user_data;
+    }
+
+    return U_CALLBACK_CONTINUE;
+}
+
+const char*
+http_request_route(const struct _u_response *response)
+{
+    struct http_request_ctx_t *ctx =
+        http_request_ctx((struct _u_response*)response, 0);
+
+    return ctx != NULL ? ctx->route : NULL;
+}
+
+/**
+ * Access log sampling settings. log_sample_threshold is the keep probability
+ * scaled to 2^32 so it can be compared against 32 random bits.
+ */
+static unsigned int log_sample_rate;
+static uint64_t log_sample_threshold = (uint64_t)1 << 32;
+static unsigned int log_slow_ms;
+
+static __thread uint64_t log_sample_count;
+static __thread uint64_t log_sample_rng;
+
+/**
+ * request_id holds the ID of the request the calling thread is handling.
+ * request_id_prefix is a random per thread prefix and request_id_seq counts
+ * the IDs the thread has generated, so generating one needs no locking.
+ */
+static __thread char request_id[HTTP_REQUEST_ID_MAX + 1];
+static __thread uint64_t request_id_prefix;
+static __thread uint64_t request_id_seq;
+
+void
+log_request_set_sample_rate(const unsigned int n)
+{
+    __atomic_store_n(&log_sample_rate, n, __ATOMIC_RELAXED);
+}
+
+void
+log_request_set_sample_probability(const double p)
+{
+    uint64_t threshold = (uint64_t)1 << 32;
+    if (p <= 0) {
+        threshold = 0;
+    } else if (p < 1) {
+        threshold = (uint64_t)(p * (double)((uint64_t)1 << 32));
+    }
+
+    __atomic_store_n(&log_sample_threshold, threshold, __ATOMIC_RELAXED);
 }
 
 void
-log_request(const struct _u_request *request, struct _u_response *response, clock_t start)
+log_request_set_slow_threshold(const unsigned int ms)
+{
+    __atomic_store_n(&log_slow_ms, ms, __ATOMIC_RELAXED);
+}
+
+/**
+ * log_sample_random returns the next value of the calling thread's
+ * xorshift64* generator.
+ */
+static uint64_t
+log_sample_random(void)
 {
-    clock_t diff = clock() - start;
-    int msec = diff * 1000;
+    uint64_t x = log_sample_rng;
+    if (x == 0) {
+        x = (uint64_t)(uintptr_t)&log_sample_rng ^ (uint64_t)time(NULL) ^
+            0x9e3779b97f4a7c15ULL;
+    }
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    log_sample_rng = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * log_request_sampled decides whether a request's access log entry is kept.
+ * Server errors and slow requests are always kept.
+ */
+static int
+log_request_sampled(const long status, const unsigned int msec)
+{
+    if (status >= 500) {
+        return 1;
+    }
+
+    unsigned int slow_ms = __atomic_load_n(&log_slow_ms, __ATOMIC_RELAXED);
+    if (slow_ms > 0 && msec >= slow_ms) {
+        return 1;
+    }
+
+    unsigned int rate = __atomic_load_n(&log_sample_rate, __ATOMIC_RELAXED);
+    if (rate > 1 && (log_sample_count++ % rate) != 0) {
+        return 0;
+    }
+
+    uint64_t threshold = __atomic_load_n(&log_sample_threshold, __ATOMIC_RELAXED);
+    if (threshold < ((uint64_t)1 << 32) &&
+        (log_sample_random() >> 32) >= threshold) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static const char http_date_days[7][4] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char http_date_months[12][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/**
+ * http_put2 writes the given 0 to 99 value as 2 digits.
+ */
+static inline char*
+http_put2(char *p, const int v)
+{
+    p[0] = (char)('0' + v / 10);
+    p[1] = (char)('0' + v % 10);
+
+    return p + 2;
+}
+
+size_t
+http_date_format(const time_t t, char *buf)
+{
+    struct tm tm;
+    if (gmtime_r(&t, &tm) == NULL || tm.tm_year + 1900 > 9999 || tm.tm_year + 1900 < 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    char *p = buf;
+    memcpy(p, http_date_days[tm.tm_wday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = http_put2(p, tm.tm_mday);
+    *p++ = ' ';
+    memcpy(p, http_date_months[tm.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    p = http_put2(p, (tm.tm_year + 1900) / 100);
+    p = http_put2(p, (tm.tm_year + 1900) % 100);
+    *p++ = ' ';
+    p = http_put2(p, tm.tm_hour);
+    *p++ = ':';
+    p = http_put2(p, tm.tm_min);
+    *p++ = ':';
+    p = http_put2(p, tm.tm_sec);
+    memcpy(p, " GMT", 5);
+
+    return HTTP_DATE_LEN;
+}
+
+/**
+ * http_date_slot_t is the Date value for one second. http_date_now renders
+ * each new second into the next of HTTP_DATE_SLOTS slots and then swaps
+ * http_date_current to it, so a slot isn't rewritten for a minute, long
+ * after readers have stopped using it.
+ */
+#define HTTP_DATE_SLOTS 64
+
+struct http_date_slot_t {
+    time_t sec;
+    char str[HTTP_DATE_LEN + 1];
+};
+
+static struct http_date_slot_t http_date_slots[HTTP_DATE_SLOTS];
+static struct http_date_slot_t *http_date_current;
+static unsigned int http_date_next;
+static char http_date_lock;
+
+static __thread char http_date_buf[HTTP_DATE_LEN + 1];
+
+const char*
+http_date_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+    struct http_date_slot_t *cur = __atomic_load_n(&http_date_current, __ATOMIC_ACQUIRE);
+    if (cur != NULL && __atomic_load_n(&cur->sec, __ATOMIC_RELAXED) == ts.tv_sec) {
+        return cur->str;
+    }
+
+    // one thread renders the new second while the rest carry on with the
+    // previous one
+    if (!__atomic_test_and_set(&http_date_lock, __ATOMIC_ACQUIRE)) {
+        cur = __atomic_load_n(&http_date_current, __ATOMIC_ACQUIRE);
+        if (cur == NULL || cur->sec != ts.tv_sec) {
+            struct http_date_slot_t *slot = &http_date_slots[http_date_next++ % HTTP_DATE_SLOTS];
+            __atomic_store_n(&slot->sec, ts.tv_sec, __ATOMIC_RELAXED);
+            http_date_format(ts.tv_sec, slot->str);
+            __atomic_store_n(&http_date_current, slot, __ATOMIC_RELEASE);
+            cur = slot;
+        }
+        __atomic_clear(&http_date_lock, __ATOMIC_RELEASE);
+        return cur->str;
+    }
+    if (cur != NULL) {
+        return cur->str;
+    }
+
+    // the very first date is still being rendered
+    http_date_format(ts.tv_sec, http_date_buf);
+
+    return http_date_buf;
+}
+
+struct http_header_set {
+    struct _u_map headers;
+    int date;
+};
+
+struct http_header_set*
+http_header_set_new(const int date)
+{
+    struct http_header_set *set = calloc(1, sizeof(struct http_header_set));
+    if (set == NULL) {
+        return NULL;
+    }
+    if (u_map_init(&set->headers) != U_OK) {
+        free(set);
+        return NULL;
+    }
+    set->date = date;
+
+    return set;
+}
+
+void
+http_header_set_free(struct http_header_set *set)
+{
+    if (set != NULL) {
+        u_map_clean(&set->headers);
+        free(set);
+    }
+}
+
+int
+http_header_set_add(struct http_header_set *set, const char *key, const char *value)
+{
+    if (key == NULL || value == NULL) {
+        return -1;
+    }
+
+    return u_map_put(&set->headers, key, value) == U_OK ? 0 : -1;
+}
+
+void
+http_header_set_apply(const struct http_header_set *set, struct _u_response *response)
+{
+    u_map_copy_into(response->map_header, &set->headers);
+    if (set->date) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_DATE, http_date_now());
+    }
+}
+
+int
+callback_header_set(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    UNUSED(request);
+
+    if (user_data != NULL) {
+        http_header_set_apply((const struct http_header_set*)user_data, response);
+    }
+
+    return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * http_get_digits parses n digits at p. Returns -1 if they aren't all digits.
+ */
+static int
+http_get_digits(const char *p, const int n)
+{
+    int v = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return -1;
+        }
+        v = v * 10 + (p[i] - '0');
+    }
+
+    return v;
+}
+
+int
+http_date_parse(const char *str, time_t *t)
+{
+    if (str == NULL || t == NULL) {
+        return -1;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(struct tm));
+
+    // the IMF-fixdate format every sender has to use is parsed by hand,
+    // strptime handles the obsolete RFC 850 and asctime formats
+    if (strlen(str) == HTTP_DATE_LEN && str[3] == ',' && str[4] == ' ' &&
+        str[7] == ' ' && str[11] == ' ' && str[16] == ' ' && str[19] == ':' &&
+        str[22] == ':' && memcmp(str + 25, " GMT", 4) == 0) {
+        tm.tm_mday = http_get_digits(str + 5, 2);
+        tm.tm_year = http_get_digits(str + 12, 4) - 1900;
+        tm.tm_hour = http_get_digits(str + 17, 2);
+        tm.tm_min = http_get_digits(str + 20, 2);
+        tm.tm_sec = http_get_digits(str + 23, 2);
+        tm.tm_mon = -1;
+        for (int i = 0; i < 12; i++) {
+            if (memcmp(str + 8, http_date_months[i], 3) == 0) {
+                tm.tm_mon = i;
+                break;
+            }
+        }
+        if (tm.tm_mday < 1 || tm.tm_year < 0 || tm.tm_hour < 0 ||
+            tm.tm_min < 0 || tm.tm_sec < 0 || tm.tm_mon < 0) {
+            return -1;
+        }
+    } else if (strptime(str, "%A, %d-%b-%y %H:%M:%S GMT", &tm) == NULL &&
+               strptime(str, "%a %b %e %H:%M:%S %Y", &tm) == NULL) {
+        return -1;
+    }
+
+    *t = timegm(&tm);
+
+    return 0;
+}
+
+uint64_t
+http_timer_start(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t
+http_timer_elapsed(const uint64_t start)
+{
+    uint64_t now = http_timer_start();
+
+    return now > start ? now - start : 0;
+}
+
+/**
+ * log_request_finish drops the calling thread's per request state: its
+ * request ID and log context.
+ */
+static void
+log_request_finish(void)
+{
+    request_id[0] = '\0';
+    s_log_context_clear();
+}
+
+/**
+ * log_request_end finishes a request: it's recorded in the metrics, its
+ * limiter slot is released and the thread's request state is cleared,
+ * whether or not it's logged. The access log entry is only written if log
+ * is set and the request is sampled.
+ */
+static void
+log_request_end(const struct _u_request *request, struct _u_response *response,
+                const uint64_t start, const int log)
+{
+    uint64_t elapsed = http_timer_elapsed(start);
+    unsigned int msec = (unsigned int)(elapsed / 1000000);
+
+    http_metrics_record(request->http_verb, http_request_route(response),
+        response->status, elapsed);
+    http_limiter_release(elapsed);
+
+    if (!log || !s_log_enabled(S_LOG_INFO) ||
+        !log_request_sampled(response->status, msec)) {
+        log_request_finish();
+        return;
+    }
+
+    char client_addr[HTTP_ADDR_STRLEN];
+    size_t client_addr_len = http_client_addr_format(request, client_addr);
 
     s_log(S_LOG_INFO,
         s_log_string("method", request->http_verb), 
@@ -77,9 +1012,96 @@ log_request(const struct _u_request *request, struct _u_response *response, cloc
         //s_log_string("host", ipv4),
         s_log_uint32("status", response->status),
         s_log_string("proto", request->http_protocol),
-        s_log_int("duration", msec),
-        s_log_string("client_addr", inet_ntoa(((struct sockaddr_in*)request->client_address)->sin_addr)),
+        s_log_double("duration", (double)elapsed / 1e6),
+        s_log_string("client_addr", client_addr_len > 0 ? client_addr : NULL),
         s_log_string("user-agent", u_map_get(request->map_header, "User-Agent")));
+    log_request_finish();
+}
+
+void
+log_request(const struct _u_request *request, struct _u_response *response, const uint64_t start)
+{
+    log_request_end(request, response, start, 1);
+}
+
+static const char http_hex[] = "0123456789abcdef";
+
+/**
+ * http_request_id_valid checks whether an incoming request ID can be used
+ * as is. Anything that isn't a reasonably sized token is replaced so it
+ * can't be used to inject into logs or headers.
+ */
+static int
+http_request_id_valid(const char *id, const size_t len)
+{
+    if (len == 0 || len > HTTP_REQUEST_ID_MAX) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)id[i];
+        if (!isalnum(c) && c != '-' && c != '_' && c != '.' && c != ':' &&
+            c != '+' && c != '/' && c != '=') {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * http_request_id_generate writes a new request ID, the thread's prefix and
+ * sequence number as 16 hex digits each, into request_id.
+ */
+static void
+http_request_id_generate(void)
+{
+    if (request_id_prefix == 0) {
+        uint64_t prefix = 0;
+        if (getrandom(&prefix, sizeof(prefix), GRND_NONBLOCK) != sizeof(prefix)) {
+            prefix = log_sample_random() ^ ((uint64_t)getpid() << 32);
+        }
+        request_id_prefix = prefix ? prefix : 1;
+    }
+
+    uint64_t seq = ++request_id_seq;
+    char *p = request_id;
+
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        *p++ = http_hex[(request_id_prefix >> shift) & 0xf];
+    }
+    *p++ = '-';
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        *p++ = http_hex[(seq >> shift) & 0xf];
+    }
+    *p = '\0';
+}
+
+const char*
+http_request_id(void)
+{
+    return request_id;
+}
+
+int
+callback_request_id(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    UNUSED(user_data);
+
+    const char *id = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_X_REQUEST_ID);
+    size_t len = id != NULL ? strlen(id) : 0;
+
+    if (http_request_id_valid(id, len)) {
+        memcpy(request_id, id, len);
+        request_id[len] = '\0';
+    } else {
+        http_request_id_generate();
+    }
+
+    u_map_put(response->map_header, HTTP_REQUEST_HEADER_X_REQUEST_ID, request_id);
+    s_log_context(s_log_string("request_id", request_id));
+
+    return U_CALLBACK_CONTINUE;
 }
 
 /**
@@ -89,8 +1111,11 @@ log_request(const struct _u_request *request, struct _u_response *response, cloc
 int
 callback_default(const struct _u_request *request, struct _u_response *response, void *user_data)
 {
+    UNUSED(request);
+    UNUSED(user_data);
+
     ulfius_set_string_body_response(response, HTTP_STATUS_CODE_NOT_FOUND, "page not found");
- 
+
     return U_CALLBACK_CONTINUE;
 }
 
@@ -101,28 +1126,175 @@ callback_default(const struct _u_request *request, struct _u_response *response,
 int
 callback_health_check(const struct _u_request *request, struct _u_response *response, void *user_data)
 {
-    clock_t start = clock();
+    uint64_t start = http_timer_start();
 
     const char *git_hash = (const char *)user_data;
-    
-    json_t * json_body = json_object();
-    json_object_set_new(json_body, "status", json_string("OK")); 
-    json_object_set_new(json_body, "git_sha", json_string(git_hash));
 
-    ulfius_set_json_body_response(response, HTTP_STATUS_CODE_OK, json_body);
-    json_decref(json_body);
+    struct http_json w;
+    http_json_init(&w, 128);
+    http_json_object_begin(&w);
+    http_json_key_pre(&w, &HTTP_JSON_KEY("status"));
+    http_json_string(&w, "OK");
+    http_json_key_pre(&w, &HTTP_JSON_KEY("git_sha"));
+    http_json_string(&w, git_hash);
+    http_json_object_end(&w);
+
+    if (http_json_set_body(response, HTTP_STATUS_CODE_OK, &w) != 0) {
+        ulfius_set_string_body_response(response,
+            HTTP_STATUS_CODE_INTERNAL_SERVER_ERROR,
+            HTTP_STATUS_MESSAGE_INTERNAL_SERVER_ERROR);
+    }
+    http_json_free(&w);
 
     log_request(request, response, start);
 
     return U_CALLBACK_CONTINUE;
 }
 
+struct http_health_check*
+http_health_check_new(const char *git_sha, const int mode, const unsigned int log_every)
+{
+    struct http_health_check *hc =
+        (struct http_health_check*)calloc(1, sizeof(struct http_health_check));
+    if (hc == NULL) {
+        return NULL;
+    }
+
+    json_t *json_body = json_object();
+    json_object_set_new(json_body, "status", json_string("OK"));
+    json_object_set_new(json_body, "git_sha", json_string(git_sha != NULL ? git_sha : ""));
+    hc->body = json_dumps(json_body, JSON_COMPACT);
+    json_decref(json_body);
+
+    if (hc->body == NULL) {
+        free(hc);
+        return NULL;
+    }
+
+    hc->body_len = strlen(hc->body);
+    hc->mode = mode;
+    hc->log_every = log_every;
+    hc->started = http_timer_start();
+
+    // readiness responses append their live fields in place of the
+    // closing brace
+    if (mode == HTTP_HEALTH_CHECK_READINESS) {
+        hc->body_len--;
+        hc->ready_size = hc->body_len +
+            sizeof(",\"log_queue_depth\":,\"log_dropped\":,\"uptime\":}") + 3 * 20;
+    }
+
+    return hc;
+}
+
+void
+http_health_check_free(struct http_health_check *hc)
+{
+    if (hc != NULL) {
+        free(hc->body);
+        free(hc);
+    }
+}
+
+int
+callback_health_check_cached(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    uint64_t start = http_timer_start();
+    struct http_health_check *hc = (struct http_health_check*)user_data;
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE,
+        HTTP_CONTENT_TYPE_JSON);
+
+    if (hc->mode == HTTP_HEALTH_CHECK_READINESS) {
+        char body[hc->ready_size];
+        int n = snprintf(body, sizeof(body),
+            "%.*s,\"log_queue_depth\":%zu,\"log_dropped\":%llu,\"uptime\":%llu}",
+            (int)hc->body_len, hc->body, s_log_queue_depth(),
+            (unsigned long long)s_log_dropped(),
+            (unsigned long long)((start - hc->started) / 1000000000ULL));
+        if (n < 0 || (size_t)n >= sizeof(body)) {
+            ulfius_set_string_body_response(response,
+                HTTP_STATUS_CODE_INTERNAL_SERVER_ERROR,
+                HTTP_STATUS_MESSAGE_INTERNAL_SERVER_ERROR);
+        } else {
+            ulfius_set_binary_body_response(response, HTTP_STATUS_CODE_OK, body, (size_t)n);
+        }
+    } else {
+        ulfius_set_binary_body_response(response, HTTP_STATUS_CODE_OK, hc->body,
+            hc->body_len);
+    }
+
+    // unlogged probes still count in the metrics and release their slot
+    log_request_end(request, response, start, hc->log_every > 0 &&
+        __atomic_fetch_add(&hc->probes, 1, __ATOMIC_RELAXED) % hc->log_every == 0);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+int
+callback_metrics(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    UNUSED(request);
+    UNUSED(user_data);
+
+    size_t len = 0;
+    char *body = http_metrics_render(&len);
+    if (body == NULL) {
+        ulfius_set_string_body_response(response,
+            HTTP_STATUS_CODE_INTERNAL_SERVER_ERROR,
+            HTTP_STATUS_MESSAGE_INTERNAL_SERVER_ERROR);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE,
+        "text/plain; version=0.0.4");
+    ulfius_set_binary_body_response(response, HTTP_STATUS_CODE_OK, body, len);
+    free(body);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+/**
+ * auth_reject sets up a 401 response with the given challenge.
+ */
+static int
+auth_reject(struct _u_response *response, const char *challenge)
+{
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_WWW_AUTHENTICATE, challenge);
+    ulfius_set_string_body_response(response, HTTP_STATUS_CODE_UNAUTHORIZED,
+        "Error authentication");
+
+    return U_CALLBACK_UNAUTHORIZED;
+}
+
 int
 callback_auth_token(const struct _u_request *request, struct _u_response *response, void *user_data)
 {
-    //const char *token = u_map_get(request->map_header, AUTH_HEADER);
+    const struct http_auth *auth = user_data;
+    if (auth == NULL || auth->verify_token == NULL) {
+        return auth_reject(response, "Bearer");
+    }
 
-    //char *token = u_map_get(request->map_url, AUTH_HEADER);
+    const char *header = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_AUTHORIZATION);
+    if (header == NULL || strncasecmp(header, "Bearer ", 7) != 0) {
+        return auth_reject(response, "Bearer");
+    }
+
+    size_t header_len = strlen(header);
+    struct http_slice token = http_slice_trim(header + 7, header + header_len);
+    if (token.len == 0) {
+        return auth_reject(response, "Bearer error=\"invalid_request\"");
+    }
+
+    int result = http_auth_cache_get(auth->cache, header, header_len);
+    if (result == HTTP_AUTH_CACHE_MISS) {
+        result = auth->verify_token(token.ptr, token.len, auth->arg) == 1 ?
+            HTTP_AUTH_CACHE_ALLOW : HTTP_AUTH_CACHE_DENY;
+        http_auth_cache_put(auth->cache, header, header_len, result);
+    }
+    if (result != HTTP_AUTH_CACHE_ALLOW) {
+        return auth_reject(response, "Bearer error=\"invalid_token\"");
+    }
 
     return U_CALLBACK_CONTINUE;
 }
@@ -131,16 +1303,39 @@ callback_auth_token(const struct _u_request *request, struct _u_response *respon
  * Auth function for basic authentication
  */
 int callback_auth_basic_body (const struct _u_request * request, struct _u_response * response, void * user_data) {
-    y_log_message(Y_LOG_LEVEL_DEBUG, "basic auth user: %s", request->auth_basic_user);
-    y_log_message(Y_LOG_LEVEL_DEBUG, "basic auth password: %s", request->auth_basic_password);
-    y_log_message(Y_LOG_LEVEL_DEBUG, "basic auth param: %s", (char *)user_data);
-    if (request->auth_basic_user != NULL && request->auth_basic_password != NULL && 
-    0 == o_strcmp(request->auth_basic_user, USER) && 0 == o_strcmp(request->auth_basic_password, PASSWORD)) {
-    return U_CALLBACK_CONTINUE;
+    const struct http_auth *auth = user_data;
+    const char *user = request->auth_basic_user;
+    const char *password = request->auth_basic_password;
+
+    if (user == NULL || password == NULL) {
+        return auth_reject(response, "Basic");
+    }
+    y_log_message(Y_LOG_LEVEL_DEBUG, "basic auth user: %s", user);
+
+    int result;
+    if (auth == NULL || auth->verify_basic == NULL) {
+        // no short circuit, both compares always run
+        result = (sizeof(HTTP_BASIC_AUTH_PASSWORD) > 1) &
+            http_auth_equal(user, strlen(user), HTTP_BASIC_AUTH_USER,
+                sizeof(HTTP_BASIC_AUTH_USER) - 1) &
+            http_auth_equal(password, strlen(password), HTTP_BASIC_AUTH_PASSWORD,
+                sizeof(HTTP_BASIC_AUTH_PASSWORD) - 1);
     } else {
-    ulfius_set_string_body_response(response, 401, "Error authentication");
-    return U_CALLBACK_UNAUTHORIZED;
+        const char *header = u_map_get_case(request->map_header, HTTP_REQUEST_HEADER_AUTHORIZATION);
+        size_t header_len = header != NULL ? strlen(header) : 0;
+
+        result = http_auth_cache_get(auth->cache, header, header_len);
+        if (result == HTTP_AUTH_CACHE_MISS) {
+            result = auth->verify_basic(user, password, auth->arg) == 1 ?
+                HTTP_AUTH_CACHE_ALLOW : HTTP_AUTH_CACHE_DENY;
+            http_auth_cache_put(auth->cache, header, header_len, result);
+        }
     }
+    if (result != HTTP_AUTH_CACHE_ALLOW) {
+        return auth_reject(response, "Basic");
+    }
+
+    return U_CALLBACK_CONTINUE;
 }
 
 /**
@@ -5,9 +5,12 @@ extern "C" {
 #ifndef __HTTP_H
 #define __HTTP_H
 
+#ifndef _POSIX_SOURCE
 #define _POSIX_SOURCE
+#endif
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -15,7 +18,14 @@ extern "C" {
 
 #include <ulfius.h>
 
+#include "addr.h"
+#include "arena.h"
+#include "auth.h"
+#include "files.h"
+#include "json_writer.h"
 #include "logger.h"
+#include "limit.h"
+#include "metrics.h"
 
 #define HTTP_METHOD_GET     "GET"
 #define HTTP_METHOD_POST    "POST"
@@ -96,7 +106,7 @@ extern "C" {
 
 #define HTTP_STATUS_MESSAGE_CONTINUE                        "Continue"
 #define HTTP_STATUS_MESSAGE_SWITCHING_PROTOCOLS             "Switching Protocols"
-#define HTTP_STATUS_MESSAGE_PROCESS                         "Processing"
+#define HTTP_STATUS_MESSAGE_PROCESSING                      "Processing"
 #define HTTP_STATUS_MESSAGE_EARLY_HINTS                     "Early Hints"
 #define HTTP_STATUS_MESSAGE_OK                              "OK"
 #define HTTP_STATUS_MESSAGE_CREATED                         "Created"
@@ -140,7 +150,7 @@ extern "C" {
 #define HTTP_STATUS_MESSAGE_LOCKED                          "Locked"
 #define HTTP_STATUS_MESSAGE_FAILED_DEPENDENCY               "Failed Dependency"
 #define HTTP_STATUS_MESSAGE_TOO_EARLY                       "Too Early"
-#define HTTP_STATUS_MESSAGE_UPGRADE_REQIUIRED               "Upgrade Required"
+#define HTTP_STATUS_MESSAGE_UPGRADE_REQUIRED                "Upgrade Required"
 #define HTTP_STATUS_MESSAGE_PRECONDITION_REQUIRED           "Precondition Required"
 #define HTTP_STATUS_MESSAGE_TOO_MANY_REQUESTS               "Too Many Requests"
 #define HTTP_STATUS_MESSAGE_REQUEST_HEADER_FIELDS_TOO_LARGE "Request Header Fields Too Large"
@@ -148,15 +158,69 @@ extern "C" {
 #define HTTP_STATUS_MESSAGE_INTERNAL_SERVER_ERROR           "Internal Server Error"
 #define HTTP_STATUS_MESSAGE_NOT_IMPLEMENTED                 "Not Implemented"
 #define HTTP_STATUS_MESSAGE_BAD_GATEWAY                     "Bad Gateway"
-#define HTTP_STATUS_MESSAGE_UNAVAILABLE                     "Service Unavailable"
+#define HTTP_STATUS_MESSAGE_SERVICE_UNAVAILABLE             "Service Unavailable"
 #define HTTP_STATUS_MESSAGE_GATEWAY_TIMEOUT                 "Gateway Timeout"
 #define HTTP_STATUS_MESSAGE_HTTP_VERSION_NOT_SUPPORTED      "HTTP Version Not Supported"
-#define HTTP_STATUS_MESSAGE_VARIAN_ALSO_NEGOTIATES          "Variant Also Negotiates"
+#define HTTP_STATUS_MESSAGE_VARIANT_ALSO_NEGOTIATES         "Variant Also Negotiates"
 #define HTTP_STATUS_MESSAGE_INSUFFICIENT_STORAGE            "Insufficient Storage"
 #define HTTP_STATUS_MESSAGE_LOOP_DETECTED                   "Loop Detected"
 #define HTTP_STATUS_MESSAGE_NOT_EXTENDED                    "Not Extended"
 #define HTTP_STATUS_MESSAGE_NETWORK_AUTHENTICATION_REQUIRED "Network Authentication Required"
 
+// misspelled names kept for existing users
+#define HTTP_STATUS_MESSAGE_PROCESS                HTTP_STATUS_MESSAGE_PROCESSING
+#define HTTP_STATUS_MESSAGE_UPGRADE_REQIUIRED      HTTP_STATUS_MESSAGE_UPGRADE_REQUIRED
+#define HTTP_STATUS_MESSAGE_UNAVAILABLE            HTTP_STATUS_MESSAGE_SERVICE_UNAVAILABLE
+#define HTTP_STATUS_MESSAGE_VARIAN_ALSO_NEGOTIATES HTTP_STATUS_MESSAGE_VARIANT_ALSO_NEGOTIATES
+
+/**
+ * http_status describes a status code: its reason phrase and the full status
+ * line, "HTTP/1.1 NNN Reason\r\n", with their lengths.
+ */
+struct http_status {
+    const char *reason;
+    size_t reason_len;
+    const char *line;
+    size_t line_len;
+};
+
+#define HTTP_STATUS_MIN 100
+#define HTTP_STATUS_MAX 599
+
+/**
+ * http_status_table holds every status code above, indexed by code minus
+ * HTTP_STATUS_MIN. It's built at compile time from the HTTP_STATUS_CODE_* and
+ * HTTP_STATUS_MESSAGE_* macros. Unassigned codes have a NULL reason.
+ */
+extern const struct http_status http_status_table[HTTP_STATUS_MAX - HTTP_STATUS_MIN + 1];
+
+/**
+ * http_status_lookup returns the entry for the given status code, or NULL if
+ * the code isn't one we know.
+ */
+static inline const struct http_status*
+http_status_lookup(const long code)
+{
+    if (code < HTTP_STATUS_MIN || code > HTTP_STATUS_MAX ||
+        http_status_table[code - HTTP_STATUS_MIN].reason == NULL) {
+        return NULL;
+    }
+
+    return &http_status_table[code - HTTP_STATUS_MIN];
+}
+
+/**
+ * http_status_reason returns the reason phrase for the given status code, or
+ * an empty string if the code isn't one we know.
+ */
+static inline const char*
+http_status_reason(const long code)
+{
+    const struct http_status *status = http_status_lookup(code);
+
+    return status != NULL ? status->reason : "";
+}
+
 #define HTTP_REQUEST_HEADER_AIM                            "A-IM"
 #define HTTP_REQUEST_HEADER_ACCEPT                         "Accept"
 #define HTTP_REQUEST_HEADER_ACCEPT_CHARSET                 "Accept-Charset"
@@ -196,12 +260,17 @@ extern "C" {
 #define HTTP_REQUEST_HEADER_UPGRADE                        "Upgrade"
 #define HTTP_REQUEST_HEADER_WARNING                        "Warning"
 
+// common non-standard request headers
+#define HTTP_REQUEST_HEADER_X_FORWARDED_FOR                "X-Forwarded-For"
+#define HTTP_REQUEST_HEADER_X_REAL_IP                      "X-Real-IP"
+#define HTTP_REQUEST_HEADER_X_REQUEST_ID                   "X-Request-ID"
+
 #define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN      "Access-Control-Allow-Origin"
-#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_CREDENTIALS HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN
-#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_EXPOSE_HEADERS    HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN
-#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_MAX_AGE           HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN
-#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_METHODS     HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN
-#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_HEADERS     HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN
+#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_CREDENTIALS "Access-Control-Allow-Credentials"
+#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_EXPOSE_HEADERS    "Access-Control-Expose-Headers"
+#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_MAX_AGE           "Access-Control-Max-Age"
+#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_METHODS     "Access-Control-Allow-Methods"
+#define HTTP_RESPONSE_HEADER_ACCESS_CONTROL_ALLOW_HEADERS     "Access-Control-Allow-Headers"
 #define HTTP_RESPONSE_HEADER_ACCEPT_PATCH                     "Accept-Patch"
 #define HTTP_RESPONSE_HEADER_ACCEPT_RANGES                    "Accept-Ranges"
 #define HTTP_RESPONSE_HEADER_AGE                              "Age"
@@ -245,22 +314,152 @@ extern "C" {
 #define HTTP_MAX_HEADER_BYTES 1 << 20 // 1 MB
 
 /**
- * time_spent takes the start time of a route handler and calculates how long
- * it ran for. It then returns that value to be logged. This is intended to be 
- * used with the log_request function.
+ * http_timer_start returns the current reading of the monotonic clock in
+ * nanoseconds. Take one at the start of a route handler and pass it to
+ * http_timer_elapsed or log_request.
  */
-#define TIME_SPENT(x)                        \
-{                                            \
-    clock_t diff = clock() - x;              \
-    int msec = diff * 1000 / CLOCKS_PER_SEC; \
-    msec % 1000;                             \
-}
+uint64_t
+http_timer_start(void);
+
+/**
+ * http_timer_elapsed returns the wall clock nanoseconds since the given
+ * http_timer_start reading.
+ */
+uint64_t
+http_timer_elapsed(const uint64_t start);
+
+/**
+ * HTTP_DATE_LEN is the length of an HTTP date, "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+#define HTTP_DATE_LEN 29
+
+/**
+ * http_date_format writes the given time as an HTTP date, RFC 7231 7.1.1.1,
+ * into buf, which needs room for HTTP_DATE_LEN + 1 bytes. Returns the length
+ * written, or 0 if the time can't be represented.
+ */
+size_t
+http_date_format(const time_t t, char *buf);
+
+/**
+ * http_date_parse parses an HTTP date in any of the 3 formats recipients have
+ * to accept into t. Returns 0 on success and -1 if the date is invalid.
+ */
+int
+http_date_parse(const char *str, time_t *t);
+
+/**
+ * http_date_now returns the current time as an HTTP date. It's rendered once
+ * a second and published with an atomic pointer swap, so the common case is
+ * a clock read and a compare. The string stays valid for a minute, long
+ * enough to copy it into a header.
+ */
+const char*
+http_date_now(void);
+
+/**
+ * http_header_set is a block of constant response headers, such as a
+ * Content-Type, Cache-Control and security headers, built once at startup
+ * and added to responses in one call. ulfius owns and frees each response's
+ * header map, so there's no way to share a prebuilt block between responses:
+ * applying a set still copies every key and value, the same as adding them
+ * one at a time. What it saves is the Date header, taken from http_date_now
+ * instead of being rendered per response.
+ */
+struct http_header_set;
+
+/**
+ * http_header_set_new creates an empty header set. If date is set, applying
+ * it also adds a Date header from http_date_now, which saves the server
+ * from rendering its own. Returns NULL on failure.
+ */
+struct http_header_set*
+http_header_set_new(const int date);
+
+/**
+ * http_header_set_free frees the given header set. No requests may be using
+ * it.
+ */
+void
+http_header_set_free(struct http_header_set *set);
+
+/**
+ * http_header_set_add adds a header to the set, replacing any earlier value
+ * for the same key. Meant to be called at startup. Returns 0 on success and
+ * -1 on failure.
+ */
+int
+http_header_set_add(struct http_header_set *set, const char *key, const char *value);
 
 /**
- * log_request
+ * http_header_set_apply adds the set's headers to the response, copying
+ * each one into its header map.
  */
 void
-log_request(const struct _u_request *request, struct _u_response *response, clock_t start);
+http_header_set_apply(const struct http_header_set *set, struct _u_response *response);
+
+/**
+ * callback_header_set adds the http_header_set given as user data to the
+ * response. Registered with a low priority it runs before the route's
+ * handler, which can still override any of the headers.
+ */
+int
+callback_header_set(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * log_request writes an access log entry for the given request, subject to
+ * the configured sampling, with the duration in milliseconds since start, a
+ * http_timer_start reading. Entries for server errors (status >= 500) and for
+ * requests slower than the slow threshold are always written. It also records
+ * the request's metrics, releases it from the rate limiter and clears the
+ * thread's log context. The request arena lives on until the response is
+ * cleaned up.
+ */
+void
+log_request(const struct _u_request *request, struct _u_response *response, const uint64_t start);
+
+/**
+ * HTTP_REQUEST_ID_MAX is the longest request ID accepted from a client.
+ */
+#define HTTP_REQUEST_ID_MAX 64
+
+/**
+ * callback_request_id gives the request an ID, taken from its X-Request-ID
+ * header if it has a usable one or generated otherwise, echoes it back in
+ * the response's X-Request-ID header and adds it as "request_id" to every
+ * log entry the thread writes until log_request clears it. It should be the
+ * first callback so everything logged for the request carries the ID.
+ */
+int
+callback_request_id(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * http_request_id returns the ID of the request the calling thread is
+ * handling, or an empty string if there isn't one.
+ */
+const char*
+http_request_id(void);
+
+/**
+ * log_request_set_sample_rate makes log_request keep 1 in every n entries.
+ * 0 or 1 keeps every entry.
+ */
+void
+log_request_set_sample_rate(const unsigned int n);
+
+/**
+ * log_request_set_sample_probability makes log_request keep entries with the
+ * given probability, between 0 and 1. It's applied on top of the sample rate.
+ */
+void
+log_request_set_sample_probability(const double p);
+
+/**
+ * log_request_set_slow_threshold makes log_request always keep entries for
+ * requests that took at least ms milliseconds. 0 disables the check.
+ */
+void
+log_request_set_slow_threshold(const unsigned int ms);
 
 /**
  * callback_default is used to handled calls that don't have a matching route.
@@ -275,16 +474,308 @@ callback_default(const struct _u_request *request, struct _u_response *response,
 int
 callback_health_check(const struct _u_request *request, struct _u_response *response, void *user_data);
 
+#define HTTP_CONTENT_TYPE_JSON "application/json"
+
+/**
+ * Health check modes. HTTP_HEALTH_CHECK_LIVENESS serves the same body on
+ * every probe while HTTP_HEALTH_CHECK_READINESS adds live state, the log
+ * queue depth, dropped log entries and uptime.
+ */
+enum {
+    HTTP_HEALTH_CHECK_LIVENESS,
+    HTTP_HEALTH_CHECK_READINESS,
+};
+
+/**
+ * http_health_check is a health check response serialized once when it's
+ * created so probes don't build any JSON.
+ */
+struct http_health_check {
+    char *body;
+    size_t body_len;
+    size_t ready_size;
+    int mode;
+    unsigned int log_every;
+    uint64_t probes;
+    uint64_t started;
+};
+
+/**
+ * http_health_check_new creates the user data for
+ * callback_health_check_cached. Only 1 in every log_every probes is access
+ * logged, 0 turns logging off for probes, but every probe is counted in the
+ * metrics and released from the rate limiter. Returns NULL on failure.
+ */
+struct http_health_check*
+http_health_check_new(const char *git_sha, const int mode, const unsigned int log_every);
+
+/**
+ * http_health_check_free frees the memory used by the given health check.
+ */
+void
+http_health_check_free(struct http_health_check *hc);
+
+/**
+ * callback_health_check_cached serves a health check response prepared with
+ * http_health_check_new, passed as the user data.
+ */
+int
+callback_health_check_cached(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * callback_metrics serves the per route latency histograms and request
+ * counters recorded by log_request in the Prometheus text format, with
+ * routes named by callback_route. Metrics have to be turned on with
+ * http_metrics_init.
+ */
+int
+callback_metrics(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * http_auth configures callback_auth_token and callback_auth_basic_body,
+ * which take it as their user data. verify_token checks a bearer token and
+ * verify_basic a user and password, returning 1 if they're valid and 0 if
+ * not. If cache isn't NULL results are cached by Authorization header so an
+ * expensive verifier runs once per credential per TTL.
+ */
+struct http_auth {
+    int (*verify_token)(const char *token, const size_t len, void *arg);
+    int (*verify_basic)(const char *user, const char *password, void *arg);
+    void *arg;
+    struct http_auth_cache *cache;
+};
+
+/**
+ * callback_auth_token checks the request's bearer token, RFC 6750, with the
+ * http_auth given as user data and rejects the request with a 401 if it's
+ * missing or invalid.
+ */
 int
 callback_auth_token(const struct _u_request *request, struct _u_response *response, void *user_data);
 
+/**
+ * callback_auth_basic_body checks the request's basic auth credentials with
+ * the http_auth given as user data or, when that's NULL, against the
+ * HTTP_BASIC_AUTH_USER and HTTP_BASIC_AUTH_PASSWORD build time credentials,
+ * and rejects the request with a 401 if they don't match.
+ */
+int
+callback_auth_basic_body(const struct _u_request *request, struct _u_response *response, void *user_data);
+
 /**
  * get_header_value returns the value for the given header by key. The caller
  * is responsible for freeing the returned value. if the value isn't found, an
- * empty string is returned.
+ * empty string is returned. Deprecated: http_header_value does the same
+ * without allocating and http_header_value_arena copies into a request's
+ * arena.
  */
 char*
-get_header_value(const char *header, char *key);
+get_header_value(const char *header, char *key)
+    __attribute__((deprecated("use http_header_value or http_header_value_arena")));
+
+/**
+ * http_slice is a view into a string, such as a header value, that isn't
+ * NUL terminated and is only valid as long as the string it points into.
+ */
+struct http_slice {
+    const char *ptr;
+    size_t len;
+};
+
+/**
+ * http_slice_equal checks whether the slice matches the given string,
+ * ignoring case.
+ */
+int
+http_slice_equal(const struct http_slice *s, const char *str);
+
+/**
+ * http_header_value checks whether the given "Key: value" header line is for
+ * key, ignoring case, and if so sets value to a view of its value with the
+ * surrounding whitespace and any trailing CRLF stripped, as per RFC 7230.
+ * Returns 1 if the key matched and 0 if not. Nothing is copied.
+ */
+int
+http_header_value(const char *line, const size_t line_len, const char *key,
+                  struct http_slice *value);
+
+/**
+ * http_header_value_arena returns a copy, allocated from the given arena, of
+ * the value of the given "Key: value" header line if it's for key, or an
+ * empty string if it isn't. The copy is freed with the arena. Returns NULL
+ * if an argument is missing or on allocation failure.
+ */
+char*
+http_header_value_arena(struct http_arena *arena, const char *header, const char *key);
+
+/**
+ * http_request_arena returns the arena of the request the response belongs
+ * to, creating it on first use. It's freed along with everything allocated
+ * from it when ulfius cleans up the response, once it has been sent, so
+ * allocations can be used for the response body. The arena is kept in the
+ * response's shared_data, so NULL is returned if the application already
+ * uses shared_data for something else, or on allocation failure.
+ */
+struct http_arena*
+http_request_arena(struct _u_response *response);
+
+/**
+ * callback_route names the route a request matched, given as the user data,
+ * for metrics and per route rate limits. Register it ahead of the route's
+ * other callbacks with the route's template as its name, for example
+ * "/users/:id", so every request for the route is counted together however
+ * its path is spelled. The name must outlive the instance. Like
+ * http_request_arena it keeps its state in the response's shared_data.
+ */
+int
+callback_route(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+/**
+ * http_request_route returns the name callback_route gave the request, or
+ * NULL if it didn't match a named route.
+ */
+const char*
+http_request_route(const struct _u_response *response);
+
+/**
+ * http_list_iter walks the elements of a comma separated list header value
+ * such as Accept, Accept-Encoding or Cache-Control.
+ */
+struct http_list_iter {
+    const char *p;
+    const char *end;
+};
+
+/**
+ * http_list_init sets up an iterator over the given list header value.
+ */
+void
+http_list_init(struct http_list_iter *it, const char *value, const size_t len);
+
+/**
+ * http_list_next sets elem to a view of the next list element, whitespace
+ * stripped, skipping empty elements and leaving commas inside quoted strings
+ * alone. Returns 1 if there was an element and 0 at the end of the list.
+ */
+int
+http_list_next(struct http_list_iter *it, struct http_slice *elem);
+
+/**
+ * http_request_header_id identifies the well known request headers above so
+ * they can be looked up without comparing names.
+ */
+enum http_request_header_id {
+    HTTP_REQUEST_HEADER_ID_UNKNOWN,
+    HTTP_REQUEST_HEADER_ID_AIM,
+    HTTP_REQUEST_HEADER_ID_ACCEPT,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_CHARSET,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_DATETIME,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_ENCODING,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_LANGUAGE,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_METHOD,
+    HTTP_REQUEST_HEADER_ID_ACCEPT_CONTROL_REQUEST_HEADERS,
+    HTTP_REQUEST_HEADER_ID_AUTHORIZATION,
+    HTTP_REQUEST_HEADER_ID_CACHE_CONTROL,
+    HTTP_REQUEST_HEADER_ID_CONNECTION,
+    HTTP_REQUEST_HEADER_ID_CONTENT_ENCODING,
+    HTTP_REQUEST_HEADER_ID_CONTENT_LENGTH,
+    HTTP_REQUEST_HEADER_ID_CONTENT_MD5,
+    HTTP_REQUEST_HEADER_ID_CONTENT_TYPE,
+    HTTP_REQUEST_HEADER_ID_COOKIE,
+    HTTP_REQUEST_HEADER_ID_DATE,
+    HTTP_REQUEST_HEADER_ID_EXPECT,
+    HTTP_REQUEST_HEADER_ID_FORWARDED,
+    HTTP_REQUEST_HEADER_ID_FROM,
+    HTTP_REQUEST_HEADER_ID_HOST,
+    HTTP_REQUEST_HEADER_ID_HTTP2_SETTINGS,
+    HTTP_REQUEST_HEADER_ID_IF_MATCH,
+    HTTP_REQUEST_HEADER_ID_IF_MODIFIED_SINCE,
+    HTTP_REQUEST_HEADER_ID_IF_NONE_MATCH,
+    HTTP_REQUEST_HEADER_ID_IF_RANGE,
+    HTTP_REQUEST_HEADER_ID_IF_UNMODIFIED_SINCE,
+    HTTP_REQUEST_HEADER_ID_MAX_FORWARDS,
+    HTTP_REQUEST_HEADER_ID_PRAGMA,
+    HTTP_REQUEST_HEADER_ID_PROXY_AUTHORIZATION,
+    HTTP_REQUEST_HEADER_ID_RANGE,
+    HTTP_REQUEST_HEADER_ID_REFERRER,
+    HTTP_REQUEST_HEADER_ID_TE,
+    HTTP_REQUEST_HEADER_ID_TRAILER,
+    HTTP_REQUEST_HEADER_ID_TRANSFER_ENCODING,
+    HTTP_REQUEST_HEADER_ID_USER_AGENT,
+    HTTP_REQUEST_HEADER_ID_UPGRADE,
+    HTTP_REQUEST_HEADER_ID_WARNING,
+    HTTP_REQUEST_HEADER_ID_X_FORWARDED_FOR,
+    HTTP_REQUEST_HEADER_ID_X_REAL_IP,
+    HTTP_REQUEST_HEADER_ID_X_REQUEST_ID,
+    HTTP_REQUEST_HEADER_ID_COUNT
+};
+
+/**
+ * http_header_id returns the id of the given well known request header name,
+ * ignoring case, or HTTP_REQUEST_HEADER_ID_UNKNOWN. It's a single perfect
+ * hash probe and one name compare.
+ */
+int
+http_header_id(const char *name, const size_t len);
+
+/**
+ * http_header_name returns the canonical name for the given header id.
+ */
+const char*
+http_header_name(const int id);
+
+/**
+ * http_header_iter walks a raw header block, "Key: value" lines separated by
+ * CRLF or LF and ending at an empty line or the end of the block.
+ */
+struct http_header_iter {
+    const char *p;
+    const char *end;
+};
+
+/**
+ * http_header_iter_init sets up an iterator over the given header block.
+ */
+void
+http_header_iter_init(struct http_header_iter *it, const char *block, const size_t len);
+
+/**
+ * http_header_iter_next sets name and value to views of the next header in
+ * the block, with the value's surrounding whitespace stripped, and id to its
+ * http_request_header_id if id isn't NULL. Returns 1 if there was a header, 0
+ * at the end of the block and -1 if the line is malformed, which includes
+ * obsolete line folding, RFC 7230 3.2.4. Delimiters are found 16 or 32 bytes
+ * at a time with SSE2 or AVX2 when the CPU has them.
+ */
+int
+http_header_iter_next(struct http_header_iter *it, struct http_slice *name,
+                      struct http_slice *value, int *id);
+
+/**
+ * http_headers holds the values of the well known request headers, indexed
+ * by http_request_header_id, so middleware that checks several of them
+ * doesn't search the header map over and over.
+ */
+struct http_headers {
+    const char *values[HTTP_REQUEST_HEADER_ID_COUNT];
+};
+
+/**
+ * http_headers_index fills headers from the given header map, usually
+ * request->map_header, in a single pass. The values point into the map.
+ */
+void
+http_headers_index(struct http_headers *headers, const struct _u_map *map);
+
+/**
+ * http_headers_get returns the value of the given header, or NULL if the
+ * request didn't have it.
+ */
+static inline const char*
+http_headers_get(const struct http_headers *headers, const int id)
+{
+    return id > 0 && id < HTTP_REQUEST_HEADER_ID_COUNT ? headers->values[id] : NULL;
+}
 
 #endif /* __HTTP_H */
 #ifdef __cplusplus
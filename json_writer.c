@@ -0,0 +1,573 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http.h"
+#include "json_writer.h"
+
+#define HTTP_JSON_ONES  0x0101010101010101ULL
+#define HTTP_JSON_HIGHS 0x8080808080808080ULL
+
+/**
+ * http_json_reserve makes sure the buffer has room for n more bytes. The
+ * buffer comes from ulfius's allocator so it can be handed over as a
+ * response body. Returns 0 on success and -1 on failure.
+ */
+static int
+http_json_reserve(struct http_json *w, const size_t n)
+{
+    if (w->error) {
+        return -1;
+    }
+    if (w->len + n <= w->cap) {
+        return 0;
+    }
+
+    size_t cap = w->cap ? w->cap : 256;
+    while (cap < w->len + n) {
+        if (cap > SIZE_MAX / 2) {
+            w->error = 1;
+            return -1;
+        }
+        cap *= 2;
+    }
+
+    char *buf = o_realloc(w->buf, cap);
+    if (buf == NULL) {
+        w->error = 1;
+        return -1;
+    }
+    w->buf = buf;
+    w->cap = cap;
+
+    return 0;
+}
+
+static inline void
+http_json_append(struct http_json *w, const char *s, const size_t n)
+{
+    if (http_json_reserve(w, n) != 0) {
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static inline void
+http_json_putc(struct http_json *w, const char c)
+{
+    if (http_json_reserve(w, 1) != 0) {
+        return;
+    }
+    w->buf[w->len++] = c;
+}
+
+/**
+ * http_json_in_object checks whether the innermost container is an object.
+ */
+static inline int
+http_json_in_object(const struct http_json *w)
+{
+    return w->depth > 0 && (w->object >> w->depth) & 1;
+}
+
+/**
+ * http_json_value starts a value, writing the comma before it if it isn't
+ * the first in its container. A value inside an object needs a key first.
+ */
+static inline void
+http_json_value(struct http_json *w)
+{
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    if (http_json_in_object(w)) {
+        w->error = 1;
+        return;
+    }
+
+    uint64_t bit = (uint64_t)1 << w->depth;
+    if (w->comma & bit) {
+        http_json_putc(w, ',');
+    }
+    w->comma |= bit;
+}
+
+void
+http_json_init(struct http_json *w, const size_t size_hint)
+{
+    memset(w, 0, sizeof(struct http_json));
+    if (size_hint > 0) {
+        http_json_reserve(w, size_hint);
+    }
+}
+
+void
+http_json_free(struct http_json *w)
+{
+    o_free(w->buf);
+    memset(w, 0, sizeof(struct http_json));
+}
+
+void
+http_json_reset(struct http_json *w)
+{
+    w->len = 0;
+    w->comma = 0;
+    w->object = 0;
+    w->depth = 0;
+    w->after_key = 0;
+    w->error = 0;
+}
+
+/**
+ * http_json_begin opens an object or array.
+ */
+static void
+http_json_begin(struct http_json *w, const char c, const int object)
+{
+    http_json_value(w);
+    if (w->depth >= HTTP_JSON_MAX_DEPTH) {
+        w->error = 1;
+        return;
+    }
+    http_json_putc(w, c);
+
+    uint64_t bit = (uint64_t)1 << ++w->depth;
+    w->comma &= ~bit;
+    if (object) {
+        w->object |= bit;
+    } else {
+        w->object &= ~bit;
+    }
+}
+
+/**
+ * http_json_end closes the innermost container, which has to be of the
+ * matching kind and can't have a key waiting for its value.
+ */
+static void
+http_json_end(struct http_json *w, const char c, const int object)
+{
+    if (w->depth == 0 || w->after_key || http_json_in_object(w) != object) {
+        w->error = 1;
+        return;
+    }
+    http_json_putc(w, c);
+    w->depth--;
+}
+
+void
+http_json_object_begin(struct http_json *w)
+{
+    http_json_begin(w, '{', 1);
+}
+
+void
+http_json_object_end(struct http_json *w)
+{
+    http_json_end(w, '}', 1);
+}
+
+void
+http_json_array_begin(struct http_json *w)
+{
+    http_json_begin(w, '[', 0);
+}
+
+void
+http_json_array_end(struct http_json *w)
+{
+    http_json_end(w, ']', 0);
+}
+
+/**
+ * http_json_needs_escape reports whether any of the 8 bytes in the given
+ * word is a quote, a backslash or a control character.
+ */
+static inline uint64_t
+http_json_needs_escape(const uint64_t w)
+{
+    uint64_t quote = w ^ (HTTP_JSON_ONES * '"');
+    uint64_t slash = w ^ (HTTP_JSON_ONES * '\\');
+
+    return (((quote - HTTP_JSON_ONES) & ~quote) |
+            ((slash - HTTP_JSON_ONES) & ~slash) |
+            ((w - HTTP_JSON_ONES * 0x20) & ~w)) & HTTP_JSON_HIGHS;
+}
+
+/**
+ * http_json_clean_prefix returns how many leading bytes of the string can
+ * be copied without escaping, checking a word at a time.
+ */
+static size_t
+http_json_clean_prefix(const char *s, const size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, sizeof(w));
+        if (http_json_needs_escape(w)) {
+            break;
+        }
+    }
+
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * http_json_escape writes len bytes of s as a quoted and escaped string.
+ */
+static void
+http_json_escape(struct http_json *w, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // most strings need no escaping and fit in one reservation
+    if (http_json_reserve(w, len + 2) != 0) {
+        return;
+    }
+    w->buf[w->len++] = '"';
+
+    while (len > 0) {
+        size_t clean = http_json_clean_prefix(s, len);
+        http_json_append(w, s, clean);
+        s += clean;
+        len -= clean;
+
+        if (len == 0) {
+            break;
+        }
+
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+            case '"':
+                http_json_append(w, "\\\"", 2);
+                break;
+            case '\\':
+                http_json_append(w, "\\\\", 2);
+                break;
+            case '\b':
+                http_json_append(w, "\\b", 2);
+                break;
+            case '\f':
+                http_json_append(w, "\\f", 2);
+                break;
+            case '\n':
+                http_json_append(w, "\\n", 2);
+                break;
+            case '\r':
+                http_json_append(w, "\\r", 2);
+                break;
+            case '\t':
+                http_json_append(w, "\\t", 2);
+                break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                http_json_append(w, esc, sizeof(esc));
+            }
+        }
+        s++;
+        len--;
+    }
+
+    http_json_putc(w, '"');
+}
+
+/**
+ * http_json_key_start checks a key can be written here and writes the comma
+ * before it if it isn't the object's first.
+ */
+static int
+http_json_key_start(struct http_json *w)
+{
+    if (!http_json_in_object(w) || w->after_key) {
+        w->error = 1;
+        return -1;
+    }
+
+    uint64_t bit = (uint64_t)1 << w->depth;
+    if (w->comma & bit) {
+        http_json_putc(w, ',');
+    }
+    w->comma |= bit;
+    w->after_key = 1;
+
+    return 0;
+}
+
+void
+http_json_key(struct http_json *w, const char *key)
+{
+    if (http_json_key_start(w) != 0) {
+        return;
+    }
+    http_json_escape(w, key, strlen(key));
+    http_json_putc(w, ':');
+}
+
+void
+http_json_key_pre(struct http_json *w, const struct http_json_key *key)
+{
+    if (http_json_key_start(w) != 0) {
+        return;
+    }
+    http_json_append(w, key->str, key->len);
+}
+
+void
+http_json_string(struct http_json *w, const char *s)
+{
+    if (s == NULL) {
+        http_json_null(w);
+        return;
+    }
+    http_json_value(w);
+    http_json_escape(w, s, strlen(s));
+}
+
+void
+http_json_string_len(struct http_json *w, const char *s, const size_t len)
+{
+    http_json_value(w);
+    http_json_escape(w, s, len);
+}
+
+void
+http_json_uint(struct http_json *w, uint64_t value)
+{
+    char tmp[20];
+    size_t i = sizeof(tmp);
+
+    do {
+        tmp[--i] = (char)('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    http_json_value(w);
+    http_json_append(w, tmp + i, sizeof(tmp) - i);
+}
+
+void
+http_json_int(struct http_json *w, const int64_t value)
+{
+    if (value >= 0) {
+        http_json_uint(w, (uint64_t)value);
+        return;
+    }
+
+    uint64_t v = (uint64_t)0 - (uint64_t)value;
+    char tmp[21];
+    size_t i = sizeof(tmp);
+
+    do {
+        tmp[--i] = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v != 0);
+    tmp[--i] = '-';
+
+    http_json_value(w);
+    http_json_append(w, tmp + i, sizeof(tmp) - i);
+}
+
+void
+http_json_double(struct http_json *w, const double value)
+{
+    if (value != value || value - value != 0) {
+        http_json_null(w);
+        return;
+    }
+
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.17g", value);
+    if (n <= 0 || (size_t)n >= sizeof(tmp)) {
+        http_json_null(w);
+        return;
+    }
+
+    http_json_value(w);
+    http_json_append(w, tmp, (size_t)n);
+    if (strpbrk(tmp, ".eE") == NULL) {
+        http_json_append(w, ".0", 2);
+    }
+}
+
+void
+http_json_bool(struct http_json *w, const int value)
+{
+    http_json_value(w);
+    if (value) {
+        http_json_append(w, "true", 4);
+    } else {
+        http_json_append(w, "false", 5);
+    }
+}
+
+void
+http_json_null(struct http_json *w)
+{
+    http_json_value(w);
+    http_json_append(w, "null", 4);
+}
+
+void
+http_json_raw(struct http_json *w, const char *json, const size_t len)
+{
+    http_json_value(w);
+    http_json_append(w, json, len);
+}
+
+int
+http_json_set_body(struct _u_response *response, const unsigned int status,
+                   struct http_json *w)
+{
+    if (w->error || w->depth != 0 || w->len == 0) {
+        return -1;
+    }
+
+    o_free(response->binary_body);
+    response->binary_body = w->buf;
+    response->binary_body_length = w->len;
+    response->status = status;
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE,
+        HTTP_CONTENT_TYPE_JSON);
+
+    memset(w, 0, sizeof(struct http_json));
+
+    return 0;
+}
+
+/**
+ * http_json_stream_t is the state of a streamed response. off is how much
+ * of the writer's buffer has been handed to ulfius.
+ */
+struct http_json_stream_t {
+    struct http_json w;
+    size_t off;
+    int done;
+    http_json_fill_fn fill;
+    void *arg;
+    void (*free_arg)(void *arg);
+};
+
+/**
+ * http_json_stream_read is the ulfius stream callback. It calls fill until
+ * there's a block's worth of output or the body is complete and copies out
+ * as much as fits.
+ */
+static ssize_t
+http_json_stream_read(void *cls, uint64_t pos, char *out, size_t max)
+{
+    (void)pos;
+    struct http_json_stream_t *st = (struct http_json_stream_t*)cls;
+    struct http_json *w = &st->w;
+
+    if (st->off == w->len && st->off > 0) {
+        w->len = 0;
+        st->off = 0;
+    }
+
+    while (!st->done && w->len - st->off < max) {
+        if (st->off > 0) {
+            memmove(w->buf, w->buf + st->off, w->len - st->off);
+            w->len -= st->off;
+            st->off = 0;
+        }
+        st->done = !st->fill(w, st->arg);
+        if (w->error || (st->done && w->depth != 0)) {
+            return U_STREAM_ERROR;
+        }
+    }
+
+    size_t n = w->len - st->off;
+    if (n == 0) {
+        return U_STREAM_END;
+    }
+    if (n > max) {
+        n = max;
+    }
+    memcpy(out, w->buf + st->off, n);
+    st->off += n;
+
+    return (ssize_t)n;
+}
+
+static void
+http_json_stream_free(void *cls)
+{
+    struct http_json_stream_t *st = (struct http_json_stream_t*)cls;
+
+    if (st->free_arg != NULL) {
+        st->free_arg(st->arg);
+    }
+    http_json_free(&st->w);
+    free(st);
+}
+
+int
+http_json_stream_response(struct _u_response *response, const unsigned int status,
+                          http_json_fill_fn fill, void *arg,
+                          void (*free_arg)(void *arg))
+{
+    struct http_json_stream_t *st =
+        (struct http_json_stream_t*)calloc(1, sizeof(struct http_json_stream_t));
+    if (st == NULL) {
+        if (free_arg != NULL) {
+            free_arg(arg);
+        }
+        return -1;
+    }
+
+    http_json_init(&st->w, HTTP_JSON_STREAM_BLOCK * 2);
+    st->fill = fill;
+    st->arg = arg;
+    st->free_arg = free_arg;
+
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CONTENT_TYPE,
+        HTTP_CONTENT_TYPE_JSON);
+    if (ulfius_set_stream_response(response, status, http_json_stream_read,
+            http_json_stream_free, U_STREAM_SIZE_UNKNOWN, HTTP_JSON_STREAM_BLOCK,
+            st) != U_OK) {
+        http_json_stream_free(st);
+        return -1;
+    }
+
+    return 0;
+}
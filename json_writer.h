@@ -0,0 +1,228 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_JSON_WRITER_H
+#define _HTTP_JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ulfius.h>
+
+/**
+ * HTTP_JSON_MAX_DEPTH is the deepest objects and arrays can be nested.
+ */
+#define HTTP_JSON_MAX_DEPTH 63
+
+/**
+ * HTTP_JSON_STREAM_BLOCK is the size of the blocks streamed responses are
+ * handed to ulfius in.
+ */
+#ifndef HTTP_JSON_STREAM_BLOCK
+#define HTTP_JSON_STREAM_BLOCK 16384
+#endif
+
+/**
+ * http_json writes JSON text straight into a growable buffer, without
+ * building a tree first. Commas and colons are added as needed, tracked with
+ * a bit per nesting level in comma and object. Once an allocation fails or
+ * the nesting is wrong, error is set and everything after that is ignored.
+ * It can live on the stack; set it up with http_json_init.
+ */
+struct http_json {
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint64_t comma;
+    uint64_t object;
+    unsigned int depth;
+    int after_key;
+    int error;
+};
+
+/**
+ * http_json_key is a key escaped and quoted ahead of time, colon included.
+ * Declare them with HTTP_JSON_KEY so writing one is a single copy.
+ */
+struct http_json_key {
+    const char *str;
+    size_t len;
+};
+
+/**
+ * HTTP_JSON_KEY makes an http_json_key from a string literal, which must
+ * not need escaping.
+ */
+#define HTTP_JSON_KEY(k) \
+    ((struct http_json_key){ .str = "\"" k "\":", .len = sizeof("\"" k "\":") - 1 })
+
+/**
+ * http_json_init sets up the writer with an empty buffer of at least
+ * size_hint bytes, 0 for the default.
+ */
+void
+http_json_init(struct http_json *w, const size_t size_hint);
+
+/**
+ * http_json_free releases the writer's buffer.
+ */
+void
+http_json_free(struct http_json *w);
+
+/**
+ * http_json_reset empties the writer, keeping its buffer.
+ */
+void
+http_json_reset(struct http_json *w);
+
+/**
+ * http_json_object_begin opens an object. Nesting deeper than
+ * HTTP_JSON_MAX_DEPTH puts the writer in error.
+ */
+void
+http_json_object_begin(struct http_json *w);
+
+/**
+ * http_json_object_end closes the innermost object. It's an error if that
+ * isn't an object or a key is still waiting for its value.
+ */
+void
+http_json_object_end(struct http_json *w);
+
+/**
+ * http_json_array_begin opens an array. Nesting deeper than
+ * HTTP_JSON_MAX_DEPTH puts the writer in error.
+ */
+void
+http_json_array_begin(struct http_json *w);
+
+/**
+ * http_json_array_end closes the innermost array. It's an error if that
+ * isn't an array.
+ */
+void
+http_json_array_end(struct http_json *w);
+
+/**
+ * http_json_key writes an object key, escaping it.
+ */
+void
+http_json_key(struct http_json *w, const char *key);
+
+/**
+ * http_json_key_pre writes a pre-escaped object key.
+ */
+void
+http_json_key_pre(struct http_json *w, const struct http_json_key *key);
+
+/**
+ * http_json_string writes an escaped string, or null if it's NULL.
+ */
+void
+http_json_string(struct http_json *w, const char *s);
+
+/**
+ * http_json_string_len writes len bytes of s as an escaped string.
+ */
+void
+http_json_string_len(struct http_json *w, const char *s, const size_t len);
+
+/**
+ * http_json_int writes a signed integer.
+ */
+void
+http_json_int(struct http_json *w, const int64_t value);
+
+/**
+ * http_json_uint writes an unsigned integer.
+ */
+void
+http_json_uint(struct http_json *w, const uint64_t value);
+
+/**
+ * http_json_double writes the value so it reads back as a real. NaN and
+ * infinity have no JSON representation and are written as null.
+ */
+void
+http_json_double(struct http_json *w, const double value);
+
+/**
+ * http_json_bool writes true if value is non-zero and false otherwise.
+ */
+void
+http_json_bool(struct http_json *w, const int value);
+
+/**
+ * http_json_null writes null.
+ */
+void
+http_json_null(struct http_json *w);
+
+/**
+ * http_json_raw writes len bytes of already serialized JSON as a value.
+ */
+void
+http_json_raw(struct http_json *w, const char *json, const size_t len);
+
+/**
+ * http_json_set_body hands the writer's buffer to the response as its body,
+ * with the given status and a JSON content type, without copying it. The
+ * writer is left empty. Returns 0 on success and -1 if the writer is in
+ * error or the JSON isn't complete.
+ */
+int
+http_json_set_body(struct _u_response *response, const unsigned int status,
+                   struct http_json *w);
+
+/**
+ * http_json_fill_fn writes the next part of a streamed response into w.
+ * Each call should write a bounded amount, such as a batch of array
+ * elements, and return 1 while there's more to come and 0 once the JSON is
+ * complete.
+ */
+typedef int (*http_json_fill_fn)(struct http_json *w, void *arg);
+
+/**
+ * http_json_stream_response sets up a chunked response whose body is
+ * generated by calling fill as ulfius asks for more, so the whole body is
+ * never held in memory. free_arg, if not NULL, is called with arg once the
+ * response is done. Returns 0 on success and -1 on failure, in which case
+ * free_arg has already been called.
+ */
+int
+http_json_stream_response(struct _u_response *response, const unsigned int status,
+                          http_json_fill_fn fill, void *arg,
+                          void (*free_arg)(void *arg));
+
+#endif /* _HTTP_JSON_WRITER_H */
+#ifdef __cplusplus
+}
+#endif
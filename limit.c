@@ -0,0 +1,447 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+#include "limit.h"
+
+/**
+ * HTTP_LIMIT_SLOTS is the number of hash chains in each stripe.
+ */
+#define HTTP_LIMIT_SLOTS 64
+
+/**
+ * HTTP_LIMIT_KEY_MAX is the longest key kept in a bucket. Longer route names
+ * are truncated, so routes that share a long prefix and a hash share a
+ * bucket.
+ */
+#define HTTP_LIMIT_KEY_MAX 64
+
+enum {
+    HTTP_LIMIT_CLIENT,
+    HTTP_LIMIT_ROUTE,
+};
+
+/**
+ * http_limit_bucket_t is the token bucket for a client or route.
+ */
+struct http_limit_bucket_t {
+    uint64_t hash;
+    uint64_t last;
+    double tokens;
+    uint8_t kind;
+    uint8_t key_len;
+    unsigned char key[HTTP_LIMIT_KEY_MAX];
+    struct http_limit_bucket_t *next;
+};
+
+/**
+ * http_limit_stripe_t is a slice of the bucket table under its own spin
+ * lock, which is only held to update a bucket or unlink idle ones. Keys that
+ * don't fit in the table share the stripe's overflow buckets.
+ */
+struct http_limit_stripe_t {
+    uint8_t lock;
+    struct http_limit_bucket_t *slots[HTTP_LIMIT_SLOTS];
+    struct http_limit_bucket_t overflow[2];
+} __attribute__((aligned(64)));
+
+struct http_limiter {
+    struct http_limit_config config;
+    struct http_limit_stripe_t stripes[HTTP_LIMIT_STRIPES];
+    size_t bucket_count;
+    unsigned int in_flight;
+    uint64_t latency_us;
+    pthread_t expiry;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+};
+
+/**
+ * limit_current is the limiter that admitted the request the thread is
+ * handling, if any.
+ */
+static __thread struct http_limiter *limit_current;
+static __thread uint64_t limit_random;
+
+static inline void
+http_limit_lock(struct http_limit_stripe_t *stripe)
+{
+    while (__atomic_test_and_set(&stripe->lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static inline void
+http_limit_unlock(struct http_limit_stripe_t *stripe)
+{
+    __atomic_clear(&stripe->lock, __ATOMIC_RELEASE);
+}
+
+static uint64_t
+http_limit_hash(const uint8_t kind, const unsigned char *key, const size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ kind;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+void
+http_limiter_expire(struct http_limiter *limiter, const uint64_t now)
+{
+    uint64_t idle = (uint64_t)limiter->config.idle_secs * 1000000000ULL;
+
+    for (int i = 0; i < HTTP_LIMIT_STRIPES; i++) {
+        struct http_limit_stripe_t *stripe = &limiter->stripes[i];
+        struct http_limit_bucket_t *expired = NULL;
+
+        http_limit_lock(stripe);
+        for (int j = 0; j < HTTP_LIMIT_SLOTS; j++) {
+            struct http_limit_bucket_t **p = &stripe->slots[j];
+            while (*p != NULL) {
+                struct http_limit_bucket_t *b = *p;
+                // a request can take from the bucket after now was read,
+                // leaving last ahead of it
+                if (b->last < now && now - b->last > idle) {
+                    *p = b->next;
+                    b->next = expired;
+                    expired = b;
+                } else {
+                    p = &b->next;
+                }
+            }
+        }
+        http_limit_unlock(stripe);
+
+        while (expired != NULL) {
+            struct http_limit_bucket_t *next = expired->next;
+            free(expired);
+            __atomic_sub_fetch(&limiter->bucket_count, 1, __ATOMIC_RELAXED);
+            expired = next;
+        }
+    }
+}
+
+static void*
+http_limit_expiry_thread(void *arg)
+{
+    struct http_limiter *limiter = (struct http_limiter*)arg;
+    unsigned int interval = limiter->config.idle_secs / 2 > 0 ? limiter->config.idle_secs / 2 : 1;
+
+    pthread_mutex_lock(&limiter->lock);
+    while (limiter->running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += interval;
+        pthread_cond_timedwait(&limiter->cond, &limiter->lock, &ts);
+        if (!limiter->running) {
+            break;
+        }
+
+        pthread_mutex_unlock(&limiter->lock);
+        http_limiter_expire(limiter, http_timer_start());
+        pthread_mutex_lock(&limiter->lock);
+    }
+    pthread_mutex_unlock(&limiter->lock);
+
+    return NULL;
+}
+
+struct http_limiter*
+http_limiter_new(const struct http_limit_config *config)
+{
+    struct http_limiter *limiter = calloc(1, sizeof(struct http_limiter));
+    if (limiter == NULL) {
+        return NULL;
+    }
+    limiter->config = *config;
+    if (limiter->config.idle_secs == 0) {
+        limiter->config.idle_secs = 60;
+    }
+    if (limiter->config.client_burst == 0) {
+        limiter->config.client_burst = 1;
+    }
+    if (limiter->config.route_burst == 0) {
+        limiter->config.route_burst = 1;
+    }
+    for (int i = 0; i < HTTP_LIMIT_STRIPES; i++) {
+        limiter->stripes[i].overflow[HTTP_LIMIT_CLIENT].tokens = limiter->config.client_burst;
+        limiter->stripes[i].overflow[HTTP_LIMIT_ROUTE].tokens = limiter->config.route_burst;
+    }
+
+    pthread_mutex_init(&limiter->lock, NULL);
+    pthread_cond_init(&limiter->cond, NULL);
+    limiter->running = 1;
+    if (pthread_create(&limiter->expiry, NULL, http_limit_expiry_thread, limiter) != 0) {
+        pthread_cond_destroy(&limiter->cond);
+        pthread_mutex_destroy(&limiter->lock);
+        free(limiter);
+        return NULL;
+    }
+
+    return limiter;
+}
+
+void
+http_limiter_free(struct http_limiter *limiter)
+{
+    if (limiter == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&limiter->lock);
+    limiter->running = 0;
+    pthread_cond_signal(&limiter->cond);
+    pthread_mutex_unlock(&limiter->lock);
+    pthread_join(limiter->expiry, NULL);
+
+    for (int i = 0; i < HTTP_LIMIT_STRIPES; i++) {
+        for (int j = 0; j < HTTP_LIMIT_SLOTS; j++) {
+            struct http_limit_bucket_t *b = limiter->stripes[i].slots[j];
+            while (b != NULL) {
+                struct http_limit_bucket_t *next = b->next;
+                free(b);
+                b = next;
+            }
+        }
+    }
+    pthread_cond_destroy(&limiter->cond);
+    pthread_mutex_destroy(&limiter->lock);
+
+    free(limiter);
+}
+
+unsigned int
+http_limiter_in_flight(struct http_limiter *limiter)
+{
+    return limiter != NULL ? __atomic_load_n(&limiter->in_flight, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * http_limit_take takes a token from the bucket for the given key, creating
+ * it full if it doesn't exist. Returns 0 if there was one and otherwise the
+ * seconds until there will be.
+ */
+static unsigned int
+http_limit_take(struct http_limiter *limiter, const uint8_t kind, const unsigned char *key,
+                size_t len, const double rate, const unsigned int burst, const uint64_t now)
+{
+    if (len > HTTP_LIMIT_KEY_MAX) {
+        len = HTTP_LIMIT_KEY_MAX;
+    }
+    uint64_t hash = http_limit_hash(kind, key, len);
+    struct http_limit_stripe_t *stripe = &limiter->stripes[hash % HTTP_LIMIT_STRIPES];
+    struct http_limit_bucket_t **slot = &stripe->slots[(hash >> 32) % HTTP_LIMIT_SLOTS];
+    struct http_limit_bucket_t *fresh = NULL;
+    unsigned int wait = 0;
+
+    http_limit_lock(stripe);
+    struct http_limit_bucket_t *b = *slot;
+    while (b != NULL && !(b->hash == hash && b->kind == kind && b->key_len == len &&
+           memcmp(b->key, key, len) == 0)) {
+        b = b->next;
+    }
+
+    if (b == NULL) {
+        // allocating under the spin lock is rare enough, it's once per key
+        if (__atomic_load_n(&limiter->bucket_count, __ATOMIC_RELAXED) < limiter->config.max_buckets ||
+            limiter->config.max_buckets == 0) {
+            fresh = malloc(sizeof(struct http_limit_bucket_t));
+        }
+        if (fresh != NULL) {
+            fresh->hash = hash;
+            fresh->last = now;
+            fresh->tokens = burst;
+            fresh->kind = kind;
+            fresh->key_len = (uint8_t)len;
+            memcpy(fresh->key, key, len);
+            fresh->next = *slot;
+            *slot = fresh;
+            b = fresh;
+        } else {
+            b = &stripe->overflow[kind];
+        }
+    }
+
+    if (now > b->last) {
+        double tokens = b->tokens + (double)(now - b->last) * rate / 1e9;
+        b->tokens = tokens > burst ? burst : tokens;
+        b->last = now;
+    }
+    if (b->tokens >= 1) {
+        b->tokens -= 1;
+    } else {
+        wait = (unsigned int)((1 - b->tokens) / rate) + 1;
+    }
+    http_limit_unlock(stripe);
+
+    if (fresh != NULL) {
+        __atomic_add_fetch(&limiter->bucket_count, 1, __ATOMIC_RELAXED);
+    }
+
+    return wait;
+}
+
+/**
+ * http_limit_finish drops the in-flight count of the request admitted on
+ * the calling thread.
+ */
+static struct http_limiter*
+http_limit_finish(void)
+{
+    struct http_limiter *limiter = limit_current;
+
+    if (limiter != NULL) {
+        limit_current = NULL;
+        __atomic_sub_fetch(&limiter->in_flight, 1, __ATOMIC_RELAXED);
+    }
+
+    return limiter;
+}
+
+void
+http_limiter_release(const uint64_t duration_ns)
+{
+    struct http_limiter *limiter = http_limit_finish();
+    if (limiter == NULL || limiter->config.max_latency_ms == 0) {
+        return;
+    }
+
+    // moving average over roughly the last 16 requests
+    uint64_t sample = duration_ns / 1000;
+    uint64_t old = __atomic_load_n(&limiter->latency_us, __ATOMIC_RELAXED);
+    uint64_t avg;
+    do {
+        avg = old + sample / 16 - old / 16;
+    } while (!__atomic_compare_exchange_n(&limiter->latency_us, &old, avg, 1,
+                 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * http_limit_shed_latency decides whether to shed a request because the
+ * average latency is over the limit, shedding a larger share the further
+ * over it is.
+ */
+static int
+http_limit_shed_latency(struct http_limiter *limiter)
+{
+    uint64_t limit = (uint64_t)limiter->config.max_latency_ms * 1000;
+    uint64_t avg = __atomic_load_n(&limiter->latency_us, __ATOMIC_RELAXED);
+
+    if (limit == 0 || avg <= limit) {
+        return 0;
+    }
+
+    uint64_t x = limit_random;
+    if (x == 0) {
+        x = http_timer_start() ^ (uint64_t)(uintptr_t)&limit_random;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    limit_random = x;
+
+    // shed with probability 1 - limit / avg
+    return (x >> 11) % avg >= limit;
+}
+
+/**
+ * http_limit_reject answers the request with the given status and
+ * Retry-After.
+ */
+static int
+http_limit_reject(const struct _u_request *request, struct _u_response *response,
+                  const unsigned int status, const unsigned int retry_after, const uint64_t start)
+{
+    char value[16];
+
+    snprintf(value, sizeof(value), "%u", retry_after);
+    u_map_put(response->map_header, HTTP_RESPONSE_HEADER_RETRY_AFTER, value);
+    ulfius_set_string_body_response(response, status, http_status_reason(status));
+    log_request(request, response, start);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+int
+callback_rate_limit(const struct _u_request *request, struct _u_response *response, void *user_data)
+{
+    struct http_limiter *limiter = (struct http_limiter*)user_data;
+    if (limiter == NULL) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    // a request that was never released can't still be running on this thread
+    http_limit_finish();
+
+    uint64_t now = http_timer_start();
+    const struct http_limit_config *config = &limiter->config;
+
+    unsigned int in_flight = __atomic_add_fetch(&limiter->in_flight, 1, __ATOMIC_RELAXED);
+    if ((config->max_in_flight > 0 && in_flight > config->max_in_flight) ||
+        http_limit_shed_latency(limiter)) {
+        __atomic_sub_fetch(&limiter->in_flight, 1, __ATOMIC_RELAXED);
+        return http_limit_reject(request, response, HTTP_STATUS_CODE_SERVICE_UNAVAILABLE, 1, now);
+    }
+
+    unsigned int wait = 0;
+    struct http_addr client;
+    if (config->client_rate > 0 && http_client_addr(request, &client) == 0) {
+        wait = http_limit_take(limiter, HTTP_LIMIT_CLIENT, client.bytes,
+            http_addr_len(&client), config->client_rate, config->client_burst, now);
+    }
+    // keyed on the route's name rather than the path, so spelling the path
+    // differently doesn't get around the limit and unmatched paths don't
+    // add buckets
+    const char *route = http_request_route(response);
+    if (wait == 0 && config->route_rate > 0 && route != NULL) {
+        wait = http_limit_take(limiter, HTTP_LIMIT_ROUTE,
+            (const unsigned char*)route, strlen(route),
+            config->route_rate, config->route_burst, now);
+    }
+    if (wait > 0) {
+        __atomic_sub_fetch(&limiter->in_flight, 1, __ATOMIC_RELAXED);
+        return http_limit_reject(request, response, HTTP_STATUS_CODE_TOO_MANY_REQUESTS, wait, now);
+    }
+
+    limit_current = limiter;
+
+    return U_CALLBACK_CONTINUE;
+}
@@ -0,0 +1,125 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_LIMIT_H
+#define _HTTP_LIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ulfius.h>
+
+/**
+ * HTTP_LIMIT_STRIPES is the number of locks the bucket table is striped
+ * across.
+ */
+#ifndef HTTP_LIMIT_STRIPES
+#define HTTP_LIMIT_STRIPES 64
+#endif
+
+/**
+ * http_limit_config configures an http_limiter. Rates are in requests per
+ * second with bursts of up to burst requests, and a rate of 0 turns that
+ * limit off. Clients are told apart by their address, as found by
+ * http_client_addr, and routes by the name callback_route gave them;
+ * requests without one have no route limit. Buckets that haven't been used for idle_secs are expired
+ * in the background and the table holds at most max_buckets of them, past
+ * which new keys share an overflow bucket per stripe. Once max_in_flight
+ * requests are being handled, or the average latency goes over
+ * max_latency_ms, requests are shed with a 503. 0 turns either of those off.
+ */
+struct http_limit_config {
+    double client_rate;
+    unsigned int client_burst;
+    double route_rate;
+    unsigned int route_burst;
+    unsigned int max_in_flight;
+    unsigned int max_latency_ms;
+    unsigned int idle_secs;
+    size_t max_buckets;
+};
+
+struct http_limiter;
+
+/**
+ * http_limiter_new creates a limiter with the given configuration and starts
+ * its expiry thread. Returns NULL on failure.
+ */
+struct http_limiter*
+http_limiter_new(const struct http_limit_config *config);
+
+/**
+ * http_limiter_free stops the expiry thread and frees the limiter. No
+ * requests may be using it.
+ */
+void
+http_limiter_free(struct http_limiter *limiter);
+
+/**
+ * http_limiter_in_flight returns the number of admitted requests that
+ * haven't finished.
+ */
+unsigned int
+http_limiter_in_flight(struct http_limiter *limiter);
+
+/**
+ * http_limiter_expire frees the buckets that were idle for more than
+ * idle_secs as of now, a http_timer_start reading. The expiry thread calls
+ * it every idle_secs / 2, so it only needs calling directly to trim the
+ * table sooner.
+ */
+void
+http_limiter_expire(struct http_limiter *limiter, const uint64_t now);
+
+/**
+ * http_limiter_release marks the request admitted on the calling thread as
+ * finished, taking duration_ns into the latency average. log_request calls
+ * it, so it only needs calling directly for requests that aren't logged.
+ * Each thread handles one request at a time, so a request that's never
+ * released is released when the thread's next one is admitted.
+ */
+void
+http_limiter_release(const uint64_t duration_ns);
+
+/**
+ * callback_rate_limit admits or rejects requests with the http_limiter given
+ * as user data. It's meant to be the first callback for a route after
+ * callback_route, before any authentication. Rejected requests get a 429 when their client or route is
+ * over its rate and a 503 when load is being shed, both with a Retry-After,
+ * and the callback returns U_CALLBACK_COMPLETE so the handler isn't called.
+ */
+int
+callback_rate_limit(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+#endif /* _HTTP_LIMIT_H */
+#ifdef __cplusplus
+}
+#endif
@@ -25,289 +25,2159 @@
  * SUCH DAMAGE.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
 
-#include <jansson.h>
+#include "logger.h"
+
+/**
+ * log_output contains the location we're going to write our log entries to.
+ */
+static FILE *log_output;
+
+/**
+ * log_fd is the descriptor behind log_output. The async and buffered modes
+ * write to it directly rather than going through stdio, and entries logged
+ * after they shut down keep doing so, since a partly flushed stdio buffer
+ * would tear lines written by their threads. s_log_init goes back to stdio.
+ */
+static int log_fd = -1;
+
+int s_log_level = S_LOG_TRACE;
+
+/**
+ * log_level_names holds the name of each level, indexed by level, already
+ * quoted for the JSON output.
+ */
+static const struct {
+    const char *name;
+    const char *quoted;
+    size_t quoted_len;
+} log_level_names[] = {
+    [S_LOG_TRACE] = { "trace", "\"trace\"", 7 },
+    [S_LOG_DEBUG] = { "debug", "\"debug\"", 7 },
+    [S_LOG_INFO]  = { "info",  "\"info\"",  6 },
+    [S_LOG_WARN]  = { "warn",  "\"warn\"",  6 },
+    [S_LOG_ERROR] = { "error", "\"error\"", 7 },
+    [S_LOG_FATAL] = { "fatal", "\"fatal\"", 7 },
+};
+
+void
+s_log_set_level(const int level)
+{
+    int l = level;
+    if (l < S_LOG_TRACE) {
+        l = S_LOG_TRACE;
+    } else if (l > S_LOG_FATAL) {
+        l = S_LOG_FATAL;
+    }
+
+    __atomic_store_n(&s_log_level, l, __ATOMIC_RELAXED);
+}
+
+int
+s_log_get_level(void)
+{
+    return __atomic_load_n(&s_log_level, __ATOMIC_RELAXED);
+}
+
+int
+s_log_level_from_string(const char *name)
+{
+    if (name == NULL) {
+        return -1;
+    }
+
+    for (int i = S_LOG_TRACE; i <= S_LOG_FATAL; i++) {
+        if (strcasecmp(name, log_level_names[i].name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+const char*
+s_log_level_string(const int level)
+{
+    if (level < S_LOG_TRACE || level > S_LOG_FATAL) {
+        return "unknown";
+    }
+
+    return log_level_names[level].name;
+}
+
+struct s_log_field_t
+s_log_int(const char *key, const int value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_INT, .key = key, .int_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_int8(const char *key, const int8_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_INT8, .key = key, .int8_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_int16(const char *key, const int16_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_INT16, .key = key, .int16_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_int32(const char *key, const int32_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_INT32, .key = key, .int32_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_int64(const char *key, const int64_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_INT64, .key = key, .int64_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_uint(const char *key, const unsigned int value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_UINT, .key = key, .uint_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_uint8(const char *key, const uint8_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_UINT8, .key = key, .uint8_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_uint16(const char *key, const uint16_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_UINT16, .key = key, .uint16_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_uint32(const char *key, const uint32_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_UINT32, .key = key, .uint32_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_uint64(const char *key, const uint64_t value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_UINT64, .key = key, .uint64_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_float(const char *key, const float value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_FLOAT, .key = key, .float_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_double(const char *key, const double value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_DOUBLE, .key = key, .double_value = value
+    };
+}
+
+struct s_log_field_t
+s_log_string(const char *key, const char *value)
+{
+    return (struct s_log_field_t){
+        .type = S_LOG_STRING, .key = key, .string_value = value
+    };
+}
+
+#ifndef S_LOG_LIMIT_BUCKETS
+#define S_LOG_LIMIT_BUCKETS 1024
+#endif
+
+/**
+ * s_log_bucket_t is the token bucket for a single rate limited key. Keys are
+ * hashed into a fixed table; a key landing on a bucket owned by another key
+ * takes it over with a full bucket.
+ */
+struct s_log_bucket_t {
+    uint64_t hash;
+    uint64_t last_ns;
+    uint64_t suppressed;
+    double tokens;
+    char lock;
+};
+
+static struct s_log_bucket_t log_limit_buckets[S_LOG_LIMIT_BUCKETS];
+static double log_limit_rate;
+static double log_limit_burst;
+
+void
+s_log_set_rate_limit(const double per_second, const unsigned int burst)
+{
+    log_limit_rate = per_second > 0 ? per_second : 0;
+    log_limit_burst = burst > 0 ? burst : 1;
+}
+
+/**
+ * s_log_hash returns the FNV-1a hash of the given string.
+ */
+static uint64_t
+s_log_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+int
+s_log_allow(const char *key, uint64_t *suppressed)
+{
+    *suppressed = 0;
+
+    if (log_limit_rate == 0 || key == NULL) {
+        return 1;
+    }
+
+    uint64_t hash = s_log_hash(key);
+    struct s_log_bucket_t *b = &log_limit_buckets[hash % S_LOG_LIMIT_BUCKETS];
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+
+    while (__atomic_test_and_set(&b->lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    if (b->hash != hash) {
+        b->hash = hash;
+        b->tokens = log_limit_burst;
+        b->suppressed = 0;
+    } else {
+        b->tokens += (double)(now - b->last_ns) / 1e9 * log_limit_rate;
+        if (b->tokens > log_limit_burst) {
+            b->tokens = log_limit_burst;
+        }
+    }
+    b->last_ns = now;
+
+    int allowed = b->tokens >= 1;
+    if (allowed) {
+        b->tokens -= 1;
+        *suppressed = b->suppressed;
+        b->suppressed = 0;
+    } else {
+        b->suppressed++;
+    }
+
+    __atomic_clear(&b->lock, __ATOMIC_RELEASE);
+
+    return allowed;
+}
+
+/**
+ * s_log_buf_t is a growable buffer log entries are serialized into before
+ * being written out. Each thread keeps its own and reuses it across entries.
+ */
+struct s_log_buf_t {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static __thread struct s_log_buf_t log_buf;
+
+/**
+ * log_buf_key frees a thread's log_buf when the thread exits. It's only set
+ * once the buffer has been allocated.
+ */
+static pthread_key_t log_buf_key;
+static pthread_once_t log_buf_once = PTHREAD_ONCE_INIT;
+
+static void
+s_log_buf_free(void *arg)
+{
+    struct s_log_buf_t *buf = (struct s_log_buf_t*)arg;
+
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+static void
+s_log_buf_key_create(void)
+{
+    pthread_key_create(&log_buf_key, s_log_buf_free);
+}
+
+/**
+ * s_log_context_t holds the calling thread's log context, serialized once in
+ * the current output format so each entry only has to copy it. count is the
+ * number of fields it holds.
+ */
+struct s_log_context_t {
+    struct s_log_buf_t buf;
+    uint16_t count;
+};
+
+static __thread struct s_log_context_t log_context;
+
+/**
+ * log_context_key frees a thread's log context when the thread exits.
+ */
+static pthread_key_t log_context_key;
+static pthread_once_t log_context_once = PTHREAD_ONCE_INIT;
+
+static void
+s_log_context_free(void *arg)
+{
+    struct s_log_context_t *ctx = (struct s_log_context_t*)arg;
+
+    s_log_buf_free(&ctx->buf);
+    ctx->count = 0;
+}
+
+static void
+s_log_context_key_create(void)
+{
+    pthread_key_create(&log_context_key, s_log_context_free);
+}
+
+/**
+ * s_log_buf_reserve makes sure the buffer has room for at least n more bytes.
+ * Returns 0 on success and -1 if the buffer couldn't be grown.
+ */
+static int
+s_log_buf_reserve(struct s_log_buf_t *buf, const size_t n)
+{
+    if (buf->len + n <= buf->cap) {
+        return 0;
+    }
+
+    size_t cap = buf->cap ? buf->cap : 512;
+    while (cap < buf->len + n) {
+        cap *= 2;
+    }
+
+    char *data = (char*)realloc(buf->data, cap);
+    if (data == NULL) {
+        return -1;
+    }
+    if (buf->data == NULL && buf == &log_buf) {
+        pthread_once(&log_buf_once, s_log_buf_key_create);
+        pthread_setspecific(log_buf_key, buf);
+    }
+    buf->data = data;
+    buf->cap = cap;
+
+    return 0;
+}
+
+static void
+s_log_buf_append(struct s_log_buf_t *buf, const char *s, const size_t n)
+{
+    if (s_log_buf_reserve(buf, n) != 0) {
+        return;
+    }
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+}
+
+static void
+s_log_buf_putc(struct s_log_buf_t *buf, const char c)
+{
+    if (s_log_buf_reserve(buf, 1) != 0) {
+        return;
+    }
+    buf->data[buf->len++] = c;
+}
+
+static void
+s_log_append_uint(struct s_log_buf_t *buf, uint64_t value)
+{
+    char tmp[20];
+    size_t i = sizeof(tmp);
+
+    do {
+        tmp[--i] = (char)('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    s_log_buf_append(buf, tmp + i, sizeof(tmp) - i);
+}
+
+static void
+s_log_append_int(struct s_log_buf_t *buf, const int64_t value)
+{
+    if (value < 0) {
+        s_log_buf_putc(buf, '-');
+        s_log_append_uint(buf, (uint64_t)0 - (uint64_t)value);
+        return;
+    }
+    s_log_append_uint(buf, (uint64_t)value);
+}
+
+/**
+ * s_log_append_double writes the value the same way jansson does, making
+ * sure it always reads back as a real. JSON has no representation for NaN or
+ * infinity so those are written as null.
+ */
+static void
+s_log_append_double(struct s_log_buf_t *buf, const double value)
+{
+    if (value != value || value - value != 0) {
+        s_log_buf_append(buf, "null", 4);
+        return;
+    }
+
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.17g", value);
+    if (n <= 0 || (size_t)n >= sizeof(tmp)) {
+        s_log_buf_append(buf, "null", 4);
+        return;
+    }
+    s_log_buf_append(buf, tmp, (size_t)n);
+
+    if (strpbrk(tmp, ".eE") == NULL) {
+        s_log_buf_append(buf, ".0", 2);
+    }
+}
+
+#define S_LOG_ONES  0x0101010101010101ULL
+#define S_LOG_HIGHS 0x8080808080808080ULL
+
+/**
+ * s_log_needs_escape reports whether any of the 8 bytes in the given word is
+ * a quote, a backslash or a control character.
+ */
+static inline uint64_t
+s_log_needs_escape(const uint64_t w)
+{
+    uint64_t quote = w ^ (S_LOG_ONES * '"');
+    uint64_t slash = w ^ (S_LOG_ONES * '\\');
+
+    return (((quote - S_LOG_ONES) & ~quote) |
+            ((slash - S_LOG_ONES) & ~slash) |
+            ((w - S_LOG_ONES * 0x20) & ~w)) & S_LOG_HIGHS;
+}
+
+/**
+ * s_log_clean_prefix returns how many leading bytes of the string can be
+ * copied without escaping. Runs of clean bytes are checked a word at a time.
+ */
+static size_t
+s_log_clean_prefix(const char *s, const size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, sizeof(w));
+        if (s_log_needs_escape(w)) {
+            break;
+        }
+    }
+
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * s_log_append_string writes the given string as a quoted and escaped JSON
+ * string. A NULL string is written as null.
+ */
+static void
+s_log_append_string(struct s_log_buf_t *buf, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (s == NULL) {
+        s_log_buf_append(buf, "null", 4);
+        return;
+    }
+
+    size_t len = strlen(s);
+
+    s_log_buf_putc(buf, '"');
+
+    while (len > 0) {
+        size_t clean = s_log_clean_prefix(s, len);
+        s_log_buf_append(buf, s, clean);
+        s += clean;
+        len -= clean;
+
+        if (len == 0) {
+            break;
+        }
+
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+            case '"':
+                s_log_buf_append(buf, "\\\"", 2);
+                break;
+            case '\\':
+                s_log_buf_append(buf, "\\\\", 2);
+                break;
+            case '\b':
+                s_log_buf_append(buf, "\\b", 2);
+                break;
+            case '\f':
+                s_log_buf_append(buf, "\\f", 2);
+                break;
+            case '\n':
+                s_log_buf_append(buf, "\\n", 2);
+                break;
+            case '\r':
+                s_log_buf_append(buf, "\\r", 2);
+                break;
+            case '\t':
+                s_log_buf_append(buf, "\\t", 2);
+                break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                s_log_buf_append(buf, esc, sizeof(esc));
+            }
+        }
+        s++;
+        len--;
+    }
+
+    s_log_buf_putc(buf, '"');
+}
+
+/**
+ * s_log_append_field writes the given field as a JSON key/value pair.
+ */
+static void
+s_log_append_field(struct s_log_buf_t *buf, const struct s_log_field_t *field)
+{
+    s_log_buf_putc(buf, ',');
+    s_log_append_string(buf, field->key);
+    s_log_buf_putc(buf, ':');
+
+    switch (field->type) {
+        case S_LOG_INT:
+            s_log_append_int(buf, field->int_value);
+            break;
+        case S_LOG_INT8:
+            s_log_append_int(buf, field->int8_value);
+            break;
+        case S_LOG_INT16:
+            s_log_append_int(buf, field->int16_value);
+            break;
+        case S_LOG_INT32:
+            s_log_append_int(buf, field->int32_value);
+            break;
+        case S_LOG_INT64:
+            s_log_append_int(buf, field->int64_value);
+            break;
+        case S_LOG_UINT:
+            s_log_append_uint(buf, field->uint_value);
+            break;
+        case S_LOG_UINT8:
+            s_log_append_uint(buf, field->uint8_value);
+            break;
+        case S_LOG_UINT16:
+            s_log_append_uint(buf, field->uint16_value);
+            break;
+        case S_LOG_UINT32:
+            s_log_append_uint(buf, field->uint32_value);
+            break;
+        case S_LOG_UINT64:
+            s_log_append_uint(buf, field->uint64_value);
+            break;
+        case S_LOG_FLOAT:
+            s_log_append_double(buf, field->float_value);
+            break;
+        case S_LOG_DOUBLE:
+            s_log_append_double(buf, field->double_value);
+            break;
+        case S_LOG_STRING:
+            s_log_append_string(buf, field->string_value);
+            break;
+        default:
+            s_log_buf_append(buf, "null", 4);
+    }
+}
+
+/**
+ * s_log_now_ms returns the wall clock time in milliseconds. The coarse clock
+ * is served from the vDSO without reading the hardware counter, and its
+ * resolution of a few milliseconds at most is plenty for log timestamps.
+ */
+static uint64_t
+s_log_now_ms(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * log_format is the output format entries are written in.
+ */
+static int log_format = S_LOG_FORMAT_JSON;
+
+void
+s_log_set_format(const int format)
+{
+    log_format = format;
+}
+
+static void
+s_log_format_binary(struct s_log_buf_t *buf, const int l,
+                    const struct s_log_field_t *fields, const size_t count);
+
+/**
+ * s_log_format serializes a complete log entry, including the trailing
+ * newline, onto the end of the given buffer.
+ */
+static void
+s_log_format(struct s_log_buf_t *buf, const int l,
+             const struct s_log_field_t *fields, const size_t count)
+{
+    if (log_format == S_LOG_FORMAT_BINARY) {
+        s_log_format_binary(buf, l, fields, count);
+        return;
+    }
+
+    // UNIX timestamp format, with millisecond precision
+    uint64_t now = s_log_now_ms();
+    char ms[4] = {
+        '.',
+        (char)('0' + (now / 100) % 10),
+        (char)('0' + (now / 10) % 10),
+        (char)('0' + now % 10),
+    };
+
+    s_log_buf_append(buf, "{\"level\":", 9);
+    if (l >= S_LOG_TRACE && l <= S_LOG_FATAL) {
+        s_log_buf_append(buf, log_level_names[l].quoted,
+            log_level_names[l].quoted_len);
+    } else {
+        s_log_append_int(buf, l);
+    }
+    s_log_buf_append(buf, ",\"timestamp\":", 13);
+    s_log_append_uint(buf, now / 1000);
+    s_log_buf_append(buf, ms, sizeof(ms));
+
+    for (size_t i = 0; i < count; i++) {
+        s_log_append_field(buf, &fields[i]);
+    }
+    if (log_context.count > 0) {
+        s_log_buf_append(buf, log_context.buf.data, log_context.buf.len);
+    }
+
+    s_log_buf_append(buf, "}\n", 2);
+}
+
+#ifndef S_LOG_ASYNC_RECORD_SIZE
+#define S_LOG_ASYNC_RECORD_SIZE 1024
+#endif
+
+/**
+ * S_LOG_ASYNC_BATCH is the most entries the writer thread hands to a single
+ * writev call and S_LOG_ASYNC_WAIT_MS is how long it sleeps when idle.
+ */
+#define S_LOG_ASYNC_BATCH   64
+#define S_LOG_ASYNC_WAIT_MS 50
+
+/**
+ * s_log_slot_t is a single entry in the async ring buffer. seq hands the
+ * slot back and forth between the producers and the writer thread.
+ */
+struct s_log_slot_t {
+    uint64_t seq;
+    size_t len;
+    char data[S_LOG_ASYNC_RECORD_SIZE];
+};
+
+/**
+ * s_log_async_t holds the state of the async logger. Producers claim slots
+ * by advancing enqueue_pos with a CAS while dequeue_pos is only ever moved by
+ * the writer thread. producers counts the threads inside
+ * s_log_async_enqueue, so shutdown can wait for them before the ring goes
+ * away.
+ */
+struct s_log_async_t {
+    int enabled;
+    int overflow;
+    int stop;
+    int sleeping;
+    struct s_log_slot_t *slots;
+    uint64_t mask;
+    uint64_t dropped;
+    uint64_t dropped_reported;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int producers __attribute__((aligned(64)));
+    uint64_t enqueue_pos __attribute__((aligned(64)));
+    uint64_t dequeue_pos __attribute__((aligned(64)));
+};
+
+static struct s_log_async_t log_async = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * log_write_lock serializes writes to log_fd so batches never interleave.
+ */
+static pthread_mutex_t log_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * s_log_write_all writes out every given buffer, picking up where a short
+ * write left off.
+ */
+static void
+s_log_write_all(const int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+}
+
+static int s_log_file_enabled(void);
+static void s_log_file_write(const char *data, const size_t len);
+
+/**
+ * s_log_write_unlocked writes a single entry straight to the output
+ * descriptor, or the current segment when logging to a file. Called with
+ * log_write_lock held.
+ */
+static void
+s_log_write_unlocked(const char *data, const size_t len)
+{
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = len };
+
+    if (s_log_file_enabled()) {
+        s_log_file_write(data, len);
+    } else {
+        s_log_write_all(log_fd, &iov, 1);
+    }
+}
+
+/**
+ * s_log_write_locked is s_log_write_unlocked for callers not holding
+ * log_write_lock.
+ */
+static void
+s_log_write_locked(const char *data, const size_t len)
+{
+    pthread_mutex_lock(&log_write_lock);
+    s_log_write_unlocked(data, len);
+    pthread_mutex_unlock(&log_write_lock);
+}
+
+/**
+ * s_log_async_push copies an entry into the next free slot of the ring.
+ * Returns -1 if the ring is full.
+ */
+static int
+s_log_async_push(const char *data, const size_t len)
+{
+    struct s_log_slot_t *slot;
+    uint64_t pos = __atomic_load_n(&log_async.enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &log_async.slots[pos & log_async.mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_async.enqueue_pos, &pos,
+                    pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&log_async.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * s_log_async_wake wakes the writer thread if it's waiting for entries.
+ */
+static void
+s_log_async_wake(void)
+{
+    if (__atomic_load_n(&log_async.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&log_async.lock);
+        pthread_cond_signal(&log_async.wake);
+        pthread_mutex_unlock(&log_async.lock);
+    }
+}
+
+/**
+ * s_log_async_enqueue hands an entry to the writer thread, applying the
+ * configured overflow policy when the ring is full. Entries too large for a
+ * slot, and entries logged once shutdown has started, are written directly.
+ */
+static void
+s_log_async_enqueue(const char *data, const size_t len)
+{
+    if (len > S_LOG_ASYNC_RECORD_SIZE) {
+        s_log_write_locked(data, len);
+        return;
+    }
+
+    // shutdown clears enabled before waiting for producers to leave, so
+    // either it waits for this one or this one sees it and doesn't touch
+    // the ring
+    __atomic_add_fetch(&log_async.producers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&log_async.enabled, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&log_async.producers, 1, __ATOMIC_RELEASE);
+        s_log_write_locked(data, len);
+        return;
+    }
+
+    // the writer keeps draining until every producer has left, so a
+    // blocked push always gets a slot
+    while (s_log_async_push(data, len) != 0) {
+        if (log_async.overflow != S_LOG_OVERFLOW_BLOCK) {
+            __atomic_add_fetch(&log_async.dropped, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        s_log_async_wake();
+        sched_yield();
+    }
+
+    s_log_async_wake();
+    __atomic_sub_fetch(&log_async.producers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * s_log_async_drain writes out everything currently in the ring in batches
+ * of up to S_LOG_ASYNC_BATCH entries. Only called by the writer thread.
+ * Returns the number of entries written.
+ */
+static size_t
+s_log_async_drain(void)
+{
+    struct iovec iov[S_LOG_ASYNC_BATCH];
+    size_t total = 0;
+
+    for (;;) {
+        uint64_t pos = log_async.dequeue_pos;
+        int cnt = 0;
+
+        while (cnt < S_LOG_ASYNC_BATCH) {
+            struct s_log_slot_t *slot =
+                &log_async.slots[(pos + cnt) & log_async.mask];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + cnt + 1) {
+                break;
+            }
+            iov[cnt].iov_base = slot->data;
+            iov[cnt].iov_len = slot->len;
+            cnt++;
+        }
+
+        if (cnt == 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&log_write_lock);
+        s_log_write_all(log_fd, iov, cnt);
+        pthread_mutex_unlock(&log_write_lock);
+
+        for (int i = 0; i < cnt; i++) {
+            struct s_log_slot_t *slot =
+                &log_async.slots[(pos + i) & log_async.mask];
+            __atomic_store_n(&slot->seq, pos + i + log_async.mask + 1,
+                __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&log_async.dequeue_pos, pos + cnt, __ATOMIC_RELEASE);
+
+        total += (size_t)cnt;
+    }
+
+    return total;
+}
+
+/**
+ * s_log_async_report_drops logs how many entries were dropped since the last
+ * report when the S_LOG_OVERFLOW_DROP_COUNT policy is in use.
+ */
+static void
+s_log_async_report_drops(void)
+{
+    if (log_async.overflow != S_LOG_OVERFLOW_DROP_COUNT) {
+        return;
+    }
+
+    uint64_t dropped = __atomic_load_n(&log_async.dropped, __ATOMIC_RELAXED);
+    if (dropped == log_async.dropped_reported) {
+        return;
+    }
+
+    struct s_log_field_t fields[] = {
+        s_log_string("msg", "log entries dropped"),
+        s_log_uint64("dropped", dropped - log_async.dropped_reported),
+    };
+    log_buf.len = 0;
+    s_log_format(&log_buf, S_LOG_WARN, fields, 2);
+    s_log_write_locked(log_buf.data, log_buf.len);
+
+    log_async.dropped_reported = dropped;
+}
+
+static void*
+s_log_async_writer(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        size_t written = s_log_async_drain();
+        s_log_async_report_drops();
+
+        if (__atomic_load_n(&log_async.stop, __ATOMIC_ACQUIRE)) {
+            s_log_async_drain();
+            s_log_async_report_drops();
+            break;
+        }
+
+        if (written > 0) {
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += S_LOG_ASYNC_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&log_async.lock);
+        __atomic_store_n(&log_async.sleeping, 1, __ATOMIC_SEQ_CST);
+        if (s_log_queue_depth() == 0 &&
+            !__atomic_load_n(&log_async.stop, __ATOMIC_ACQUIRE)) {
+            pthread_cond_timedwait(&log_async.wake, &log_async.lock, &deadline);
+        }
+        __atomic_store_n(&log_async.sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&log_async.lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * s_log_tbuf_t is a thread's batch of formatted entries in buffered mode.
+ * The lock is only contended when another thread flushes every batch.
+ */
+struct s_log_tbuf_t {
+    struct s_log_buf_t buf;
+    pthread_mutex_t lock;
+    struct s_log_tbuf_t *prev;
+    struct s_log_tbuf_t *next;
+};
+
+/**
+ * s_log_batch_t holds the state of the buffered logger. lock protects the
+ * list of thread buffers and is always taken before a buffer's own lock.
+ */
+struct s_log_batch_t {
+    int enabled;
+    int stop;
+    size_t flush_bytes;
+    unsigned int flush_ms;
+    struct s_log_tbuf_t *head;
+    pthread_key_t key;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+static struct s_log_batch_t log_batch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread struct s_log_tbuf_t *log_tbuf;
+
+/**
+ * s_log_tbuf_flush_locked writes out the given batch. The caller must hold
+ * the buffer's lock.
+ */
+static void
+s_log_tbuf_flush_locked(struct s_log_tbuf_t *tb)
+{
+    if (tb->buf.len > 0) {
+        s_log_write_locked(tb->buf.data, tb->buf.len);
+        tb->buf.len = 0;
+    }
+}
+
+/**
+ * s_log_tbuf_free is called when a thread exits to write out and release its
+ * batch buffer.
+ */
+static void
+s_log_tbuf_free(void *arg)
+{
+    struct s_log_tbuf_t *tb = (struct s_log_tbuf_t*)arg;
+
+    pthread_mutex_lock(&log_batch.lock);
+    if (tb->prev != NULL) {
+        tb->prev->next = tb->next;
+    } else {
+        log_batch.head = tb->next;
+    }
+    if (tb->next != NULL) {
+        tb->next->prev = tb->prev;
+    }
+    pthread_mutex_lock(&tb->lock);
+    s_log_tbuf_flush_locked(tb);
+    pthread_mutex_unlock(&tb->lock);
+    pthread_mutex_unlock(&log_batch.lock);
+
+    pthread_mutex_destroy(&tb->lock);
+    free(tb->buf.data);
+    free(tb);
+}
+
+/**
+ * s_log_tbuf_get returns the calling thread's batch buffer, creating and
+ * registering it on first use. Returns NULL if it couldn't be allocated.
+ */
+static struct s_log_tbuf_t*
+s_log_tbuf_get(void)
+{
+    if (log_tbuf != NULL) {
+        return log_tbuf;
+    }
+
+    struct s_log_tbuf_t *tb =
+        (struct s_log_tbuf_t*)calloc(1, sizeof(struct s_log_tbuf_t));
+    if (tb == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&tb->lock, NULL);
+
+    pthread_mutex_lock(&log_batch.lock);
+    tb->next = log_batch.head;
+    if (log_batch.head != NULL) {
+        log_batch.head->prev = tb;
+    }
+    log_batch.head = tb;
+    pthread_mutex_unlock(&log_batch.lock);
+
+    pthread_setspecific(log_batch.key, tb);
+    log_tbuf = tb;
+
+    return tb;
+}
+
+/**
+ * s_log_batch_flush writes out the pending batch of every thread.
+ */
+static void
+s_log_batch_flush(void)
+{
+    pthread_mutex_lock(&log_batch.lock);
+    for (struct s_log_tbuf_t *tb = log_batch.head; tb != NULL; tb = tb->next) {
+        pthread_mutex_lock(&tb->lock);
+        s_log_tbuf_flush_locked(tb);
+        pthread_mutex_unlock(&tb->lock);
+    }
+    pthread_mutex_unlock(&log_batch.lock);
+}
+
+/**
+ * s_log_batch_append formats an entry into the calling thread's batch and
+ * writes the batch out once it reaches the configured size.
+ */
+static void
+s_log_batch_append(const int l, const struct s_log_field_t *fields,
+                   const size_t count)
+{
+    struct s_log_tbuf_t *tb = s_log_tbuf_get();
+    if (tb == NULL) {
+        log_buf.len = 0;
+        s_log_format(&log_buf, l, fields, count);
+        s_log_write_locked(log_buf.data, log_buf.len);
+        return;
+    }
+
+    pthread_mutex_lock(&tb->lock);
+    s_log_format(&tb->buf, l, fields, count);
+    if (tb->buf.len >= log_batch.flush_bytes) {
+        s_log_tbuf_flush_locked(tb);
+    }
+    pthread_mutex_unlock(&tb->lock);
+}
+
+/**
+ * s_log_batch_flusher periodically writes out batches that haven't filled up
+ * so entries from quiet threads aren't held back indefinitely.
+ */
+static void*
+s_log_batch_flusher(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&log_batch.lock);
+    while (!log_batch.stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += log_batch.flush_ms / 1000;
+        deadline.tv_nsec += (long)(log_batch.flush_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&log_batch.wake, &log_batch.lock, &deadline);
+        if (log_batch.stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&log_batch.lock);
+        s_log_batch_flush();
+        pthread_mutex_lock(&log_batch.lock);
+    }
+    pthread_mutex_unlock(&log_batch.lock);
+
+    return NULL;
+}
+
+/**
+ * s_log_batch_shutdown stops the flusher thread and writes out every batch.
+ */
+static void
+s_log_batch_shutdown(void)
+{
+    int enabled = 1;
+    if (!__atomic_compare_exchange_n(&log_batch.enabled, &enabled, 0, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    if (log_batch.flush_ms > 0) {
+        pthread_mutex_lock(&log_batch.lock);
+        log_batch.stop = 1;
+        pthread_cond_signal(&log_batch.wake);
+        pthread_mutex_unlock(&log_batch.lock);
+
+        pthread_join(log_batch.flusher, NULL);
+    }
+
+    s_log_batch_flush();
+}
+
+/**
+ * s_log_register_shutdown makes sure pending entries are written when the
+ * process exits.
+ */
+static void
+s_log_register_shutdown(void)
+{
+    static int registered;
+
+    if (!__atomic_exchange_n(&registered, 1, __ATOMIC_ACQ_REL)) {
+        atexit(s_log_shutdown);
+    }
+}
+
+int
+s_log_init_buffered(FILE *out, const size_t flush_bytes,
+                    const unsigned int flush_ms)
+{
+    if (out == NULL || log_async.enabled || log_batch.enabled ||
+        s_log_file_enabled()) {
+        return -1;
+    }
+
+    static int key_created;
+    if (!key_created) {
+        if (pthread_key_create(&log_batch.key, s_log_tbuf_free) != 0) {
+            return -1;
+        }
+        key_created = 1;
+    }
+
+    fflush(out);
+    log_output = out;
+    log_fd = fileno(out);
+
+    log_batch.flush_bytes = flush_bytes;
+    log_batch.flush_ms = flush_ms;
+    log_batch.stop = 0;
+
+    if (flush_ms > 0 &&
+        pthread_create(&log_batch.flusher, NULL, s_log_batch_flusher, NULL) != 0) {
+        return -1;
+    }
+
+    __atomic_store_n(&log_batch.enabled, 1, __ATOMIC_RELEASE);
+    s_log_register_shutdown();
+
+    return 0;
+}
+
+/**
+ * s_log_segment_t is a preallocated segment file mapped into memory. Entries
+ * are appended by copying them in at used.
+ */
+struct s_log_segment_t {
+    int fd;
+    char *base;
+    size_t size;
+    size_t used;
+    time_t opened;
+};
+
+#ifndef S_LOG_RETIRED
+#define S_LOG_RETIRED 8
+#endif
+
+/**
+ * s_log_file_t holds the state of the file sink. The current segment is
+ * guarded by log_write_lock. The next segment is prepared ahead of time by
+ * the background thread, under lock, so rotating is just a swap, and the
+ * segments rotated out are handed back to it to unmap, trim and close.
+ */
+struct s_log_file_t {
+    int enabled;
+    int stop;
+    char path[PATH_MAX - 32];
+    size_t segment_size;
+    unsigned int rotate_secs;
+    unsigned int fsync_ms;
+    uint64_t seq;
+    struct s_log_segment_t cur;
+    struct s_log_segment_t next;
+    char next_path[PATH_MAX];
+    int next_ready;
+    unsigned int inline_opens;
+    struct s_log_segment_t retired[S_LOG_RETIRED];
+    unsigned int retired_count;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
 
-#include "logger.h"
+static struct s_log_file_t log_file = {
+    .cur = { .fd = -1 },
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static int
+s_log_file_enabled(void)
+{
+    return __atomic_load_n(&log_file.enabled, __ATOMIC_ACQUIRE);
+}
 
 /**
- * s_log_field_types is an enum of the supported log field types.
- */
-enum { 
-    S_LOG_INT, 
-    S_LOG_INT8,
-    S_LOG_INT16,
-    S_LOG_INT32,
-    S_LOG_INT64,
-    S_LOG_UINT, 
-    S_LOG_UINT8,
-    S_LOG_UINT16,
-    S_LOG_UINT32,
-    S_LOG_UINT64,
-    S_LOG_FLOAT,
-    S_LOG_DOUBLE, 
-    S_LOG_STRING
-} s_log_field_types;
-
-/**
- * s_log_field_t represents a field in a log entry and it's associated type.
- */
-struct s_log_field_t {
-    uint8_t type;
-    char *key;
-    union {
-        int int_value;
-        int8_t int8_value;
-        int16_t int16_value;
-        int32_t int32_value;
-        int64_t int64_value;
-        unsigned int uint_value;
-        uint8_t uint8_value;
-        uint16_t uint16_value;
-        uint32_t uint32_value;
-        uint64_t uint64_value;
-        float float_value;
-        double double_value;
-        char *string_value;
-    };
-} s_log_field_t;
+ * s_log_segment_open creates and maps the next segment file, named after the
+ * configured path, the current time and a sequence number. Returns 0 on
+ * success and -1 on failure.
+ */
+static int
+s_log_segment_open(struct s_log_segment_t *seg, char *path, const size_t path_len)
+{
+    time_t now = time(NULL);
+    int fd = -1;
+
+    for (int tries = 0; tries < 100 && fd < 0; tries++) {
+        uint64_t seq = __atomic_fetch_add(&log_file.seq, 1, __ATOMIC_RELAXED);
+        snprintf(path, path_len, "%s.%lu-%lu", log_file.path,
+            (unsigned long)now, (unsigned long)seq);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (posix_fallocate(fd, 0, (off_t)log_file.segment_size) != 0 &&
+        ftruncate(fd, (off_t)log_file.segment_size) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    void *base = mmap(NULL, log_file.segment_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    seg->fd = fd;
+    seg->base = (char*)base;
+    seg->size = log_file.segment_size;
+    seg->used = 0;
+    seg->opened = now;
+
+    return 0;
+}
 
 /**
- * log_output contains the location we're going to write our log entries to.
+ * s_log_segment_close unmaps the given segment and trims the file down to
+ * what was written.
  */
-static FILE *log_output;
+static void
+s_log_segment_close(struct s_log_segment_t *seg, const int sync)
+{
+    if (seg->base == NULL) {
+        return;
+    }
 
-void
-s_log_init(FILE *out)
+    munmap(seg->base, seg->size);
+    if (ftruncate(seg->fd, (off_t)seg->used) != 0) {
+        // the tail stays zero filled, which readers skip
+    }
+    if (sync) {
+        fdatasync(seg->fd);
+    }
+    close(seg->fd);
+
+    seg->base = NULL;
+    seg->fd = -1;
+}
+
+static void s_log_file_write_keys(void);
+
+/**
+ * s_log_file_rotate switches to the segment the background thread prepared
+ * and hands the old one to it to close, so writers waiting on the lock don't
+ * wait on munmap and ftruncate. A segment is only opened or closed here if
+ * the background thread has fallen behind. Called with log_write_lock held.
+ */
+static void
+s_log_file_rotate(void)
 {
-    log_output = out;
+    struct s_log_segment_t old = log_file.cur;
+    int retired = 0;
+
+    pthread_mutex_lock(&log_file.lock);
+    if (log_file.next_ready) {
+        log_file.cur = log_file.next;
+        log_file.next_ready = 0;
+    } else {
+        char path[PATH_MAX];
+        log_file.inline_opens++;
+        if (s_log_segment_open(&log_file.cur, path, sizeof(path)) != 0) {
+            log_file.cur.base = NULL;
+            log_file.cur.fd = -1;
+        }
+    }
+    if (old.base != NULL && log_file.retired_count < S_LOG_RETIRED) {
+        log_file.retired[log_file.retired_count++] = old;
+        retired = 1;
+    }
+    pthread_cond_signal(&log_file.wake);
+    pthread_mutex_unlock(&log_file.lock);
+
+    if (old.base != NULL && !retired) {
+        s_log_segment_close(&old, 0);
+    }
+
+    s_log_file_write_keys();
 }
 
 /**
- * s_log_field_new allocates memory for a new log field, sets the memory to 0,
- * and returns a pointer to it.
+ * s_log_file_close_retired closes the segments rotated out since the last
+ * call. Called with log_file.lock held, which is dropped while closing.
  */
-static struct s_log_field_t*
-s_log_field_new(const char *key)
+static void
+s_log_file_close_retired(void)
 {
-    struct s_log_field_t *field =
-        (struct s_log_field_t*)calloc(1, sizeof(s_log_field_t));
+    struct s_log_segment_t segs[S_LOG_RETIRED];
+    unsigned int count = log_file.retired_count;
+
+    if (count == 0) {
+        return;
+    }
+    memcpy(segs, log_file.retired, count * sizeof(segs[0]));
+    log_file.retired_count = 0;
 
-    size_t key_len = strlen(key)+1;
-    field->key = (char*)calloc(key_len, sizeof(char));
-    memcpy(field->key, key, key_len);
+    pthread_mutex_unlock(&log_file.lock);
+    for (unsigned int i = 0; i < count; i++) {
+        s_log_segment_close(&segs[i], log_file.fsync_ms > 0);
+    }
+    pthread_mutex_lock(&log_file.lock);
+}
 
-    return field;
+/**
+ * s_log_segment_room returns how many bytes are left in the mapping. used
+ * goes past the end after an entry bigger than the segment was written with
+ * pwrite, which leaves no room at all.
+ */
+static size_t
+s_log_segment_room(const struct s_log_segment_t *seg)
+{
+    return seg->used < seg->size ? seg->size - seg->used : 0;
 }
 
 /**
- * log_field_free frees the memory used by the log_field_t struct.
+ * s_log_file_copy appends data to the current segment. An entry bigger than
+ * the room left, which only happens for one bigger than a whole segment, is
+ * written past the mapping with pwrite. used then counts the bytes beyond
+ * the mapping too, so the file is trimmed to what was written, and the
+ * segment has no room left. Called with log_write_lock held.
  */
 static void
-s_log_field_free(struct s_log_field_t *sf)
+s_log_file_copy(const char *data, const size_t len)
 {
-    if (sf != NULL) {
-        if (sf->key != NULL) {
-            free(sf->key);
-        }
+    struct s_log_segment_t *seg = &log_file.cur;
 
-        if ((sf->type == S_LOG_STRING) && (sf->string_value != NULL)) {
-            free(sf->string_value);
-        }
+    if (seg->base == NULL) {
+        return;
+    }
+
+    if (len <= s_log_segment_room(seg)) {
+        memcpy(seg->base + seg->used, data, len);
+        seg->used += len;
+        return;
+    }
 
-        free(sf);
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = pwrite(seg->fd, data + off, len - off,
+            (off_t)(seg->used + off));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += (size_t)n;
     }
+    seg->used += off;
 }
 
-struct s_log_field_t*
-s_log_int(const char *key, const int value)
+static void
+s_log_file_write(const char *data, const size_t len)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_INT;
-    field->int_value = value;
+    struct s_log_segment_t *seg = &log_file.cur;
+
+    int expired = log_file.rotate_secs > 0 && seg->base != NULL &&
+        time(NULL) >= seg->opened + (time_t)log_file.rotate_secs;
+
+    // an entry bigger than a whole segment goes into a fresh one rather
+    // than rotating over and over
+    if (seg->base == NULL || expired ||
+        (len > s_log_segment_room(seg) && seg->used > 0)) {
+        s_log_file_rotate();
+    }
 
-    return field;
+    s_log_file_copy(data, len);
 }
 
-struct s_log_field_t*
-s_log_int8(const char *key, const int8_t value)
+/**
+ * s_log_file_worker keeps the next segment ready, closes the ones rotated
+ * out and, if configured, syncs the current one to disk on a schedule.
+ */
+static void*
+s_log_file_worker(void *arg)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_INT8;
-    field->int8_value = value;
+    (void)arg;
+
+    unsigned int wait_ms = log_file.fsync_ms > 0 ? log_file.fsync_ms : 1000;
+
+    pthread_mutex_lock(&log_file.lock);
+    while (!log_file.stop) {
+        if (!log_file.next_ready) {
+            struct s_log_segment_t seg;
+            char path[PATH_MAX];
+            unsigned int opens = log_file.inline_opens;
+
+            pthread_mutex_unlock(&log_file.lock);
+            int ret = s_log_segment_open(&seg, path, sizeof(path));
+            pthread_mutex_lock(&log_file.lock);
+
+            // a segment opened by a rotation in the meantime may have a
+            // higher sequence number, so this one would sort out of order
+            if (ret == 0 && log_file.inline_opens != opens) {
+                munmap(seg.base, seg.size);
+                close(seg.fd);
+                unlink(path);
+                continue;
+            }
+            if (ret == 0) {
+                log_file.next = seg;
+                memcpy(log_file.next_path, path, sizeof(path));
+                log_file.next_ready = 1;
+            }
+        }
+
+        s_log_file_close_retired();
+        if (log_file.stop) {
+            break;
+        }
+        if (log_file.retired_count > 0) {
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&log_file.wake, &log_file.lock, &deadline);
+
+        if (log_file.fsync_ms > 0 && !log_file.stop) {
+            pthread_mutex_unlock(&log_file.lock);
+
+            pthread_mutex_lock(&log_write_lock);
+            int fd = log_file.cur.fd >= 0 ? dup(log_file.cur.fd) : -1;
+            pthread_mutex_unlock(&log_write_lock);
 
-    return field;
+            if (fd >= 0) {
+                fdatasync(fd);
+                close(fd);
+            }
+
+            pthread_mutex_lock(&log_file.lock);
+        }
+    }
+    pthread_mutex_unlock(&log_file.lock);
+
+    return NULL;
 }
 
-struct s_log_field_t*
-s_log_int16(const char *key, const int16_t value)
+/**
+ * s_log_file_shutdown stops the background thread, finalizes the current
+ * segment and any still waiting to be closed, and removes the unused
+ * prepared one.
+ */
+static void
+s_log_file_shutdown(void)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_INT16;
-    field->int16_value = value;
+    int enabled = 1;
+    if (!__atomic_compare_exchange_n(&log_file.enabled, &enabled, 0, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    pthread_mutex_lock(&log_file.lock);
+    log_file.stop = 1;
+    pthread_cond_signal(&log_file.wake);
+    pthread_mutex_unlock(&log_file.lock);
+
+    pthread_join(log_file.worker, NULL);
+
+    pthread_mutex_lock(&log_write_lock);
+    s_log_segment_close(&log_file.cur, log_file.fsync_ms > 0);
+    pthread_mutex_unlock(&log_write_lock);
 
-    return field;
+    pthread_mutex_lock(&log_file.lock);
+    s_log_file_close_retired();
+    pthread_mutex_unlock(&log_file.lock);
+
+    if (log_file.next_ready) {
+        munmap(log_file.next.base, log_file.next.size);
+        close(log_file.next.fd);
+        unlink(log_file.next_path);
+        log_file.next_ready = 0;
+    }
 }
 
-struct s_log_field_t*
-s_log_int32(const char *key, const int32_t value)
+int
+s_log_init_file(const char *path, const size_t segment_size,
+                const unsigned int rotate_secs, const unsigned int fsync_ms)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_INT32;
-    field->int32_value = value;
+    if (path == NULL || segment_size == 0 || log_async.enabled ||
+        log_batch.enabled || s_log_file_enabled()) {
+        return -1;
+    }
 
-    return field;
+    size_t path_len = strlen(path);
+    if (path_len >= sizeof(log_file.path)) {
+        return -1;
+    }
+    memcpy(log_file.path, path, path_len + 1);
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pg = page > 0 ? (size_t)page : 4096;
+
+    log_file.segment_size = (segment_size + pg - 1) / pg * pg;
+    log_file.rotate_secs = rotate_secs;
+    log_file.fsync_ms = fsync_ms;
+    log_file.stop = 0;
+    log_file.next_ready = 0;
+    log_file.retired_count = 0;
+
+    char seg_path[PATH_MAX];
+    if (s_log_segment_open(&log_file.cur, seg_path, sizeof(seg_path)) != 0) {
+        return -1;
+    }
+
+    if (pthread_create(&log_file.worker, NULL, s_log_file_worker, NULL) != 0) {
+        s_log_segment_close(&log_file.cur, 0);
+        unlink(seg_path);
+        return -1;
+    }
+
+    __atomic_store_n(&log_file.enabled, 1, __ATOMIC_RELEASE);
+    s_log_register_shutdown();
+
+    return 0;
 }
 
-struct s_log_field_t*
-s_log_int64(const char *key, const int64_t value)
+/**
+ * The binary format is a sequence of records, all integers little endian:
+ *
+ *   u32 length of the rest of the record
+ *   u8  record kind
+ *
+ * A key record (S_LOG_REC_KEY) assigns an ID to a field key and is always
+ * written before the first entry using it:
+ *
+ *   u16 key ID, followed by the key bytes
+ *
+ * An entry record (S_LOG_REC_ENTRY) holds a log entry:
+ *
+ *   u8  level
+ *   u64 timestamp in milliseconds
+ *   u16 field count, followed by the fields
+ *
+ * Each field is a u16 key ID, or S_LOG_KEY_INLINE followed by a u16 length
+ * and the key bytes once the key table is full, a u8 s_log_field_types tag
+ * and the value. Integers and floats are written at their own width and
+ * strings as a u32 length, S_LOG_NULL_STRING for NULL, and the bytes.
+ */
+#define S_LOG_REC_KEY     1
+#define S_LOG_REC_ENTRY   2
+#define S_LOG_KEY_INLINE  0xffff
+#define S_LOG_NULL_STRING 0xffffffff
+
+#ifndef S_LOG_KEYS
+#define S_LOG_KEYS 4096
+#endif
+
+/**
+ * s_log_key_t is an interned field key. key is published last, so an entry
+ * with a key set is complete and its key record has already been written.
+ */
+struct s_log_key_t {
+    const char *key;
+    uint64_t hash;
+    uint16_t id;
+};
+
+static struct s_log_key_t log_keys[S_LOG_KEYS];
+static uint16_t log_keys_count;
+static pthread_mutex_t log_keys_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+s_log_put_u8(struct s_log_buf_t *buf, const uint8_t v)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_INT64;
-    field->int64_value = value;
+    s_log_buf_putc(buf, (char)v);
+}
 
-    return field;
+static void
+s_log_put_u16(struct s_log_buf_t *buf, const uint16_t v)
+{
+    char b[2] = { (char)v, (char)(v >> 8) };
+    s_log_buf_append(buf, b, sizeof(b));
 }
 
-struct s_log_field_t*
-s_log_uint(const char *key, const unsigned int value)
+static void
+s_log_put_u32(struct s_log_buf_t *buf, const uint32_t v)
+{
+    char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+    s_log_buf_append(buf, b, sizeof(b));
+}
+
+static void
+s_log_put_u64(struct s_log_buf_t *buf, const uint64_t v)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_UINT;
-    field->int_value = value;
+    s_log_put_u32(buf, (uint32_t)v);
+    s_log_put_u32(buf, (uint32_t)(v >> 32));
+}
 
-    return field;
+/**
+ * s_log_direct_fd reports whether entries bypassing the queue and thread
+ * buffers go to the output descriptor or file sink rather than through
+ * stdio.
+ */
+static int
+s_log_direct_fd(void)
+{
+    return log_fd >= 0 || s_log_file_enabled();
 }
 
-struct s_log_field_t*
-s_log_uint8(const char *key, const uint8_t value)
+/**
+ * s_log_write_direct writes data to the output right away, bypassing any
+ * queue or thread buffer.
+ */
+static void
+s_log_write_direct(const char *data, const size_t len)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_UINT8;
-    field->int8_value = value;
+    if (s_log_direct_fd()) {
+        s_log_write_locked(data, len);
+        return;
+    }
 
-    return field;
+    fwrite(data, 1, len, log_output != NULL ? log_output : stderr);
 }
 
-struct s_log_field_t*
-s_log_uint16(const char *key, const uint16_t value)
+/**
+ * s_log_key_id returns the ID of the given key, interning it and writing its
+ * key record if it hasn't been seen before. Returns S_LOG_KEY_INLINE if the
+ * key table is full.
+ */
+static uint16_t
+s_log_key_id(const char *key)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_UINT16;
-    field->int16_value = value;
+    uint64_t hash = s_log_hash(key);
+    size_t mask = S_LOG_KEYS - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const char *k = __atomic_load_n(&log_keys[i].key, __ATOMIC_ACQUIRE);
+        if (k == NULL) {
+            break;
+        }
+        if (log_keys[i].hash == hash && strcmp(k, key) == 0) {
+            return log_keys[i].id;
+        }
+    }
+
+    pthread_mutex_lock(&log_keys_lock);
+
+    size_t i = hash & mask;
+    for (;; i = (i + 1) & mask) {
+        const char *k = log_keys[i].key;
+        if (k == NULL) {
+            break;
+        }
+        if (log_keys[i].hash == hash && strcmp(k, key) == 0) {
+            pthread_mutex_unlock(&log_keys_lock);
+            return log_keys[i].id;
+        }
+    }
+
+    // keep the table at most half full so probes stay short
+    char *copy = NULL;
+    if (log_keys_count < S_LOG_KEYS / 2) {
+        copy = strdup(key);
+    }
+    if (copy == NULL) {
+        pthread_mutex_unlock(&log_keys_lock);
+        return S_LOG_KEY_INLINE;
+    }
+
+    uint16_t id = log_keys_count++;
+    size_t key_len = strlen(key);
+
+    struct s_log_buf_t rec = { 0 };
+    s_log_put_u32(&rec, (uint32_t)(key_len + 3));
+    s_log_put_u8(&rec, S_LOG_REC_KEY);
+    s_log_put_u16(&rec, id);
+    s_log_buf_append(&rec, key, key_len);
+
+    // write the record and publish the key under the lock rotation holds,
+    // so a new segment's key table either has the key or gets the record
+    pthread_mutex_lock(&log_write_lock);
+    if (s_log_direct_fd()) {
+        s_log_write_unlocked(rec.data, rec.len);
+    } else {
+        fwrite(rec.data, 1, rec.len, log_output != NULL ? log_output : stderr);
+    }
 
-    return field;
+    log_keys[i].hash = hash;
+    log_keys[i].id = id;
+    __atomic_store_n(&log_keys[i].key, copy, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_write_lock);
+
+    pthread_mutex_unlock(&log_keys_lock);
+    free(rec.data);
+
+    return id;
 }
 
-struct s_log_field_t*
-s_log_uint32(const char *key, const uint32_t value)
+/**
+ * s_log_file_write_keys writes a key record for every interned key at the
+ * start of a new segment so each segment can be decoded on its own. Called
+ * with log_write_lock held.
+ */
+static void
+s_log_file_write_keys(void)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_UINT32;
-    field->int32_value = value;
+    if (log_format != S_LOG_FORMAT_BINARY) {
+        return;
+    }
+
+    struct s_log_buf_t rec = { 0 };
 
-    return field;
+    for (size_t i = 0; i < S_LOG_KEYS; i++) {
+        const char *k = __atomic_load_n(&log_keys[i].key, __ATOMIC_ACQUIRE);
+        if (k == NULL) {
+            continue;
+        }
+
+        size_t key_len = strlen(k);
+        s_log_put_u32(&rec, (uint32_t)(key_len + 3));
+        s_log_put_u8(&rec, S_LOG_REC_KEY);
+        s_log_put_u16(&rec, log_keys[i].id);
+        s_log_buf_append(&rec, k, key_len);
+    }
+
+    if (rec.len > 0) {
+        s_log_file_copy(rec.data, rec.len);
+    }
+    free(rec.data);
 }
 
-struct s_log_field_t*
-s_log_uint64(const char *key, const uint64_t value)
+/**
+ * s_log_format_binary_field serializes a single field, interning its key.
+ */
+static void
+s_log_format_binary_field(struct s_log_buf_t *buf, const struct s_log_field_t *f)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_UINT64;
-    field->int64_value = value;
+    uint16_t id = s_log_key_id(f->key);
+    s_log_put_u16(buf, id);
+    if (id == S_LOG_KEY_INLINE) {
+        size_t key_len = strlen(f->key);
+        s_log_put_u16(buf, (uint16_t)key_len);
+        s_log_buf_append(buf, f->key, (uint16_t)key_len);
+    }
+    s_log_put_u8(buf, f->type);
 
-    return field;
+    switch (f->type) {
+        case S_LOG_INT8:
+        case S_LOG_UINT8:
+            s_log_put_u8(buf, f->uint8_value);
+            break;
+        case S_LOG_INT16:
+        case S_LOG_UINT16:
+            s_log_put_u16(buf, f->uint16_value);
+            break;
+        case S_LOG_INT:
+        case S_LOG_INT32:
+        case S_LOG_UINT:
+        case S_LOG_UINT32:
+            s_log_put_u32(buf, f->uint32_value);
+            break;
+        case S_LOG_INT64:
+        case S_LOG_UINT64:
+            s_log_put_u64(buf, f->uint64_value);
+            break;
+        case S_LOG_FLOAT: {
+            uint32_t bits;
+            memcpy(&bits, &f->float_value, sizeof(bits));
+            s_log_put_u32(buf, bits);
+            break;
+        }
+        case S_LOG_DOUBLE: {
+            uint64_t bits;
+            memcpy(&bits, &f->double_value, sizeof(bits));
+            s_log_put_u64(buf, bits);
+            break;
+        }
+        case S_LOG_STRING:
+            if (f->string_value == NULL) {
+                s_log_put_u32(buf, S_LOG_NULL_STRING);
+            } else {
+                size_t len = strlen(f->string_value);
+                s_log_put_u32(buf, (uint32_t)len);
+                s_log_buf_append(buf, f->string_value, len);
+            }
+            break;
+    }
 }
 
-struct s_log_field_t*
-s_log_float(const char *key, const float value)
+static void
+s_log_format_binary(struct s_log_buf_t *buf, const int l,
+                    const struct s_log_field_t *fields, const size_t count)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_FLOAT;
-    field->float_value = value;
+    size_t start = buf->len;
+
+    s_log_put_u32(buf, 0);
+    s_log_put_u8(buf, S_LOG_REC_ENTRY);
+    s_log_put_u8(buf, (uint8_t)l);
+    s_log_put_u64(buf, s_log_now_ms());
+    s_log_put_u16(buf, (uint16_t)(count + log_context.count));
+
+    for (size_t i = 0; i < count; i++) {
+        s_log_format_binary_field(buf, &fields[i]);
+    }
+    if (log_context.count > 0) {
+        s_log_buf_append(buf, log_context.buf.data, log_context.buf.len);
+    }
 
-    return field;
+    if (buf->len - start >= 4) {
+        uint32_t len = (uint32_t)(buf->len - start - 4);
+        char b[4] = { (char)len, (char)(len >> 8), (char)(len >> 16), (char)(len >> 24) };
+        memcpy(buf->data + start, b, sizeof(b));
+    }
 }
 
-struct s_log_field_t*
-s_log_double(const char *key, const double value)
+int
+s_log_init_async(FILE *out, const size_t capacity, const int overflow)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_DOUBLE;
-    field->double_value = value;
+    if (out == NULL || log_async.enabled || log_batch.enabled ||
+        s_log_file_enabled()) {
+        return -1;
+    }
+
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    log_async.slots =
+        (struct s_log_slot_t*)calloc(size, sizeof(struct s_log_slot_t));
+    if (log_async.slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        log_async.slots[i].seq = i;
+    }
+
+    log_async.mask = size - 1;
+    log_async.enqueue_pos = 0;
+    log_async.dequeue_pos = 0;
+    log_async.overflow = overflow;
+    log_async.stop = 0;
+
+    fflush(out);
+    log_output = out;
+    log_fd = fileno(out);
+
+    if (pthread_create(&log_async.writer, NULL, s_log_async_writer, NULL) != 0) {
+        free(log_async.slots);
+        log_async.slots = NULL;
+        return -1;
+    }
+
+    __atomic_store_n(&log_async.enabled, 1, __ATOMIC_RELEASE);
+    s_log_register_shutdown();
 
-    return field;
+    return 0;
 }
 
-struct s_log_field_t*
-s_log_string(const char *key, const char *value)
+/**
+ * s_log_async_shutdown stops the writer thread once the ring is drained.
+ */
+static void
+s_log_async_shutdown(void)
 {
-    struct s_log_field_t *field = s_log_field_new(key);
-    field->type = S_LOG_STRING;
+    int enabled = 1;
+    if (!__atomic_compare_exchange_n(&log_async.enabled, &enabled, 0, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // new entries are written directly from here on; wait for the ones
+    // already on their way into the ring so the writer drains them
+    while (__atomic_load_n(&log_async.producers, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&log_async.lock);
+    __atomic_store_n(&log_async.stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log_async.wake);
+    pthread_mutex_unlock(&log_async.lock);
 
-    size_t val_len = strlen(value)+1;
-    field->string_value = (char*)calloc(val_len, sizeof(char));
-    memcpy(field->string_value, value, val_len);
+    pthread_join(log_async.writer, NULL);
 
-    return field;
+    free(log_async.slots);
+    log_async.slots = NULL;
 }
 
 void
-reallog(char* l, ...)
+s_log_init(FILE *out)
 {
-    va_list ap;
+    // whichever mode is running has to be done with the old output before
+    // it's swapped, and log_fd would otherwise point the direct writes of a
+    // mode left running at it
+    s_log_async_shutdown();
+    s_log_batch_shutdown();
+    s_log_file_shutdown();
 
-    // UNIX timestamp format
-    unsigned long now = (unsigned long)time(NULL);
+    log_output = out;
+    log_fd = -1;
+}
 
-    json_t *root = json_object();
-    json_object_set_new(root, "level", json_string(l));
-    json_object_set_new(root, "timestamp", json_integer(now));
+void
+s_log_shutdown(void)
+{
+    s_log_async_shutdown();
+    s_log_batch_shutdown();
+    s_log_file_shutdown();
 
-    va_start(ap, l);
+    if (log_output != NULL) {
+        fflush(log_output);
+    }
+}
 
-    for (;;) {
-        struct s_log_field_t *arg = va_arg(ap, struct s_log_field_t*);
-        if (arg == NULL) {
-            break;
-        }
+void
+s_log_flush(void)
+{
+    if (__atomic_load_n(&log_batch.enabled, __ATOMIC_ACQUIRE)) {
+        s_log_batch_flush();
+    }
 
-        switch (arg->type) {
-            case S_LOG_INT ... S_LOG_UINT64:
-                json_object_set_new(root, arg->key,
-                    json_integer(arg->int_value));
-                break;
-            case S_LOG_FLOAT ... S_LOG_DOUBLE:
-                json_object_set_new(root, arg->key,
-                    json_real(arg->double_value));
-                break;
-            case S_LOG_STRING:
-                json_object_set_new(root, arg->key,
-                    json_string(arg->string_value));
+    if (__atomic_load_n(&log_async.enabled, __ATOMIC_ACQUIRE)) {
+        uint64_t target = __atomic_load_n(&log_async.enqueue_pos, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&log_async.dequeue_pos, __ATOMIC_ACQUIRE) < target &&
+               __atomic_load_n(&log_async.enabled, __ATOMIC_ACQUIRE)) {
+            s_log_async_wake();
+            sched_yield();
         }
+    }
+
+    if (log_output != NULL) {
+        fflush(log_output);
+    }
+}
+
+uint64_t
+s_log_dropped(void)
+{
+    return __atomic_load_n(&log_async.dropped, __ATOMIC_RELAXED);
+}
+
+size_t
+s_log_queue_depth(void)
+{
+    uint64_t head = __atomic_load_n(&log_async.enqueue_pos, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&log_async.dequeue_pos, __ATOMIC_RELAXED);
 
-        s_log_field_free(arg);
+    return head > tail ? (size_t)(head - tail) : 0;
+}
+
+void
+s_log_context_set(const struct s_log_field_t *fields, const size_t count)
+{
+    struct s_log_context_t *ctx = &log_context;
 
-        continue;
+    if (ctx->buf.data == NULL) {
+        pthread_once(&log_context_once, s_log_context_key_create);
+        pthread_setspecific(log_context_key, ctx);
     }
 
-    va_end(ap); 
+    ctx->buf.len = 0;
+    ctx->count = 0;
 
-    int res = json_dumpf(root, log_output, JSON_INDENT(0));
-    if (res != 0) {
-        // error handler...
+    for (size_t i = 0; i < count && i < UINT16_MAX; i++) {
+        if (log_format == S_LOG_FORMAT_BINARY) {
+            s_log_format_binary_field(&ctx->buf, &fields[i]);
+        } else {
+            s_log_append_field(&ctx->buf, &fields[i]);
+        }
+        ctx->count++;
     }
-    fprintf(log_output, "\n");
+}
+
+void
+s_log_context_clear(void)
+{
+    log_context.buf.len = 0;
+    log_context.count = 0;
+}
+
+void
+reallog(const int l, const struct s_log_field_t *fields, const size_t count)
+{
+    FILE *out = log_output != NULL ? log_output : stderr;
+
+    if (__atomic_load_n(&log_batch.enabled, __ATOMIC_ACQUIRE)) {
+        s_log_batch_append(l, fields, count);
+    } else {
+        struct s_log_buf_t *buf = &log_buf;
+        buf->len = 0;
+        s_log_format(buf, l, fields, count);
 
-    json_decref(root);
+        if (buf->len > 0) {
+            if (__atomic_load_n(&log_async.enabled, __ATOMIC_ACQUIRE)) {
+                s_log_async_enqueue(buf->data, buf->len);
+            } else {
+                s_log_write_direct(buf->data, buf->len);
+            }
+        }
+    }
 
-    if (strcmp(l, S_LOG_FATAL) == 0) {
+    if (l >= S_LOG_FATAL) {
+        s_log_shutdown();
+        fflush(out);
         exit(1);
     }
 }
@@ -37,114 +37,365 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 
-#define S_LOG_TRACE "trace"
-#define S_LOG_DEBUG "debug"
-#define S_LOG_INFO  "info"
-#define S_LOG_WARN  "warn"
-#define S_LOG_ERROR "error"
-#define S_LOG_FATAL "fatal"
+#define S_LOG_TRACE 0
+#define S_LOG_DEBUG 1
+#define S_LOG_INFO  2
+#define S_LOG_WARN  3
+#define S_LOG_ERROR 4
+#define S_LOG_FATAL 5
+
+/**
+ * s_log_level is the minimum level an entry needs to be written. It can be
+ * read and changed at any time, including from a signal handler, but should
+ * be set through s_log_set_level.
+ */
+extern int s_log_level;
+
+/**
+ * s_log_set_level sets the minimum level of entries that get written. Fatal
+ * entries are always written.
+ */
+void
+s_log_set_level(const int level);
+
+/**
+ * s_log_get_level returns the current minimum log level.
+ */
+int
+s_log_get_level(void);
+
+/**
+ * s_log_level_from_string returns the level for the given name, e.g. "debug",
+ * or -1 if the name isn't a known level.
+ */
+int
+s_log_level_from_string(const char *name);
+
+/**
+ * s_log_level_string returns the name of the given level.
+ */
+const char*
+s_log_level_string(const int level);
+
+/**
+ * s_log_enabled checks whether entries at the given level are written.
+ */
+#define s_log_enabled(l) \
+    ((l) >= __atomic_load_n(&s_log_level, __ATOMIC_RELAXED))
+
+/**
+ * s_log_field_types is an enum of the supported log field types.
+ */
+enum s_log_field_types {
+    S_LOG_INT,
+    S_LOG_INT8,
+    S_LOG_INT16,
+    S_LOG_INT32,
+    S_LOG_INT64,
+    S_LOG_UINT,
+    S_LOG_UINT8,
+    S_LOG_UINT16,
+    S_LOG_UINT32,
+    S_LOG_UINT64,
+    S_LOG_FLOAT,
+    S_LOG_DOUBLE,
+    S_LOG_STRING
+};
+
+/**
+ * s_log_field_t represents a field in a log entry and it's associated type.
+ * Fields are passed around by value and borrow the key and string value from
+ * the caller rather than copying them, so building a log entry doesn't touch
+ * the heap. Borrowed pointers only need to live until s_log returns.
+ */
+struct s_log_field_t {
+    uint8_t type;
+    const char *key;
+    union {
+        int int_value;
+        int8_t int8_value;
+        int16_t int16_value;
+        int32_t int32_value;
+        int64_t int64_value;
+        unsigned int uint_value;
+        uint8_t uint8_value;
+        uint16_t uint16_value;
+        uint32_t uint32_value;
+        uint64_t uint64_value;
+        float float_value;
+        double double_value;
+        const char *string_value;
+    };
+};
 
 /**
  * s_log_int is used to add an integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_int(const char *key, const int value);
 
 /**
  * s_log_int8 is used to add a 8 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_int8(const char *key, const int8_t value);
 
 /**
  * s_log_int16 is used to add a 16 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_int16(const char *key, const int16_t value);
 
 /**
  * s_log_int32 is used to add a 32 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_int32(const char *key, const int32_t value);
 
 /**
  * s_s_log_int64 is used to add a 64 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_int64(const char *key, const int64_t value);
 
 /**
  * s_log_uint is used to add an unsigned integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_uint(const char *key, const unsigned int value);
 
 /**
  * s_log_uint8 is used to add a 8 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_uint8(const char *key, const uint8_t value);
 
 /**
  * s_log_uint16 is used to add a 16 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_uint16(const char *key, const uint16_t value);
 
 /**
  * s_log_uint32 is used to add a 32 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_uint32(const char *key, const uint32_t value);
 
 /**
  * s_log_uint64 is used to add a 64 bit integer value to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_uint64(const char *key, const uint64_t value);
 
 /**
  * s_log_float is used to add a float to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_float(const char *key, const float value);
 
 /**
  * s_log_double is used to add a double to the log entry.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_double(const char *key, const double value);
 
 /**
- * s_log_string is used to add a string to the log entry.
+ * s_log_string is used to add a string to the log entry. A NULL value is
+ * written as null.
  */
-struct s_log_field_t*
+struct s_log_field_t
 s_log_string(const char *key, const char *value);
 
 enum {
     S_LOG_OUT_STDERR,
     S_LOG_OUT_STDOUT,
+    S_LOG_OUT_FILE,
 };
 
+/**
+ * Output formats. S_LOG_FORMAT_JSON writes a JSON object per line and
+ * S_LOG_FORMAT_BINARY writes compact length prefixed records with interned
+ * keys, which tools/s_log_decode converts back to JSON lines.
+ */
+enum {
+    S_LOG_FORMAT_JSON,
+    S_LOG_FORMAT_BINARY,
+};
+
+/**
+ * s_log_set_format sets the output format. Meant to be called once at
+ * startup, before anything is logged.
+ */
+void
+s_log_set_format(const int format);
+
 /**
  * s_log_init initializes the logger and sets up where the logger writes to.
+ * Any async, buffered or file mode is shut down first, as s_log_shutdown
+ * does, so everything pending goes to the previous output, which has to
+ * stay open until this returns.
  */
 void
 s_log_init(FILE *out);
 
 /**
- * reallog provides the functionality of the logger. Returns the number os
- * bytes written.
+ * s_log_set_rate_limit configures the per-key limiter used by s_log_limited.
+ * Each key may write per_second entries on average with bursts of up to
+ * burst entries. A rate of 0 disables limiting. Meant to be called once at
+ * startup.
  */
 void
-reallog(char *l, ...);
+s_log_set_rate_limit(const double per_second, const unsigned int burst);
+
+/**
+ * s_log_allow takes a token from the bucket for the given key. Returns 1 if
+ * the entry should be written, in which case suppressed is set to the number
+ * of entries dropped for the key since the last one written, and 0 if not.
+ */
+int
+s_log_allow(const char *key, uint64_t *suppressed);
+
+/**
+ * Overflow policies for the async logger, applied when its queue is full.
+ * S_LOG_OVERFLOW_BLOCK makes the logging thread wait for room,
+ * S_LOG_OVERFLOW_DROP drops the new entry and S_LOG_OVERFLOW_DROP_COUNT drops
+ * it and has the writer thread log how many entries were lost.
+ */
+enum {
+    S_LOG_OVERFLOW_BLOCK,
+    S_LOG_OVERFLOW_DROP,
+    S_LOG_OVERFLOW_DROP_COUNT,
+};
+
+/**
+ * s_log_init_async initializes the logger in async mode. Entries are queued
+ * in a ring buffer holding capacity entries, rounded up to a power of 2, and
+ * written to out in batches by a dedicated writer thread. Entries that don't
+ * fit in a queue slot are written directly. The queue is drained on exit and
+ * before a fatal entry exits. Returns 0 on success and -1 on failure.
+ */
+int
+s_log_init_async(FILE *out, const size_t capacity, const int overflow);
+
+/**
+ * s_log_init_buffered initializes the logger in buffered mode. Each thread
+ * formats entries into its own buffer which is written out in one call once
+ * it holds flush_bytes, or every flush_ms milliseconds if that's not 0, so
+ * entries never interleave and there's no shared lock per entry. Pending
+ * entries are written on exit and before a fatal entry exits. Returns 0 on
+ * success and -1 on failure.
+ */
+int
+s_log_init_buffered(FILE *out, const size_t flush_bytes,
+                    const unsigned int flush_ms);
+
+/**
+ * s_log_init_file initializes the logger to write to memory mapped segment
+ * files named path.<time>-<seq>. Each segment is preallocated to
+ * segment_size bytes and entries are copied straight into the mapping. A new
+ * segment is started once the current one is full or, if rotate_secs isn't
+ * 0, has been open that long. The next segment is prepared in the background
+ * so rotating doesn't block writers, and if fsync_ms isn't 0 the current
+ * segment is synced to disk that often. Finished segments are trimmed to the
+ * data written. Returns 0 on success and -1 on failure.
+ */
+int
+s_log_init_file(const char *path, const size_t segment_size,
+                const unsigned int rotate_secs, const unsigned int fsync_ms);
+
+/**
+ * s_log_flush writes out everything pending, whether it's sitting in thread
+ * buffers or the async queue.
+ */
+void
+s_log_flush(void);
+
+/**
+ * s_log_shutdown stops any background logging threads once everything
+ * pending has been written. Logging afterwards falls back to synchronous
+ * writes.
+ */
+void
+s_log_shutdown(void);
+
+/**
+ * s_log_dropped returns the number of entries the async logger has dropped.
+ */
+uint64_t
+s_log_dropped(void);
+
+/**
+ * s_log_queue_depth returns the number of entries waiting to be written by
+ * the async logger.
+ */
+size_t
+s_log_queue_depth(void);
+
+/**
+ * s_log_context_set replaces the calling thread's log context with the given
+ * fields, which are then added to every entry the thread writes until the
+ * context is cleared. The fields are serialized once here, so they only need
+ * to live until the call returns and each entry just copies them. The format
+ * should be set before a context is.
+ */
+void
+s_log_context_set(const struct s_log_field_t *fields, const size_t count);
+
+/**
+ * s_log_context_clear removes the calling thread's log context.
+ */
+void
+s_log_context_clear(void);
+
+/**
+ * s_log_context sets the calling thread's log context from a list of fields,
+ * like s_log does for a single entry.
+ */
+#define s_log_context(...) ({                                      \
+    struct s_log_field_t __s_log_fields[] = { __VA_ARGS__ };       \
+    s_log_context_set(__s_log_fields,                              \
+        sizeof(__s_log_fields) / sizeof(__s_log_fields[0]));       \
+})
+
+/**
+ * reallog provides the functionality of the logger. It writes a single log
+ * entry made up of the given fields.
+ */
+void
+reallog(const int l, const struct s_log_field_t *fields, const size_t count);
 
 /**
  * s_log is the main entry point for adding data to the logger to create log
- * entries.
+ * entries. The fields are collected into an array on the caller's stack. The
+ * level is checked first so the fields of a disabled entry are never
+ * evaluated.
+ */
+#define s_log(l, ...) ({                                           \
+    if (s_log_enabled(l)) {                                        \
+        struct s_log_field_t __s_log_fields[] = { __VA_ARGS__ };   \
+        reallog(l, __s_log_fields,                                 \
+            sizeof(__s_log_fields) / sizeof(__s_log_fields[0]));   \
+    }                                                              \
+})
+
+/**
+ * s_log_limited writes an entry subject to the rate limit for the given key,
+ * so a storm of identical entries collapses into one entry with a
+ * "suppressed" count of how many were dropped. Neither the limit nor the
+ * fields are evaluated if the level is disabled.
  */
-#define s_log(l, ...) ({ reallog(l, __VA_ARGS__, NULL); })
+#define s_log_limited(l, key, ...) ({                                  \
+    uint64_t __s_log_suppressed = 0;                                   \
+    if (s_log_enabled(l) && s_log_allow(key, &__s_log_suppressed)) {   \
+        struct s_log_field_t __s_log_fields[] = {                      \
+            __VA_ARGS__,                                               \
+            s_log_uint64("suppressed", __s_log_suppressed)             \
+        };                                                             \
+        reallog(l, __s_log_fields,                                     \
+            sizeof(__s_log_fields) / sizeof(__s_log_fields[0]));       \
+    }                                                                  \
+})
 
 #endif /** end _S_LOGGER_H */
 #ifdef __cplusplus
@@ -0,0 +1,557 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+/**
+ * HTTP_METRICS_ROUTE_SLOTS is the size of the route lookup table, kept at
+ * least twice HTTP_METRICS_MAX_ROUTES so probes stay short.
+ */
+#define HTTP_METRICS_ROUTE_SLOTS 128
+
+/**
+ * http_metrics_route_t maps a "METHOD route" key to its route ID. key is
+ * published last so a slot with a key set is complete.
+ */
+struct http_metrics_route_t {
+    const char *key;
+    uint64_t hash;
+    uint32_t id;
+};
+
+/**
+ * http_metrics_shard_t holds the histograms recorded by a single thread.
+ * Only the owning thread writes to it; readers aggregate with relaxed loads.
+ */
+struct http_metrics_shard_t {
+    uint64_t buckets[HTTP_METRICS_MAX_ROUTES][HTTP_METRICS_CLASSES][HTTP_METRICS_BUCKETS];
+    uint64_t sum_ns[HTTP_METRICS_MAX_ROUTES][HTTP_METRICS_CLASSES];
+    struct http_metrics_shard_t *prev;
+    struct http_metrics_shard_t *next;
+};
+
+/**
+ * http_metrics_t holds the global metrics state. Route 0 is "other". Shards
+ * of exited threads are folded into retired so their counts aren't lost.
+ */
+struct http_metrics_t {
+    int enabled;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    struct http_metrics_shard_t *head;
+    struct http_metrics_shard_t retired;
+    struct http_metrics_route_t routes[HTTP_METRICS_ROUTE_SLOTS];
+    const char *names[HTTP_METRICS_MAX_ROUTES];
+    uint32_t route_count;
+};
+
+static struct http_metrics_t metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct http_metrics_shard_t *metrics_shard;
+
+/**
+ * http_metrics_shard_free folds an exiting thread's histograms into the
+ * retired shard and releases them.
+ */
+static void
+http_metrics_shard_free(void *arg)
+{
+    struct http_metrics_shard_t *shard = (struct http_metrics_shard_t*)arg;
+
+    pthread_mutex_lock(&metrics.lock);
+    if (shard->prev != NULL) {
+        shard->prev->next = shard->next;
+    } else {
+        metrics.head = shard->next;
+    }
+    if (shard->next != NULL) {
+        shard->next->prev = shard->prev;
+    }
+
+    for (size_t r = 0; r < HTTP_METRICS_MAX_ROUTES; r++) {
+        for (size_t c = 0; c < HTTP_METRICS_CLASSES; c++) {
+            for (size_t b = 0; b < HTTP_METRICS_BUCKETS; b++) {
+                metrics.retired.buckets[r][c][b] += shard->buckets[r][c][b];
+            }
+            metrics.retired.sum_ns[r][c] += shard->sum_ns[r][c];
+        }
+    }
+    pthread_mutex_unlock(&metrics.lock);
+
+    free(shard);
+}
+
+void
+http_metrics_init(void)
+{
+    pthread_mutex_lock(&metrics.lock);
+    if (!metrics.enabled) {
+        if (pthread_key_create(&metrics.key, http_metrics_shard_free) == 0) {
+            metrics.names[0] = " other";
+            metrics.route_count = 1;
+            __atomic_store_n(&metrics.enabled, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&metrics.lock);
+}
+
+/**
+ * http_metrics_shard_get returns the calling thread's shard, creating and
+ * registering it on first use.
+ */
+static struct http_metrics_shard_t*
+http_metrics_shard_get(void)
+{
+    if (metrics_shard != NULL) {
+        return metrics_shard;
+    }
+
+    struct http_metrics_shard_t *shard =
+        (struct http_metrics_shard_t*)calloc(1, sizeof(struct http_metrics_shard_t));
+    if (shard == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+    shard->next = metrics.head;
+    if (metrics.head != NULL) {
+        metrics.head->prev = shard;
+    }
+    metrics.head = shard;
+    pthread_mutex_unlock(&metrics.lock);
+
+    pthread_setspecific(metrics.key, shard);
+    metrics_shard = shard;
+
+    return shard;
+}
+
+/**
+ * http_metrics_method returns the given method if it's a standard one and
+ * "OTHER" if not, so clients can't fill the route table with made up ones.
+ */
+static const char*
+http_metrics_method(const char *method)
+{
+    static const char *const methods[] = {
+        "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "CONNECT",
+        "TRACE",
+    };
+
+    if (method != NULL) {
+        for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+            if (strcmp(method, methods[i]) == 0) {
+                return methods[i];
+            }
+        }
+    }
+
+    return "OTHER";
+}
+
+/**
+ * http_metrics_hash returns the FNV-1a hash of "method route".
+ */
+static uint64_t
+http_metrics_hash(const char *method, const char *route)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (const char *s = method; *s != '\0'; s++) {
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    }
+    h = (h ^ ' ') * 0x100000001b3ULL;
+    for (const char *s = route; *s != '\0'; s++) {
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/**
+ * http_metrics_key_equal checks whether the given key is "method route".
+ */
+static int
+http_metrics_key_equal(const char *key, const char *method, const char *route)
+{
+    size_t method_len = strlen(method);
+
+    return strncmp(key, method, method_len) == 0 &&
+           key[method_len] == ' ' &&
+           strcmp(key + method_len + 1, route) == 0;
+}
+
+/**
+ * http_metrics_route_id returns the ID of the given route, registering it if
+ * there's still room and returning the "other" route if not.
+ */
+static uint32_t
+http_metrics_route_id(const char *method, const char *route)
+{
+    uint64_t hash = http_metrics_hash(method, route);
+    size_t mask = HTTP_METRICS_ROUTE_SLOTS - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const char *k = __atomic_load_n(&metrics.routes[i].key, __ATOMIC_ACQUIRE);
+        if (k == NULL) {
+            break;
+        }
+        if (metrics.routes[i].hash == hash &&
+            http_metrics_key_equal(k, method, route)) {
+            return metrics.routes[i].id;
+        }
+    }
+
+    if (__atomic_load_n(&metrics.route_count, __ATOMIC_RELAXED) >=
+        HTTP_METRICS_MAX_ROUTES) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+
+    size_t i = hash & mask;
+    for (;; i = (i + 1) & mask) {
+        const char *k = metrics.routes[i].key;
+        if (k == NULL) {
+            break;
+        }
+        if (metrics.routes[i].hash == hash &&
+            http_metrics_key_equal(k, method, route)) {
+            pthread_mutex_unlock(&metrics.lock);
+            return metrics.routes[i].id;
+        }
+    }
+
+    uint32_t id = 0;
+    if (metrics.route_count < HTTP_METRICS_MAX_ROUTES) {
+        size_t method_len = strlen(method);
+        size_t route_len = strlen(route);
+        char *key = (char*)malloc(method_len + route_len + 2);
+
+        if (key != NULL) {
+            memcpy(key, method, method_len);
+            key[method_len] = ' ';
+            memcpy(key + method_len + 1, route, route_len + 1);
+
+            id = metrics.route_count;
+            metrics.names[id] = key;
+            metrics.routes[i].hash = hash;
+            metrics.routes[i].id = id;
+            __atomic_store_n(&metrics.routes[i].key, key, __ATOMIC_RELEASE);
+            __atomic_store_n(&metrics.route_count, id + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&metrics.lock);
+
+    return id;
+}
+
+#define HTTP_METRICS_SUB_HALF ((uint64_t)1 << (HTTP_METRICS_SUB_BITS - 1))
+
+/**
+ * http_metrics_bucket returns the bucket for the given duration, the one
+ * whose upper bound is the smallest at least as long. Counting in units,
+ * less one so bounds are inclusive, durations under 2^HTTP_METRICS_SUB_BITS
+ * units get a bucket per unit. Past that, a duration whose highest set bit
+ * is b shifts out m = b - SUB_BITS + 1 bits, leaving a sub-bucket between
+ * SUB_HALF and 2 * SUB_HALF, and each m gets SUB_HALF buckets after the
+ * ones before it.
+ */
+static inline size_t
+http_metrics_bucket(const uint64_t duration_ns)
+{
+    uint64_t u = duration_ns > 0 ? (duration_ns - 1) >> HTTP_METRICS_UNIT_SHIFT : 0;
+
+    if (u < (HTTP_METRICS_SUB_HALF << 1)) {
+        return (size_t)u;
+    }
+
+    unsigned int m = (unsigned int)(63 - __builtin_clzll(u)) -
+        (HTTP_METRICS_SUB_BITS - 1);
+    size_t b = (size_t)(m * HTTP_METRICS_SUB_HALF + (u >> m));
+
+    return b < HTTP_METRICS_BUCKETS - 1 ? b : HTTP_METRICS_BUCKETS - 1;
+}
+
+uint64_t
+http_metrics_bucket_upper(const size_t bucket)
+{
+    if (bucket >= HTTP_METRICS_BUCKETS - 1) {
+        return 0;
+    }
+    if (bucket < (HTTP_METRICS_SUB_HALF << 1)) {
+        return (uint64_t)(bucket + 1) << HTTP_METRICS_UNIT_SHIFT;
+    }
+
+    uint64_t m = bucket / HTTP_METRICS_SUB_HALF - 1;
+    uint64_t sub = bucket - m * HTTP_METRICS_SUB_HALF;
+
+    return ((sub + 1) << m) << HTTP_METRICS_UNIT_SHIFT;
+}
+
+void
+http_metrics_record(const char *method, const char *route, const long status,
+                    const uint64_t duration_ns)
+{
+    if (!__atomic_load_n(&metrics.enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (status < 100 || status >= 600) {
+        return;
+    }
+
+    struct http_metrics_shard_t *shard = http_metrics_shard_get();
+    if (shard == NULL) {
+        return;
+    }
+
+    uint32_t id = http_metrics_route_id(http_metrics_method(method),
+        route != NULL ? route : "other");
+    size_t class = (size_t)(status / 100) - 1;
+    size_t bucket = http_metrics_bucket(duration_ns);
+
+    uint64_t *count = &shard->buckets[id][class][bucket];
+    uint64_t *sum = &shard->sum_ns[id][class];
+
+    // single writer, so a plain load and store is enough for readers to see
+    // whole values
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(sum, __atomic_load_n(sum, __ATOMIC_RELAXED) + duration_ns,
+        __ATOMIC_RELAXED);
+}
+
+/**
+ * http_metrics_buf_t is a growable buffer the exposition text is rendered
+ * into.
+ */
+struct http_metrics_buf_t {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+};
+
+static void
+http_metrics_printf(struct http_metrics_buf_t *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+http_metrics_printf(struct http_metrics_buf_t *buf, const char *fmt, ...)
+{
+    if (buf->failed) {
+        return;
+    }
+
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+
+        if (n < 0) {
+            buf->failed = 1;
+            return;
+        }
+        if ((size_t)n < buf->cap - buf->len) {
+            buf->len += (size_t)n;
+            return;
+        }
+
+        size_t cap = buf->cap * 2;
+        while (cap - buf->len <= (size_t)n) {
+            cap *= 2;
+        }
+        char *data = (char*)realloc(buf->data, cap);
+        if (data == NULL) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+}
+
+/**
+ * http_metrics_labels writes the method and route labels of the given route,
+ * escaped for the exposition format, into out.
+ */
+static void
+http_metrics_labels(const char *name, char *out, const size_t out_len)
+{
+    const char *space = strchr(name, ' ');
+    size_t j = 0;
+
+    const char *prefix = "method=\"";
+    for (const char *p = prefix; *p != '\0' && j + 1 < out_len; p++) {
+        out[j++] = *p;
+    }
+
+    for (const char *p = name; *p != '\0' && j + 4 < out_len; p++) {
+        if (p == space) {
+            const char *sep = "\",route=\"";
+            for (const char *q = sep; *q != '\0' && j + 1 < out_len; q++) {
+                out[j++] = *q;
+            }
+            continue;
+        }
+        if (*p == '\\' || *p == '"') {
+            out[j++] = '\\';
+            out[j++] = *p;
+        } else if (*p == '\n') {
+            out[j++] = '\\';
+            out[j++] = 'n';
+        } else {
+            out[j++] = *p;
+        }
+    }
+
+    if (space == NULL) {
+        const char *sep = "\",route=\"";
+        for (const char *q = sep; *q != '\0' && j + 1 < out_len; q++) {
+            out[j++] = *q;
+        }
+    }
+    if (j + 1 < out_len) {
+        out[j++] = '"';
+    }
+    out[j] = '\0';
+}
+
+char*
+http_metrics_render(size_t *len)
+{
+    struct http_metrics_shard_t *agg =
+        (struct http_metrics_shard_t*)calloc(1, sizeof(struct http_metrics_shard_t));
+    if (agg == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+    memcpy(agg->buckets, metrics.retired.buckets, sizeof(agg->buckets));
+    memcpy(agg->sum_ns, metrics.retired.sum_ns, sizeof(agg->sum_ns));
+
+    for (struct http_metrics_shard_t *s = metrics.head; s != NULL; s = s->next) {
+        for (size_t r = 0; r < HTTP_METRICS_MAX_ROUTES; r++) {
+            for (size_t c = 0; c < HTTP_METRICS_CLASSES; c++) {
+                for (size_t b = 0; b < HTTP_METRICS_BUCKETS; b++) {
+                    agg->buckets[r][c][b] +=
+                        __atomic_load_n(&s->buckets[r][c][b], __ATOMIC_RELAXED);
+                }
+                agg->sum_ns[r][c] +=
+                    __atomic_load_n(&s->sum_ns[r][c], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    uint32_t routes = __atomic_load_n(&metrics.route_count, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&metrics.lock);
+
+    struct http_metrics_buf_t buf = { .cap = 4096 };
+    buf.data = (char*)malloc(buf.cap);
+    if (buf.data == NULL) {
+        free(agg);
+        return NULL;
+    }
+    buf.data[0] = '\0';
+
+    uint64_t totals[HTTP_METRICS_MAX_ROUTES][HTTP_METRICS_CLASSES] = { { 0 } };
+
+    http_metrics_printf(&buf,
+        "# HELP http_request_duration_seconds Request latency by route and status class.\n"
+        "# TYPE http_request_duration_seconds histogram\n");
+
+    for (uint32_t r = 0; r < routes; r++) {
+        char labels[512];
+        http_metrics_labels(metrics.names[r], labels, sizeof(labels));
+
+        for (size_t c = 0; c < HTTP_METRICS_CLASSES; c++) {
+            uint64_t total = 0;
+            for (size_t b = 0; b < HTTP_METRICS_BUCKETS; b++) {
+                total += agg->buckets[r][c][b];
+            }
+            totals[r][c] = total;
+            if (total == 0) {
+                continue;
+            }
+
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < HTTP_METRICS_BUCKETS - 1; b++) {
+                cumulative += agg->buckets[r][c][b];
+                http_metrics_printf(&buf,
+                    "http_request_duration_seconds_bucket{%s,status=\"%zuxx\",le=\"%.12g\"} %llu\n",
+                    labels, c + 1, (double)http_metrics_bucket_upper(b) / 1e9,
+                    (unsigned long long)cumulative);
+            }
+            http_metrics_printf(&buf,
+                "http_request_duration_seconds_bucket{%s,status=\"%zuxx\",le=\"+Inf\"} %llu\n"
+                "http_request_duration_seconds_sum{%s,status=\"%zuxx\"} %.9f\n"
+                "http_request_duration_seconds_count{%s,status=\"%zuxx\"} %llu\n",
+                labels, c + 1, (unsigned long long)total,
+                labels, c + 1, (double)agg->sum_ns[r][c] / 1e9,
+                labels, c + 1, (unsigned long long)total);
+        }
+    }
+
+    http_metrics_printf(&buf,
+        "# HELP http_requests_total Requests served by route and status class.\n"
+        "# TYPE http_requests_total counter\n");
+
+    for (uint32_t r = 0; r < routes; r++) {
+        char labels[512];
+        http_metrics_labels(metrics.names[r], labels, sizeof(labels));
+
+        for (size_t c = 0; c < HTTP_METRICS_CLASSES; c++) {
+            if (totals[r][c] == 0) {
+                continue;
+            }
+            http_metrics_printf(&buf, "http_requests_total{%s,status=\"%zuxx\"} %llu\n",
+                labels, c + 1, (unsigned long long)totals[r][c]);
+        }
+    }
+
+    free(agg);
+
+    if (buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = buf.len;
+    }
+
+    return buf.data;
+}
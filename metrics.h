@@ -0,0 +1,111 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _HTTP_METRICS_H
+#define _HTTP_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * HTTP_METRICS_MAX_ROUTES is the number of distinct method and route pairs
+ * tracked. Routes are the names given to callback_route, so the set is
+ * bounded by the application rather than by the paths clients send.
+ * Requests for routes beyond that are counted under route "other" with no
+ * method.
+ */
+#ifndef HTTP_METRICS_MAX_ROUTES
+#define HTTP_METRICS_MAX_ROUTES 32
+#endif
+
+/**
+ * The latency histograms are log-linear, like HdrHistogram: every power of
+ * two range of durations is split into 2^(HTTP_METRICS_SUB_BITS - 1) equal
+ * width buckets, so a bucket is at most 1/4 wider than its lower bound with
+ * the default of 3. Durations are counted in units of
+ * 2^HTTP_METRICS_UNIT_SHIFT nanoseconds, about a microsecond, and bucket
+ * bounds go up to 2^HTTP_METRICS_RANGE_BITS nanoseconds, about 69 seconds.
+ * The last of the HTTP_METRICS_BUCKETS buckets counts everything slower.
+ */
+#ifndef HTTP_METRICS_SUB_BITS
+#define HTTP_METRICS_SUB_BITS 3
+#endif
+#define HTTP_METRICS_UNIT_SHIFT 10
+#define HTTP_METRICS_RANGE_BITS 36
+#define HTTP_METRICS_BUCKETS \
+    (((HTTP_METRICS_RANGE_BITS - HTTP_METRICS_UNIT_SHIFT - HTTP_METRICS_SUB_BITS + 2) << \
+        (HTTP_METRICS_SUB_BITS - 1)) + 1)
+
+/**
+ * HTTP_METRICS_CLASSES is the number of status classes tracked, 1xx to 5xx.
+ */
+#define HTTP_METRICS_CLASSES 5
+
+/**
+ * http_metrics_init turns on metrics collection. Until it's called
+ * http_metrics_record does nothing.
+ */
+void
+http_metrics_init(void);
+
+/**
+ * http_metrics_record adds a request to the latency histogram and counters
+ * of its route and status class. route is a route name such as "/users/:id",
+ * never the request path, or NULL for requests that didn't match one, which
+ * are counted under route "other". Methods other than the standard ones are
+ * counted as "OTHER". Each thread records into its own histograms with plain
+ * stores, so there's no contention or atomic read-modify-write on the hot
+ * path. log_request calls this for every request.
+ */
+void
+http_metrics_record(const char *method, const char *route, const long status,
+                    const uint64_t duration_ns);
+
+/**
+ * http_metrics_bucket_upper returns the upper bound, in nanoseconds and
+ * inclusive, of the given latency bucket, or 0 for the last one, which has
+ * none.
+ */
+uint64_t
+http_metrics_bucket_upper(const size_t bucket);
+
+/**
+ * http_metrics_render aggregates the histograms of every thread and renders
+ * them in the Prometheus text exposition format. The caller is responsible
+ * for freeing the returned string. Returns NULL on allocation failure.
+ */
+char*
+http_metrics_render(size_t *len);
+
+#endif /* _HTTP_METRICS_H */
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HTTP_TEST_H
+#define _HTTP_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * A minimal test harness. Each test is a function registered with TEST_RUN
+ * from main, checks are made with TEST_ASSERT and friends, and main returns
+ * TEST_RESULT so ctest sees a failure as a non-zero exit.
+ */
+static int test_failures;
+static int test_checks;
+
+#define TEST_ASSERT(cond) do {                                          \
+    test_checks++;                                                      \
+    if (!(cond)) {                                                      \
+        fprintf(stderr, "%s:%d: assertion failed: %s\n",                \
+            __FILE__, __LINE__, #cond);                                 \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+#define TEST_ASSERT_INT(a, b) do {                                      \
+    long long __a = (long long)(a), __b = (long long)(b);               \
+    test_checks++;                                                      \
+    if (__a != __b) {                                                   \
+        fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n",       \
+            __FILE__, __LINE__, #a, #b, __a, __b);                      \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+#define TEST_ASSERT_STR(a, b) do {                                      \
+    const char *__a = (a), *__b = (b);                                  \
+    test_checks++;                                                      \
+    if (__a == NULL || __b == NULL || strcmp(__a, __b) != 0) {          \
+        fprintf(stderr, "%s:%d: %s == %s failed: \"%s\" != \"%s\"\n",   \
+            __FILE__, __LINE__, #a, #b,                                 \
+            __a ? __a : "(null)", __b ? __b : "(null)");                \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+#define TEST_ASSERT_MEM(a, alen, b) do {                                \
+    const char *__a = (const char*)(a), *__b = (b);                     \
+    size_t __alen = (size_t)(alen);                                     \
+    test_checks++;                                                      \
+    if (__a == NULL || __alen != strlen(__b) ||                         \
+        memcmp(__a, __b, __alen) != 0) {                                \
+        fprintf(stderr, "%s:%d: %s == %s failed: \"%.*s\" != \"%s\"\n", \
+            __FILE__, __LINE__, #a, #b,                                 \
+            __a ? (int)__alen : 6, __a ? __a : "(null)", __b);          \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+#define TEST_RUN(fn) do {                                               \
+    int __before = test_failures;                                       \
+    fn();                                                               \
+    fprintf(stderr, "%s %s\n",                                          \
+        test_failures == __before ? "ok  " : "FAIL", #fn);              \
+} while (0)
+
+#define TEST_RESULT (fprintf(stderr, "%d checks, %d failed\n",          \
+    test_checks, test_failures), test_failures != 0)
+
+#endif /* _HTTP_TEST_H */
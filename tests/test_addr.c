@@ -0,0 +1,221 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http.h"
+#include "test.h"
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t
+next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return rng;
+}
+
+static void
+check_format(const char *text, const int family)
+{
+    struct http_addr addr;
+    char buf[HTTP_ADDR_STRLEN];
+
+    TEST_ASSERT_INT(http_addr_parse(text, strlen(text), &addr), 0);
+    TEST_ASSERT_INT(addr.family, family);
+    size_t n = http_addr_format(&addr, buf);
+    TEST_ASSERT_INT(n, strlen(buf));
+    TEST_ASSERT_STR(buf, text);
+}
+
+static void
+test_format(void)
+{
+    check_format("0.0.0.0", AF_INET);
+    check_format("255.255.255.255", AF_INET);
+    check_format("192.0.2.1", AF_INET);
+    check_format("::", AF_INET6);
+    check_format("::1", AF_INET6);
+    check_format("2001:db8::1", AF_INET6);
+    check_format("2001:db8:0:1:1:1:1:1", AF_INET6);
+    check_format("2001:0:0:1::1", AF_INET6);
+    check_format("fe80::1:0:0:1", AF_INET6);
+    check_format("::ffff:192.0.2.1", AF_INET6);
+    check_format("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", AF_INET6);
+
+    struct http_addr addr = { .family = AF_UNSPEC };
+    char buf[HTTP_ADDR_STRLEN];
+    TEST_ASSERT_INT(http_addr_format(&addr, buf), 0);
+}
+
+/**
+ * test_format_matches_inet_ntop compares against inet_ntop on random
+ * addresses, biased towards zero runs. IPv4-compatible addresses, ::a.b.c.d,
+ * are left out since they're written in hex as RFC 5952 recommends.
+ */
+static void
+test_format_matches_inet_ntop(void)
+{
+    struct http_addr addr;
+    char ours[HTTP_ADDR_STRLEN];
+    char theirs[INET6_ADDRSTRLEN];
+    int mismatches = 0;
+
+    for (int i = 0; i < 200000; i++) {
+        addr.family = (i & 1) ? AF_INET6 : AF_INET;
+        for (int k = 0; k < 16; k++) {
+            uint64_t r = next_random();
+            addr.bytes[k] = r % 3 == 0 ? 0 : (unsigned char)(r >> 8);
+        }
+        if (i % 7 == 0) {
+            memcpy(addr.bytes, "\0\0\0\0\0\0\0\0\0\0\xff\xff", 12);
+        }
+        static const unsigned char zeros[12];
+        if (addr.family == AF_INET6 && memcmp(addr.bytes, zeros, 12) == 0) {
+            continue;
+        }
+
+        http_addr_format(&addr, ours);
+        inet_ntop(addr.family, addr.bytes, theirs, sizeof(theirs));
+        if (strcmp(ours, theirs) != 0) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "mismatch: %s != %s\n", ours, theirs);
+            }
+            continue;
+        }
+
+        struct http_addr back;
+        TEST_ASSERT(http_addr_parse(ours, strlen(ours), &back) == 0 &&
+            memcmp(back.bytes, addr.bytes, http_addr_len(&addr)) == 0);
+    }
+    TEST_ASSERT_INT(mismatches, 0);
+}
+
+static void
+test_parse_invalid(void)
+{
+    struct http_addr addr;
+
+    TEST_ASSERT_INT(http_addr_parse("", 0, &addr), -1);
+    TEST_ASSERT_INT(http_addr_parse("1.2.3", 5, &addr), -1);
+    TEST_ASSERT_INT(http_addr_parse("1.2.3.256", 9, &addr), -1);
+    TEST_ASSERT_INT(http_addr_parse("::1::2", 6, &addr), -1);
+    TEST_ASSERT_INT(http_addr_parse("unknown", 7, &addr), -1);
+
+    // only len bytes are looked at
+    TEST_ASSERT_INT(http_addr_parse("10.0.0.1:8080", 8, &addr), 0);
+    TEST_ASSERT_INT(addr.family, AF_INET);
+}
+
+static void
+test_from_sockaddr(void)
+{
+    struct http_addr addr;
+    char buf[HTTP_ADDR_STRLEN];
+
+    struct sockaddr_in sin = { .sin_family = AF_INET };
+    inet_pton(AF_INET, "198.51.100.7", &sin.sin_addr);
+    TEST_ASSERT_INT(http_addr_from_sockaddr((struct sockaddr*)&sin, &addr), 0);
+    http_addr_format(&addr, buf);
+    TEST_ASSERT_STR(buf, "198.51.100.7");
+
+    // v4 mapped peers are reported as plain IPv4
+    struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6 };
+    inet_pton(AF_INET6, "::ffff:10.0.0.1", &sin6.sin6_addr);
+    TEST_ASSERT_INT(http_addr_from_sockaddr((struct sockaddr*)&sin6, &addr), 0);
+    TEST_ASSERT_INT(addr.family, AF_INET);
+    http_addr_format(&addr, buf);
+    TEST_ASSERT_STR(buf, "10.0.0.1");
+
+    struct sockaddr unix_sa = { .sa_family = AF_UNIX };
+    TEST_ASSERT_INT(http_addr_from_sockaddr(&unix_sa, &addr), -1);
+}
+
+static void
+test_client_addr(void)
+{
+    TEST_ASSERT_INT(http_trusted_proxy_add("10.0.0.0/8"), 0);
+    TEST_ASSERT_INT(http_trusted_proxy_add("fd00::/8"), 0);
+    TEST_ASSERT_INT(http_trusted_proxy_add("1.2.3.4/33"), -1);
+    TEST_ASSERT_INT(http_trusted_proxy_add("bogus"), -1);
+
+    struct _u_map headers;
+    u_map_init(&headers);
+    struct sockaddr_in peer = { .sin_family = AF_INET };
+    inet_pton(AF_INET, "10.1.2.3", &peer.sin_addr);
+    struct _u_request request = {
+        .map_header = &headers,
+        .client_address = (struct sockaddr*)&peer,
+    };
+    char buf[HTTP_ADDR_STRLEN];
+
+    http_client_addr_format(&request, buf);
+    TEST_ASSERT_STR(buf, "10.1.2.3");
+
+    // the nearest untrusted hop wins, not whatever the client claimed
+    u_map_put(&headers, "X-Forwarded-For", "6.6.6.6, 203.0.113.9, 10.9.9.9");
+    http_client_addr_format(&request, buf);
+    TEST_ASSERT_STR(buf, "203.0.113.9");
+
+    // Forwarded takes precedence, with quoted IPv6 and ports
+    u_map_put(&headers, "Forwarded",
+        "for=1.1.1.1;proto=http, For=\"[2001:db8::1]:4711\";by=x, for=\"[fd00::5]\"");
+    http_client_addr_format(&request, buf);
+    TEST_ASSERT_STR(buf, "2001:db8::1");
+
+    // an obfuscated hop stops the walk at the last known proxy
+    u_map_put(&headers, "Forwarded", "for=unknown, for=10.0.0.7:80");
+    http_client_addr_format(&request, buf);
+    TEST_ASSERT_STR(buf, "10.0.0.7");
+
+    // headers from untrusted peers are ignored
+    inet_pton(AF_INET, "8.8.8.8", &peer.sin_addr);
+    http_client_addr_format(&request, buf);
+    TEST_ASSERT_STR(buf, "8.8.8.8");
+
+    u_map_clean(&headers);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_format);
+    TEST_RUN(test_format_matches_inet_ntop);
+    TEST_RUN(test_parse_invalid);
+    TEST_RUN(test_from_sockaddr);
+    TEST_RUN(test_client_addr);
+
+    return TEST_RESULT;
+}
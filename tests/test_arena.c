@@ -0,0 +1,147 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "test.h"
+
+static void
+test_alloc(void)
+{
+    struct http_arena *arena = http_arena_new();
+    TEST_ASSERT(arena != NULL);
+
+    char *prev = NULL;
+    for (size_t n = 1; n < 200; n += 7) {
+        char *p = (char*)http_arena_alloc(arena, n);
+        TEST_ASSERT(p != NULL);
+        TEST_ASSERT_INT((uintptr_t)p % alignof(max_align_t), 0);
+        TEST_ASSERT(p != prev);
+        memset(p, 0xab, n);
+        prev = p;
+    }
+
+    char *s = http_arena_strndup(arena, "hello world", 5);
+    TEST_ASSERT_STR(s, "hello");
+
+    // bigger than a quarter chunk, so it gets a block of its own
+    char *big = (char*)http_arena_alloc(arena, HTTP_ARENA_CHUNK_SIZE * 4);
+    TEST_ASSERT(big != NULL);
+    memset(big, 0xcd, HTTP_ARENA_CHUNK_SIZE * 4);
+    TEST_ASSERT_STR(s, "hello");
+
+    TEST_ASSERT(http_arena_alloc(NULL, 16) == NULL);
+    TEST_ASSERT(http_arena_alloc(arena, SIZE_MAX) == NULL);
+
+    http_arena_free(arena);
+    http_arena_free(NULL);
+}
+
+/**
+ * test_reuse checks that freed chunks are cached for the thread's next
+ * arena and that the stats add up.
+ */
+static void
+test_reuse(void)
+{
+    struct http_arena_stats before, after;
+
+    // warm the cache
+    http_arena_free(http_arena_new());
+    http_arena_get_stats(&before);
+
+    for (int i = 0; i < 100; i++) {
+        struct http_arena *arena = http_arena_new();
+        for (int j = 0; j < 10; j++) {
+            TEST_ASSERT(http_arena_alloc(arena, 100) != NULL);
+        }
+        http_arena_free(arena);
+    }
+    http_arena_get_stats(&after);
+
+    TEST_ASSERT_INT(after.requests - before.requests, 100);
+    TEST_ASSERT_INT(after.chunk_allocs, before.chunk_allocs);
+    TEST_ASSERT_INT(after.overflows, before.overflows);
+    TEST_ASSERT(after.bytes - before.bytes >= 100 * 10 * 100);
+    TEST_ASSERT(after.peak_bytes >= 10 * 100);
+
+    // spilling into more chunks counts as an overflow
+    struct http_arena *arena = http_arena_new();
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT(http_arena_alloc(arena, 512) != NULL);
+    }
+    http_arena_free(arena);
+    http_arena_get_stats(&after);
+    TEST_ASSERT_INT(after.overflows - before.overflows, 1);
+}
+
+static void*
+free_arena(void *arg)
+{
+    http_arena_free((struct http_arena*)arg);
+
+    return NULL;
+}
+
+/**
+ * test_cross_thread frees an arena on another thread than the one that
+ * created it, as happens when a response is cleaned up elsewhere.
+ */
+static void
+test_cross_thread(void)
+{
+    struct http_arena *arena = http_arena_new();
+    for (int i = 0; i < 50; i++) {
+        TEST_ASSERT(http_arena_alloc(arena, 200) != NULL);
+    }
+    TEST_ASSERT(http_arena_alloc(arena, 100000) != NULL);
+
+    pthread_t t;
+    TEST_ASSERT_INT(pthread_create(&t, NULL, free_arena, arena), 0);
+    pthread_join(t, NULL);
+
+    struct http_arena_stats stats;
+    http_arena_get_stats(&stats);
+    TEST_ASSERT(stats.large_allocs >= 2);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_alloc);
+    TEST_RUN(test_reuse);
+    TEST_RUN(test_cross_thread);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,349 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "http.h"
+#include "test.h"
+
+static void
+test_equal(void)
+{
+    TEST_ASSERT_INT(http_auth_equal("secret", 6, "secret", 6), 1);
+    TEST_ASSERT_INT(http_auth_equal("secret", 6, "secreT", 6), 0);
+    TEST_ASSERT_INT(http_auth_equal("Secret", 6, "secret", 6), 0);
+    TEST_ASSERT_INT(http_auth_equal("secret", 6, "secrets", 7), 0);
+    TEST_ASSERT_INT(http_auth_equal("secrets", 7, "secret", 6), 0);
+    TEST_ASSERT_INT(http_auth_equal("secret", 6, "", 0), 0);
+    TEST_ASSERT_INT(http_auth_equal("", 0, "secret", 6), 0);
+    TEST_ASSERT_INT(http_auth_equal("", 0, "", 0), 1);
+
+    // a repeat of the shorter value mustn't compare equal
+    TEST_ASSERT_INT(http_auth_equal("abab", 4, "ab", 2), 0);
+}
+
+static int
+cache_get(struct http_auth_cache *cache, const char *key)
+{
+    return http_auth_cache_get(cache, key, strlen(key));
+}
+
+static void
+cache_put(struct http_auth_cache *cache, const char *key, const int result)
+{
+    http_auth_cache_put(cache, key, strlen(key), result);
+}
+
+static void
+test_cache(void)
+{
+    struct http_auth_cache *cache = http_auth_cache_new(64, 60, 60, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    TEST_ASSERT_INT(cache_get(cache, "Bearer a"), HTTP_AUTH_CACHE_MISS);
+    cache_put(cache, "Bearer a", HTTP_AUTH_CACHE_ALLOW);
+    cache_put(cache, "Bearer b", HTTP_AUTH_CACHE_DENY);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer a"), HTTP_AUTH_CACHE_ALLOW);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer b"), HTTP_AUTH_CACHE_DENY);
+
+    // only the exact header matches
+    TEST_ASSERT_INT(cache_get(cache, "Bearer a "), HTTP_AUTH_CACHE_MISS);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer A"), HTTP_AUTH_CACHE_MISS);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer "), HTTP_AUTH_CACHE_MISS);
+
+    // a later put replaces the result
+    cache_put(cache, "Bearer a", HTTP_AUTH_CACHE_DENY);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer a"), HTTP_AUTH_CACHE_DENY);
+
+    uint64_t hits, misses;
+    http_auth_cache_stats(cache, &hits, &misses);
+    TEST_ASSERT_INT(hits, 3);
+    TEST_ASSERT_INT(misses, 4);
+
+    // headers too long to cache are never stored
+    size_t long_len = HTTP_AUTH_CACHE_MAX_KEY + 1;
+    char *long_key = malloc(long_len);
+    memset(long_key, 'x', long_len);
+    http_auth_cache_put(cache, long_key, long_len, HTTP_AUTH_CACHE_ALLOW);
+    TEST_ASSERT_INT(http_auth_cache_get(cache, long_key, long_len), HTTP_AUTH_CACHE_MISS);
+    free(long_key);
+
+    http_auth_cache_free(cache);
+
+    TEST_ASSERT(http_auth_cache_new(0, 60, 60, 0) == NULL);
+}
+
+/**
+ * test_cache_ttl checks that results expire after their TTL and failures
+ * after the negative TTL, or aren't cached at all when that's 0.
+ */
+static void
+test_cache_ttl(void)
+{
+    // the clock has a one second resolution, so the TTLs are a second apart
+    // plus one for rounding
+    struct http_auth_cache *cache = http_auth_cache_new(64, 3, 1, 0);
+    struct http_auth_cache *no_negative = http_auth_cache_new(64, 60, 0, 0);
+    TEST_ASSERT(cache != NULL);
+    TEST_ASSERT(no_negative != NULL);
+    if (cache == NULL || no_negative == NULL) {
+        http_auth_cache_free(cache);
+        http_auth_cache_free(no_negative);
+        return;
+    }
+
+    cache_put(cache, "Bearer good", HTTP_AUTH_CACHE_ALLOW);
+    cache_put(cache, "Bearer bad", HTTP_AUTH_CACHE_DENY);
+    cache_put(no_negative, "Bearer bad", HTTP_AUTH_CACHE_DENY);
+    cache_put(no_negative, "Bearer good", HTTP_AUTH_CACHE_ALLOW);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer bad"), HTTP_AUTH_CACHE_DENY);
+    TEST_ASSERT_INT(cache_get(no_negative, "Bearer bad"), HTTP_AUTH_CACHE_MISS);
+    TEST_ASSERT_INT(cache_get(no_negative, "Bearer good"), HTTP_AUTH_CACHE_ALLOW);
+
+    usleep(1100 * 1000);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer bad"), HTTP_AUTH_CACHE_MISS);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer good"), HTTP_AUTH_CACHE_ALLOW);
+
+    usleep(2000 * 1000);
+    TEST_ASSERT_INT(cache_get(cache, "Bearer good"), HTTP_AUTH_CACHE_MISS);
+
+    http_auth_cache_free(cache);
+    http_auth_cache_free(no_negative);
+}
+
+/**
+ * test_cache_lru checks that the cache stays within its capacity by
+ * evicting the least recently used entries, keeping ones still in use.
+ */
+static void
+test_cache_lru(void)
+{
+    size_t capacity = 2 * HTTP_AUTH_CACHE_SHARDS;
+    struct http_auth_cache *cache = http_auth_cache_new(capacity, 60, 60, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    cache_put(cache, "Bearer hot", HTTP_AUTH_CACHE_ALLOW);
+    cache_put(cache, "Bearer cold", HTTP_AUTH_CACHE_ALLOW);
+
+    char key[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "Bearer %d", i);
+        cache_put(cache, key, HTTP_AUTH_CACHE_ALLOW);
+        TEST_ASSERT_INT(cache_get(cache, "Bearer hot"), HTTP_AUTH_CACHE_ALLOW);
+    }
+    TEST_ASSERT_INT(cache_get(cache, "Bearer cold"), HTTP_AUTH_CACHE_MISS);
+
+    size_t live = 0;
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "Bearer %d", i);
+        live += cache_get(cache, key) == HTTP_AUTH_CACHE_ALLOW;
+    }
+    TEST_ASSERT(live > 0);
+    TEST_ASSERT(live < capacity);
+
+    http_auth_cache_free(cache);
+}
+
+struct verifier {
+    int calls;
+};
+
+static int
+verify_token(const char *token, const size_t len, void *arg)
+{
+    ((struct verifier*)arg)->calls++;
+
+    return len == 4 && memcmp(token, "good", 4) == 0;
+}
+
+static int
+verify_basic(const char *user, const char *password, void *arg)
+{
+    ((struct verifier*)arg)->calls++;
+
+    return strcmp(user, "alice") == 0 && strcmp(password, "wonderland") == 0;
+}
+
+/**
+ * authorize runs callback with the given Authorization header, and basic
+ * auth user and password if user isn't NULL, and returns what it returned.
+ */
+static int
+authorize(int (*callback)(const struct _u_request *, struct _u_response *, void *),
+          struct http_auth *auth, const char *header, const char *user,
+          const char *password)
+{
+    struct _u_request request;
+    struct _u_response response;
+    ulfius_init_request(&request);
+    ulfius_init_response(&response);
+
+    if (header != NULL) {
+        u_map_put(request.map_header, HTTP_REQUEST_HEADER_AUTHORIZATION, header);
+    }
+    if (user != NULL) {
+        request.auth_basic_user = o_strdup(user);
+        request.auth_basic_password = o_strdup(password);
+    }
+
+    int ret = callback(&request, &response, auth);
+    if (ret == U_CALLBACK_UNAUTHORIZED) {
+        TEST_ASSERT_INT(response.status, 401);
+        TEST_ASSERT(u_map_get(response.map_header, HTTP_RESPONSE_HEADER_WWW_AUTHENTICATE) != NULL);
+    }
+
+    o_free(request.auth_basic_user);
+    o_free(request.auth_basic_password);
+    request.auth_basic_user = NULL;
+    request.auth_basic_password = NULL;
+    ulfius_clean_response(&response);
+    ulfius_clean_request(&request);
+
+    return ret;
+}
+
+static void
+test_bearer(void)
+{
+    struct verifier v = { 0 };
+    struct http_auth auth = {
+        .verify_token = verify_token,
+        .arg = &v,
+        .cache = http_auth_cache_new(64, 60, 60, 0),
+    };
+
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer good", NULL, NULL),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(v.calls, 1);
+
+    // a hit doesn't verify again
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer good", NULL, NULL),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(v.calls, 1);
+
+    // wrong tokens are rejected, then rejected from the cache
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer bad", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(v.calls, 2);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer bad", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(v.calls, 2);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer goo", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer goodx", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+
+    // malformed headers never reach the verifier
+    int calls = v.calls;
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, NULL, NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Bearer ", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &auth, "Basic good", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(v.calls, calls);
+
+    // without a cache every request is verified
+    struct http_auth uncached = auth;
+    uncached.cache = NULL;
+    calls = v.calls;
+    TEST_ASSERT_INT(authorize(callback_auth_token, &uncached, "Bearer good", NULL, NULL),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(authorize(callback_auth_token, &uncached, "Bearer good", NULL, NULL),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(v.calls, calls + 2);
+
+    TEST_ASSERT_INT(authorize(callback_auth_token, NULL, "Bearer good", NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+
+    http_auth_cache_free(auth.cache);
+}
+
+static void
+test_basic(void)
+{
+    struct verifier v = { 0 };
+    struct http_auth auth = {
+        .verify_basic = verify_basic,
+        .arg = &v,
+        .cache = http_auth_cache_new(64, 60, 60, 0),
+    };
+    // the headers stand in for the base64 ulfius decoded the user from
+    const char *good = "Basic YWxpY2U6d29uZGVybGFuZA==";
+    const char *bad = "Basic YWxpY2U6d29uZGVybGFuZQ==";
+
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, &auth, good, "alice", "wonderland"),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, &auth, good, "alice", "wonderland"),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_INT(v.calls, 1);
+
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, &auth, bad, "alice", "wonderlane"),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, &auth, bad, "alice", "wonderlane"),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(v.calls, 2);
+
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, &auth, NULL, NULL, NULL),
+        U_CALLBACK_UNAUTHORIZED);
+    TEST_ASSERT_INT(v.calls, 2);
+
+    // the build time credentials have no password by default, which
+    // rejects everyone
+    TEST_ASSERT_INT(authorize(callback_auth_basic_body, NULL, "Basic dXNlcjo=", "user", ""),
+        U_CALLBACK_UNAUTHORIZED);
+
+    http_auth_cache_free(auth.cache);
+}
+
+int
+main(void)
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    s_log_init(null_out);
+
+    TEST_RUN(test_equal);
+    TEST_RUN(test_cache);
+    TEST_RUN(test_cache_ttl);
+    TEST_RUN(test_cache_lru);
+    TEST_RUN(test_bearer);
+    TEST_RUN(test_basic);
+
+    s_log_init(stderr);
+    fclose(null_out);
+
+    return TEST_RESULT;
+}
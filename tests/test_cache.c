@@ -0,0 +1,402 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "http.h"
+#include "test.h"
+
+/**
+ * handler_config sets the headers the test handler adds to its response.
+ * Every response it builds has a different body, so a repeated body shows
+ * the response came from the cache.
+ */
+struct handler_config {
+    const char *cache_control;
+    const char *last_modified;
+    const char *vary;
+    const char *set_cookie;
+    size_t body_size;
+};
+
+static int handled;
+
+static void
+handler(struct _u_response *response, const struct handler_config *config)
+{
+    char body[4096];
+    size_t len = (size_t)snprintf(body, sizeof(body), "response %d", ++handled);
+
+    if (config->body_size > len && config->body_size <= sizeof(body)) {
+        memset(body + len, '.', config->body_size - len);
+        len = config->body_size;
+    }
+    if (config->cache_control != NULL) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_CACHE_CONTROL,
+            config->cache_control);
+    }
+    if (config->last_modified != NULL) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_LAST_MODIFIED,
+            config->last_modified);
+    }
+    if (config->vary != NULL) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_VARY, config->vary);
+    }
+    if (config->set_cookie != NULL) {
+        u_map_put(response->map_header, HTTP_RESPONSE_HEADER_SET_COOKIE, config->set_cookie);
+    }
+    ulfius_set_binary_body_response(response, 200, body, len);
+}
+
+/**
+ * result is what a client got back from serve.
+ */
+struct result {
+    long status;
+    int hit;
+    char body[64];
+    char etag[64];
+};
+
+/**
+ * serve runs a request through a route with the cache, as
+ * callback_cache_lookup, the handler and callback_cache_store would. The
+ * headers are name and value pairs ending with a NULL name.
+ */
+static struct result
+serve(struct http_cache *cache, const char *verb, const char *url,
+      const char *const *headers, const struct handler_config *config)
+{
+    struct _u_request request;
+    struct _u_response response;
+    struct result result = { 0 };
+
+    ulfius_init_request(&request);
+    ulfius_init_response(&response);
+    o_free(request.http_verb);
+    request.http_verb = o_strdup(verb);
+    o_free(request.http_url);
+    request.http_url = o_strdup(url);
+    for (size_t i = 0; headers != NULL && headers[i] != NULL; i += 2) {
+        u_map_put(request.map_header, headers[i], headers[i + 1]);
+    }
+
+    int before = handled;
+    if (callback_cache_lookup(&request, &response, cache) != U_CALLBACK_COMPLETE) {
+        handler(&response, config);
+        callback_cache_store(&request, &response, cache);
+    }
+    result.hit = handled == before;
+    result.status = response.status;
+    snprintf(result.body, sizeof(result.body), "%.*s",
+        (int)(response.binary_body_length < 63 ? response.binary_body_length : 63),
+        response.binary_body != NULL ? (const char*)response.binary_body : "");
+    const char *etag = u_map_get_case(response.map_header, HTTP_RESPONSE_HEADER_ETAG);
+    snprintf(result.etag, sizeof(result.etag), "%s", etag != NULL ? etag : "");
+
+    ulfius_clean_response(&response);
+    ulfius_clean_request(&request);
+
+    return result;
+}
+
+static const struct handler_config plain = { .cache_control = "max-age=60" };
+
+static void
+test_hit(void)
+{
+    struct http_cache *cache = http_cache_new(1 << 20, 0, NULL, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    struct result miss = serve(cache, "GET", "/a", NULL, &plain);
+    TEST_ASSERT_INT(miss.hit, 0);
+    TEST_ASSERT_INT(miss.status, 200);
+    TEST_ASSERT(miss.etag[0] == '"');
+
+    struct result hit = serve(cache, "GET", "/a", NULL, &plain);
+    TEST_ASSERT_INT(hit.hit, 1);
+    TEST_ASSERT_INT(hit.status, 200);
+    TEST_ASSERT_STR(hit.body, miss.body);
+    TEST_ASSERT_STR(hit.etag, miss.etag);
+
+    // HEAD is answered from the GET entry but never stored itself
+    struct result head = serve(cache, "HEAD", "/a", NULL, &plain);
+    TEST_ASSERT_INT(head.hit, 1);
+    TEST_ASSERT_STR(head.etag, miss.etag);
+    TEST_ASSERT_INT(serve(cache, "HEAD", "/b", NULL, &plain).hit, 0);
+    TEST_ASSERT_INT(serve(cache, "GET", "/b", NULL, &plain).hit, 0);
+
+    // the query string is part of the key, other methods aren't cached
+    TEST_ASSERT_INT(serve(cache, "GET", "/a?page=2", NULL, &plain).hit, 0);
+    TEST_ASSERT_INT(serve(cache, "POST", "/a", NULL, &plain).hit, 0);
+
+    // clients can ask for a fresh response
+    static const char *const no_cache[] = { "Cache-Control", "no-cache", NULL };
+    TEST_ASSERT_INT(serve(cache, "GET", "/a", no_cache, &plain).hit, 0);
+
+    uint64_t hits, misses;
+    size_t bytes;
+    http_cache_stats(cache, &hits, &misses, &bytes);
+    TEST_ASSERT_INT(hits, 2);
+    TEST_ASSERT(bytes > 0);
+
+    http_cache_free(cache);
+}
+
+/**
+ * test_vary checks that responses are keyed on the vary headers, telling
+ * an absent header from an empty one.
+ */
+static void
+test_vary(void)
+{
+    static const char *const vary[] = { "Accept-Language" };
+    static const char *const en[] = { "Accept-Language", "en", NULL };
+    static const char *const fr[] = { "Accept-Language", "fr", NULL };
+    static const char *const empty[] = { "Accept-Language", "", NULL };
+    struct http_cache *cache = http_cache_new(1 << 20, 0, vary, 1);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    struct result r_none = serve(cache, "GET", "/v", NULL, &plain);
+    struct result r_empty = serve(cache, "GET", "/v", empty, &plain);
+    struct result r_en = serve(cache, "GET", "/v", en, &plain);
+    struct result r_fr = serve(cache, "GET", "/v", fr, &plain);
+    TEST_ASSERT_INT(r_none.hit + r_empty.hit + r_en.hit + r_fr.hit, 0);
+
+    struct result h = serve(cache, "GET", "/v", NULL, &plain);
+    TEST_ASSERT_INT(h.hit, 1);
+    TEST_ASSERT_STR(h.body, r_none.body);
+    h = serve(cache, "GET", "/v", empty, &plain);
+    TEST_ASSERT_INT(h.hit, 1);
+    TEST_ASSERT_STR(h.body, r_empty.body);
+    h = serve(cache, "GET", "/v", en, &plain);
+    TEST_ASSERT_INT(h.hit, 1);
+    TEST_ASSERT_STR(h.body, r_en.body);
+    h = serve(cache, "GET", "/v", fr, &plain);
+    TEST_ASSERT_INT(h.hit, 1);
+    TEST_ASSERT_STR(h.body, r_fr.body);
+
+    // a response varying on a header the key doesn't include isn't stored
+    static const struct handler_config other = {
+        .cache_control = "max-age=60",
+        .vary = "Accept-Language, X-Other",
+    };
+    serve(cache, "GET", "/other", en, &other);
+    TEST_ASSERT_INT(serve(cache, "GET", "/other", en, &other).hit, 0);
+
+    http_cache_free(cache);
+}
+
+static void
+test_not_modified(void)
+{
+    static const struct handler_config dated = {
+        .cache_control = "max-age=60",
+        .last_modified = "Sun, 06 Nov 1994 08:49:37 GMT",
+    };
+    struct http_cache *cache = http_cache_new(1 << 20, 0, NULL, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    struct result first = serve(cache, "GET", "/e", NULL, &dated);
+    TEST_ASSERT_INT(first.status, 200);
+
+    const char *inm[] = { "If-None-Match", first.etag, NULL };
+    struct result r = serve(cache, "GET", "/e", inm, &dated);
+    TEST_ASSERT_INT(r.hit, 1);
+    TEST_ASSERT_INT(r.status, 304);
+    TEST_ASSERT_STR(r.etag, first.etag);
+    TEST_ASSERT_STR(r.body, "");
+
+    static const char *const inm_other[] = { "If-None-Match", "\"other\", W/\"x\"", NULL };
+    r = serve(cache, "GET", "/e", inm_other, &dated);
+    TEST_ASSERT_INT(r.status, 200);
+    TEST_ASSERT_STR(r.body, first.body);
+
+    static const char *const ims_same[] = {
+        "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT", NULL };
+    static const char *const ims_before[] = {
+        "If-Modified-Since", "Sat, 05 Nov 1994 08:49:37 GMT", NULL };
+    TEST_ASSERT_INT(serve(cache, "GET", "/e", ims_same, &dated).status, 304);
+    TEST_ASSERT_INT(serve(cache, "GET", "/e", ims_before, &dated).status, 200);
+
+    // If-None-Match wins over If-Modified-Since
+    static const char *const both[] = {
+        "If-None-Match", "\"other\"",
+        "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT", NULL };
+    TEST_ASSERT_INT(serve(cache, "GET", "/e", both, &dated).status, 200);
+
+    http_cache_free(cache);
+}
+
+/**
+ * test_not_stored checks the responses a shared cache mustn't keep.
+ */
+static void
+test_not_stored(void)
+{
+    static const struct handler_config no_store = { .cache_control = "no-store" };
+    static const struct handler_config private = { .cache_control = "private, max-age=60" };
+    static const struct handler_config cookie = {
+        .cache_control = "max-age=60",
+        .set_cookie = "session=1",
+    };
+    static const struct handler_config public = { .cache_control = "public, max-age=60" };
+    static const struct handler_config no_ttl = { 0 };
+    static const char *const auth[] = { "Authorization", "Bearer token", NULL };
+    struct http_cache *cache = http_cache_new(1 << 20, 0, NULL, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_INT(serve(cache, "GET", "/no-store", NULL, &no_store).hit, 0);
+        TEST_ASSERT_INT(serve(cache, "GET", "/private", NULL, &private).hit, 0);
+        TEST_ASSERT_INT(serve(cache, "GET", "/cookie", NULL, &cookie).hit, 0);
+        TEST_ASSERT_INT(serve(cache, "GET", "/auth", auth, &plain).hit, 0);
+        TEST_ASSERT_INT(serve(cache, "GET", "/no-ttl", NULL, &no_ttl).hit, 0);
+    }
+
+    // authenticated responses marked public can be shared
+    serve(cache, "GET", "/public", auth, &public);
+    TEST_ASSERT_INT(serve(cache, "GET", "/public", auth, &public).hit, 1);
+
+    uint64_t hits, misses;
+    size_t bytes;
+    http_cache_stats(cache, &hits, &misses, &bytes);
+    TEST_ASSERT_INT(hits, 1);
+
+    http_cache_free(cache);
+
+    // without a Cache-Control the default TTL applies
+    cache = http_cache_new(1 << 20, 60, NULL, 0);
+    if (cache != NULL) {
+        serve(cache, "GET", "/no-ttl", NULL, &no_ttl);
+        TEST_ASSERT_INT(serve(cache, "GET", "/no-ttl", NULL, &no_ttl).hit, 1);
+        http_cache_free(cache);
+    }
+}
+
+static void
+test_ttl(void)
+{
+    static const struct handler_config short_ttl = { .cache_control = "max-age=1" };
+    struct http_cache *cache = http_cache_new(1 << 20, 0, NULL, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    serve(cache, "GET", "/t", NULL, &short_ttl);
+    serve(cache, "GET", "/s", NULL, &plain);
+    TEST_ASSERT_INT(serve(cache, "GET", "/t", NULL, &short_ttl).hit, 1);
+
+    usleep(1100 * 1000);
+    TEST_ASSERT_INT(serve(cache, "GET", "/t", NULL, &short_ttl).hit, 0);
+    TEST_ASSERT_INT(serve(cache, "GET", "/s", NULL, &plain).hit, 1);
+
+    http_cache_free(cache);
+}
+
+/**
+ * test_eviction checks that the cache stays under its byte cap, that the
+ * CLOCK hand evicts entries that aren't being used and that it passes over
+ * one that is.
+ */
+static void
+test_eviction(void)
+{
+    static const struct handler_config big = {
+        .cache_control = "max-age=60",
+        .body_size = 1000,
+    };
+    size_t max_bytes = HTTP_CACHE_SHARDS * 4096;
+    struct http_cache *cache = http_cache_new(max_bytes, 0, NULL, 0);
+    TEST_ASSERT(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    serve(cache, "GET", "/cold", NULL, &big);
+    serve(cache, "GET", "/hot", NULL, &big);
+
+    for (int i = 0; i < 500; i++) {
+        char url[32];
+        snprintf(url, sizeof(url), "/page/%d", i);
+        serve(cache, "GET", url, NULL, &big);
+        TEST_ASSERT_INT(serve(cache, "GET", "/hot", NULL, &big).hit, 1);
+
+        uint64_t hits, misses;
+        size_t bytes;
+        http_cache_stats(cache, &hits, &misses, &bytes);
+        TEST_ASSERT(bytes <= max_bytes);
+    }
+    TEST_ASSERT_INT(serve(cache, "GET", "/cold", NULL, &big).hit, 0);
+
+    int cached = 0;
+    for (int i = 0; i < 500; i++) {
+        char url[32];
+        snprintf(url, sizeof(url), "/page/%d", i);
+        cached += serve(cache, "GET", url, NULL, &big).hit;
+    }
+    TEST_ASSERT(cached < 500);
+
+    http_cache_free(cache);
+}
+
+int
+main(void)
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    s_log_init(null_out);
+    http_metrics_init();
+
+    TEST_RUN(test_hit);
+    TEST_RUN(test_vary);
+    TEST_RUN(test_not_modified);
+    TEST_RUN(test_not_stored);
+    TEST_RUN(test_ttl);
+    TEST_RUN(test_eviction);
+
+    s_log_init(stderr);
+    fclose(null_out);
+
+    return TEST_RESULT;
+}
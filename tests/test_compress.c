@@ -0,0 +1,378 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "compress.h"
+#include "http.h"
+#include "test.h"
+
+/**
+ * HTTP_ENCODING_BEST is the encoding picked when every one is acceptable.
+ */
+#if defined(HTTP_HAVE_BROTLI)
+#define HTTP_ENCODING_BEST HTTP_ENCODING_BROTLI
+#elif defined(HTTP_HAVE_ZSTD)
+#define HTTP_ENCODING_BEST HTTP_ENCODING_ZSTD
+#else
+#define HTTP_ENCODING_BEST HTTP_ENCODING_GZIP
+#endif
+
+static void
+test_negotiate(void)
+{
+    TEST_ASSERT_INT(http_encoding_negotiate(NULL), HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate(""), HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate("identity"), HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip"), HTTP_ENCODING_GZIP);
+    TEST_ASSERT_INT(http_encoding_negotiate("GZip"), HTTP_ENCODING_GZIP);
+    TEST_ASSERT_INT(http_encoding_negotiate("x-gzip"), HTTP_ENCODING_GZIP);
+    TEST_ASSERT_INT(http_encoding_negotiate("deflate"), HTTP_ENCODING_DEFLATE);
+    TEST_ASSERT_INT(http_encoding_negotiate("compress, unknown"), HTTP_ENCODING_IDENTITY);
+
+    // gzip is preferred on a tie, q-values decide otherwise
+    TEST_ASSERT_INT(http_encoding_negotiate("deflate, gzip"), HTTP_ENCODING_GZIP);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip;q=0.5, deflate"), HTTP_ENCODING_DEFLATE);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip ; q=0.8, deflate;q=0.9"),
+        HTTP_ENCODING_DEFLATE);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip;q=1.0, deflate;q=0.999"),
+        HTTP_ENCODING_GZIP);
+
+    // q=0 means not acceptable
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip;q=0"), HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip;q=0.000, deflate;q=0"),
+        HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate("x-gzip;q=0, deflate;q=0.1"),
+        HTTP_ENCODING_DEFLATE);
+
+    // * covers everything not listed
+    TEST_ASSERT_INT(http_encoding_negotiate("*"), HTTP_ENCODING_BEST);
+    TEST_ASSERT_INT(http_encoding_negotiate("*;q=0"), HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_INT(http_encoding_negotiate("*;q=0, deflate"), HTTP_ENCODING_DEFLATE);
+#if !defined(HTTP_HAVE_BROTLI) && !defined(HTTP_HAVE_ZSTD)
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip;q=0, *;q=0.5"), HTTP_ENCODING_DEFLATE);
+#endif
+#ifdef HTTP_HAVE_BROTLI
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip, br"), HTTP_ENCODING_BROTLI);
+    TEST_ASSERT_INT(http_encoding_negotiate("gzip, br;q=0"), HTTP_ENCODING_GZIP);
+#else
+    TEST_ASSERT_INT(http_encoding_negotiate("br"), HTTP_ENCODING_IDENTITY);
+#endif
+}
+
+/**
+ * body is a compressible JSON body of about 4KB.
+ */
+static char body[4096];
+static size_t body_len;
+
+static void
+body_init(void)
+{
+    size_t len = 0;
+
+    len += (size_t)snprintf(body + len, sizeof(body) - len, "[");
+    for (int i = 0; len + 64 < sizeof(body); i++) {
+        len += (size_t)snprintf(body + len, sizeof(body) - len,
+            "%s{\"id\":%d,\"name\":\"user %d\"}", i > 0 ? "," : "", i, i);
+    }
+    len += (size_t)snprintf(body + len, sizeof(body) - len, "]");
+    body_len = len;
+}
+
+/**
+ * inflate_body decompresses a gzip or zlib body into out. Returns the
+ * length or 0 on failure.
+ */
+static size_t
+inflate_body(const void *in, const size_t len, const int gzip, char *out, const size_t cap)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, gzip ? 15 + 16 : 15) != Z_OK) {
+        return 0;
+    }
+
+    zs.next_in = (Bytef*)in;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = (uInt)cap;
+    int ret = inflate(&zs, Z_FINISH);
+    size_t n = cap - zs.avail_out;
+    inflateEnd(&zs);
+
+    return ret == Z_STREAM_END ? n : 0;
+}
+
+/**
+ * exchange is a request and the response the handler built for it.
+ */
+struct exchange {
+    struct _u_request request;
+    struct _u_response response;
+};
+
+static void
+exchange_init(struct exchange *x, const char *verb, const char *url,
+              const char *accept_encoding, const char *data, const size_t len)
+{
+    ulfius_init_request(&x->request);
+    ulfius_init_response(&x->response);
+    o_free(x->request.http_verb);
+    x->request.http_verb = o_strdup(verb);
+    o_free(x->request.http_url);
+    x->request.http_url = o_strdup(url);
+    if (accept_encoding != NULL) {
+        u_map_put(x->request.map_header, "Accept-Encoding", accept_encoding);
+    }
+    ulfius_set_binary_body_response(&x->response, 200, data, len);
+}
+
+static void
+exchange_clean(struct exchange *x)
+{
+    ulfius_clean_response(&x->response);
+    ulfius_clean_request(&x->request);
+}
+
+static const char*
+response_header(const struct exchange *x, const char *name)
+{
+    return u_map_get_case(x->response.map_header, name);
+}
+
+static void
+test_round_trip(void)
+{
+    struct http_compress *compress = http_compress_new(HTTP_COMPRESS_MIN_SIZE, 6, 0);
+    static char out[8192];
+    struct exchange x;
+
+    TEST_ASSERT(compress != NULL);
+    for (int gzip = 0; gzip < 2 && compress != NULL; gzip++) {
+        exchange_init(&x, "GET", "/users", gzip ? "gzip" : "deflate", body, body_len);
+        u_map_put(x.response.map_header, "Content-Type", "application/json");
+        TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+            gzip ? HTTP_ENCODING_GZIP : HTTP_ENCODING_DEFLATE);
+        TEST_ASSERT_STR(response_header(&x, "Content-Encoding"), gzip ? "gzip" : "deflate");
+        TEST_ASSERT_STR(response_header(&x, "Vary"), "Accept-Encoding");
+        TEST_ASSERT(x.response.binary_body_length < body_len);
+
+        size_t n = inflate_body(x.response.binary_body, x.response.binary_body_length,
+            gzip, out, sizeof(out));
+        TEST_ASSERT_INT(n, body_len);
+        TEST_ASSERT(n == body_len && memcmp(out, body, body_len) == 0);
+        exchange_clean(&x);
+    }
+
+    http_compress_free(compress);
+}
+
+/**
+ * test_skipped checks the responses that are left alone.
+ */
+static void
+test_skipped(void)
+{
+    struct http_compress *compress = http_compress_new(HTTP_COMPRESS_MIN_SIZE, 6, 0);
+    static const char *const types[] = {
+        "image/png", "video/mp4", "application/zip", "application/gzip", "font/woff2",
+    };
+    struct exchange x;
+
+    TEST_ASSERT(compress != NULL);
+    if (compress == NULL) {
+        return;
+    }
+
+    // too small to be worth it
+    exchange_init(&x, "GET", "/small", "gzip", body, HTTP_COMPRESS_MIN_SIZE - 1);
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT(response_header(&x, "Content-Encoding") == NULL);
+    TEST_ASSERT_INT(x.response.binary_body_length, HTTP_COMPRESS_MIN_SIZE - 1);
+    exchange_clean(&x);
+
+    // already encoded by the handler
+    exchange_init(&x, "GET", "/encoded", "gzip", body, body_len);
+    u_map_put(x.response.map_header, "Content-Encoding", "br");
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_STR(response_header(&x, "Content-Encoding"), "br");
+    TEST_ASSERT_INT(x.response.binary_body_length, body_len);
+    exchange_clean(&x);
+
+    // compressed media types
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        exchange_init(&x, "GET", "/media", "gzip", body, body_len);
+        u_map_put(x.response.map_header, "Content-Type", types[i]);
+        TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+            HTTP_ENCODING_IDENTITY);
+        TEST_ASSERT(response_header(&x, "Content-Encoding") == NULL);
+        TEST_ASSERT_INT(x.response.binary_body_length, body_len);
+        exchange_clean(&x);
+    }
+
+    // SVG is text
+    exchange_init(&x, "GET", "/logo.svg", "gzip", body, body_len);
+    u_map_put(x.response.map_header, "Content-Type", "image/svg+xml");
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_GZIP);
+    exchange_clean(&x);
+
+    // HEAD gets the Vary header but no body to compress
+    exchange_init(&x, "HEAD", "/users", "gzip", body, body_len);
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_STR(response_header(&x, "Vary"), "Accept-Encoding");
+    exchange_clean(&x);
+
+    // the client doesn't accept any encoding, the body still varies on it
+    exchange_init(&x, "GET", "/users", "identity", body, body_len);
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_IDENTITY);
+    TEST_ASSERT_STR(response_header(&x, "Vary"), "Accept-Encoding");
+    TEST_ASSERT_INT(x.response.binary_body_length, body_len);
+    exchange_clean(&x);
+
+    http_compress_free(compress);
+}
+
+static void
+test_headers(void)
+{
+    struct http_compress *compress = http_compress_new(HTTP_COMPRESS_MIN_SIZE, 6, 0);
+    struct exchange x;
+
+    TEST_ASSERT(compress != NULL);
+    if (compress == NULL) {
+        return;
+    }
+
+    // Accept-Encoding is added to an existing Vary, once
+    exchange_init(&x, "GET", "/users", "gzip", body, body_len);
+    u_map_put(x.response.map_header, "Vary", "Accept-Language");
+    u_map_put(x.response.map_header, "ETag", "\"v1\"");
+    TEST_ASSERT_INT(http_compress_response(compress, &x.request, &x.response),
+        HTTP_ENCODING_GZIP);
+    TEST_ASSERT_STR(response_header(&x, "Vary"), "Accept-Language, Accept-Encoding");
+    TEST_ASSERT_STR(response_header(&x, "ETag"), "W/\"v1\"");
+    exchange_clean(&x);
+
+    exchange_init(&x, "GET", "/users", "gzip", body, body_len);
+    u_map_put(x.response.map_header, "Vary", "Accept-Language, accept-encoding");
+    u_map_put(x.response.map_header, "ETag", "W/\"v1\"");
+    http_compress_response(compress, &x.request, &x.response);
+    TEST_ASSERT_STR(response_header(&x, "Vary"), "Accept-Language, accept-encoding");
+    TEST_ASSERT_STR(response_header(&x, "ETag"), "W/\"v1\"");
+    exchange_clean(&x);
+
+    http_compress_free(compress);
+}
+
+/**
+ * compress_url compresses data for the given URL and ETag with gzip and
+ * inflates the result into out. Returns the inflated length.
+ */
+static size_t
+compress_url(struct http_compress *compress, const char *url, const char *etag,
+             const char *data, char *out, const size_t cap)
+{
+    struct exchange x;
+
+    exchange_init(&x, "GET", url, "gzip", data, body_len);
+    u_map_put(x.response.map_header, "ETag", etag);
+    http_compress_response(compress, &x.request, &x.response);
+    size_t n = inflate_body(x.response.binary_body, x.response.binary_body_length, 1,
+        out, cap);
+    exchange_clean(&x);
+
+    return n;
+}
+
+/**
+ * test_cache checks that compressed bodies are reused for the same URL and
+ * strong ETag, and only then. The bodies differ but have the same length,
+ * so a body served from the cache gives itself away.
+ */
+static void
+test_cache(void)
+{
+    struct http_compress *compress = http_compress_new(HTTP_COMPRESS_MIN_SIZE, 6, 1 << 20);
+    static char other[sizeof(body)];
+    static char out[8192];
+
+    TEST_ASSERT(compress != NULL);
+    if (compress == NULL) {
+        return;
+    }
+    memcpy(other, body, body_len);
+    other[1] = '[';
+
+    TEST_ASSERT_INT(compress_url(compress, "/items?page=1", "\"v1\"", body, out, sizeof(out)),
+        body_len);
+    TEST_ASSERT(memcmp(out, body, body_len) == 0);
+
+    // same URL and ETag: served from the cache
+    TEST_ASSERT_INT(compress_url(compress, "/items?page=1", "\"v1\"", other, out, sizeof(out)),
+        body_len);
+    TEST_ASSERT(memcmp(out, body, body_len) == 0);
+
+    // another query string or ETag is another body
+    TEST_ASSERT_INT(compress_url(compress, "/items?page=2", "\"v1\"", other, out, sizeof(out)),
+        body_len);
+    TEST_ASSERT(memcmp(out, other, body_len) == 0);
+    TEST_ASSERT_INT(compress_url(compress, "/items?page=1", "\"v2\"", other, out, sizeof(out)),
+        body_len);
+    TEST_ASSERT(memcmp(out, other, body_len) == 0);
+
+    // weak ETags aren't cached
+    compress_url(compress, "/weak", "W/\"v1\"", body, out, sizeof(out));
+    TEST_ASSERT_INT(compress_url(compress, "/weak", "W/\"v1\"", other, out, sizeof(out)),
+        body_len);
+    TEST_ASSERT(memcmp(out, other, body_len) == 0);
+
+    http_compress_free(compress);
+}
+
+int
+main(void)
+{
+    body_init();
+
+    TEST_RUN(test_negotiate);
+    TEST_RUN(test_round_trip);
+    TEST_RUN(test_skipped);
+    TEST_RUN(test_headers);
+    TEST_RUN(test_cache);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,227 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http.h"
+#include "test.h"
+
+static char dir[] = "/tmp/http_files_XXXXXX";
+static char file_path[300];
+
+/**
+ * get runs a request for path through callback_static_file, with the given
+ * Range header if any, and reads the streamed body into body, returning its
+ * length, or -1 if the stream failed.
+ */
+static ssize_t
+get(struct http_files *files, const char *path, const char *range,
+    long *status, char *body, const size_t body_len, int truncate_after_first)
+{
+    struct _u_request request;
+    struct _u_response response;
+    ulfius_init_request(&request);
+    ulfius_init_response(&response);
+    request.http_verb = o_strdup("GET");
+    request.url_path = o_strdup(path);
+    request.http_protocol = o_strdup("HTTP/1.1");
+    if (range != NULL) {
+        u_map_put(request.map_header, "Range", range);
+    }
+
+    callback_static_file(&request, &response, files);
+    *status = response.status;
+
+    ssize_t len = 0;
+    if (response.stream_callback != NULL) {
+        char block[100];
+        for (;;) {
+            ssize_t n = response.stream_callback(response.stream_user_data,
+                (uint64_t)len, block, sizeof(block));
+            if (n == U_STREAM_END) {
+                break;
+            }
+            if (n < 0) {
+                len = -1;
+                break;
+            }
+            if ((size_t)(len + n) <= body_len) {
+                memcpy(body + len, block, (size_t)n);
+            }
+            len += n;
+            if (truncate_after_first) {
+                TEST_ASSERT_INT(truncate(file_path, 0), 0);
+                truncate_after_first = 0;
+            }
+        }
+    }
+
+    ulfius_clean_response(&response);
+    ulfius_clean_request(&request);
+
+    return len;
+}
+
+static void
+test_body(void)
+{
+    struct http_files *files = http_files_new(dir, "/static", 16);
+    TEST_ASSERT(files != NULL);
+
+    char body[4096];
+    long status;
+
+    ssize_t len = get(files, "/static/a.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 200);
+    TEST_ASSERT_INT(len, 1000);
+    int ok = len == 1000;
+    for (ssize_t i = 0; ok && i < len; i++) {
+        ok = body[i] == (char)('a' + i % 26);
+    }
+    TEST_ASSERT(ok);
+
+    len = get(files, "/static/a.txt", "bytes=26-51", &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 206);
+    TEST_ASSERT_MEM(body, (size_t)len, "abcdefghijklmnopqrstuvwxyz");
+
+    len = get(files, "/static/a.txt", "bytes=0-1,-2", &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 206);
+    body[len > 0 ? len : 0] = '\0';
+    TEST_ASSERT(strstr(body, "Content-Range: bytes 0-1/1000\r\n\r\nab\r\n--") != NULL);
+    TEST_ASSERT(strstr(body, "Content-Range: bytes 998-999/1000\r\n\r\nkl\r\n--") != NULL);
+
+    http_files_free(files);
+}
+
+/**
+ * test_truncated truncates the file in place halfway through sending it,
+ * which used to be a SIGBUS reading the mapping, and checks the stream
+ * fails instead.
+ */
+static void
+test_truncated(void)
+{
+    struct http_files *files = http_files_new(dir, "/static", 0);
+    TEST_ASSERT(files != NULL);
+
+    char body[4096];
+    long status;
+    ssize_t len = get(files, "/static/a.txt", NULL, &status, body, sizeof(body), 1);
+    TEST_ASSERT_INT(status, 200);
+    TEST_ASSERT_INT(len, -1);
+
+    http_files_free(files);
+}
+
+/**
+ * test_symlinks checks that symbolic links aren't followed, whether they're
+ * the file or a directory on the way to it.
+ */
+static void
+test_symlinks(void)
+{
+    struct http_files *files = http_files_new(dir, "/static", 16);
+    TEST_ASSERT(files != NULL);
+
+    char body[4096];
+    long status;
+
+    ssize_t len = get(files, "/static/sub/b.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 200);
+    TEST_ASSERT_MEM(body, (size_t)len, "b");
+
+    get(files, "/static/link/b.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 404);
+    get(files, "/static/sub/link/sub/b.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 404);
+    get(files, "/static/c.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 404);
+    get(files, "/static/a.txt/b.txt", NULL, &status, body, sizeof(body), 0);
+    TEST_ASSERT_INT(status, 404);
+
+    http_files_free(files);
+}
+
+int
+main(void)
+{
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(file_path, sizeof(file_path), "%s/a.txt", dir);
+
+    FILE *f = fopen(file_path, "w");
+    for (int i = 0; f != NULL && i < 1000; i++) {
+        fputc('a' + i % 26, f);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    char path[350];
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/sub/b.txt", dir);
+    f = fopen(path, "w");
+    if (f != NULL) {
+        fputc('b', f);
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "%s/link", dir);
+    symlink("sub", path);
+    snprintf(path, sizeof(path), "%s/sub/link", dir);
+    symlink("..", path);
+    snprintf(path, sizeof(path), "%s/c.txt", dir);
+    symlink("a.txt", path);
+
+    FILE *null_out = fopen("/dev/null", "w");
+    s_log_init(null_out);
+
+    TEST_RUN(test_body);
+    TEST_RUN(test_truncated);
+    TEST_RUN(test_symlinks);
+
+    s_log_init(stderr);
+    fclose(null_out);
+    unlink(file_path);
+    static const char *const names[] = { "c.txt", "link", "sub/link", "sub/b.txt" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    rmdir(path);
+    rmdir(dir);
+
+    return TEST_RESULT;
+}
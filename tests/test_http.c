@@ -0,0 +1,334 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+#include "test.h"
+
+static void
+check_value(const char *line, const char *key, const char *expected)
+{
+    struct http_slice value = { 0 };
+    int found = http_header_value(line, strlen(line), key, &value);
+
+    if (expected == NULL) {
+        TEST_ASSERT_INT(found, 0);
+        return;
+    }
+    TEST_ASSERT_INT(found, 1);
+    TEST_ASSERT_MEM(value.ptr, value.len, expected);
+}
+
+static void
+test_header_value(void)
+{
+    check_value("Content-Type: text/html", "Content-Type", "text/html");
+    check_value("content-type:text/html", "Content-Type", "text/html");
+    check_value("Content-Type: \t text/html \t\r\n", "content-type", "text/html");
+    check_value("Content-Type:", "Content-Type", "");
+    check_value("Content-Type: text/html", "Content", NULL);
+    check_value("Content-Typed: text/html", "Content-Type", NULL);
+    check_value("Content-Type text/html", "Content-Type", NULL);
+    check_value("Accept: a, b", "Content-Type", NULL);
+}
+
+static void
+check_list(const char *value, const char **expected, const int count)
+{
+    struct http_list_iter it;
+    struct http_slice elem;
+    int n = 0;
+
+    http_list_init(&it, value, strlen(value));
+    while (http_list_next(&it, &elem)) {
+        if (n < count) {
+            TEST_ASSERT_MEM(elem.ptr, elem.len, expected[n]);
+        }
+        n++;
+    }
+    TEST_ASSERT_INT(n, count);
+}
+
+static void
+test_header_value_copies(void)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    char *v = get_header_value("Accept: text/html ", "accept");
+    TEST_ASSERT_STR(v, "text/html");
+    free(v);
+    v = get_header_value("Accept: text/html", "Host");
+    TEST_ASSERT_STR(v, "");
+    free(v);
+    TEST_ASSERT(get_header_value("", "Host") == NULL);
+#pragma GCC diagnostic pop
+
+    struct http_arena *arena = http_arena_new();
+    TEST_ASSERT_STR(http_header_value_arena(arena, "Host: example.com\r\n", "host"),
+        "example.com");
+    TEST_ASSERT_STR(http_header_value_arena(arena, "Host: example.com", "Accept"), "");
+    TEST_ASSERT(http_header_value_arena(NULL, "Host: example.com", "Host") == NULL);
+    TEST_ASSERT(http_header_value_arena(arena, "Host: example.com", NULL) == NULL);
+    http_arena_free(arena);
+}
+
+static int shared_freed;
+
+static void
+shared_free(void *data)
+{
+    (void)data;
+    shared_freed++;
+}
+
+/**
+ * test_request_arena checks that the request arena is kept with the
+ * response, freed when the response is cleaned up, and left alone when the
+ * application uses shared_data itself.
+ */
+static void
+test_request_arena(void)
+{
+    struct _u_response response;
+    ulfius_init_response(&response);
+
+    struct http_arena *arena = http_request_arena(&response);
+    TEST_ASSERT(arena != NULL);
+    TEST_ASSERT(http_request_arena(&response) == arena);
+
+    // allocations outlive the callbacks, so a body can point into them
+    for (int i = 0; i < 100; i++) {
+        char *v = http_header_value_arena(arena, "X-Test: value", "X-Test");
+        TEST_ASSERT_STR(v, "value");
+    }
+    TEST_ASSERT(http_arena_alloc(arena, 64 * 1024) != NULL);
+    ulfius_clean_response(&response);
+
+    int data = 1;
+    ulfius_init_response(&response);
+    response.shared_data = &data;
+    response.free_shared_data = shared_free;
+    TEST_ASSERT(http_request_arena(&response) == NULL);
+    TEST_ASSERT(response.shared_data == &data);
+    ulfius_clean_response(&response);
+    TEST_ASSERT_INT(shared_freed, 1);
+}
+
+static void
+test_route(void)
+{
+    struct _u_request request;
+    struct _u_response response;
+    ulfius_init_request(&request);
+    ulfius_init_response(&response);
+
+    TEST_ASSERT(http_request_route(&response) == NULL);
+    TEST_ASSERT_INT(callback_route(&request, &response, "/users/:id"),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT_STR(http_request_route(&response), "/users/:id");
+
+    // the route and arena share the request state
+    TEST_ASSERT(http_request_arena(&response) != NULL);
+    TEST_ASSERT_STR(http_request_route(&response), "/users/:id");
+    ulfius_clean_response(&response);
+
+    int data = 1;
+    ulfius_init_response(&response);
+    response.shared_data = &data;
+    TEST_ASSERT_INT(callback_route(&request, &response, "/users/:id"),
+        U_CALLBACK_CONTINUE);
+    TEST_ASSERT(http_request_route(&response) == NULL);
+    response.shared_data = NULL;
+    ulfius_clean_response(&response);
+    ulfius_clean_request(&request);
+}
+
+static void
+test_list(void)
+{
+    const char *accept[] = { "text/html", "application/json;q=0.9", "*/*;q=0.1" };
+    check_list("text/html, application/json;q=0.9 ,*/*;q=0.1", accept, 3);
+
+    const char *empty[] = { "gzip", "br" };
+    check_list(" , gzip,, ,br , ", empty, 2);
+
+    const char *quoted[] = { "no-cache=\"a, b\"", "max-age=0" };
+    check_list("no-cache=\"a, b\", max-age=0", quoted, 2);
+
+    check_list("", NULL, 0);
+    check_list(" ,, ", NULL, 0);
+}
+
+static void
+test_header_ids(void)
+{
+    for (int id = 1; id < HTTP_REQUEST_HEADER_ID_COUNT; id++) {
+        const char *name = http_header_name(id);
+        TEST_ASSERT(name != NULL);
+        if (name == NULL) {
+            continue;
+        }
+        TEST_ASSERT_INT(http_header_id(name, strlen(name)), id);
+
+        char lower[64];
+        size_t len = strlen(name);
+        for (size_t i = 0; i <= len && i < sizeof(lower); i++) {
+            lower[i] = (char)(name[i] >= 'A' && name[i] <= 'Z' ?
+                name[i] + 32 : name[i]);
+        }
+        TEST_ASSERT_INT(http_header_id(lower, len), id);
+    }
+
+    TEST_ASSERT_INT(http_header_id("X-Custom", 8), HTTP_REQUEST_HEADER_ID_UNKNOWN);
+    TEST_ASSERT_INT(http_header_id("", 0), HTTP_REQUEST_HEADER_ID_UNKNOWN);
+    TEST_ASSERT_INT(http_header_id("Hos", 3), HTTP_REQUEST_HEADER_ID_UNKNOWN);
+}
+
+static void
+test_header_iter(void)
+{
+    const char block[] =
+        "Host: example.com\r\n"
+        "Accept-Encoding:gzip, br\r\n"
+        "X-Custom-Header-With-A-Long-Name:    padded value   \r\n"
+        "Empty:\n"
+        "\r\n"
+        "Ignored: after the end\r\n";
+    struct http_header_iter it;
+    struct http_slice name, value;
+    int id;
+
+    http_header_iter_init(&it, block, sizeof(block) - 1);
+
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), 1);
+    TEST_ASSERT_MEM(name.ptr, name.len, "Host");
+    TEST_ASSERT_MEM(value.ptr, value.len, "example.com");
+    TEST_ASSERT_INT(id, HTTP_REQUEST_HEADER_ID_HOST);
+
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), 1);
+    TEST_ASSERT_MEM(value.ptr, value.len, "gzip, br");
+    TEST_ASSERT_INT(id, HTTP_REQUEST_HEADER_ID_ACCEPT_ENCODING);
+
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), 1);
+    TEST_ASSERT_MEM(name.ptr, name.len, "X-Custom-Header-With-A-Long-Name");
+    TEST_ASSERT_MEM(value.ptr, value.len, "padded value");
+    TEST_ASSERT_INT(id, HTTP_REQUEST_HEADER_ID_UNKNOWN);
+
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, NULL), 1);
+    TEST_ASSERT_MEM(name.ptr, name.len, "Empty");
+    TEST_ASSERT_INT(value.len, 0);
+
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), 0);
+
+    const char folded[] = "A: b\r\n c\r\n";
+    http_header_iter_init(&it, folded, sizeof(folded) - 1);
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), 1);
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), -1);
+
+    const char no_colon[] = "Bad header\r\n";
+    http_header_iter_init(&it, no_colon, sizeof(no_colon) - 1);
+    TEST_ASSERT_INT(http_header_iter_next(&it, &name, &value, &id), -1);
+}
+
+static void
+test_headers_index(void)
+{
+    struct _u_map map;
+    struct http_headers headers;
+
+    u_map_init(&map);
+    u_map_put(&map, "host", "example.com");
+    u_map_put(&map, "X-Request-ID", "abc");
+    u_map_put(&map, "X-Other", "1");
+
+    http_headers_index(&headers, &map);
+    TEST_ASSERT_STR(http_headers_get(&headers, HTTP_REQUEST_HEADER_ID_HOST),
+        "example.com");
+    TEST_ASSERT_STR(http_headers_get(&headers, HTTP_REQUEST_HEADER_ID_X_REQUEST_ID),
+        "abc");
+    TEST_ASSERT(http_headers_get(&headers, HTTP_REQUEST_HEADER_ID_ACCEPT) == NULL);
+    TEST_ASSERT(http_headers_get(&headers, HTTP_REQUEST_HEADER_ID_COUNT) == NULL);
+
+    u_map_clean(&map);
+}
+
+static void
+test_status(void)
+{
+    TEST_ASSERT_STR(http_status_reason(200), "OK");
+    TEST_ASSERT_STR(http_status_reason(404), "Not Found");
+    TEST_ASSERT_STR(http_status_reason(503), "Service Unavailable");
+    TEST_ASSERT(http_status_lookup(299) == NULL);
+    TEST_ASSERT(http_status_lookup(-1) == NULL);
+    TEST_ASSERT(http_status_lookup(1000) == NULL);
+}
+
+static void
+test_dates(void)
+{
+    char buf[HTTP_DATE_LEN + 1];
+    time_t t;
+
+    TEST_ASSERT_INT(http_date_format(784111777, buf), HTTP_DATE_LEN);
+    TEST_ASSERT_STR(buf, "Sun, 06 Nov 1994 08:49:37 GMT");
+
+    TEST_ASSERT_INT(http_date_parse("Sun, 06 Nov 1994 08:49:37 GMT", &t), 0);
+    TEST_ASSERT_INT(t, 784111777);
+    TEST_ASSERT_INT(http_date_parse("Sunday, 06-Nov-94 08:49:37 GMT", &t), 0);
+    TEST_ASSERT_INT(t, 784111777);
+    TEST_ASSERT_INT(http_date_parse("Sun Nov  6 08:49:37 1994", &t), 0);
+    TEST_ASSERT_INT(t, 784111777);
+    TEST_ASSERT_INT(http_date_parse("yesterday", &t), -1);
+
+    const char *now = http_date_now();
+    TEST_ASSERT_INT(strlen(now), HTTP_DATE_LEN);
+    TEST_ASSERT_INT(http_date_parse(now, &t), 0);
+    time_t wall = time(NULL);
+    TEST_ASSERT(t <= wall && t >= wall - 2);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_header_value);
+    TEST_RUN(test_header_value_copies);
+    TEST_RUN(test_request_arena);
+    TEST_RUN(test_route);
+    TEST_RUN(test_list);
+    TEST_RUN(test_header_ids);
+    TEST_RUN(test_header_iter);
+    TEST_RUN(test_headers_index);
+    TEST_RUN(test_status);
+    TEST_RUN(test_dates);
+
+    return TEST_RESULT;
+}
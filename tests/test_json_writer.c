@@ -0,0 +1,266 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http.h"
+#include "test.h"
+
+static void
+test_values(void)
+{
+    struct http_json w;
+    http_json_init(&w, 0);
+
+    http_json_object_begin(&w);
+    http_json_key_pre(&w, &HTTP_JSON_KEY("int"));
+    http_json_int(&w, INT64_MIN);
+    http_json_key_pre(&w, &HTTP_JSON_KEY("uint"));
+    http_json_uint(&w, UINT64_MAX);
+    http_json_key(&w, "double");
+    http_json_double(&w, 2.0);
+    http_json_key(&w, "nan");
+    http_json_double(&w, NAN);
+    http_json_key(&w, "true");
+    http_json_bool(&w, 1);
+    http_json_key(&w, "false");
+    http_json_bool(&w, 0);
+    http_json_key(&w, "null");
+    http_json_null(&w);
+    http_json_key(&w, "str");
+    http_json_string(&w, NULL);
+    http_json_key(&w, "raw");
+    http_json_raw(&w, "{\"a\":[]}", 8);
+    http_json_key(&w, "list");
+    http_json_array_begin(&w);
+    http_json_array_begin(&w);
+    http_json_array_end(&w);
+    http_json_object_begin(&w);
+    http_json_object_end(&w);
+    http_json_string_len(&w, "abcdef", 3);
+    http_json_array_end(&w);
+    http_json_object_end(&w);
+
+    TEST_ASSERT_INT(w.error, 0);
+    TEST_ASSERT_MEM(w.buf, w.len,
+        "{\"int\":-9223372036854775808,\"uint\":18446744073709551615,"
+        "\"double\":2.0,\"nan\":null,\"true\":true,\"false\":false,"
+        "\"null\":null,\"str\":null,\"raw\":{\"a\":[]},"
+        "\"list\":[[],{},\"abc\"]}");
+
+    http_json_reset(&w);
+    TEST_ASSERT_INT(w.len, 0);
+    http_json_array_begin(&w);
+    http_json_int(&w, 1);
+    http_json_array_end(&w);
+    TEST_ASSERT_MEM(w.buf, w.len, "[1]");
+
+    http_json_free(&w);
+}
+
+static void
+test_escaping(void)
+{
+    struct http_json w;
+    http_json_init(&w, 0);
+
+    http_json_object_begin(&w);
+    http_json_key(&w, "k\"ey");
+    http_json_string(&w, "line\nbreak \x01 \"q\" \\ tab\t and a longer clean run");
+    http_json_object_end(&w);
+
+    TEST_ASSERT_MEM(w.buf, w.len,
+        "{\"k\\\"ey\":\"line\\nbreak \\u0001 \\\"q\\\" \\\\ tab\\t "
+        "and a longer clean run\"}");
+
+    http_json_free(&w);
+}
+
+static void
+test_errors(void)
+{
+    struct http_json w;
+    struct _u_map headers;
+    struct _u_response response = { 0 };
+
+    u_map_init(&headers);
+    response.map_header = &headers;
+
+    // a value without a key
+    http_json_init(&w, 0);
+    http_json_object_begin(&w);
+    http_json_int(&w, 1);
+    TEST_ASSERT(w.error);
+    http_json_free(&w);
+
+    // mismatched nesting
+    http_json_init(&w, 0);
+    http_json_array_begin(&w);
+    http_json_object_end(&w);
+    TEST_ASSERT(w.error);
+    http_json_free(&w);
+
+    // incomplete JSON isn't handed to the response
+    http_json_init(&w, 0);
+    http_json_array_begin(&w);
+    TEST_ASSERT_INT(http_json_set_body(&response, 200, &w), -1);
+    http_json_free(&w);
+
+    // too deep
+    http_json_init(&w, 0);
+    for (int i = 0; i < HTTP_JSON_MAX_DEPTH + 1; i++) {
+        http_json_array_begin(&w);
+    }
+    TEST_ASSERT(w.error);
+    http_json_free(&w);
+
+    u_map_clean(&headers);
+}
+
+static void
+test_set_body(void)
+{
+    struct http_json w;
+    struct _u_map headers;
+    struct _u_response response = { 0 };
+
+    u_map_init(&headers);
+    response.map_header = &headers;
+
+    http_json_init(&w, 0);
+    http_json_object_begin(&w);
+    http_json_key(&w, "ok");
+    http_json_bool(&w, 1);
+    http_json_object_end(&w);
+
+    TEST_ASSERT_INT(http_json_set_body(&response, 201, &w), 0);
+    TEST_ASSERT_INT(response.status, 201);
+    TEST_ASSERT_MEM(response.binary_body, response.binary_body_length,
+        "{\"ok\":true}");
+    TEST_ASSERT_STR(u_map_get_case(&headers, "Content-Type"),
+        HTTP_CONTENT_TYPE_JSON);
+    TEST_ASSERT_INT(w.len, 0);
+
+    http_json_free(&w);
+    o_free(response.binary_body);
+    u_map_clean(&headers);
+}
+
+struct gen {
+    int i;
+    int n;
+};
+
+static int
+fill(struct http_json *w, void *arg)
+{
+    struct gen *g = (struct gen*)arg;
+
+    if (g->i == 0) {
+        http_json_array_begin(w);
+    }
+    for (int k = 0; k < 100 && g->i < g->n; k++, g->i++) {
+        http_json_object_begin(w);
+        http_json_key_pre(w, &HTTP_JSON_KEY("id"));
+        http_json_int(w, g->i);
+        http_json_object_end(w);
+    }
+    if (g->i == g->n) {
+        http_json_array_end(w);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int freed;
+
+static void
+free_gen(void *arg)
+{
+    (void)arg;
+    freed++;
+}
+
+static void
+test_stream(void)
+{
+    struct _u_map headers;
+    struct _u_response response = { 0 };
+    struct gen g = { 0, 5000 };
+
+    u_map_init(&headers);
+    response.map_header = &headers;
+
+    TEST_ASSERT_INT(http_json_stream_response(&response, 200, fill, &g,
+        free_gen), 0);
+
+    // the streamed body must match the buffered one
+    struct http_json w;
+    struct gen g2 = { 0, 5000 };
+    http_json_init(&w, 0);
+    while (fill(&w, &g2)) {
+    }
+
+    char *body = (char*)malloc(w.len + HTTP_JSON_STREAM_BLOCK);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = response.stream_callback(response.stream_user_data, total,
+            body + total, HTTP_JSON_STREAM_BLOCK)) > 0) {
+        total += (size_t)n;
+        TEST_ASSERT(total <= w.len);
+        if (total > w.len) {
+            break;
+        }
+    }
+    TEST_ASSERT(n == U_STREAM_END);
+    TEST_ASSERT_INT(total, w.len);
+    TEST_ASSERT(memcmp(body, w.buf, w.len) == 0);
+
+    response.stream_callback_free(response.stream_user_data);
+    TEST_ASSERT_INT(freed, 1);
+
+    free(body);
+    http_json_free(&w);
+    u_map_clean(&headers);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_values);
+    TEST_RUN(test_escaping);
+    TEST_RUN(test_errors);
+    TEST_RUN(test_set_body);
+    TEST_RUN(test_stream);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,253 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http.h"
+#include "test.h"
+
+static struct _u_request*
+request_new(const char *path)
+{
+    struct _u_request *request =
+        (struct _u_request*)o_malloc(sizeof(struct _u_request));
+    ulfius_init_request(request);
+
+    o_free(request->http_verb);
+    request->http_verb = o_strdup("GET");
+    o_free(request->url_path);
+    request->url_path = o_strdup(path);
+    o_free(request->http_protocol);
+    request->http_protocol = o_strdup("HTTP/1.1");
+
+    struct sockaddr_in *sin =
+        (struct sockaddr_in*)o_malloc(sizeof(struct sockaddr_in));
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    inet_pton(AF_INET, "192.0.2.1", &sin->sin_addr);
+    o_free(request->client_address);
+    request->client_address = (struct sockaddr*)sin;
+
+    return request;
+}
+
+static void
+request_free(struct _u_request *request)
+{
+    ulfius_clean_request(request);
+    o_free(request);
+}
+
+/**
+ * admit runs a request for the given path through callback_route, when a
+ * route is given, and callback_rate_limit, and returns the status: 0 if it
+ * was admitted.
+ */
+static long
+admit(struct http_limiter *limiter, const char *path, const char *route)
+{
+    struct _u_request *request = request_new(path);
+    struct _u_response response;
+    ulfius_init_response(&response);
+
+    if (route != NULL) {
+        callback_route(request, &response, (void*)route);
+    }
+    long status = 0;
+    if (callback_rate_limit(request, &response, limiter) != U_CALLBACK_CONTINUE) {
+        status = response.status;
+    } else {
+        http_limiter_release(1000);
+    }
+
+    ulfius_clean_response(&response);
+    request_free(request);
+
+    return status;
+}
+
+/**
+ * test_route_limit checks that the route limit applies to the route however
+ * its path is spelled, and not at all to requests without a route.
+ */
+static void
+test_route_limit(void)
+{
+    struct http_limit_config config = {
+        .route_rate = 0.001,
+        .route_burst = 3,
+        .idle_secs = 60,
+        .max_buckets = 1024,
+    };
+    struct http_limiter *limiter = http_limiter_new(&config);
+    TEST_ASSERT(limiter != NULL);
+    if (limiter == NULL) {
+        return;
+    }
+
+    TEST_ASSERT_INT(admit(limiter, "/a", "/a"), 0);
+    TEST_ASSERT_INT(admit(limiter, "/a/", "/a"), 0);
+    TEST_ASSERT_INT(admit(limiter, "//a", "/a"), 0);
+    TEST_ASSERT_INT(admit(limiter, "/a?x=1", "/a"), 429);
+    TEST_ASSERT_INT(admit(limiter, "/A", "/a"), 429);
+
+    // other routes have their own bucket
+    TEST_ASSERT_INT(admit(limiter, "/b", "/b"), 0);
+
+    // unmatched paths aren't route limited
+    for (int i = 0; i < 10; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/missing/%d", i);
+        TEST_ASSERT_INT(admit(limiter, path, NULL), 0);
+    }
+    TEST_ASSERT_INT(http_limiter_in_flight(limiter), 0);
+
+    http_limiter_free(limiter);
+}
+
+/**
+ * test_expire_race checks that a bucket used after the expiry pass read the
+ * clock isn't taken for idle, which would hand its client a fresh burst,
+ * while one that really is idle is freed.
+ */
+static void
+test_expire_race(void)
+{
+    struct http_limit_config config = {
+        .client_rate = 0.001,
+        .client_burst = 1,
+        .idle_secs = 60,
+        .max_buckets = 1024,
+    };
+    struct http_limiter *limiter = http_limiter_new(&config);
+    TEST_ASSERT(limiter != NULL);
+    if (limiter == NULL) {
+        return;
+    }
+
+    uint64_t before = http_timer_start();
+    TEST_ASSERT_INT(admit(limiter, "/a", NULL), 0);
+    TEST_ASSERT_INT(admit(limiter, "/a", NULL), 429);
+
+    http_limiter_expire(limiter, before);
+    TEST_ASSERT_INT(admit(limiter, "/a", NULL), 429);
+
+    http_limiter_expire(limiter, http_timer_start() + 61ULL * 1000000000ULL);
+    TEST_ASSERT_INT(admit(limiter, "/a", NULL), 0);
+
+    http_limiter_free(limiter);
+}
+
+/**
+ * probe runs a health check probe the way a route with a rate limit would,
+ * and returns the response status.
+ */
+static long
+probe(struct http_limiter *limiter, struct http_health_check *hc)
+{
+    struct _u_request *request = request_new("/healthz");
+    struct _u_response response;
+    ulfius_init_response(&response);
+
+    callback_request_id(request, &response, NULL);
+    callback_route(request, &response, "/healthz");
+    long status = 503;
+    if (callback_rate_limit(request, &response, limiter) == U_CALLBACK_CONTINUE) {
+        callback_health_check_cached(request, &response, hc);
+        status = response.status;
+    }
+
+    ulfius_clean_response(&response);
+    request_free(request);
+
+    return status;
+}
+
+/**
+ * test_health_check_unlogged checks that probes that aren't access logged
+ * are still counted in the metrics, release their limiter slot and clear
+ * the request ID, and that a long git SHA fits in the readiness body.
+ */
+static void
+test_health_check_unlogged(void)
+{
+    struct http_limit_config config = {
+        .max_in_flight = 1,
+        .idle_secs = 60,
+    };
+    struct http_limiter *limiter = http_limiter_new(&config);
+    char sha[1024];
+    memset(sha, 'a', sizeof(sha) - 1);
+    sha[sizeof(sha) - 1] = '\0';
+    struct http_health_check *hc =
+        http_health_check_new(sha, HTTP_HEALTH_CHECK_READINESS, 0);
+    TEST_ASSERT(limiter != NULL);
+    TEST_ASSERT(hc != NULL);
+    if (limiter == NULL || hc == NULL) {
+        http_limiter_free(limiter);
+        http_health_check_free(hc);
+        return;
+    }
+
+    http_metrics_init();
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_INT(probe(limiter, hc), 200);
+        TEST_ASSERT_INT(http_limiter_in_flight(limiter), 0);
+        TEST_ASSERT_STR(http_request_id(), "");
+    }
+
+    char *text = http_metrics_render(NULL);
+    TEST_ASSERT(text != NULL);
+    if (text != NULL) {
+        TEST_ASSERT(strstr(text,
+            "http_requests_total{method=\"GET\",route=\"/healthz\",status=\"2xx\"} 10\n") != NULL);
+        free(text);
+    }
+
+    http_health_check_free(hc);
+    http_limiter_free(limiter);
+}
+
+int
+main(void)
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    s_log_init(null_out);
+
+    TEST_RUN(test_route_limit);
+    TEST_RUN(test_expire_race);
+    TEST_RUN(test_health_check_unlogged);
+
+    s_log_init(stderr);
+    fclose(null_out);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,319 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "test.h"
+
+static char *out_buf;
+static size_t out_len;
+static FILE *out;
+
+/**
+ * capture points the logger at a fresh in-memory stream and returns what
+ * was written to the previous one.
+ */
+static void
+capture_start(void)
+{
+    out = open_memstream(&out_buf, &out_len);
+    s_log_init(out);
+}
+
+static char*
+capture_end(void)
+{
+    fclose(out);
+    out = NULL;
+    s_log_init(stderr);
+
+    return out_buf;
+}
+
+/**
+ * skip_timestamp returns the line with the timestamp field removed so it
+ * can be compared exactly, e.g. {"level":"info",...}.
+ */
+static char*
+skip_timestamp(char *line)
+{
+    char *ts = strstr(line, ",\"timestamp\":");
+    if (ts == NULL) {
+        return line;
+    }
+    char *end = ts + 13;
+    while (*end != ',' && *end != '}' && *end != '\0') {
+        end++;
+    }
+    memmove(ts, end, strlen(end) + 1);
+
+    return line;
+}
+
+static void
+test_field_constructors(void)
+{
+    struct s_log_field_t f;
+
+    f = s_log_int("k", -7);
+    TEST_ASSERT_INT(f.type, S_LOG_INT);
+    TEST_ASSERT_STR(f.key, "k");
+    TEST_ASSERT_INT(f.int_value, -7);
+
+    f = s_log_int8("k", -8);
+    TEST_ASSERT_INT(f.type, S_LOG_INT8);
+    TEST_ASSERT_INT(f.int8_value, -8);
+
+    f = s_log_int16("k", -16);
+    TEST_ASSERT_INT(f.type, S_LOG_INT16);
+    TEST_ASSERT_INT(f.int16_value, -16);
+
+    f = s_log_int32("k", -32);
+    TEST_ASSERT_INT(f.type, S_LOG_INT32);
+    TEST_ASSERT_INT(f.int32_value, -32);
+
+    f = s_log_int64("k", INT64_MIN);
+    TEST_ASSERT_INT(f.type, S_LOG_INT64);
+    TEST_ASSERT(f.int64_value == INT64_MIN);
+
+    f = s_log_uint("k", 7);
+    TEST_ASSERT_INT(f.type, S_LOG_UINT);
+    TEST_ASSERT_INT(f.uint_value, 7);
+
+    f = s_log_uint8("k", 255);
+    TEST_ASSERT_INT(f.type, S_LOG_UINT8);
+    TEST_ASSERT_INT(f.uint8_value, 255);
+
+    f = s_log_uint16("k", 65535);
+    TEST_ASSERT_INT(f.type, S_LOG_UINT16);
+    TEST_ASSERT_INT(f.uint16_value, 65535);
+
+    f = s_log_uint32("k", UINT32_MAX);
+    TEST_ASSERT_INT(f.type, S_LOG_UINT32);
+    TEST_ASSERT(f.uint32_value == UINT32_MAX);
+
+    f = s_log_uint64("k", UINT64_MAX);
+    TEST_ASSERT_INT(f.type, S_LOG_UINT64);
+    TEST_ASSERT(f.uint64_value == UINT64_MAX);
+
+    f = s_log_float("k", 1.5f);
+    TEST_ASSERT_INT(f.type, S_LOG_FLOAT);
+    TEST_ASSERT(f.float_value == 1.5f);
+
+    f = s_log_double("k", 2.25);
+    TEST_ASSERT_INT(f.type, S_LOG_DOUBLE);
+    TEST_ASSERT(f.double_value == 2.25);
+
+    f = s_log_string("k", "v");
+    TEST_ASSERT_INT(f.type, S_LOG_STRING);
+    TEST_ASSERT_STR(f.string_value, "v");
+}
+
+static void
+test_json_entry(void)
+{
+    capture_start();
+    s_log(S_LOG_INFO,
+        s_log_string("msg", "hello"),
+        s_log_int("int", -42),
+        s_log_uint64("big", UINT64_MAX),
+        s_log_int64("small", INT64_MIN),
+        s_log_double("whole", 3.0),
+        s_log_double("frac", 0.5),
+        s_log_string("none", NULL));
+    char *s = capture_end();
+
+    TEST_ASSERT(strncmp(s, "{\"level\":\"info\",\"timestamp\":", 28) == 0);
+    TEST_ASSERT_STR(skip_timestamp(s),
+        "{\"level\":\"info\",\"msg\":\"hello\",\"int\":-42,"
+        "\"big\":18446744073709551615,\"small\":-9223372036854775808,"
+        "\"whole\":3.0,\"frac\":0.5,\"none\":null}\n");
+    free(s);
+}
+
+static void
+test_json_timestamp(void)
+{
+    capture_start();
+    s_log(S_LOG_INFO, s_log_string("msg", "ts"));
+    char *s = capture_end();
+
+    // seconds with a 3 digit millisecond fraction
+    char *ts = strstr(s, "\"timestamp\":");
+    TEST_ASSERT(ts != NULL);
+    if (ts != NULL) {
+        char *end = NULL;
+        double v = strtod(ts + 12, &end);
+        TEST_ASSERT(v > 1.6e9);
+        TEST_ASSERT(end - strchr(ts, '.') == 4);
+    }
+    free(s);
+}
+
+static void
+test_json_escaping(void)
+{
+    capture_start();
+    s_log(S_LOG_WARN,
+        s_log_string("msg", "a \"quoted\" \\path\\ with\ttab\nand\x01 control"),
+        s_log_string("long", "0123456789abcdef0123456789abcdef\"tail"),
+        s_log_string("key \"x\"", "v"));
+    char *s = capture_end();
+
+    TEST_ASSERT_STR(skip_timestamp(s),
+        "{\"level\":\"warn\","
+        "\"msg\":\"a \\\"quoted\\\" \\\\path\\\\ with\\ttab\\nand\\u0001 control\","
+        "\"long\":\"0123456789abcdef0123456789abcdef\\\"tail\","
+        "\"key \\\"x\\\"\":\"v\"}\n");
+    free(s);
+}
+
+static void
+test_json_non_finite(void)
+{
+    capture_start();
+    s_log(S_LOG_INFO, s_log_double("nan", NAN), s_log_double("inf", INFINITY),
+        s_log_float("f", 0.25f));
+    char *s = capture_end();
+
+    TEST_ASSERT_STR(skip_timestamp(s),
+        "{\"level\":\"info\",\"nan\":null,\"inf\":null,\"f\":0.25}\n");
+    free(s);
+}
+
+static int evaluated;
+
+static const char*
+side_effect(void)
+{
+    evaluated++;
+    return "x";
+}
+
+static void
+test_levels(void)
+{
+    TEST_ASSERT_INT(s_log_level_from_string("debug"), S_LOG_DEBUG);
+    TEST_ASSERT_INT(s_log_level_from_string("WARN"), S_LOG_WARN);
+    TEST_ASSERT_INT(s_log_level_from_string("nope"), -1);
+    TEST_ASSERT_INT(s_log_level_from_string(NULL), -1);
+    TEST_ASSERT_STR(s_log_level_string(S_LOG_ERROR), "error");
+    TEST_ASSERT_STR(s_log_level_string(42), "unknown");
+
+    s_log_set_level(S_LOG_WARN);
+    TEST_ASSERT_INT(s_log_get_level(), S_LOG_WARN);
+
+    evaluated = 0;
+    capture_start();
+    s_log(S_LOG_INFO, s_log_string("msg", side_effect()));
+    s_log(S_LOG_ERROR, s_log_string("msg", side_effect()));
+    char *s = capture_end();
+
+    // the disabled entry is neither written nor evaluated
+    TEST_ASSERT_INT(evaluated, 1);
+    TEST_ASSERT(strstr(s, "\"info\"") == NULL);
+    TEST_ASSERT(strstr(s, "\"error\"") != NULL);
+    free(s);
+
+    s_log_set_level(S_LOG_FATAL + 3);
+    TEST_ASSERT_INT(s_log_get_level(), S_LOG_FATAL);
+    s_log_set_level(-1);
+    TEST_ASSERT_INT(s_log_get_level(), S_LOG_TRACE);
+}
+
+static void
+test_context(void)
+{
+    s_log_context(s_log_string("request_id", "abc"), s_log_uint("n", 1));
+
+    capture_start();
+    s_log(S_LOG_INFO, s_log_string("msg", "with"));
+    s_log_context_clear();
+    s_log(S_LOG_INFO, s_log_string("msg", "without"));
+    char *s = capture_end();
+
+    char *second = strchr(s, '\n') + 1;
+    second[-1] = '\0';
+    TEST_ASSERT_STR(skip_timestamp(s),
+        "{\"level\":\"info\",\"msg\":\"with\",\"request_id\":\"abc\",\"n\":1}");
+    TEST_ASSERT_STR(skip_timestamp(second),
+        "{\"level\":\"info\",\"msg\":\"without\"}\n");
+    free(s);
+}
+
+static void
+test_rate_limit(void)
+{
+    uint64_t suppressed = 0;
+
+    s_log_set_rate_limit(0, 0);
+    TEST_ASSERT(s_log_allow("k", &suppressed));
+
+    // a very slow refill so the burst is all that's available
+    s_log_set_rate_limit(0.001, 2);
+    TEST_ASSERT(s_log_allow("limited", &suppressed));
+    TEST_ASSERT(s_log_allow("limited", &suppressed));
+    TEST_ASSERT(!s_log_allow("limited", &suppressed));
+    TEST_ASSERT(!s_log_allow("limited", &suppressed));
+    TEST_ASSERT(s_log_allow("other", &suppressed));
+    TEST_ASSERT_INT(suppressed, 0);
+
+    capture_start();
+    for (int i = 0; i < 5; i++) {
+        s_log_limited(S_LOG_INFO, "storm", s_log_string("msg", "storm"));
+    }
+    char *s = capture_end();
+
+    int lines = 0;
+    for (char *p = s; (p = strchr(p, '\n')) != NULL; p++) {
+        lines++;
+    }
+    TEST_ASSERT_INT(lines, 2);
+    free(s);
+
+    s_log_set_rate_limit(0, 0);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_field_constructors);
+    TEST_RUN(test_json_entry);
+    TEST_RUN(test_json_timestamp);
+    TEST_RUN(test_json_escaping);
+    TEST_RUN(test_json_non_finite);
+    TEST_RUN(test_levels);
+    TEST_RUN(test_context);
+    TEST_RUN(test_rate_limit);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,193 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "test.h"
+
+#define THREADS 4
+#define ENTRIES 20000
+#define ROUNDS  5
+
+static void*
+writer(void *arg)
+{
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+
+    for (unsigned int i = 0; i < ENTRIES; i++) {
+        s_log(S_LOG_INFO, s_log_uint("thread", id), s_log_uint("seq", i));
+    }
+
+    return NULL;
+}
+
+/**
+ * run_round logs from several threads into a small ring and shuts the async
+ * logger down while they're still going. Entries logged before shutdown go
+ * through the ring and the rest are written directly, so every one of them
+ * has to come out exactly once.
+ */
+static void
+run_round(const int overflow)
+{
+    FILE *out = tmpfile();
+    TEST_ASSERT(out != NULL);
+    if (out == NULL) {
+        return;
+    }
+    uint64_t dropped = s_log_dropped();
+    TEST_ASSERT_INT(s_log_init_async(out, 16, overflow), 0);
+
+    pthread_t threads[THREADS];
+    for (unsigned int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, writer, (void*)(uintptr_t)i);
+    }
+    usleep(2000);
+    s_log_shutdown();
+    for (unsigned int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    fflush(out);
+    rewind(out);
+
+    static unsigned char seen[THREADS][ENTRIES];
+    memset(seen, 0, sizeof(seen));
+
+    unsigned int lines = 0, bad = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), out) != NULL) {
+        char *thread = strstr(line, "\"thread\":");
+        char *seq = strstr(line, "\"seq\":");
+        if (thread == NULL || seq == NULL) {
+            // the drop report
+            continue;
+        }
+        unsigned long t = strtoul(thread + 9, NULL, 10);
+        unsigned long n = strtoul(seq + 6, NULL, 10);
+        if (t >= THREADS || n >= ENTRIES || seen[t][n]) {
+            bad++;
+            continue;
+        }
+        seen[t][n] = 1;
+        lines++;
+    }
+    fclose(out);
+    s_log_init(stderr);
+
+    TEST_ASSERT_INT(bad, 0);
+    if (overflow == S_LOG_OVERFLOW_BLOCK) {
+        TEST_ASSERT_INT(lines, THREADS * ENTRIES);
+    } else {
+        TEST_ASSERT_INT(lines + (s_log_dropped() - dropped), THREADS * ENTRIES);
+    }
+}
+
+static void
+test_shutdown_block(void)
+{
+    for (int i = 0; i < ROUNDS; i++) {
+        run_round(S_LOG_OVERFLOW_BLOCK);
+    }
+}
+
+static void
+test_shutdown_drop(void)
+{
+    for (int i = 0; i < ROUNDS; i++) {
+        run_round(S_LOG_OVERFLOW_DROP);
+    }
+}
+
+/**
+ * count_lines rewinds out and counts the lines in it.
+ */
+static unsigned int
+count_lines(FILE *out)
+{
+    char line[256];
+    unsigned int lines = 0;
+
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) {
+        lines++;
+    }
+
+    return lines;
+}
+
+/**
+ * test_reinit switches back to a plain stream with s_log_init while async
+ * and buffered mode are running, without calling s_log_shutdown, and checks
+ * every pending entry went to the old stream and later ones to the new one.
+ */
+static void
+test_reinit(void)
+{
+    for (int buffered = 0; buffered < 2; buffered++) {
+        FILE *before = tmpfile();
+        FILE *after = tmpfile();
+        TEST_ASSERT(before != NULL && after != NULL);
+        if (before == NULL || after == NULL) {
+            return;
+        }
+
+        int ret = buffered ? s_log_init_buffered(before, 1 << 20, 0) :
+            s_log_init_async(before, 1024, S_LOG_OVERFLOW_BLOCK);
+        TEST_ASSERT_INT(ret, 0);
+        for (unsigned int i = 0; i < 100; i++) {
+            s_log(S_LOG_INFO, s_log_uint("seq", i));
+        }
+
+        // nothing may be left pointing at before once it's closed
+        s_log_init(after);
+        TEST_ASSERT_INT(count_lines(before), 100);
+        fclose(before);
+
+        s_log(S_LOG_INFO, s_log_uint("seq", 100));
+        s_log_flush();
+        TEST_ASSERT_INT(s_log_queue_depth(), 0);
+        TEST_ASSERT_INT(count_lines(after), 1);
+        s_log_init(stderr);
+        fclose(after);
+    }
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_shutdown_block);
+    TEST_RUN(test_shutdown_drop);
+    TEST_RUN(test_reinit);
+
+    return TEST_RESULT;
+}
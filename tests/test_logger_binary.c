@@ -0,0 +1,151 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "test.h"
+
+/**
+ * S_LOG_DECODE is the path of the s_log_decode tool, set by the build.
+ */
+#ifndef S_LOG_DECODE
+#define S_LOG_DECODE "./s_log_decode"
+#endif
+
+/**
+ * strip_timestamps removes every timestamp field from the given lines so
+ * output written at different times can be compared.
+ */
+static void
+strip_timestamps(char *s)
+{
+    char *ts;
+
+    while ((ts = strstr(s, ",\"timestamp\":")) != NULL) {
+        char *end = ts + 13;
+        while (*end != ',' && *end != '}' && *end != '\0') {
+            end++;
+        }
+        memmove(ts, end, strlen(end) + 1);
+    }
+}
+
+static void
+write_entries(void)
+{
+    char long_value[70000];
+    memset(long_value, 'x', sizeof(long_value) - 1);
+    long_value[sizeof(long_value) - 1] = '\0';
+
+    s_log(S_LOG_INFO,
+        s_log_string("msg", "binary \"round\" trip\n"),
+        s_log_int("int", -1),
+        s_log_int8("i8", -128),
+        s_log_int16("i16", -32768),
+        s_log_int32("i32", INT32_MIN),
+        s_log_int64("i64", INT64_MIN),
+        s_log_uint("uint", 4000000000u),
+        s_log_uint8("u8", 255),
+        s_log_uint16("u16", 65535),
+        s_log_uint32("u32", UINT32_MAX),
+        s_log_uint64("u64", UINT64_MAX),
+        s_log_float("float", 0.5f),
+        s_log_double("double", 1e300),
+        s_log_double("nan", NAN),
+        s_log_string("null", NULL));
+    s_log(S_LOG_ERROR, s_log_string("msg", "again"), s_log_int("int", 2));
+
+    s_log_context(s_log_string("request_id", "r-1"));
+    s_log(S_LOG_DEBUG, s_log_string("msg", "context"));
+    s_log_context_clear();
+
+    s_log(S_LOG_WARN, s_log_string("long", long_value));
+}
+
+static void
+test_binary_round_trip(void)
+{
+    char *json = NULL;
+    size_t json_len = 0;
+    FILE *mem = open_memstream(&json, &json_len);
+
+    s_log_set_format(S_LOG_FORMAT_JSON);
+    s_log_init(mem);
+    write_entries();
+    fclose(mem);
+
+    char path[] = "/tmp/s_log_binary_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0);
+    FILE *bin = fdopen(fd, "w");
+
+    s_log_set_format(S_LOG_FORMAT_BINARY);
+    s_log_init(bin);
+    write_entries();
+    fclose(bin);
+    s_log_init(stderr);
+    s_log_set_format(S_LOG_FORMAT_JSON);
+
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "%s %s", S_LOG_DECODE, path);
+    FILE *p = popen(cmd, "r");
+    TEST_ASSERT(p != NULL);
+
+    char *decoded = NULL;
+    size_t decoded_len = 0;
+    FILE *dec = open_memstream(&decoded, &decoded_len);
+    char chunk[4096];
+    size_t n;
+    while (p != NULL && (n = fread(chunk, 1, sizeof(chunk), p)) > 0) {
+        fwrite(chunk, 1, n, dec);
+    }
+    TEST_ASSERT_INT(p != NULL ? pclose(p) : -1, 0);
+    fclose(dec);
+    unlink(path);
+
+    strip_timestamps(json);
+    strip_timestamps(decoded);
+    TEST_ASSERT(json_len > 70000);
+    TEST_ASSERT(strcmp(json, decoded) == 0);
+
+    free(json);
+    free(decoded);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_binary_round_trip);
+
+    return TEST_RESULT;
+}
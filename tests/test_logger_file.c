@@ -0,0 +1,331 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "test.h"
+
+/**
+ * S_LOG_DECODE is the path of the s_log_decode tool, set by the build.
+ */
+#ifndef S_LOG_DECODE
+#define S_LOG_DECODE "./s_log_decode"
+#endif
+
+#define MAX_SEGMENTS 4096
+
+static char dir[] = "/tmp/s_log_file_XXXXXX";
+
+/**
+ * segment is a segment file found in the test directory, ordered by the
+ * sequence number at the end of its name.
+ */
+struct segment {
+    unsigned long seq;
+    char path[512];
+};
+
+static int
+segment_cmp(const void *a, const void *b)
+{
+    const struct segment *x = (const struct segment*)a;
+    const struct segment *y = (const struct segment*)b;
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/**
+ * list_segments returns the segment files in the test directory in the
+ * order they were written.
+ */
+static size_t
+list_segments(struct segment *segs, const size_t max)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    size_t n = 0;
+
+    while (d != NULL && (e = readdir(d)) != NULL && n < max) {
+        const char *dash = strrchr(e->d_name, '-');
+        if (e->d_name[0] == '.' || dash == NULL) {
+            continue;
+        }
+        segs[n].seq = strtoul(dash + 1, NULL, 10);
+        snprintf(segs[n].path, sizeof(segs[n].path), "%s/%s", dir, e->d_name);
+        n++;
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    qsort(segs, n, sizeof(struct segment), segment_cmp);
+
+    return n;
+}
+
+/**
+ * read_all returns the contents of every segment, in order, and removes
+ * them.
+ */
+static char*
+read_all(size_t *len, size_t *count)
+{
+    struct segment *segs = calloc(MAX_SEGMENTS, sizeof(struct segment));
+    size_t n = list_segments(segs, MAX_SEGMENTS);
+    char *all = NULL;
+    FILE *out = open_memstream(&all, len);
+
+    for (size_t i = 0; i < n; i++) {
+        FILE *in = fopen(segs[i].path, "r");
+        char chunk[4096];
+        size_t got;
+        while (in != NULL && (got = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+            fwrite(chunk, 1, got, out);
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+        unlink(segs[i].path);
+    }
+    fclose(out);
+    free(segs);
+    *count = n;
+
+    return all;
+}
+
+/**
+ * test_oversized_entry writes an entry bigger than a whole segment, which
+ * is written past the mapping, followed by small ones that have to go into
+ * the next segment rather than past the end of the full one.
+ */
+static void
+test_oversized_entry(void)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s/app.log", dir);
+    TEST_ASSERT_INT(s_log_init_file(path, 4096, 0, 0), 0);
+
+    static char big[3 * 4096];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    s_log(S_LOG_INFO, s_log_uint("seq", 0), s_log_string("big", big));
+    for (unsigned int i = 1; i <= 200; i++) {
+        s_log(S_LOG_INFO, s_log_uint("seq", i), s_log_string("msg", "small"));
+    }
+    s_log_shutdown();
+
+    size_t len, count;
+    char *all = read_all(&len, &count);
+    TEST_ASSERT(count >= 3);
+
+    // every entry is there, whole and in order
+    unsigned int expect = 0;
+    for (char *line = all; line < all + len;) {
+        char *nl = memchr(line, '\n', (size_t)(all + len - line));
+        TEST_ASSERT(nl != NULL);
+        if (nl == NULL) {
+            break;
+        }
+        *nl = '\0';
+        char *seq = strstr(line, "\"seq\":");
+        TEST_ASSERT(seq != NULL && strtoul(seq + 6, NULL, 10) == expect);
+        TEST_ASSERT(line[0] == '{' && nl[-1] == '}');
+        if (expect == 0) {
+            TEST_ASSERT(strstr(line, big) != NULL);
+        }
+        expect++;
+        line = nl + 1;
+    }
+    TEST_ASSERT_INT(expect, 201);
+
+    free(all);
+}
+
+#define ROTATE_THREADS 4
+#define ROTATE_ENTRIES 5000
+
+static void*
+rotate_writer(void *arg)
+{
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+
+    for (unsigned int i = 0; i < ROTATE_ENTRIES; i++) {
+        s_log(S_LOG_INFO, s_log_uint("thread", id), s_log_uint("seq", i),
+            s_log_string("msg", "rotating through small segments"));
+    }
+
+    return NULL;
+}
+
+/**
+ * test_rotation has several threads write through many small segments, so
+ * segments are rotated out while others are writing and closed in the
+ * background. Every entry has to end up whole in exactly one segment.
+ */
+static void
+test_rotation(void)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s/app.log", dir);
+    TEST_ASSERT_INT(s_log_init_file(path, 4096, 0, 0), 0);
+
+    pthread_t threads[ROTATE_THREADS];
+    for (unsigned int i = 0; i < ROTATE_THREADS; i++) {
+        pthread_create(&threads[i], NULL, rotate_writer, (void*)(uintptr_t)i);
+    }
+    for (unsigned int i = 0; i < ROTATE_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    s_log_shutdown();
+
+    size_t len, count;
+    char *all = read_all(&len, &count);
+    TEST_ASSERT(count > 100);
+
+    unsigned int next[ROTATE_THREADS] = {0};
+    unsigned int lines = 0, bad = 0;
+    for (char *line = all; line < all + len;) {
+        char *nl = memchr(line, '\n', (size_t)(all + len - line));
+        if (nl == NULL) {
+            bad++;
+            break;
+        }
+        *nl = '\0';
+        char *thread = strstr(line, "\"thread\":");
+        char *seq = strstr(line, "\"seq\":");
+        if (thread == NULL || seq == NULL || line[0] != '{' || nl[-1] != '}') {
+            bad++;
+        } else {
+            unsigned long t = strtoul(thread + 9, NULL, 10);
+            // each thread's entries come out in the order it wrote them
+            if (t >= ROTATE_THREADS || strtoul(seq + 6, NULL, 10) != next[t]) {
+                bad++;
+            } else {
+                next[t]++;
+            }
+        }
+        lines++;
+        line = nl + 1;
+    }
+    TEST_ASSERT_INT(bad, 0);
+    TEST_ASSERT_INT(lines, ROTATE_THREADS * ROTATE_ENTRIES);
+
+    free(all);
+}
+
+#define KEY_THREADS 4
+#define KEY_ENTRIES 300
+
+static void*
+key_writer(void *arg)
+{
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+    char key[32];
+
+    for (unsigned int i = 0; i < KEY_ENTRIES; i++) {
+        snprintf(key, sizeof(key), "t%u_k%u", id, i);
+        s_log(S_LOG_INFO, s_log_uint(key, i),
+            s_log_string("msg", "a fresh key in every entry"));
+    }
+
+    return NULL;
+}
+
+/**
+ * test_segment_keys interns new keys from several threads while binary
+ * segments rotate. Each segment has to decode on its own, with every key
+ * defined either by the table at its start or by a key record in it.
+ */
+static void
+test_segment_keys(void)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s/app.bin", dir);
+    s_log_set_format(S_LOG_FORMAT_BINARY);
+    TEST_ASSERT_INT(s_log_init_file(path, 4096, 0, 0), 0);
+
+    pthread_t threads[KEY_THREADS];
+    for (unsigned int i = 0; i < KEY_THREADS; i++) {
+        pthread_create(&threads[i], NULL, key_writer, (void*)(uintptr_t)i);
+    }
+    for (unsigned int i = 0; i < KEY_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    s_log_shutdown();
+    s_log_set_format(S_LOG_FORMAT_JSON);
+
+    struct segment *segs = calloc(MAX_SEGMENTS, sizeof(struct segment));
+    size_t n = list_segments(segs, MAX_SEGMENTS);
+    TEST_ASSERT(n > 10);
+
+    unsigned int lines = 0, unknown = 0;
+    for (size_t i = 0; i < n; i++) {
+        char cmd[1024];
+        snprintf(cmd, sizeof(cmd), "%s %s", S_LOG_DECODE, segs[i].path);
+        FILE *p = popen(cmd, "r");
+        TEST_ASSERT(p != NULL);
+
+        char line[4096];
+        while (p != NULL && fgets(line, sizeof(line), p) != NULL) {
+            if (strstr(line, "\"key_") != NULL) {
+                unknown++;
+            }
+            lines++;
+        }
+        TEST_ASSERT_INT(p != NULL ? pclose(p) : -1, 0);
+        unlink(segs[i].path);
+    }
+    TEST_ASSERT_INT(unknown, 0);
+    TEST_ASSERT_INT(lines, KEY_THREADS * KEY_ENTRIES);
+
+    free(segs);
+}
+
+int
+main(void)
+{
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    TEST_RUN(test_oversized_entry);
+    TEST_RUN(test_rotation);
+    TEST_RUN(test_segment_keys);
+
+    rmdir(dir);
+
+    return TEST_RESULT;
+}
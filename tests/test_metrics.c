@@ -0,0 +1,162 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "test.h"
+
+/**
+ * test_bucket_bounds checks that the bucket bounds grow steadily, that no
+ * bucket is more than a quarter wider than its lower bound past the linear
+ * ones, and that they reach about a minute.
+ */
+static void
+test_bucket_bounds(void)
+{
+    uint64_t prev = 0;
+
+    for (size_t b = 0; b < HTTP_METRICS_BUCKETS - 1; b++) {
+        uint64_t upper = http_metrics_bucket_upper(b);
+        TEST_ASSERT(upper > prev);
+        if (b >= (1u << HTTP_METRICS_SUB_BITS)) {
+            TEST_ASSERT((upper - prev) * 4 <= prev);
+        }
+        prev = upper;
+    }
+    TEST_ASSERT_INT(http_metrics_bucket_upper(HTTP_METRICS_BUCKETS - 1), 0);
+    TEST_ASSERT(prev >= 60ULL * 1000000000ULL);
+    TEST_ASSERT(prev <= (1ULL << HTTP_METRICS_RANGE_BITS));
+}
+
+/**
+ * count_le returns the cumulative count rendered for the given labels at
+ * the bucket whose bound is le seconds, or -1 if there's no such line.
+ */
+static long long
+count_le(const char *text, const char *labels, const double le)
+{
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "http_request_duration_seconds_bucket{%s,le=\"", labels);
+
+    for (const char *p = strstr(text, prefix); p != NULL; p = strstr(p + 1, prefix)) {
+        char *end;
+        double v = strtod(p + strlen(prefix), &end);
+        if (v == le && end[0] == '"') {
+            return strtoll(end + 3, NULL, 10);
+        }
+    }
+
+    return -1;
+}
+
+static void
+test_render(void)
+{
+    http_metrics_init();
+
+    // right on a bound counts in that bucket, a nanosecond more in the next
+    uint64_t bound = http_metrics_bucket_upper(20);
+    http_metrics_record("GET", "/users/:id", 200, bound);
+    http_metrics_record("GET", "/users/:id", 200, bound + 1);
+    http_metrics_record("GET", "/users/:id", 200, 90ULL * 1000000000ULL);
+    http_metrics_record("GET", "/users/:id", 404, 1000);
+    http_metrics_record("BREW", "/users/:id", 200, 1000);
+    http_metrics_record("GET", NULL, 404, 1000);
+    http_metrics_record("GET", "/users/:id", 99, 1000);
+
+    size_t len = 0;
+    char *text = http_metrics_render(&len);
+    TEST_ASSERT(text != NULL);
+    if (text == NULL) {
+        return;
+    }
+    TEST_ASSERT_INT(strlen(text), len);
+
+    const char *users = "method=\"GET\",route=\"/users/:id\",status=\"2xx\"";
+    TEST_ASSERT_INT(count_le(text, users, (double)http_metrics_bucket_upper(19) / 1e9), 0);
+    TEST_ASSERT_INT(count_le(text, users, (double)bound / 1e9), 1);
+    TEST_ASSERT_INT(count_le(text, users, (double)http_metrics_bucket_upper(21) / 1e9), 2);
+    TEST_ASSERT_INT(count_le(text, users,
+        (double)http_metrics_bucket_upper(HTTP_METRICS_BUCKETS - 2) / 1e9), 2);
+    TEST_ASSERT(strstr(text, "http_request_duration_seconds_bucket{method=\"GET\","
+        "route=\"/users/:id\",status=\"2xx\",le=\"+Inf\"} 3\n") != NULL);
+    TEST_ASSERT(strstr(text, "http_requests_total{method=\"GET\",route=\"/users/:id\","
+        "status=\"4xx\"} 1\n") != NULL);
+    TEST_ASSERT(strstr(text, "http_requests_total{method=\"OTHER\",route=\"/users/:id\","
+        "status=\"2xx\"} 1\n") != NULL);
+    TEST_ASSERT(strstr(text, "http_requests_total{method=\"GET\",route=\"other\","
+        "status=\"4xx\"} 1\n") != NULL);
+    TEST_ASSERT(strstr(text, "status=\"0xx\"") == NULL);
+
+    free(text);
+}
+
+/**
+ * test_route_limit checks that routes past HTTP_METRICS_MAX_ROUTES are
+ * counted together rather than growing the table.
+ */
+static void
+test_route_limit(void)
+{
+    char route[32];
+
+    for (int i = 0; i < HTTP_METRICS_MAX_ROUTES * 2; i++) {
+        snprintf(route, sizeof(route), "/r%d", i);
+        http_metrics_record("POST", route, 200, 1000);
+    }
+
+    char *text = http_metrics_render(NULL);
+    TEST_ASSERT(text != NULL);
+    if (text == NULL) {
+        return;
+    }
+
+    int series = 0;
+    for (const char *p = strstr(text, "http_requests_total{"); p != NULL;
+         p = strstr(p + 1, "http_requests_total{")) {
+        series++;
+    }
+    TEST_ASSERT(series <= HTTP_METRICS_MAX_ROUTES * 2);
+    TEST_ASSERT(strstr(text, "http_requests_total{method=\"\",route=\"other\","
+        "status=\"2xx\"}") != NULL);
+
+    free(text);
+}
+
+int
+main(void)
+{
+    TEST_RUN(test_bucket_bounds);
+    TEST_RUN(test_render);
+    TEST_RUN(test_route_limit);
+
+    return TEST_RESULT;
+}
@@ -0,0 +1,423 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2025 Brian J. Downs
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * s_log_decode converts logs written with S_LOG_FORMAT_BINARY back into the
+ * JSON lines the logger writes by default. It reads the given files, or
+ * stdin if there are none, and writes to stdout.
+ *
+ *   cc -o s_log_decode tools/s_log_decode.c
+ *   s_log_decode app.log.bin > app.log
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../logger.h"
+
+#define S_LOG_REC_KEY     1
+#define S_LOG_REC_ENTRY   2
+#define S_LOG_KEY_INLINE  0xffff
+#define S_LOG_NULL_STRING 0xffffffff
+
+/**
+ * level_names holds the name of each level, indexed by level.
+ */
+static const char *level_names[] = {
+    [S_LOG_TRACE] = "trace",
+    [S_LOG_DEBUG] = "debug",
+    [S_LOG_INFO]  = "info",
+    [S_LOG_WARN]  = "warn",
+    [S_LOG_ERROR] = "error",
+    [S_LOG_FATAL] = "fatal",
+};
+
+/**
+ * keys maps key IDs to their names as defined by key records.
+ */
+static char *keys[S_LOG_KEY_INLINE];
+
+/**
+ * reader_t walks the bytes of a single record.
+ */
+struct reader_t {
+    const unsigned char *p;
+    size_t left;
+};
+
+static int
+read_bytes(struct reader_t *r, void *out, const size_t n)
+{
+    if (r->left < n) {
+        return -1;
+    }
+    memcpy(out, r->p, n);
+    r->p += n;
+    r->left -= n;
+
+    return 0;
+}
+
+static int
+read_u8(struct reader_t *r, uint8_t *v)
+{
+    return read_bytes(r, v, 1);
+}
+
+static int
+read_u16(struct reader_t *r, uint16_t *v)
+{
+    unsigned char b[2];
+    if (read_bytes(r, b, sizeof(b)) != 0) {
+        return -1;
+    }
+    *v = (uint16_t)(b[0] | (b[1] << 8));
+
+    return 0;
+}
+
+static int
+read_u32(struct reader_t *r, uint32_t *v)
+{
+    unsigned char b[4];
+    if (read_bytes(r, b, sizeof(b)) != 0) {
+        return -1;
+    }
+    *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+         ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+
+    return 0;
+}
+
+static int
+read_u64(struct reader_t *r, uint64_t *v)
+{
+    uint32_t lo, hi;
+    if (read_u32(r, &lo) != 0 || read_u32(r, &hi) != 0) {
+        return -1;
+    }
+    *v = (uint64_t)lo | ((uint64_t)hi << 32);
+
+    return 0;
+}
+
+/**
+ * print_string writes the given bytes as a quoted and escaped JSON string.
+ */
+static void
+print_string(const unsigned char *s, const size_t len)
+{
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        switch (c) {
+            case '"':  fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\b': fputs("\\b", stdout); break;
+            case '\f': fputs("\\f", stdout); break;
+            case '\n': fputs("\\n", stdout); break;
+            case '\r': fputs("\\r", stdout); break;
+            case '\t': fputs("\\t", stdout); break;
+            default:
+                if (c < 0x20) {
+                    printf("\\u%04x", c);
+                } else {
+                    putchar(c);
+                }
+        }
+    }
+    putchar('"');
+}
+
+static void
+print_double(const double value)
+{
+    if (value != value || value - value != 0) {
+        fputs("null", stdout);
+        return;
+    }
+
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%.17g", value);
+    fputs(tmp, stdout);
+    if (strpbrk(tmp, ".eE") == NULL) {
+        fputs(".0", stdout);
+    }
+}
+
+/**
+ * decode_field prints a single field of an entry record.
+ */
+static int
+decode_field(struct reader_t *r)
+{
+    uint16_t id;
+    uint8_t type;
+
+    if (read_u16(r, &id) != 0) {
+        return -1;
+    }
+
+    putchar(',');
+    if (id == S_LOG_KEY_INLINE) {
+        uint16_t len;
+        if (read_u16(r, &len) != 0 || r->left < len) {
+            return -1;
+        }
+        print_string(r->p, len);
+        r->p += len;
+        r->left -= len;
+    } else if (keys[id] != NULL) {
+        print_string((const unsigned char*)keys[id], strlen(keys[id]));
+    } else {
+        printf("\"key_%u\"", id);
+    }
+    putchar(':');
+
+    if (read_u8(r, &type) != 0) {
+        return -1;
+    }
+
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (type) {
+        case S_LOG_INT8:
+            if (read_u8(r, &u8) != 0) return -1;
+            printf("%d", (int8_t)u8);
+            break;
+        case S_LOG_UINT8:
+            if (read_u8(r, &u8) != 0) return -1;
+            printf("%u", u8);
+            break;
+        case S_LOG_INT16:
+            if (read_u16(r, &u16) != 0) return -1;
+            printf("%d", (int16_t)u16);
+            break;
+        case S_LOG_UINT16:
+            if (read_u16(r, &u16) != 0) return -1;
+            printf("%u", u16);
+            break;
+        case S_LOG_INT:
+        case S_LOG_INT32:
+            if (read_u32(r, &u32) != 0) return -1;
+            printf("%" PRId32, (int32_t)u32);
+            break;
+        case S_LOG_UINT:
+        case S_LOG_UINT32:
+            if (read_u32(r, &u32) != 0) return -1;
+            printf("%" PRIu32, u32);
+            break;
+        case S_LOG_INT64:
+            if (read_u64(r, &u64) != 0) return -1;
+            printf("%" PRId64, (int64_t)u64);
+            break;
+        case S_LOG_UINT64:
+            if (read_u64(r, &u64) != 0) return -1;
+            printf("%" PRIu64, u64);
+            break;
+        case S_LOG_FLOAT: {
+            float f;
+            if (read_u32(r, &u32) != 0) return -1;
+            memcpy(&f, &u32, sizeof(f));
+            print_double(f);
+            break;
+        }
+        case S_LOG_DOUBLE: {
+            double d;
+            if (read_u64(r, &u64) != 0) return -1;
+            memcpy(&d, &u64, sizeof(d));
+            print_double(d);
+            break;
+        }
+        case S_LOG_STRING:
+            if (read_u32(r, &u32) != 0) return -1;
+            if (u32 == S_LOG_NULL_STRING) {
+                fputs("null", stdout);
+                break;
+            }
+            if (r->left < u32) {
+                return -1;
+            }
+            print_string(r->p, u32);
+            r->p += u32;
+            r->left -= u32;
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * decode_record handles a single record. Returns -1 if it's malformed.
+ */
+static int
+decode_record(struct reader_t *r)
+{
+    uint8_t kind;
+    if (read_u8(r, &kind) != 0) {
+        return -1;
+    }
+
+    if (kind == S_LOG_REC_KEY) {
+        uint16_t id;
+        if (read_u16(r, &id) != 0 || id == S_LOG_KEY_INLINE) {
+            return -1;
+        }
+        char *key = (char*)malloc(r->left + 1);
+        if (key == NULL) {
+            return -1;
+        }
+        memcpy(key, r->p, r->left);
+        key[r->left] = '\0';
+        free(keys[id]);
+        keys[id] = key;
+
+        return 0;
+    }
+
+    if (kind != S_LOG_REC_ENTRY) {
+        return -1;
+    }
+
+    uint8_t level;
+    uint64_t timestamp;
+    uint16_t count;
+    if (read_u8(r, &level) != 0 || read_u64(r, &timestamp) != 0 ||
+        read_u16(r, &count) != 0) {
+        return -1;
+    }
+
+    fputs("{\"level\":", stdout);
+    if (level <= S_LOG_FATAL) {
+        print_string((const unsigned char*)level_names[level],
+            strlen(level_names[level]));
+    } else {
+        printf("%u", level);
+    }
+    printf(",\"timestamp\":%" PRIu64 ".%03u", timestamp / 1000,
+        (unsigned int)(timestamp % 1000));
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (decode_field(r) != 0) {
+            fputs("}\n", stdout);
+            return -1;
+        }
+    }
+    fputs("}\n", stdout);
+
+    return 0;
+}
+
+/**
+ * decode reads records from the given stream until it runs out. Returns -1
+ * if a malformed or truncated record was found.
+ */
+static int
+decode(FILE *in, const char *name)
+{
+    unsigned char *rec = NULL;
+    size_t cap = 0;
+    uint64_t n = 0;
+
+    for (;; n++) {
+        unsigned char b[4];
+        size_t got = fread(b, 1, sizeof(b), in);
+        if (got == 0) {
+            break;
+        }
+        if (got != sizeof(b)) {
+            fprintf(stderr, "%s: truncated record %" PRIu64 "\n", name, n);
+            free(rec);
+            return -1;
+        }
+
+        uint32_t len = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+                       ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+        if (len == 0) {
+            // zero fill at the end of a preallocated file
+            break;
+        }
+        if (len > cap) {
+            unsigned char *tmp = (unsigned char*)realloc(rec, len);
+            if (tmp == NULL) {
+                free(rec);
+                return -1;
+            }
+            rec = tmp;
+            cap = len;
+        }
+        if (fread(rec, 1, len, in) != len) {
+            fprintf(stderr, "%s: truncated record %" PRIu64 "\n", name, n);
+            free(rec);
+            return -1;
+        }
+
+        struct reader_t r = { .p = rec, .left = len };
+        if (decode_record(&r) != 0) {
+            fprintf(stderr, "%s: malformed record %" PRIu64 "\n", name, n);
+            free(rec);
+            return -1;
+        }
+    }
+
+    free(rec);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int ret = 0;
+
+    if (argc < 2) {
+        return decode(stdin, "stdin") == 0 ? 0 : 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *in = fopen(argv[i], "rb");
+        if (in == NULL) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (decode(in, argv[i]) != 0) {
+            ret = 1;
+        }
+        fclose(in);
+    }
+
+    return ret;
+}